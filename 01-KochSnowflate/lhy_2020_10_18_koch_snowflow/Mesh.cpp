@@ -57,6 +57,7 @@ CMesh::CMesh(void)
 	num_vertices=0;
 	vertex_array_obj=0;
 	vertex_buffer_obj=0;
+	segment_array_obj=0;
 }
 
 void CMesh::ReleaseGLResources(void)
@@ -65,6 +66,10 @@ void CMesh::ReleaseGLResources(void)
 		glDeleteVertexArrays(1, &vertex_array_obj);
 	vertex_array_obj=0;
 
+	if (segment_array_obj!=0)
+		glDeleteVertexArrays(1, &segment_array_obj);
+	segment_array_obj=0;
+
 	if (vertex_buffer_obj!=0)
 		glDeleteBuffers(1, &vertex_buffer_obj);
 	vertex_buffer_obj=0;
@@ -77,28 +82,26 @@ void CMesh::Draw(void)
 	glBindVertexArray(0);
 }
 
-void CMesh::CreateKochSnowflate(
-	const point2 snow_vertices[3],
-	int subdivision_depth)
+//ʵƴߣGL_LINESÿһʵɫչĻϵľ
+//num_segmentsΪ-1ʱȫ߶
+void CMesh::DrawThickLines(int num_segments)
+{
+	if (num_segments<0)
+		num_segments=num_vertices/2;
+	glBindVertexArray(segment_array_obj);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, num_segments);
+	glBindVertexArray(0);
+}
+
+void CMesh::CreateGLResources(CMeshVertex *vertices)
 {
-	//㶥   3*pow(4, subdivision_depth+1)   ǱͼֱģҪ2
-	num_vertices = (3*pow(4, subdivision_depth+1))*2;
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
-	int i = 0;
-	DivideLine(snow_vertices[0], snow_vertices[1], vertices, i, subdivision_depth);
-	DivideLine(snow_vertices[1], snow_vertices[2], vertices, i, subdivision_depth);
-	DivideLine(snow_vertices[2], snow_vertices[0], vertices, i, subdivision_depth);
-	/*for (int i = 0; i < num_vertices; i++)   //һ¶ļ
-	{
-		printf("-------v%d(%.1f,%.1f)\n", i, (vertices+i)->pos.x, (vertices+i)->pos.y);
-	}*/
 	glGenVertexArrays(1, &vertex_array_obj);
 	glBindVertexArray(vertex_array_obj);
 
 	glGenBuffers(1, &vertex_buffer_obj);
 	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_obj);
 	glBufferData(GL_ARRAY_BUFFER, 
-		sizeof(CMeshVertex)* i,
+		sizeof(CMeshVertex)*num_vertices,
 		vertices, GL_STATIC_DRAW);
 
 	glEnableVertexAttribArray(0);
@@ -109,7 +112,65 @@ void CMesh::CreateKochSnowflate(
 	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 
 		sizeof(CMeshVertex), (GLvoid *)offsetof(CMeshVertex, color));
 
+	//ͬһ㻺壬߶Σ㣩ΪΪʵԶȡ
+	glGenVertexArrays(1, &segment_array_obj);
+	glBindVertexArray(segment_array_obj);
+	for (int i = 0; i < 2; i++)
+	{
+		glEnableVertexAttribArray(2*i);
+		glVertexAttribPointer(2*i, 2, GL_FLOAT, GL_FALSE, 
+			2*sizeof(CMeshVertex), (GLvoid *)(sizeof(CMeshVertex)*i+offsetof(CMeshVertex, pos)));
+		glVertexAttribDivisor(2*i, 1);
+
+		glEnableVertexAttribArray(2*i+1);
+		glVertexAttribPointer(2*i+1, 4, GL_FLOAT, GL_FALSE, 
+			2*sizeof(CMeshVertex), (GLvoid *)(sizeof(CMeshVertex)*i+offsetof(CMeshVertex, color)));
+		glVertexAttribDivisor(2*i+1, 1);
+	}
+
 	glBindVertexArray(0);
+}
+
+void CMesh::CreateKochSnowflate(
+	const point2 snow_vertices[3],
+	int subdivision_depth)
+{
+	//㶥   3*pow(4, subdivision_depth+1)   ǱͼֱģҪ2
+	num_vertices = (3*pow(4, subdivision_depth+1))*2;
+	CMeshVertex *vertices=new CMeshVertex [num_vertices];
+	int i = 0;
+	DivideLine(snow_vertices[0], snow_vertices[1], vertices, i, subdivision_depth);
+	DivideLine(snow_vertices[1], snow_vertices[2], vertices, i, subdivision_depth);
+	DivideLine(snow_vertices[2], snow_vertices[0], vertices, i, subdivision_depth);
+	/*for (int i = 0; i < num_vertices; i++)   //һ¶ļ
+	{
+		printf("-------v%d(%.1f,%.1f)\n", i, (vertices+i)->pos.x, (vertices+i)->pos.y);
+	}*/
+	num_vertices = i;
+	CreateGLResources(vertices);
 
 	delete [] vertices;
 }
+
+void CMesh::CreateScreenQuad(void)
+{
+	// A triangle strip covering the whole viewport, for fragment-shader-only passes
+	static const point2 corners[4]={
+		point2(-1.0f, -1.0f),
+		point2(1.0f, -1.0f),
+		point2(-1.0f, 1.0f),
+		point2(1.0f, 1.0f)
+	};
+
+	prmitive_type = GL_TRIANGLE_STRIP;
+	num_vertices = 4;
+
+	CMeshVertex vertices[4];
+	for (int i = 0; i < 4; i++)
+	{
+		vertices[i].pos = corners[i];
+		vertices[i].color = color4(1.0f, 1.0f, 1.0f, 1.0f);
+	}
+
+	CreateGLResources(vertices);
+}
@@ -18,9 +18,13 @@ protected:
 		const point2& p0, const point2& p1, 
 		CMeshVertex *vbuf, int& vcounter, int depth);
 	static point2 CalNewPoint(point2 v0, point2 v1);
+
+	void CreateGLResources(CMeshVertex *vertices);
+
 public:
 	GLuint vertex_array_obj;
 	GLuint vertex_buffer_obj;
+	GLuint segment_array_obj;	// Ѷ㻺尴߶ζȡVAOÿʵһ߶
 	int num_vertices;
 	GLenum prmitive_type;
 
@@ -28,9 +32,11 @@ public:
 	void ReleaseGLResources(void);
 
 	void Draw(void);
+	void DrawThickLines(int num_segments=-1);
 	void CreateKochSnowflate(
 		const point2 snow_vertices[3],
 		int subdivision_depth);
+	void CreateScreenQuad(void);
 };
 
 #endif
@@ -0,0 +1,368 @@
+#include <stddef.h>
+#include <math.h>
+#include <emmintrin.h>
+#include "Snowfall.h"
+
+static unsigned int NextRandom(unsigned int& state)
+// Xorshift random number generator, the same recurrence as the SSE2 version
+{
+	state^=state<<13;
+	state^=state>>17;
+	state^=state<<5;
+	return state;
+}
+
+static float RandomFloat(unsigned int& state)
+// Uniform random number in [0, 1)
+{
+	return (NextRandom(state)>>8)*(1.0f/16777216.0f);
+}
+
+CSnowfall::CSnowfall(void)
+{
+	pos_x=pos_y=vel_x=fall_speed=angle=spin=scale=NULL;
+	seed=NULL;
+	max_particles=0;
+	num_particles=0;
+	mesh=NULL;
+	vertex_array_obj=0;
+	instance_buffer_obj=0;
+	for (int i=0; i<NUM_SECTIONS; i++)
+		section_fences[i]=0;
+	current_section=0;
+	persistent_ptr=NULL;
+	job_id=0;
+	num_pending=0;
+	quit=false;
+	job_dt=job_wind=0.0f;
+	job_output=NULL;
+	wind_strength=0.3f;
+	drag=1.5f;
+}
+
+CSnowfall::~CSnowfall(void)
+{
+	// OpenGL resources must be released by Release while the context is current
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit=true;
+	}
+	start_cond.notify_all();
+	for (size_t i=0; i<workers.size(); i++)
+		workers[i].join();
+	workers.clear();
+}
+
+void CSnowfall::Init(const CMesh *snowflake_mesh, int max_particles_in, int num_threads)
+// Allocate the particles, the instance ring buffer and the worker threads
+// snowflake_mesh: (in) Mesh shared by all instances
+// max_particles_in: (in) Maximum number of particles
+// num_threads: (in) The number of threads, 0 for the number of hardware threads
+{
+	mesh=snowflake_mesh;
+	max_particles=(max_particles_in+3)&~3;
+	num_particles=max_particles_in;
+
+	// 16-byte aligned arrays for aligned SSE loads and stores
+	float **arrays[7]={&pos_x, &pos_y, &vel_x, &fall_speed, &angle, &spin, &scale};
+	for (int i=0; i<7; i++)
+		*arrays[i]=(float *)_mm_malloc(sizeof(float)*max_particles, 16);
+	seed=(unsigned int *)_mm_malloc(sizeof(unsigned int)*max_particles, 16);
+
+	for (int i=0; i<max_particles; i++)
+	{
+		unsigned int s=2654435761u*(unsigned int)(i+1);
+		if (s==0) s=1;
+		pos_x[i]=2.0f*RandomFloat(s)-1.0f;
+		pos_y[i]=2.2f*RandomFloat(s)-1.1f;
+		vel_x[i]=0.0f;
+		scale[i]=0.01f+0.03f*RandomFloat(s);
+		fall_speed[i]=-(0.1f+4.0f*scale[i]); // Larger flakes fall faster
+		angle[i]=6.2831853f*RandomFloat(s);
+		spin[i]=4.0f*RandomFloat(s)-2.0f;
+		seed[i]=s;
+	}
+
+	// Instance ring buffer
+	GLsizeiptr buffer_size=NUM_SECTIONS*sizeof(float)*4*max_particles;
+	glGenBuffers(1, &instance_buffer_obj);
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_obj);
+	if (GLEW_ARB_buffer_storage)
+	{
+		// Map once and keep writing through the same pointer
+		GLbitfield flags=GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, buffer_size, NULL, flags);
+		persistent_ptr=(float *)glMapBufferRange(GL_ARRAY_BUFFER, 0, buffer_size, flags);
+	}
+	else
+	{
+		glBufferData(GL_ARRAY_BUFFER, buffer_size, NULL, GL_STREAM_DRAW);
+	}
+
+	// Mesh vertices come from the mesh buffer, instances from the ring buffer
+	glGenVertexArrays(1, &vertex_array_obj);
+	glBindVertexArray(vertex_array_obj);
+
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->vertex_buffer_obj);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE,
+		sizeof(CMeshVertex), (GLvoid *)offsetof(CMeshVertex, pos));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE,
+		sizeof(CMeshVertex), (GLvoid *)offsetof(CMeshVertex, color));
+
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_obj);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 0, (GLvoid *)0);
+	glVertexAttribDivisor(2, 1);
+
+	glBindVertexArray(0);
+
+	// Worker threads
+	if (num_threads<=0)
+		num_threads=(int)std::thread::hardware_concurrency();
+	if (num_threads<=0)
+		num_threads=1;
+	quit=false;
+	for (int i=1; i<num_threads; i++)
+		workers.push_back(std::thread(&CSnowfall::WorkerMain, this, i));
+}
+
+void CSnowfall::Release(void)
+// Stop the worker threads and release memory and OpenGL resources
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit=true;
+	}
+	start_cond.notify_all();
+	for (size_t i=0; i<workers.size(); i++)
+		workers[i].join();
+	workers.clear();
+
+	for (int i=0; i<NUM_SECTIONS; i++)
+	{
+		if (section_fences[i]!=0)
+			glDeleteSync(section_fences[i]);
+		section_fences[i]=0;
+	}
+
+	if (persistent_ptr!=NULL)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_obj);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		persistent_ptr=NULL;
+	}
+	if (vertex_array_obj!=0)
+		glDeleteVertexArrays(1, &vertex_array_obj);
+	vertex_array_obj=0;
+	if (instance_buffer_obj!=0)
+		glDeleteBuffers(1, &instance_buffer_obj);
+	instance_buffer_obj=0;
+
+	float **arrays[7]={&pos_x, &pos_y, &vel_x, &fall_speed, &angle, &spin, &scale};
+	for (int i=0; i<7; i++)
+	{
+		_mm_free(*arrays[i]);
+		*arrays[i]=NULL;
+	}
+	_mm_free(seed);
+	seed=NULL;
+	max_particles=num_particles=0;
+}
+
+void CSnowfall::SetNumParticles(int n)
+// Change the number of simulated particles, clamped to the capacity
+{
+	if (n<0) n=0;
+	if (n>max_particles) n=max_particles;
+	num_particles=n;
+}
+
+void CSnowfall::UpdateRange(int begin, int end, float dt, float wind, float *output)
+// Update particles [begin, end) and write their instances to output
+// begin and end are multiples of 4
+{
+	const __m128 v_dt=_mm_set1_ps(dt);
+	const __m128 v_wind=_mm_set1_ps(wind);
+	const __m128 v_follow=_mm_set1_ps(drag*dt<1.0f ? drag*dt : 1.0f);
+	const __m128 v_one=_mm_set1_ps(1.0f);
+	const __m128 v_two=_mm_set1_ps(2.0f);
+	const __m128 v_minus_one=_mm_set1_ps(-1.0f);
+	const __m128i v_exponent=_mm_set1_epi32(0x3f800000);
+	bool aligned=((size_t)output&15)==0;
+
+	for (int i=begin; i<end; i+=4)
+	{
+		__m128 x=_mm_load_ps(pos_x+i);
+		__m128 y=_mm_load_ps(pos_y+i);
+		__m128 vx=_mm_load_ps(vel_x+i);
+		__m128 a=_mm_load_ps(angle+i);
+		__m128 s=_mm_load_ps(scale+i);
+
+		// Relax towards the wind, then integrate
+		vx=_mm_add_ps(vx, _mm_mul_ps(_mm_sub_ps(v_wind, vx), v_follow));
+		x=_mm_add_ps(x, _mm_mul_ps(vx, v_dt));
+		y=_mm_add_ps(y, _mm_mul_ps(_mm_load_ps(fall_speed+i), v_dt));
+		a=_mm_add_ps(a, _mm_mul_ps(_mm_load_ps(spin+i), v_dt));
+
+		// Wrap around horizontally
+		__m128 mask=_mm_cmpgt_ps(x, v_one);
+		x=_mm_sub_ps(x, _mm_and_ps(mask, v_two));
+		mask=_mm_cmplt_ps(x, v_minus_one);
+		x=_mm_add_ps(x, _mm_and_ps(mask, v_two));
+
+		// Respawn above the window once a flake has left the bottom
+		mask=_mm_cmplt_ps(y, _mm_sub_ps(v_minus_one, s));
+		if (_mm_movemask_ps(mask))
+		{
+			// Two xorshift steps, one random number for x and one for y
+			__m128i r=_mm_load_si128((const __m128i *)(seed+i));
+			__m128 u[2];
+			for (int k=0; k<2; k++)
+			{
+				r=_mm_xor_si128(r, _mm_slli_epi32(r, 13));
+				r=_mm_xor_si128(r, _mm_srli_epi32(r, 17));
+				r=_mm_xor_si128(r, _mm_slli_epi32(r, 5));
+
+				// Random bits as the mantissa of a float in [1, 2)
+				u[k]=_mm_castsi128_ps(_mm_or_si128(_mm_srli_epi32(r, 9), v_exponent));
+			}
+			_mm_store_si128((__m128i *)(seed+i), r);
+
+			// x in [-1, 1), y a little above the window so respawns do not line up
+			__m128 new_x=_mm_sub_ps(_mm_mul_ps(u[0], v_two), _mm_set1_ps(3.0f));
+			__m128 new_y=_mm_add_ps(_mm_add_ps(v_one, s),
+				_mm_mul_ps(_mm_sub_ps(u[1], v_one), _mm_set1_ps(0.2f)));
+			x=_mm_or_ps(_mm_and_ps(mask, new_x), _mm_andnot_ps(mask, x));
+			y=_mm_or_ps(_mm_and_ps(mask, new_y), _mm_andnot_ps(mask, y));
+			vx=_mm_andnot_ps(mask, vx);
+		}
+
+		_mm_store_ps(pos_x+i, x);
+		_mm_store_ps(pos_y+i, y);
+		_mm_store_ps(vel_x+i, vx);
+		_mm_store_ps(angle+i, a);
+
+		// Transpose to 4 instances of (x, y, angle, scale)
+		_MM_TRANSPOSE4_PS(x, y, a, s);
+		float *out=output+4*i;
+		if (aligned)
+		{
+			// The mapped buffer is write-combined, so bypass the cache
+			_mm_stream_ps(out, x);
+			_mm_stream_ps(out+4, y);
+			_mm_stream_ps(out+8, a);
+			_mm_stream_ps(out+12, s);
+		}
+		else
+		{
+			_mm_storeu_ps(out, x);
+			_mm_storeu_ps(out+4, y);
+			_mm_storeu_ps(out+8, a);
+			_mm_storeu_ps(out+12, s);
+		}
+	}
+	_mm_sfence();
+}
+
+void CSnowfall::RunJob(int worker_index)
+// Update the share of the current job that belongs to worker_index
+{
+	int num_workers=(int)workers.size()+1;
+	int n=(num_particles+3)&~3;
+	int share=((n+num_workers-1)/num_workers+3)&~3;
+	int begin=worker_index*share;
+	int end=begin+share<n ? begin+share : n;
+	if (begin<end)
+		UpdateRange(begin, end, job_dt, job_wind, job_output);
+}
+
+void CSnowfall::WorkerMain(int worker_index)
+// Thread function of the worker threads
+{
+	int last_job_id=0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			start_cond.wait(lock, [&]{ return quit || job_id!=last_job_id; });
+			if (quit) return;
+			last_job_id=job_id;
+		}
+
+		RunJob(worker_index);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--num_pending==0)
+				done_cond.notify_one();
+		}
+	}
+}
+
+void CSnowfall::Update(float dt, float time)
+// Advance the simulation and write this frame's instances into the ring buffer
+// dt: (in) Time step in seconds
+// time: (in) Absolute time in seconds, drives the wind gusts
+{
+	if (num_particles<=0) return;
+
+	// Wait until the GPU has finished reading this section three frames ago
+	int section=current_section;
+	if (section_fences[section]!=0)
+	{
+		glClientWaitSync(section_fences[section], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(section_fences[section]);
+		section_fences[section]=0;
+	}
+
+	GLintptr offset=section*sizeof(float)*4*max_particles;
+	GLsizeiptr size=sizeof(float)*4*((num_particles+3)&~3);
+	float *output;
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_obj);
+	if (persistent_ptr!=NULL)
+		output=persistent_ptr+offset/sizeof(float);
+	else
+		output=(float *)glMapBufferRange(GL_ARRAY_BUFFER, offset, size,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (output==NULL) return;
+
+	// Gusty wind from two slow sine waves
+	job_dt=dt;
+	job_wind=wind_strength*(0.7f*sinf(0.3f*time)+0.3f*sinf(1.7f*time));
+	job_output=output;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		num_pending=(int)workers.size();
+		++job_id;
+	}
+	start_cond.notify_all();
+	RunJob(0);
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		done_cond.wait(lock, [&]{ return num_pending==0; });
+	}
+
+	if (persistent_ptr==NULL)
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+
+	// Point the instance attribute at this frame's section
+	glBindVertexArray(vertex_array_obj);
+	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 0, (GLvoid *)offset);
+	glBindVertexArray(0);
+}
+
+void CSnowfall::Draw(void)
+// Draw all particles written by the last Update
+{
+	if (num_particles<=0) return;
+
+	glBindVertexArray(vertex_array_obj);
+	glDrawArraysInstanced(mesh->prmitive_type, 0, mesh->num_vertices, num_particles);
+	glBindVertexArray(0);
+
+	// The section may be rewritten once the GPU has passed this point
+	section_fences[current_section]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	current_section=(current_section+1)%NUM_SECTIONS;
+}
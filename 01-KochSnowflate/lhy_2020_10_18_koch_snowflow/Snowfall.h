@@ -0,0 +1,79 @@
+#ifndef _SNOWFALL_H_
+#define _SNOWFALL_H_
+
+#include "GL/glew.h"
+#include "Mesh.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+// Particle system that draws many instances of one snowflake mesh
+// The particles are kept as a structure of arrays and updated 4 at a time with SSE2
+//   by a pool of worker threads, which write the instance data directly into
+//   a mapped ring buffer; the whole system is drawn with one instanced draw call
+class CSnowfall
+{
+protected:
+	enum { NUM_SECTIONS=3 }; // Frames in flight in the instance ring buffer
+
+	// Particle state, padded to a multiple of 4 particles
+	float *pos_x, *pos_y; // Position
+	float *vel_x;         // Horizontal velocity, relaxes towards the wind
+	float *fall_speed;    // Vertical velocity (negative)
+	float *angle, *spin;  // Rotation angle and angular velocity in radians
+	float *scale;         // Snowflake size
+	unsigned int *seed;   // Per-particle random number state for respawning
+	int max_particles;    // Capacity, a multiple of 4
+
+	// Instances are stored as vec4(x, y, angle, scale)
+	const CMesh *mesh;          // Shared snowflake mesh
+	GLuint vertex_array_obj;    // Mesh vertices plus per-instance attribute
+	GLuint instance_buffer_obj; // NUM_SECTIONS sections of max_particles instances
+	GLsync section_fences[NUM_SECTIONS]; // Signalled when the GPU is done with a section
+	int current_section;
+	float *persistent_ptr; // Persistent mapping of the whole buffer, NULL if unsupported
+
+	// Worker threads; worker 0 is the calling thread
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable start_cond, done_cond;
+	int job_id, num_pending;
+	bool quit;
+	float job_dt, job_wind;
+	float *job_output;
+
+	void WorkerMain(int worker_index);
+	void RunJob(int worker_index);
+	void UpdateRange(int begin, int end, float dt, float wind, float *output);
+
+public:
+	int num_particles; // The number of particles that are simulated and drawn
+	float wind_strength; // Horizontal wind speed amplitude
+	float drag;          // Rate at which particles follow the wind
+
+	CSnowfall(void);
+	~CSnowfall(void);
+
+	void Init(const CMesh *snowflake_mesh, int max_particles_in, int num_threads=0);
+	// Allocate the particles, the instance ring buffer and the worker threads
+	// snowflake_mesh: (in) Mesh shared by all instances
+	// max_particles_in: (in) Maximum number of particles
+	// num_threads: (in) The number of threads, 0 for the number of hardware threads
+
+	void Release(void);
+	// Stop the worker threads and release memory and OpenGL resources
+
+	void SetNumParticles(int n);
+	// Change the number of simulated particles, clamped to the capacity
+
+	void Update(float dt, float time);
+	// Advance the simulation and write this frame's instances into the ring buffer
+	// dt: (in) Time step in seconds
+	// time: (in) Absolute time in seconds, drives the wind gusts
+
+	void Draw(void);
+	// Draw all particles written by the last Update
+};
+
+#endif
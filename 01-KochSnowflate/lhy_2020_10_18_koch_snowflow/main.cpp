@@ -2,20 +2,72 @@
 #include "GL/freeglut.h"
 #include "vec.h"
 #include <stdlib.h>
+#include <stdio.h>
 #include "GLHelper.h"
 #include "Mesh.h"
+#include "Snowfall.h"
 #include "math.h"
 
+#define RENDER_MODE_MESH 0
+#define RENDER_MODE_DISTANCE 1
+#define RENDER_MODE_SNOWFALL 2
+#define NUM_RENDER_MODES 3
+
+#define MAX_SNOWFLAKES (1<<20)	//ѩӵ
+
 GLuint g_GLSL_prog;
+GLuint g_koch_de_prog;
 CMesh g_obj;
+CMesh g_screen_quad;
+
+//ѩģʽӹһϸȵѩʵ
+GLuint g_snowfall_prog;
+CMesh g_snowflake_mesh;
+CSnowfall g_snowfall;
+int g_last_frame_time=0;
+int g_stats_start_time=0, g_stats_frames=0, g_stats_update_time=0;
+
+int g_render_mode=RENDER_MODE_MESH;
+int g_subdivision_depth=4;
+int g_unbounded_depth=0;
+int g_window_width, g_window_height;
+vec2 g_view_center(0.0f, 0.0f);
+float g_view_zoom=1.0f;
 
 void init_shaders(void)
 {
+	//ģʽglLineWidth1ĿȲһ֧֣Ϊڶɫа߶չɾ
 	g_GLSL_prog=InitShader(
-		"..\\shaders\\simple_with_color-vs.txt",
+		"..\\shaders\\thick_line-vs.txt",
+		"..\\shaders\\thick_line-fs.txt");
+	glUniform1f(glGetUniformLocation(g_GLSL_prog, "line_width"), 4.0f);
+
+	g_koch_de_prog=InitShader(
+		"..\\shaders\\koch_snowflake_de-vs.txt",
+		"..\\shaders\\koch_snowflake_de-fs.txt");
+	glUniform1f(glGetUniformLocation(g_koch_de_prog, "line_width"), 4.0f);
+
+	g_snowfall_prog=InitShader(
+		"..\\shaders\\snowfall-vs.txt",
 		"..\\shaders\\simple_with_color-fs.txt");
 }
 
+void update_view_uniforms(void)
+{
+	//ģʽֱڹ淶豸лƣΪ1ʱģʽʾͬ
+	vec2 half_size(1.0f/g_view_zoom, 1.0f/g_view_zoom);
+	float pixel_size_x=2.0f*half_size.x/g_window_width;
+	float pixel_size_y=2.0f*half_size.y/g_window_height;
+
+	glUseProgram(g_koch_de_prog);
+	glUniform2fv(glGetUniformLocation(g_koch_de_prog, "view_center"), 1, g_view_center);
+	glUniform2fv(glGetUniformLocation(g_koch_de_prog, "view_half_size"), 1, half_size);
+	glUniform1f(glGetUniformLocation(g_koch_de_prog, "pixel_size"),
+		pixel_size_x>pixel_size_y ? pixel_size_x : pixel_size_y);
+	glUniform1i(glGetUniformLocation(g_koch_de_prog, "max_iterations"),
+		g_unbounded_depth ? 0 : g_subdivision_depth);
+}
+
 void init_scene(void)
 {
 	// ζࣩࣨĳʼ
@@ -33,16 +85,24 @@ void init_scene(void)
 	//};
 
 	//ԣҵлֻܵ9
-	int subdivision_depth = 4;
+	int subdivision_depth = g_subdivision_depth;
 	if(subdivision_depth > 0)
 		g_obj.CreateKochSnowflate(snow_vertices,subdivision_depth-1);
+
+	//볡ģʽֻҪһڵľΣԴռϸ޹
+	g_screen_quad.CreateScreenQuad();
+
+	g_snowflake_mesh.CreateKochSnowflate(snow_vertices, 1);
+	g_snowfall.Init(&g_snowflake_mesh, MAX_SNOWFLAKES);
+	g_snowfall.SetNumParticles(MAX_SNOWFLAKES/8);
 }
 
 void init(void)
 {
 	init_shaders();
 	init_scene();
-	glLineWidth(4.0);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glClearColor(1.0, 1.0, 1.0, 0.0);
 }
 
@@ -50,8 +110,42 @@ void display(void)
 {
 	glClear(GL_COLOR_BUFFER_BIT);
 
-	glUseProgram(g_GLSL_prog);
-	g_obj.Draw();
+	if (g_render_mode==RENDER_MODE_MESH)
+	{
+		glUseProgram(g_GLSL_prog);
+		g_obj.DrawThickLines();
+	}
+	else if (g_render_mode==RENDER_MODE_DISTANCE)
+	{
+		glUseProgram(g_koch_de_prog);
+		g_screen_quad.Draw();
+	}
+	else
+	{
+		int time=glutGet(GLUT_ELAPSED_TIME);
+		float dt=0.001f*(time-g_last_frame_time);
+		if (dt>0.1f) dt=0.1f;	//ڱ϶ɵĳʱͣٲҪѩ̫Զ
+		g_last_frame_time=time;
+
+		g_snowfall.Update(dt, 0.001f*time);
+		g_stats_update_time+=glutGet(GLUT_ELAPSED_TIME)-time;
+
+		glUseProgram(g_snowfall_prog);
+		g_snowfall.Draw();
+
+		//ÿһ֡ʺCPUºʱ
+		g_stats_frames++;
+		if (time-g_stats_start_time>=1000)
+		{
+			printf("snowfall: %d flakes, %.1f fps, update %.2f ms\n",
+				g_snowfall.num_particles,
+				1000.0f*g_stats_frames/(time-g_stats_start_time),
+				(float)g_stats_update_time/g_stats_frames);
+			g_stats_start_time=time;
+			g_stats_frames=0;
+			g_stats_update_time=0;
+		}
+	}
 
 	glFlush();
 	glutSwapBuffers();
@@ -59,7 +153,77 @@ void display(void)
 
 void reshape(int w, int h)
 {
+	g_window_width=w;
+	g_window_height=h;
 	glViewport(0, 0, w, h);
+	glUseProgram(g_GLSL_prog);
+	glUniform2f(glGetUniformLocation(g_GLSL_prog, "viewport_size"), (float)w, (float)h);
+	update_view_uniforms();
+}
+
+void keyboard(unsigned char key, int x, int y)
+{
+	switch (key)
+	{
+	case 'm':
+	case 'M':
+		g_render_mode=(g_render_mode+1)%NUM_RENDER_MODES;
+		printf("Render mode: %s\n", g_render_mode==RENDER_MODE_MESH ? "line mesh" :
+			g_render_mode==RENDER_MODE_DISTANCE ? "distance estimator" : "snowfall");
+		g_last_frame_time=g_stats_start_time=glutGet(GLUT_ELAPSED_TIME);
+		g_stats_frames=g_stats_update_time=0;
+		break;
+	case '[':
+		g_snowfall.SetNumParticles(g_snowfall.num_particles/2);
+		break;
+	case ']':
+		g_snowfall.SetNumParticles(g_snowfall.num_particles>0 ? g_snowfall.num_particles*2 : 1);
+		break;
+	case 'u':
+	case 'U':
+		//볡ģʽл̶ϸȡ͡ϸֵشС
+		g_unbounded_depth=!g_unbounded_depth;
+		break;
+	case '+':
+	case '=':
+		g_view_zoom*=1.25f;
+		break;
+	case '-':
+	case '_':
+		g_view_zoom/=1.25f;
+		break;
+	case 'r':
+	case 'R':
+		g_view_center=vec2(0.0f, 0.0f);
+		g_view_zoom=1.0f;
+		break;
+	default:
+		return;
+	}
+	update_view_uniforms();
+	glutPostRedisplay();
+}
+
+void idle(void)
+{
+	//ѩģʽҪػ
+	if (g_render_mode==RENDER_MODE_SNOWFALL)
+		glutPostRedisplay();
+}
+
+void special_keys(int key, int x, int y)
+{
+	float step=0.1f/g_view_zoom;
+	switch (key)
+	{
+	case GLUT_KEY_LEFT:  g_view_center.x-=step; break;
+	case GLUT_KEY_RIGHT: g_view_center.x+=step; break;
+	case GLUT_KEY_DOWN:  g_view_center.y-=step; break;
+	case GLUT_KEY_UP:    g_view_center.y+=step; break;
+	default: return;
+	}
+	update_view_uniforms();
+	glutPostRedisplay();
 }
 
 int main(int argc, char **argv)
@@ -78,6 +242,9 @@ int main(int argc, char **argv)
 	init();
 	glutDisplayFunc(display);
 	glutReshapeFunc(reshape);
+	glutKeyboardFunc(keyboard);
+	glutSpecialFunc(special_keys);
+	glutIdleFunc(idle);
 
 	glutMainLoop();
 
@@ -7,6 +7,7 @@ CMesh::CMesh(void)
 	num_vertices=0;
 	vertex_array_obj=0;
 	vertex_buffer_obj=0;
+	segment_array_obj=0;
 }
 
 void CMesh::ReleaseGLResources(void)
@@ -15,6 +16,10 @@ void CMesh::ReleaseGLResources(void)
 		glDeleteVertexArrays(1, &vertex_array_obj);
 	vertex_array_obj=0;
 
+	if (segment_array_obj!=0)
+		glDeleteVertexArrays(1, &segment_array_obj);
+	segment_array_obj=0;
+
 	if (vertex_buffer_obj!=0)
 		glDeleteBuffers(1, &vertex_buffer_obj);
 	vertex_buffer_obj=0;
@@ -27,6 +32,17 @@ void CMesh::Draw(void)
 	glBindVertexArray(0);
 }
 
+//ʵƴߣGL_LINESÿһʵɫչĻϵľ
+//num_segmentsΪ-1ʱȫ߶
+void CMesh::DrawThickLines(int num_segments)
+{
+	if (num_segments<0)
+		num_segments=num_vertices/2;
+	glBindVertexArray(segment_array_obj);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, num_segments);
+	glBindVertexArray(0);
+}
+
 void CMesh::CreateGLResources(CMeshVertex *vertices)
 {
 	glGenVertexArrays(1, &vertex_array_obj);
@@ -46,6 +62,22 @@ void CMesh::CreateGLResources(CMeshVertex *vertices)
 	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 
 		sizeof(CMeshVertex), (GLvoid *)offsetof(CMeshVertex, color));
 
+	//ͬһ㻺壬߶Σ㣩ΪΪʵԶȡ
+	glGenVertexArrays(1, &segment_array_obj);
+	glBindVertexArray(segment_array_obj);
+	for (int i = 0; i < 2; i++)
+	{
+		glEnableVertexAttribArray(2*i);
+		glVertexAttribPointer(2*i, 3, GL_FLOAT, GL_FALSE, 
+			2*sizeof(CMeshVertex), (GLvoid *)(sizeof(CMeshVertex)*i+offsetof(CMeshVertex, pos)));
+		glVertexAttribDivisor(2*i, 1);
+
+		glEnableVertexAttribArray(2*i+1);
+		glVertexAttribPointer(2*i+1, 4, GL_FLOAT, GL_FALSE, 
+			2*sizeof(CMeshVertex), (GLvoid *)(sizeof(CMeshVertex)*i+offsetof(CMeshVertex, color)));
+		glVertexAttribDivisor(2*i+1, 1);
+	}
+
 	glBindVertexArray(0);
 }
 
@@ -54,3 +86,92 @@ void CMesh::CreateGenericModel(int num_vertices_in)
 	num_vertices=num_vertices_in;
 	CreateGLResources(NULL);
 }
+
+CDynamicMesh::CDynamicMesh(void)
+{
+	capacity=0;
+	dirty_begin=dirty_end=0;
+}
+
+void CDynamicMesh::Create(int initial_capacity)
+{
+	//num_verticesGPUѾϴĶȰյĻ
+	num_vertices=initial_capacity;
+	CreateGLResources(NULL);
+	capacity=initial_capacity;
+	num_vertices=0;
+	vertices.reserve(initial_capacity);
+}
+
+int CDynamicMesh::GetNumVertices(void) const
+{
+	return (int)vertices.size();
+}
+
+void CDynamicMesh::MarkDirty(int begin, int end)
+{
+	if (dirty_begin==dirty_end)
+	{
+		dirty_begin=begin;
+		dirty_end=end;
+	}
+	else
+	{
+		if (begin<dirty_begin) dirty_begin=begin;
+		if (end>dirty_end) dirty_end=end;
+	}
+}
+
+int CDynamicMesh::AddVertex(const CMeshVertex& v)
+{
+	int i=(int)vertices.size();
+	vertices.push_back(v);
+	MarkDirty(i, i+1);
+	return i;
+}
+
+const point3& CDynamicMesh::GetPosition(int i) const
+{
+	return vertices[i].pos;
+}
+
+bool CDynamicMesh::SetPosition(int i, const point3& pos)
+{
+	point3& p=vertices[i].pos;
+	if (p.x==pos.x && p.y==pos.y && p.z==pos.z)
+		return false;
+	p=pos;
+	MarkDirty(i, i+1);
+	return true;
+}
+
+void CDynamicMesh::SetColor(int i, const color4& color)
+{
+	vertices[i].color=color;
+	MarkDirty(i, i+1);
+}
+
+void CDynamicMesh::Flush(void)
+{
+	if (dirty_begin==dirty_end)
+		return;
+
+	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_obj);
+	int n=(int)vertices.size();
+	if (n>capacity)
+	{
+		//ʱglBufferDataµĴ洢ɴ洢GPUͷţϴ
+		while (capacity<n)
+			capacity=capacity>0 ? 2*capacity : 1024;
+		glBufferData(GL_ARRAY_BUFFER, sizeof(CMeshVertex)*capacity, NULL, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(CMeshVertex)*n, &vertices[0]);
+	}
+	else
+	{
+		//ֻϴһ֡޸ĵķΧ
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(CMeshVertex)*dirty_begin,
+			sizeof(CMeshVertex)*(dirty_end-dirty_begin), &vertices[dirty_begin]);
+	}
+	num_vertices=n;
+	dirty_begin=dirty_end=0;
+}
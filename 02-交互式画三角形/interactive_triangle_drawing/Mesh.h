@@ -3,6 +3,7 @@
 
 #include "GL/glew.h"
 #include "vec.h"
+#include <vector>
 
 class CMeshVertex
 {
@@ -13,11 +14,13 @@ public:
 
 class CMesh
 {
+protected:
 	void CreateGLResources(CMeshVertex *vertices);
 
 public:
 	GLuint vertex_array_obj;
 	GLuint vertex_buffer_obj;
+	GLuint segment_array_obj;	// Ѷ㻺尴߶ζȡVAOÿʵһ߶
 	int num_vertices;
 	GLenum prmitive_type;
 
@@ -25,8 +28,32 @@ public:
 	void ReleaseGLResources(void);
 
 	void Draw(void);
+	void DrawThickLines(int num_segments=-1);
 	void CreateGenericModel(int num_vertices_in);
 
 };
 
+//CPU˱ȫ㣬¼޸ĹĶ㷶Χ
+//ÿ֡һFlush޸ĺϲһϴ
+class CDynamicMesh : public CMesh
+{
+protected:
+	std::vector<CMeshVertex> vertices;	// CPU˵Ķ
+	int capacity;	// GPUɵĶ
+	int dirty_begin, dirty_end;	// ϴFlush֮޸ĵĶ㷶Χ[dirty_begin, dirty_end)
+
+	void MarkDirty(int begin, int end);
+
+public:
+	CDynamicMesh(void);
+
+	void Create(int initial_capacity);
+	int GetNumVertices(void) const;
+	int AddVertex(const CMeshVertex& v);	// ¶
+	const point3& GetPosition(int i) const;
+	bool SetPosition(int i, const point3& pos);	// λûб仯ʱfalseϴ
+	void SetColor(int i, const color4& color);
+	void Flush(void);
+};
+
 #endif
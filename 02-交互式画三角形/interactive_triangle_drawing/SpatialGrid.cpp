@@ -0,0 +1,247 @@
+#include <math.h>
+#include <stdlib.h>
+#include "SpatialGrid.h"
+
+CSpatialGrid::CSpatialGrid(void)
+{
+	x_min=y_min=0.0f;
+	cell_size_x=cell_size_y=1.0f;
+	resolution=0;
+	query_stamp=0;
+}
+
+void CSpatialGrid::Init(float x0, float y0, float x1, float y1, int resolution_in)
+// Set up an empty grid
+// x0, y0, x1, y1: (in) Indexed rectangle; items outside go to the border cells
+// resolution_in: (in) The number of cells in x and y directions
+{
+	x_min=x0;
+	y_min=y0;
+	resolution=resolution_in;
+	cell_size_x=(x1-x0)/resolution;
+	cell_size_y=(y1-y0)/resolution;
+
+	point_cells.assign(resolution*resolution, std::vector<int>());
+	segment_cells.assign(resolution*resolution, std::vector<int>());
+	points.clear();
+	segments[0].clear();
+	segments[1].clear();
+	segment_stamps.clear();
+	query_stamp=0;
+}
+
+int CSpatialGrid::CellX(float x) const
+{
+	int i=(int)floorf((x-x_min)/cell_size_x);
+	return i<0 ? 0 : (i>=resolution ? resolution-1 : i);
+}
+
+int CSpatialGrid::CellY(float y) const
+{
+	int j=(int)floorf((y-y_min)/cell_size_y);
+	return j<0 ? 0 : (j>=resolution ? resolution-1 : j);
+}
+
+void CSpatialGrid::RemoveId(std::vector<int>& cell, int id)
+// Remove id from a cell, not keeping the order
+{
+	for (size_t k=0; k<cell.size(); k++)
+		if (cell[k]==id)
+		{
+			cell[k]=cell.back();
+			cell.pop_back();
+			return;
+		}
+}
+
+point2 CSpatialGrid::ClampToGrid(const point2& p) const
+{
+	float x_max=x_min+resolution*cell_size_x, y_max=y_min+resolution*cell_size_y;
+	return point2(
+		p.x<x_min ? x_min : (p.x>x_max ? x_max : p.x),
+		p.y<y_min ? y_min : (p.y>y_max ? y_max : p.y));
+}
+
+void CSpatialGrid::CollectSegmentCells(
+	const point2& a, const point2& b, std::vector<int>& cells) const
+// Collect the cells that segment ab touches, clamping it to the grid rectangle
+{
+	cells.clear();
+
+	// Split ab where it crosses the lines of the rectangle; after clamping,
+	//   each piece is again a straight segment inside the rectangle
+	float bounds_x[2]={x_min, x_min+resolution*cell_size_x};
+	float bounds_y[2]={y_min, y_min+resolution*cell_size_y};
+	float t[6];
+	int n=0;
+	t[n++]=0.0f;
+	for (int k=0; k<2; k++)
+	{
+		if ((a.x-bounds_x[k])*(b.x-bounds_x[k])<0.0f)
+			t[n++]=(bounds_x[k]-a.x)/(b.x-a.x);
+		if ((a.y-bounds_y[k])*(b.y-bounds_y[k])<0.0f)
+			t[n++]=(bounds_y[k]-a.y)/(b.y-a.y);
+	}
+	t[n++]=1.0f;
+
+	// Insertion sort of the few split parameters
+	for (int k=1; k<n; k++)
+		for (int m=k; m>0 && t[m]<t[m-1]; m--)
+		{
+			float tmp=t[m]; t[m]=t[m-1]; t[m-1]=tmp;
+		}
+
+	for (int k=0; k+1<n; k++)
+		WalkSegmentCells(ClampToGrid(a+t[k]*(b-a)), ClampToGrid(a+t[k+1]*(b-a)), cells);
+}
+
+void CSpatialGrid::WalkSegmentCells(
+	const point2& a, const point2& b, std::vector<int>& cells) const
+// Append the cells crossed by segment ab inside the rectangle (Amanatides and Woo)
+{
+	int i=CellX(a.x), j=CellY(a.y);
+	int i_end=CellX(b.x), j_end=CellY(b.y);
+	if (cells.empty() || cells.back()!=j*resolution+i)
+		cells.push_back(j*resolution+i);
+
+	float dx=b.x-a.x, dy=b.y-a.y;
+	int step_i=dx>0.0f ? 1 : -1;
+	int step_j=dy>0.0f ? 1 : -1;
+
+	// Parameter t along ab at which the next cell boundary is crossed, and its increment
+	float t_max_x=1e30f, t_max_y=1e30f, t_delta_x=1e30f, t_delta_y=1e30f;
+	if (dx!=0.0f)
+	{
+		float next_x=x_min+(i+(step_i>0 ? 1 : 0))*cell_size_x;
+		t_max_x=(next_x-a.x)/dx;
+		t_delta_x=cell_size_x/fabsf(dx);
+	}
+	if (dy!=0.0f)
+	{
+		float next_y=y_min+(j+(step_j>0 ? 1 : 0))*cell_size_y;
+		t_max_y=(next_y-a.y)/dy;
+		t_delta_y=cell_size_y/fabsf(dy);
+	}
+
+	// The walk cannot take more steps than the Manhattan distance between the end cells
+	int num_steps=abs(i_end-i)+abs(j_end-j);
+	for (int k=0; k<num_steps; k++)
+	{
+		if (t_max_x<t_max_y)
+		{
+			i+=step_i;
+			t_max_x+=t_delta_x;
+		}
+		else
+		{
+			j+=step_j;
+			t_max_y+=t_delta_y;
+		}
+		if (i<0 || i>=resolution || j<0 || j>=resolution)
+			break;
+		cells.push_back(j*resolution+i);
+	}
+}
+
+void CSpatialGrid::InsertPoint(int id, const point2& p)
+{
+	if (id>=(int)points.size())
+		points.resize(id+1);
+	points[id]=p;
+	point_cells[CellY(p.y)*resolution+CellX(p.x)].push_back(id);
+}
+
+void CSpatialGrid::RemovePoint(int id)
+{
+	const point2& p=points[id];
+	RemoveId(point_cells[CellY(p.y)*resolution+CellX(p.x)], id);
+}
+
+void CSpatialGrid::InsertSegment(int id, const point2& a, const point2& b)
+{
+	if (id>=(int)segment_stamps.size())
+	{
+		segments[0].resize(id+1);
+		segments[1].resize(id+1);
+		segment_stamps.resize(id+1, 0);
+	}
+	segments[0][id]=a;
+	segments[1][id]=b;
+
+	std::vector<int> cells;
+	CollectSegmentCells(a, b, cells);
+	for (size_t k=0; k<cells.size(); k++)
+		segment_cells[cells[k]].push_back(id);
+}
+
+void CSpatialGrid::RemoveSegment(int id)
+{
+	std::vector<int> cells;
+	CollectSegmentCells(segments[0][id], segments[1][id], cells);
+	for (size_t k=0; k<cells.size(); k++)
+		RemoveId(segment_cells[cells[k]], id);
+}
+
+int CSpatialGrid::FindNearestPoint(const point2& q, float max_dist) const
+// Return the id of the point nearest to q, or -1 if none is within max_dist
+{
+	int i0=CellX(q.x-max_dist), i1=CellX(q.x+max_dist);
+	int j0=CellY(q.y-max_dist), j1=CellY(q.y+max_dist);
+
+	int best=-1;
+	float best_dist2=max_dist*max_dist;
+	for (int j=j0; j<=j1; j++)
+		for (int i=i0; i<=i1; i++)
+		{
+			const std::vector<int>& cell=point_cells[j*resolution+i];
+			for (size_t k=0; k<cell.size(); k++)
+			{
+				point2 d=points[cell[k]]-q;
+				float dist2=dot(d, d);
+				if (dist2<=best_dist2)
+				{
+					best_dist2=dist2;
+					best=cell[k];
+				}
+			}
+		}
+	return best;
+}
+
+int CSpatialGrid::PickSegment(const point2& q, float max_dist)
+// Return the id of the segment nearest to q, or -1 if none is within max_dist
+{
+	int i0=CellX(q.x-max_dist), i1=CellX(q.x+max_dist);
+	int j0=CellY(q.y-max_dist), j1=CellY(q.y+max_dist);
+
+	// A segment is stored in every cell it crosses, so test each one only once
+	++query_stamp;
+
+	int best=-1;
+	float best_dist2=max_dist*max_dist;
+	for (int j=j0; j<=j1; j++)
+		for (int i=i0; i<=i1; i++)
+		{
+			const std::vector<int>& cell=segment_cells[j*resolution+i];
+			for (size_t k=0; k<cell.size(); k++)
+			{
+				int id=cell[k];
+				if (segment_stamps[id]==query_stamp)
+					continue;
+				segment_stamps[id]=query_stamp;
+
+				point2 a=segments[0][id], ab=segments[1][id]-a, aq=q-a;
+				float len2=dot(ab, ab);
+				float t=len2>0.0f ? dot(aq, ab)/len2 : 0.0f;
+				t=t<0.0f ? 0.0f : (t>1.0f ? 1.0f : t);
+				point2 d=aq-t*ab;
+				float dist2=dot(d, d);
+				if (dist2<=best_dist2)
+				{
+					best_dist2=dist2;
+					best=id;
+				}
+			}
+		}
+	return best;
+}
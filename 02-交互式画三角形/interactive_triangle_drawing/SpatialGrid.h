@@ -0,0 +1,55 @@
+#ifndef _SPATIAL_GRID_H_
+#define _SPATIAL_GRID_H_
+
+#include "vec.h"
+#include <vector>
+
+// Uniform grid over a rectangle that indexes points and line segments by id
+// Points are stored in the cell that contains them; segments are stored in every
+//   cell they pass through, so queries only look at the cells near the query point
+// Items may be inserted and removed at any time
+class CSpatialGrid
+{
+protected:
+	float x_min, y_min;     // Lower-left corner of the indexed rectangle
+	float cell_size_x, cell_size_y;
+	int resolution;         // The number of cells in x and y directions
+	std::vector< std::vector<int> > point_cells;   // Point ids in each cell
+	std::vector< std::vector<int> > segment_cells; // Segment ids in each cell
+
+	std::vector<point2> points;             // Point positions by id
+	std::vector<point2> segments[2];        // Segment end points by id
+	std::vector<int> segment_stamps;        // Avoids testing a segment twice in one query
+	int query_stamp;
+
+	int CellX(float x) const;
+	int CellY(float y) const;
+	point2 ClampToGrid(const point2& p) const;
+	void CollectSegmentCells(const point2& a, const point2& b, std::vector<int>& cells) const;
+	void WalkSegmentCells(const point2& a, const point2& b, std::vector<int>& cells) const;
+	static void RemoveId(std::vector<int>& cell, int id);
+
+public:
+	CSpatialGrid(void);
+
+	void Init(float x0, float y0, float x1, float y1, int resolution_in);
+	// Set up an empty grid
+	// x0, y0, x1, y1: (in) Indexed rectangle; items outside go to the border cells
+	// resolution_in: (in) The number of cells in x and y directions
+
+	void InsertPoint(int id, const point2& p);
+	void RemovePoint(int id);
+	// Insert or remove point 'id'
+
+	void InsertSegment(int id, const point2& a, const point2& b);
+	void RemoveSegment(int id);
+	// Insert or remove segment 'id' with end points a and b
+
+	int FindNearestPoint(const point2& q, float max_dist) const;
+	// Return the id of the point nearest to q, or -1 if none is within max_dist
+
+	int PickSegment(const point2& q, float max_dist);
+	// Return the id of the segment nearest to q, or -1 if none is within max_dist
+};
+
+#endif
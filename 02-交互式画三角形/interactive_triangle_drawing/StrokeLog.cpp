@@ -0,0 +1,185 @@
+#include "StrokeLog.h"
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Events are written in blocks of this many
+#define STROKE_LOG_BLOCK_SIZE 4096
+
+CStrokeRecorder::CStrokeRecorder(void)
+{
+	file=NULL;
+	num_events=0;
+}
+
+CStrokeRecorder::~CStrokeRecorder(void)
+{
+	Close();
+}
+
+bool CStrokeRecorder::Open(const char *filename)
+// Start recording to a file
+{
+	Close();
+	file=fopen(filename, "wb");
+	if (file==NULL)
+		return false;
+
+	// The event count is filled in by Close
+	CStrokeLogHeader header;
+	memcpy(header.magic, "STRK", 4);
+	header.version=STROKE_LOG_VERSION;
+	header.num_events=0;
+	header.reserved=0;
+	fwrite(&header, sizeof(header), 1, file);
+
+	buffer.clear();
+	buffer.reserve(STROKE_LOG_BLOCK_SIZE);
+	num_events=0;
+	start_time=std::chrono::steady_clock::now();
+	return true;
+}
+
+void CStrokeRecorder::Close(void)
+// Write the remaining events and the final header
+{
+	if (file==NULL)
+		return;
+
+	if (!buffer.empty())
+		fwrite(&buffer[0], sizeof(CStrokeEvent), buffer.size(), file);
+	buffer.clear();
+
+	fseek(file, offsetof(CStrokeLogHeader, num_events), SEEK_SET);
+	fwrite(&num_events, sizeof(num_events), 1, file);
+	fclose(file);
+	file=NULL;
+}
+
+void CStrokeRecorder::Record(int type, int button, int state, int x, int y)
+{
+	if (file==NULL)
+		return;
+
+	CStrokeEvent e;
+	e.time_us=(unsigned int)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now()-start_time).count();
+	e.x=(short)x;
+	e.y=(short)y;
+	e.type=(unsigned char)type;
+	e.button=(unsigned char)button;
+	e.state=(unsigned char)state;
+	e.padding=0;
+	buffer.push_back(e);
+	num_events++;
+
+	if (buffer.size()>=STROKE_LOG_BLOCK_SIZE)
+	{
+		fwrite(&buffer[0], sizeof(CStrokeEvent), buffer.size(), file);
+		buffer.clear();
+	}
+}
+
+void CStrokeRecorder::RecordMouse(int button, int state, int x, int y)
+{
+	Record(STROKE_EVENT_MOUSE, button, state, x, y);
+}
+
+void CStrokeRecorder::RecordMotion(int x, int y)
+{
+	Record(STROKE_EVENT_MOTION, 0, 0, x, y);
+}
+
+void CStrokeRecorder::RecordKeyboard(unsigned char key, int x, int y)
+{
+	Record(STROKE_EVENT_KEYBOARD, key, 0, x, y);
+}
+
+void CStrokeRecorder::RecordReshape(int width, int height)
+{
+	Record(STROKE_EVENT_RESHAPE, 0, 0, width, height);
+}
+
+CStrokeLog::CStrokeLog(void)
+{
+	data=NULL;
+	size=0;
+	file_handle=mapping_handle=NULL;
+}
+
+CStrokeLog::~CStrokeLog(void)
+{
+	Close();
+}
+
+bool CStrokeLog::Open(const char *filename)
+// Map a stroke log into memory and check its header
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE file=CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file==INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file, &file_size);
+	HANDLE mapping=CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping==NULL)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	file_handle=file;
+	mapping_handle=mapping;
+	size=(size_t)file_size.QuadPart;
+	data=MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	int fd=open(filename, O_RDONLY);
+	if (fd<0)
+		return false;
+	struct stat st;
+	fstat(fd, &st);
+	size=(size_t)st.st_size;
+	data=size>0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (data==MAP_FAILED)
+		data=NULL;
+#endif
+
+	// Reject files that are not stroke logs or are shorter than the header says
+	const CStrokeLogHeader *header=(const CStrokeLogHeader *)data;
+	if (data==NULL || size<sizeof(CStrokeLogHeader) ||
+		memcmp(header->magic, "STRK", 4)!=0 || header->version!=STROKE_LOG_VERSION ||
+		header->num_events>(size-sizeof(CStrokeLogHeader))/sizeof(CStrokeEvent))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void CStrokeLog::Close(void)
+{
+#ifdef _WIN32
+	if (data!=NULL)
+		UnmapViewOfFile(data);
+	if (mapping_handle!=NULL)
+		CloseHandle((HANDLE)mapping_handle);
+	if (file_handle!=NULL)
+		CloseHandle((HANDLE)file_handle);
+#else
+	if (data!=NULL)
+		munmap(data, size);
+#endif
+	data=NULL;
+	size=0;
+	file_handle=mapping_handle=NULL;
+}
@@ -0,0 +1,93 @@
+#ifndef _STROKE_LOG_H_
+#define _STROKE_LOG_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <vector>
+#include <chrono>
+
+// Input events are stored in a binary file that starts with a CStrokeLogHeader
+//   followed by the events, each a fixed size CStrokeEvent
+enum STROKE_EVENT_TYPE
+{
+	STROKE_EVENT_MOUSE=0,  // glutMouseFunc: button, state, x, y
+	STROKE_EVENT_MOTION,   // glutMotionFunc: x, y
+	STROKE_EVENT_KEYBOARD, // glutKeyboardFunc: key, x, y
+	STROKE_EVENT_RESHAPE,  // glutReshapeFunc: width and height in x, y
+};
+
+struct CStrokeLogHeader
+{
+	char magic[4];         // "STRK"
+	unsigned int version;  // STROKE_LOG_VERSION
+	unsigned int num_events;
+	unsigned int reserved;
+};
+
+struct CStrokeEvent
+{
+	unsigned int time_us;  // Microseconds since the recording started
+	short x, y;            // Mouse position in window coordinates
+	unsigned char type;    // STROKE_EVENT_TYPE
+	unsigned char button;  // Mouse button, or the key for keyboard events
+	unsigned char state;   // GLUT_DOWN or GLUT_UP
+	unsigned char padding;
+};
+
+#define STROKE_LOG_VERSION 1
+
+// Writes input events to a stroke log as they arrive
+class CStrokeRecorder
+{
+protected:
+	FILE *file;
+	std::vector<CStrokeEvent> buffer; // Events not written yet
+	unsigned int num_events;
+	std::chrono::steady_clock::time_point start_time;
+
+	void Record(int type, int button, int state, int x, int y);
+
+public:
+	CStrokeRecorder(void);
+	~CStrokeRecorder(void);
+
+	bool Open(const char *filename);
+	// Start recording to a file
+
+	void Close(void);
+	// Write the remaining events and the final header
+
+	bool IsRecording(void) const { return file!=NULL; }
+
+	void RecordMouse(int button, int state, int x, int y);
+	void RecordMotion(int x, int y);
+	void RecordKeyboard(unsigned char key, int x, int y);
+	void RecordReshape(int width, int height);
+	// Append one event; does nothing if not recording
+};
+
+// Read-only view of a stroke log mapped into memory
+class CStrokeLog
+{
+protected:
+	void *data;        // Start of the mapping
+	size_t size;       // Size of the mapping in bytes
+	void *file_handle, *mapping_handle; // Platform handles of the mapping
+
+public:
+	CStrokeLog(void);
+	~CStrokeLog(void);
+
+	bool Open(const char *filename);
+	// Map a stroke log into memory and check its header
+
+	void Close(void);
+
+	const CStrokeLogHeader& GetHeader(void) const
+	{ return *(const CStrokeLogHeader *)data; }
+
+	const CStrokeEvent *GetEvents(void) const
+	{ return (const CStrokeEvent *)((const char *)data+sizeof(CStrokeLogHeader)); }
+};
+
+#endif
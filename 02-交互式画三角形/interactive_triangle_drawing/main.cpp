@@ -3,19 +3,32 @@
 #include "vec.h"
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
 #include "GLHelper.h"
 #include "Mesh.h"
+#include "SpatialGrid.h"
+#include "StrokeLog.h"
 
-#define N 583		//ֵ֧󶥵һܻN/3
+#define INITIAL_CAPACITY 1024	//㻺ĳʼʱԶ
+#define PICK_RADIUS_PIXELS 8.0f	//ѡȡķΧλ
 
 int vcounter = 0;	//ѾĶ,λùϵڻͼʱʹ
 int g_window_width, g_window_height;
 
 GLuint g_GLSL_prog;
-CMesh g_obj;
+CDynamicMesh g_obj;
 
-point3 g_line_seg_vertices[N];
-int g_interactive_drawing_mode=0;
+int g_interactive_drawing_mode=0;	//ºΪ1ʾǰıѾʼɿʱύ
+
+CSpatialGrid g_grid;			//ѾĶͱߵĿռߵvcounter/2
+bool g_snap_enabled=true;		//¶Ƿж
+int g_selected_triangle=-1;		//ҼѡеΣ-1ʾûѡ
+
+CStrokeRecorder g_recorder;		//-recordʱ¼дļ
 
 void MousePosToNormalizedPos(
 	float mouse_pos_x, float mouse_pos_y,
@@ -25,42 +38,118 @@ void MousePosToNormalizedPos(
 	normalized_pos_y=2.0f*(g_window_height-mouse_pos_y)/g_window_height-1.0f;
 }
 
-void CopyVertexPositionToGPU(int vertex_id)
+void EnsureVertices(int n)
+{
+	//ҪõĶ㻹ûзʱ׷Ӻɫ
+	CMeshVertex v;
+	v.pos = point3(0.0f, 0.0f, 0.0f);
+	v.color = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	while (g_obj.GetNumVertices() < n)
+		g_obj.AddVertex(v);
+}
+
+float GetPickRadius(void)
+{
+	//ذ뾶ɹ淶
+	int size = g_window_width < g_window_height ? g_window_width : g_window_height;
+	return 2.0f * PICK_RADIUS_PIXELS / size;
+}
+
+point3 MousePosToVertex(int x, int y)
+{
+	point3 p(0.0f, 0.0f, 0.0f);
+	MousePosToNormalizedPos(x, y, p.x, p.y);
+
+	//ڸѻʱȥ㻭βӵ
+	if (g_snap_enabled)
+	{
+		int id = g_grid.FindNearestPoint(point2(p.x, p.y), GetPickRadius());
+		if (id >= 0)
+			p = g_obj.GetPosition(id);
+	}
+	return p;
+}
+
+void CommitSegment(int seg)
+{
+	//һ߻˵ռ
+	point3 a = g_obj.GetPosition(2 * seg), b = g_obj.GetPosition(2 * seg + 1);
+	g_grid.InsertPoint(2 * seg, point2(a.x, a.y));
+	g_grid.InsertPoint(2 * seg + 1, point2(b.x, b.y));
+	g_grid.InsertSegment(seg, point2(a.x, a.y), point2(b.x, b.y));
+}
+
+void SetTriangleColor(int tri, const color4& color)
+{
+	//һռ6
+	for (int k = 6 * tri; k < 6 * tri + 6; k++)
+		g_obj.SetColor(k, color);
+	glutPostRedisplay();
+}
+
+void SelectTriangle(int x, int y)
+{
+	point3 p(0.0f, 0.0f, 0.0f);
+	MousePosToNormalizedPos(x, y, p.x, p.y);
+	int seg = g_grid.PickSegment(point2(p.x, p.y), GetPickRadius());
+
+	//ֻѡѾ
+	int tri = seg >= 0 && seg / 3 < vcounter / 6 ? seg / 3 : -1;
+	if (g_selected_triangle >= 0)
+		SetTriangleColor(g_selected_triangle, color4(0.0f, 0.0f, 0.0f, 1.0f));
+	g_selected_triangle = tri;
+	if (g_selected_triangle >= 0)
+		SetTriangleColor(g_selected_triangle, color4(1.0f, 0.0f, 0.0f, 1.0f));
+}
+
+void EraseSelectedTriangle(void)
 {
-	glBindBuffer(GL_ARRAY_BUFFER, g_obj.vertex_buffer_obj);
-	glBufferSubData(GL_ARRAY_BUFFER,  
-		sizeof(CMeshVertex)*vertex_id+offsetof(CMeshVertex, pos),
-		sizeof(point3), g_line_seg_vertices+vertex_id);
+	if (g_selected_triangle < 0)
+		return;
+
+	//ȻڻΪ͸ʾͬʱӿռɾ
+	int tri = g_selected_triangle;
+	SetTriangleColor(tri, color4(0.0f, 0.0f, 0.0f, 0.0f));
+	for (int seg = 3 * tri; seg < 3 * tri + 3; seg++)
+	{
+		g_grid.RemoveSegment(seg);
+		g_grid.RemovePoint(2 * seg);
+		g_grid.RemovePoint(2 * seg + 1);
+	}
+	g_selected_triangle = -1;
+}
+
+void SetVertexPosition(int vertex_id, const point3& pos)
+{
+	//ֻ޸CPU˵Ķ㲢¼޸ķΧϴdisplayÿ֡һ
+	if (g_obj.SetPosition(vertex_id, pos))
+		glutPostRedisplay();
 }
 
 void init_shaders(void)
 {
+	//ʵľλƴߣglLineWidth
 	g_GLSL_prog=InitShader(
-		"..\\shaders\\simple_with_color-vs.txt",
-		"..\\shaders\\simple_with_color-fs.txt");
+		"..\\shaders\\thick_line-vs.txt",
+		"..\\shaders\\thick_line-fs.txt");
+	glUniform1f(glGetUniformLocation(g_GLSL_prog, "line_width"), 4.0f);
 }
 
 void init_scene(void)
 {
-	g_obj.CreateGenericModel(N);
+	g_obj.Create(INITIAL_CAPACITY);
 	g_obj.prmitive_type=GL_LINES;
-	
-	CMeshVertex v[N];
-	int i;
-	for (i = 0; i < N; i++)
-	{
-		v[i].pos = g_line_seg_vertices[i];
-		v[i].color = vec4(0.0f, 0.0f, 0.0f, 1.0f);
-	}
-	glBindBuffer(GL_ARRAY_BUFFER, g_obj.vertex_buffer_obj);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, 
-		sizeof(CMeshVertex)*N, v);
+
+	//ռڣڵĶڱ߽ĸ
+	g_grid.Init(-1.0f, -1.0f, 1.0f, 1.0f, 256);
 }
 
 void init(void)
 {
 	init_shaders();
 	init_scene();
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glClearColor(1.0, 1.0, 1.0, 0.0);
 }
 
@@ -68,9 +157,16 @@ void display(void)
 {
 	glClear(GL_COLOR_BUFFER_BIT);
 
+	//һ֡еĶ޸ĺϲһϴ
+	g_obj.Flush();
+
 	glUseProgram(g_GLSL_prog);
 
-	g_obj.Draw();
+	//ֻѾıߺڻıߣδʹõĶ㶼ԭ㣬ɴ߻Բ
+	int num_segments = vcounter / 2 + g_interactive_drawing_mode;
+	if (num_segments > g_obj.GetNumVertices() / 2)
+		num_segments = g_obj.GetNumVertices() / 2;
+	g_obj.DrawThickLines(num_segments);
 
 	glFlush();
 	glutSwapBuffers();
@@ -78,73 +174,185 @@ void display(void)
 
 void reshape(int w, int h)
 {
+	g_recorder.RecordReshape(w, h);
 	g_window_width=w;
 	g_window_height=h;
 	glViewport(0, 0, w, h);
+	glUseProgram(g_GLSL_prog);
+	glUniform2f(glGetUniformLocation(g_GLSL_prog, "viewport_size"), (float)w, (float)h);
 }
 
 void mouse(int button, int state, int x, int y)
 {
+	g_recorder.RecordMouse(button, state, x, y);
 	if (button == GLUT_LEFT_BUTTON)
 	{
-		g_interactive_drawing_mode = 1;
 		int i = vcounter % 6;	//iӳĿǰڻڼߡϢ
+		if (state == GLUT_DOWN)
+		{
+			EnsureVertices(vcounter + 2);	//ޣõʱ׷
+			g_interactive_drawing_mode = 1;
+		}
+
 		if (state == GLUT_DOWN && i == 0)		//i=0ʾӳʼһ
 		{
-			MousePosToNormalizedPos(x, y,
-				g_line_seg_vertices[vcounter].x,
-				g_line_seg_vertices[vcounter].y);
-			g_line_seg_vertices[vcounter + 1] = g_line_seg_vertices[vcounter];	//΢ƫƴ
-			CopyVertexPositionToGPU(vcounter);
-			CopyVertexPositionToGPU(vcounter + 1);
+			point3 p = MousePosToVertex(x, y);
+			SetVertexPosition(vcounter, p);
+			SetVertexPosition(vcounter + 1, p);	//΢ƫƴ
 			glutPostRedisplay();
 		}
 		else if (state == GLUT_DOWN && i == 2)	//i=2ʾڶ
 		{
-			g_line_seg_vertices[vcounter] = g_line_seg_vertices[vcounter - 1];		//ڶߵĳǰһߵյ
-			MousePosToNormalizedPos(x, y,
-				g_line_seg_vertices[vcounter + 1].x,
-				g_line_seg_vertices[vcounter + 1].y);
-			CopyVertexPositionToGPU(vcounter);
-			CopyVertexPositionToGPU(vcounter + 1);
+			SetVertexPosition(vcounter, g_obj.GetPosition(vcounter - 1));		//ڶߵĳǰһߵյ
+			SetVertexPosition(vcounter + 1, MousePosToVertex(x, y));
 			glutPostRedisplay();
 		}
 		else if (state == GLUT_DOWN && i == 4)	//i=4ʾ
 		{
-			g_line_seg_vertices[vcounter] = g_line_seg_vertices[vcounter - 1];		//ߵĳǰһߵյ
-			g_line_seg_vertices[vcounter + 1] = g_line_seg_vertices[vcounter - 4];		//ߵյǳ
-			CopyVertexPositionToGPU(vcounter);
-			CopyVertexPositionToGPU(vcounter + 1);
+			SetVertexPosition(vcounter, g_obj.GetPosition(vcounter - 1));		//ߵĳǰһߵյ
+			SetVertexPosition(vcounter + 1, g_obj.GetPosition(vcounter - 4));		//ߵյǳ
 			glutPostRedisplay();
 		}
 		else if (state == GLUT_UP)
 		{
+			//ûжӦµɿ˫ʱڶɿڴڣύ
+			//ߵĶ㻹ûз
+			if (!g_interactive_drawing_mode || vcounter + 2 > g_obj.GetNumVertices())
+				return;
+			CommitSegment(vcounter / 2);
 			vcounter += 2;	//ʾɿˣԻһߣż2һҪ洢
 			g_interactive_drawing_mode = 0;
 		}
 	}
+	else if (button == GLUT_RIGHT_BUTTON && state == GLUT_DOWN)
+	{
+		SelectTriangle(x, y);
+	}
+}
+
+void keyboard(unsigned char key, int x, int y)
+{
+	g_recorder.RecordKeyboard(key, x, y);
+	switch (key)
+	{
+	case 's':	//򿪻رն
+		g_snap_enabled = !g_snap_enabled;
+		printf("snapping %s\n", g_snap_enabled ? "on" : "off");
+		break;
+	case 'x':	//ɾҼѡе
+	case 127:
+		EraseSelectedTriangle();
+		break;
+	}
 }
 
 void mouse_motion(int x, int y)
 {
+	g_recorder.RecordMotion(x, y);
 	int i = vcounter % 6;	//iӳĿǰڻڼߡϢͬ
 	if (g_interactive_drawing_mode && i < 4)	//ƶʱһ͵ڶߴʽһ
 	{
-		MousePosToNormalizedPos(x, y,
-			g_line_seg_vertices[vcounter + 1].x,
-			g_line_seg_vertices[vcounter + 1].y);
-		CopyVertexPositionToGPU(vcounter + 1);
-		glutPostRedisplay();
+		SetVertexPosition(vcounter + 1, MousePosToVertex(x, y));	//λûб仯ʱϴҲػ
+	}
+	//ߵ˵㶼ж㣬ƶʱҪ
+}
+
+bool IsValidStrokeEvent(const CStrokeEvent& e)
+{
+	//־𻵻򱻸дֻܳʱܲ¼
+	switch (e.type)
+	{
+	case STROKE_EVENT_MOUSE:
+		return (e.button == GLUT_LEFT_BUTTON || e.button == GLUT_MIDDLE_BUTTON || e.button == GLUT_RIGHT_BUTTON) &&
+			(e.state == GLUT_DOWN || e.state == GLUT_UP);
+	case STROKE_EVENT_MOTION:
+	case STROKE_EVENT_KEYBOARD:
+		return true;
+	case STROKE_EVENT_RESHAPE:
+		return e.x > 0 && e.y > 0;	//껻ҪԴڴС
+	}
+	return false;
+}
+
+int replay_strokes(const char *filename)
+{
+	//¼Ƶ¼ԭ˳ٶͽͬĻصҪ˲
+	CStrokeLog log;
+	if (!log.Open(filename))
+	{
+		printf("cannot open stroke log %s\n", filename);
+		return 1;
 	}
-	else	//
+	const CStrokeEvent *events = log.GetEvents();
+	unsigned int num_events = log.GetHeader().num_events;
+	std::vector<double> latencies;
+	latencies.reserve(num_events);
+	unsigned int num_skipped = 0;
+
+	//־ĵһ¼һǴڴСʵʴڵĴС֤껻ʱڴСΪ0
+	reshape(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned int k = 0; k < num_events; k++)
 	{
-		CopyVertexPositionToGPU(vcounter);
+		const CStrokeEvent& e = events[k];
+		if (!IsValidStrokeEvent(e))
+		{
+			num_skipped++;
+			continue;
+		}
+
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+		switch (e.type)
+		{
+		case STROKE_EVENT_MOUSE:	mouse(e.button, e.state, e.x, e.y); break;
+		case STROKE_EVENT_MOTION:	mouse_motion(e.x, e.y); break;
+		case STROKE_EVENT_KEYBOARD:	keyboard(e.button, e.x, e.y); break;
+		case STROKE_EVENT_RESHAPE:	reshape(e.x, e.y); break;
+		}
+		//ÿ¼֮ϴ뵽㻺µ·
+		g_obj.Flush();
+
+		latencies.push_back(std::chrono::duration<double, std::micro>(
+			std::chrono::steady_clock::now() - t0).count());
 	}
+	glFinish();
+	double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	size_t num_replayed = latencies.size();
+	double sum = 0.0;
+	for (size_t k = 0; k < num_replayed; k++)
+		sum += latencies[k];
+	std::sort(latencies.begin(), latencies.end());
+
+	printf("replayed %u events (%.3f s recorded) in %.3f s, %.0f events/s\n",
+		(unsigned int)num_replayed, num_events > 0 ? events[num_events - 1].time_us * 1e-6 : 0.0,
+		total, num_replayed / total);
+	if (num_skipped > 0)
+		printf("skipped %u invalid events\n", num_skipped);
+	if (num_replayed > 0)
+		printf("latency per event (us): mean %.2f, median %.2f, 99%% %.2f, max %.2f\n",
+			sum / num_replayed, latencies[num_replayed / 2],
+			latencies[(size_t)(num_replayed * 0.99)], latencies[num_replayed - 1]);
+	printf("%d vertices, %d segments\n", g_obj.GetNumVertices(), vcounter / 2);
+	return 0;
 }
 
 int main(int argc, char **argv)
 {
 	glutInit(&argc, argv);
+
+	//-record file¼¼-replay fileط¼ݺ˳
+	const char *record_file = NULL, *replay_file = NULL;
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (strcmp(argv[i], "-record") == 0)
+			record_file = argv[++i];
+		else if (strcmp(argv[i], "-replay") == 0)
+			replay_file = argv[++i];
+	}
+
 	glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE);
 
 	glutInitContextVersion(3, 3);
@@ -157,12 +365,24 @@ int main(int argc, char **argv)
 
 	init();
 
+	if (replay_file != NULL)
+	{
+		glutHideWindow();
+		return replay_strokes(replay_file);
+	}
+	if (record_file != NULL && !g_recorder.Open(record_file))
+		printf("cannot create stroke log %s\n", record_file);
+
 	glutDisplayFunc(display);
 	glutReshapeFunc(reshape);
 	glutMouseFunc(mouse);
 	glutMotionFunc(mouse_motion);
+	glutKeyboardFunc(keyboard);
 
+	//رմʱglutMainLoopأ֤־д
+	glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS);
 	glutMainLoop();
+	g_recorder.Close();
 
 	return 0;
 }
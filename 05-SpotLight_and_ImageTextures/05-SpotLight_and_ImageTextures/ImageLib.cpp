@@ -1,6 +1,7 @@
 #include "ImageLib.h"
 #include "FreeImage.h"
 #include "GL/glew.h"
+#include "ScratchArena.h"
 
 unsigned int LoadTexture2DFromFile(const char *file_name)
 // Create a 2D texture object and load its image from an image file
@@ -164,7 +165,8 @@ unsigned int LoadBumpMap2DFromHeightMapFile(const char *file_name)
 	BYTE *height_image=FreeImage_GetBits(img);
 
 	// Create a bump map image
-	float *bump_image=new float [image_width*image_height*3];
+	CScratchScope scratch;
+	float *bump_image=scratch.Allocate<float>(image_width*image_height*3);
 
 	// Set pixel values of the bump map image using
 	//   finite differences of pixel values of the height map image
@@ -220,9 +222,6 @@ unsigned int LoadBumpMap2DFromHeightMapFile(const char *file_name)
 	// Delete the height map image
 	FreeImage_Unload(img);
 
-	// Delete the bump map image
-	delete [] bump_image;
-
 	// Return the texture object name (index)
 	return itex;
 }
@@ -1,5 +1,6 @@
 #include <stddef.h>
 #include "Mesh.h"
+#include "ScratchArena.h"
 
 void CMesh::DivideTriangle(
 	const point2& v0, const point2& v1, const point2& v2, 
@@ -99,37 +100,115 @@ CMesh::CMesh(void)
 	primitive_type=GL_TRIANGLES;
 	num_vertices=0;
 	num_indices=0;
-	vertex_array_obj=0;
-	vertex_buffer_obj=0;
-	index_buffer_obj=0;
+	bound_center=vec3(0.0f);
+	bound_radius=0.0f;
+	coarser_lod=NULL;
+	lod_levels=1;
+	lod_error=0.0f;
 }
 
 void CMesh::ReleaseGLResources(void)
 // Release OpenGL resources
 {
-	if (vertex_array_obj!=0)
-		glDeleteVertexArrays(1, &vertex_array_obj);
-	vertex_array_obj=0;
+	arena.Free(arena_block);
 
-	if (vertex_buffer_obj!=0)
-		glDeleteBuffers(1, &vertex_buffer_obj);
-	vertex_buffer_obj=0;
-
-	if (index_buffer_obj!=0)
-		glDeleteBuffers(1, &index_buffer_obj);
-	index_buffer_obj=0;
+	if (coarser_lod!=NULL)
+	{
+		coarser_lod->ReleaseGLResources();
+		delete coarser_lod;
+	}
+	coarser_lod=NULL;
 }
 
 void CMesh::Draw(void)
 // Draw the mesh
 {
-	glBindVertexArray(vertex_array_obj);
-	if (index_buffer_obj==0)
-		glDrawArrays(primitive_type, 0, num_vertices);
-	else
-		glDrawElements(primitive_type, num_indices, 
-			GL_UNSIGNED_INT, (GLvoid *)0);
-	glBindVertexArray(0);
+	if (arena_block.arena!=NULL)
+		arena.Draw(arena_block, primitive_type);
+}
+
+int CMesh::GetNumTriangles(void) const
+// Return the number of triangles drawn by Draw
+{
+	if (primitive_type!=GL_TRIANGLES)
+		return 0;
+	return (arena_block.num_indices!=0 ? num_indices : num_vertices)/3;
+}
+
+CMesh *CMesh::CreateCoarserLOD(void)
+// Attach a new empty mesh as the next coarser level of detail and return it
+// Returns NULL if lod_levels does not allow another level
+{
+	if (lod_levels<=1)
+		return NULL;
+
+	if (coarser_lod!=NULL)
+	{
+		coarser_lod->ReleaseGLResources();
+		delete coarser_lod;
+	}
+	coarser_lod=new CMesh;
+	coarser_lod->lod_levels=lod_levels-1;
+	return coarser_lod;
+}
+
+CMesh& CMesh::GetLOD(int level)
+// Return a level of detail, 0 for the mesh itself
+{
+	CMesh *mesh=this;
+	for (; level>0 && mesh->coarser_lod!=NULL; --level)
+		mesh=mesh->coarser_lod;
+	return *mesh;
+}
+
+int CMesh::SelectLOD(const mat4& model_view_matrix, float viewport_scale,
+	float max_pixel_error, int current_lod, float hysteresis) const
+// Return the coarsest level of detail whose error stays within max_pixel_error on the screen
+// model_view_matrix: (in) Matrix from object to eye coordinates
+// viewport_scale: (in) Pixels per unit at distance 1
+// max_pixel_error: (in) Largest allowed error in pixels
+// current_lod: (in) Level of detail drawn in the previous frame
+// hysteresis: (in) Fraction of max_pixel_error for switching to a coarser level
+{
+	if (coarser_lod==NULL)
+		return 0;
+
+	// Bounding sphere in eye coordinates, scaled by the largest scale of the matrix
+	vec4 center=model_view_matrix*vec4(bound_center, 1.0f);
+	float scale=0.0f;
+	for (int j=0; j<3; ++j)
+	{
+		vec3 axis(model_view_matrix[0][j], model_view_matrix[1][j], model_view_matrix[2][j]);
+		if (length(axis)>scale)
+			scale=length(axis);
+	}
+	float distance=length(vec3(center.x, center.y, center.z));
+	float radius=scale*bound_radius;
+
+	// The finest level is drawn when the camera is inside the bounding sphere
+	if (distance<=radius)
+		return 0;
+
+	// Pixels per object unit at the nearest point of the bounding sphere; the
+	//   bounding sphere covers bound_radius*pixels_per_unit pixels on the screen
+	float pixels_per_unit=viewport_scale*scale/(distance-radius);
+
+	// max_level is the coarsest level within max_pixel_error and min_level the coarsest
+	//   one within hysteresis*max_pixel_error; the current level is kept between them
+	int level=0, min_level=0, max_level=0;
+	for (const CMesh *mesh=this; mesh!=NULL; mesh=mesh->coarser_lod, ++level)
+	{
+		float pixel_error=mesh->lod_error*pixels_per_unit;
+		if (pixel_error<=max_pixel_error)
+			max_level=level;
+		if (pixel_error<=hysteresis*max_pixel_error)
+			min_level=level;
+	}
+	if (current_lod<min_level)
+		return min_level;
+	if (current_lod>max_level)
+		return max_level;
+	return current_lod;
 }
 
 void CMesh::CreateGLResources(
@@ -141,19 +220,30 @@ void CMesh::CreateGLResources(
 // Input member variables:
 //     num_vertices, num_indices
 // Output member variables:
-//     vertex_array_obj, vertex_buffer_obj, index_buffer_obj
+//     arena_block, bound_center, bound_radius
 {
-	// Create the vertex array object
-	glGenVertexArrays(1, &vertex_array_obj);
-	glBindVertexArray(vertex_array_obj);
+	// Bounding sphere around the center of the bounding box
+	vec3 pmin=vertices[0].pos, pmax=vertices[0].pos;
+	int i;
+	for (i=1; i<num_vertices; ++i)
+	{
+		const point3& p=vertices[i].pos;
+		pmin=vec3(fminf(pmin.x, p.x), fminf(pmin.y, p.y), fminf(pmin.z, p.z));
+		pmax=vec3(fmaxf(pmax.x, p.x), fmaxf(pmax.y, p.y), fmaxf(pmax.z, p.z));
+	}
+	bound_center=0.5f*(pmin+pmax);
+	bound_radius=0.0f;
+	for (i=0; i<num_vertices; ++i)
+		bound_radius=fmaxf(bound_radius, length(vertices[i].pos-bound_center));
+
+	CreateGLResources2(vertices, indices);
+}
 
-	// Create the vertex buffer object
-	glGenBuffers(1, &vertex_buffer_obj);
-	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_obj);
-	glBufferData(GL_ARRAY_BUFFER, 
-		sizeof(CMeshVertex)*num_vertices,
-		vertices, GL_STATIC_DRAW);
+CMeshArena CMesh::arena(sizeof(CMeshVertex), CMesh::SetVertexFormat);
 
+void CMesh::SetVertexFormat(int /*format*/, int /*vertex_size*/)
+// Set the vertex attributes of CMeshVertex for the arena
+{
 	// Enable vertex attribute arrays and
 	//   set their data and formats in the vertex buffer object
 	glEnableVertexAttribArray(0); // 0=position
@@ -171,19 +261,6 @@ void CMesh::CreateGLResources(
 	glEnableVertexAttribArray(3); // 3=texture coordinates
 	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 
 		sizeof(CMeshVertex), (GLvoid *)offsetof(CMeshVertex, texcoord));
-
-	// Create the index buffer object if necessary
-	if (indices!=NULL)
-	{
-		glGenBuffers(1, &index_buffer_obj);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_obj);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, 
-			sizeof(GLuint)*num_indices,
-			indices, GL_STATIC_DRAW);
-	}
-
-	// Restore the current vertex array object to the default one
-	glBindVertexArray(0);
 }
 
 
@@ -196,49 +273,13 @@ void CMesh::CreateGLResources2(
 	// Input member variables:
 	//     num_vertices, num_indices
 	// Output member variables:
-	//     vertex_array_obj, vertex_buffer_obj, index_buffer_obj
+	//     arena_block
 {
-	// Create the vertex array object
-	glGenVertexArrays(1, &vertex_array_obj);
-	glBindVertexArray(vertex_array_obj);
-
-	// Create the vertex buffer object
-	glGenBuffers(1, &vertex_buffer_obj);
-	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_obj);
-	glBufferData(GL_ARRAY_BUFFER,
-		sizeof(CMeshVertex) * num_vertices,
-		vertices, GL_STATIC_DRAW);
-
-	// Enable vertex attribute arrays and
-	//   set their data and formats in the vertex buffer object
-	glEnableVertexAttribArray(0); // 0=position
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
-		sizeof(CMeshVertex), (GLvoid*)offsetof(CMeshVertex, pos));
-
-	glEnableVertexAttribArray(1); // 1=color
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE,
-		sizeof(CMeshVertex), (GLvoid*)offsetof(CMeshVertex, color));
-
-	glEnableVertexAttribArray(2); // 2=normal
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE,
-		sizeof(CMeshVertex), (GLvoid*)offsetof(CMeshVertex, normal));
-
-	glEnableVertexAttribArray(3); // 3=texture coordinates
-	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE,
-		sizeof(CMeshVertex), (GLvoid*)offsetof(CMeshVertex, texcoord));
-
-	// Create the index buffer object if necessary
+	// Copy the arrays into ranges of the shared buffers
+	arena.Allocate(arena_block, num_vertices, indices != NULL ? num_indices : 0);
+	arena.UploadVertices(arena_block, vertices);
 	if (indices != NULL)
-	{
-		glGenBuffers(1, &index_buffer_obj);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_obj);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-			sizeof(GLuint) * num_indices,
-			indices, GL_STATIC_DRAW);
-	}
-
-	// Restore the current vertex array object to the default one
-	glBindVertexArray(0);
+		arena.UploadIndices(arena_block, indices);
 }
 
 void CMesh::CreateGasket2D(
@@ -252,7 +293,8 @@ void CMesh::CreateGasket2D(
 	int i;
 	for (i=0; i<=subdivision_depth; ++i)
 		num_vertices*=3;
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
 
 	i=0;
 	DivideTriangle(
@@ -263,8 +305,6 @@ void CMesh::CreateGasket2D(
 		i, subdivision_depth);
 
 	CreateGLResources(vertices);
-
-	delete [] vertices;
 }
 
 void CMesh::CreateGasket3D(
@@ -274,11 +314,25 @@ void CMesh::CreateGasket3D(
 // tetra_vertices:    (in) Tetrahedron vertices
 // subdivision_depth: (in) Maximum recursive subdivision depth
 {
+	// Coarser levels of detail subdivide one level less
+	CMesh *lod=subdivision_depth>0 ? CreateCoarserLOD() : NULL;
+	if (lod!=NULL)
+		lod->CreateGasket3D(tetra_vertices, subdivision_depth-1);
+
 	num_vertices=3;
 	int i;
 	for (i=0; i<=subdivision_depth; ++i)
 		num_vertices*=4;
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
+
+	// The smallest tetrahedra are the error; each is within its circumradius
+	//   of the gasket, sqrt(6)/4 of its edge length
+	float edge=0.0f;
+	for (i=0; i<4; ++i)
+		for (int j=i+1; j<4; ++j)
+			edge=fmaxf(edge, length(tetra_vertices[i]-tetra_vertices[j]));
+	lod_error=0.61237f*edge/(1<<subdivision_depth);
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
 
 	i=0;
 	DivideTetra(
@@ -290,8 +344,6 @@ void CMesh::CreateGasket3D(
 		i, subdivision_depth);
 
 	CreateGLResources(vertices);
-
-	delete [] vertices;
 }
 
 void CMesh::CreateCube(float size, float ntex)
@@ -341,8 +393,9 @@ void CMesh::CreateCube(float size, float ntex)
 	num_indices=36;
 
 	// Allocate memory for vertices and indices
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
-	GLuint *indices=new GLuint [num_indices];
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint *indices=scratch.Allocate<GLuint>(num_indices);
 
 	// Loop through all 6 faces
 	int i, k;
@@ -381,10 +434,6 @@ void CMesh::CreateCube(float size, float ntex)
 
 	// Create OpenGL resources
 	CreateGLResources(vertices, indices);
-
-	// Free memory
-	delete [] vertices;
-	delete [] indices;
 }
 
 void CMesh::CreateBlock(float sx, float sy, float sz,
@@ -443,8 +492,9 @@ void CMesh::CreateBlock(float sx, float sy, float sz,
 	num_indices=36;
 
 	// Allocate memory for vertices and indices
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
-	GLuint *indices=new GLuint [num_indices];
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint *indices=scratch.Allocate<GLuint>(num_indices);
 
 	// Loop through all 6 faces
 	int i, k;
@@ -487,10 +537,6 @@ void CMesh::CreateBlock(float sx, float sy, float sz,
 
 	// Create OpenGL resources
 	CreateGLResources(vertices, indices);
-
-	// Free memory
-	delete [] vertices;
-	delete [] indices;
 }
 
 void CMesh::CreateRect(
@@ -510,8 +556,9 @@ void CMesh::CreateRect(
 	num_indices=6*nx*ny;
 
 	// Allocate memory for vertices and indices
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
-	GLuint *indices=new GLuint [num_indices];
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint *indices=scratch.Allocate<GLuint>(num_indices);
 
 	// Set vertices
 	int i, j, k;
@@ -577,10 +624,6 @@ void CMesh::CreateRect(
 
 	// Create OpenGL resources
 	CreateGLResources(vertices, indices);
-
-	// Free memory
-	delete [] vertices;
-	delete [] indices;
 }
 
 void CMesh::CreateSphere(
@@ -593,16 +636,25 @@ void CMesh::CreateSphere(
 // tex_ntheta: (in) Texture coordinate multiplier in theta direction
 // tex_nphi:   (in) Texture coordinate multiplier in phi direction
 {
+	// Coarser levels of detail halve the subdivisions
+	CMesh *lod=num_slices>=8 && num_stacks>=4 ? CreateCoarserLOD() : NULL;
+	if (lod!=NULL)
+		lod->CreateSphere(radius, num_slices/2, num_stacks/2, tex_ntheta, tex_nphi);
+
 	float dtheta=(M_PI+M_PI)/num_slices;
 	float dphi=M_PI/num_stacks;
 
+	// Distance from the center of a sub rectangle to the sphere
+	lod_error=radius*(1.0f-cosf(0.5f*dtheta)*cosf(0.5f*dphi));
+
 	// Set the number of vertices and indices
 	num_vertices=(num_slices+1)*(num_stacks+1);
 	num_indices=6*num_slices*num_stacks;
 
 	// Allocate memory for vertices and indices
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
-	GLuint *indices=new GLuint [num_indices];
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint *indices=scratch.Allocate<GLuint>(num_indices);
 
 	// Set vertices
 	int i, j, k;
@@ -673,10 +725,6 @@ void CMesh::CreateSphere(
 
 	// Create OpenGL resources
 	CreateGLResources(vertices, indices);
-
-	// Free memory
-	delete [] vertices;
-	delete [] indices;
 }
 
 void CMesh::CreateAxes(float sx, float sy, float sz)
@@ -711,6 +759,14 @@ void CMesh::CreateAxes(float sx, float sy, float sz)
 
 void CMesh::CreateCone(float radius, float h, int num_slices, int num_stacks, int num_rings, float tex_ntheta, float tex_nh)
 {
+	// Coarser levels of detail halve the subdivisions
+	CMesh *lod=num_slices>=8 ? CreateCoarserLOD() : NULL;
+	if (lod!=NULL)
+		lod->CreateCone(radius, h, num_slices/2, num_stacks>1 ? num_stacks/2 : 1, num_rings>1 ? num_rings/2 : 1, tex_ntheta, tex_nh);
+
+	// Distance from the middle of an edge of the base polygon to the circle
+	lod_error=radius*(1.0f-cosf((float)M_PI/num_slices));
+
 	//printf("-----------------------------------------------------------------------------------------------\n");
 	//printf("Բ׶");
 	float dtheta = (M_PI + M_PI) / num_slices;
@@ -721,8 +777,9 @@ void CMesh::CreateCone(float radius, float h, int num_slices, int num_stacks, in
 	num_vertices = num_curve_vertices + num_bottom_vertices;	//׶涥 + 涥
 	num_indices = 6 * num_slices * num_stacks + 6 * num_slices * num_rings;	//׶涥+ 涥
 
-	CMeshVertex* vertices = new CMeshVertex[num_vertices];
-	GLuint* indices = new GLuint[num_indices];
+	CScratchScope scratch;
+	CMeshVertex* vertices = scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint* indices = scratch.Allocate<GLuint>(num_indices);
 
 	//׶涥ϸ--
 	int i, j, k;
@@ -846,12 +903,17 @@ void CMesh::CreateCone(float radius, float h, int num_slices, int num_stacks, in
 	//printf("**********(k:%d,num_vertices:%d,num_indices:%d)***************\n",k, num_vertices, num_indices);
 
 	CreateGLResources(vertices, indices);
-
-	delete[] vertices;
-	delete[] indices;
 }
 void CMesh::CreateCylinder(float radius, float h, int num_slices, int num_stacks, int num_rings, float tex_ntheta, float tex_nh)
 {
+	// Coarser levels of detail halve the subdivisions
+	CMesh *lod=num_slices>=8 ? CreateCoarserLOD() : NULL;
+	if (lod!=NULL)
+		lod->CreateCylinder(radius, h, num_slices/2, num_stacks>1 ? num_stacks/2 : 1, num_rings>1 ? num_rings/2 : 1, tex_ntheta, tex_nh);
+
+	// Distance from the middle of an edge of the base polygon to the circle
+	lod_error=radius*(1.0f-cosf((float)M_PI/num_slices));
+
 	//printf("-----------------------------------------------------------------------------------------------\n");
 	//printf("Բ");
 	float dtheta = (M_PI + M_PI) / num_slices;
@@ -862,8 +924,9 @@ void CMesh::CreateCylinder(float radius, float h, int num_slices, int num_stacks
 	num_vertices = num_curve_vertices + num_beside_curve_vertices;	//׶涥 + 涥ȦĶǹ㣩
 	num_indices = 6 * num_slices * num_stacks + 2 * 6 * num_slices * num_rings;	//׶涥+ 涥
 
-	CMeshVertex* vertices = new CMeshVertex[num_vertices];
-	GLuint* indices = new GLuint[num_indices];
+	CScratchScope scratch;
+	CMeshVertex* vertices = scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint* indices = scratch.Allocate<GLuint>(num_indices);
 
 	//Բϸ--
 	int i, j, k;
@@ -1022,8 +1085,4 @@ void CMesh::CreateCylinder(float radius, float h, int num_slices, int num_stacks
 	//printf("**********(k:%d,num_vertices:%d,num_indices:%d)***************\n", k, num_vertices, num_indices);
 
 	CreateGLResources(vertices, indices);
-
-	delete[] vertices;
-	delete[] indices;
-
 }
\ No newline at end of file
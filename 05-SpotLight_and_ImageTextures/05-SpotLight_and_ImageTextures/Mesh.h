@@ -4,6 +4,7 @@
 #include "GL/glew.h"
 #include "vec.h"
 #include "Camera.h"
+#include "MeshArena.h"
 // Mesh vertex
 class CMeshVertex
 {
@@ -49,24 +50,58 @@ protected:
 	// Input member variables:
 	//     num_vertices, num_indices
 	// Output member variables:
-	//     vertex_array_obj, vertex_buffer_obj, index_buffer_obj
+	//     arena_block
+
+	static void SetVertexFormat(int format, int vertex_size);
+	// Set the vertex attributes of CMeshVertex for the arena
 
 public:
-	GLuint vertex_array_obj;  // OpenGL vertex array object
-	GLuint vertex_buffer_obj; // OpenGL vertex buffer object
-	GLuint index_buffer_obj;  // OpenGL index buffer object
+	static CMeshArena arena;  // Vertex and index buffers shared by all meshes
+	CMeshArenaBlock arena_block; // Ranges of the mesh in arena
 	int num_vertices; // The number of vertices
 	int num_indices;  // The number of indices
 	GLenum primitive_type; // OpenGL primitive type
+	vec3 bound_center;  // Bounding sphere of the vertices in object coordinates
+	float bound_radius;
+	CMesh *coarser_lod; // Next coarser level of detail, NULL for the coarsest level
+	int lod_levels;     // The number of levels of detail that the gasket, sphere, cone and
+	                    //   cylinder create, including the mesh itself, set before creating
+	                    //   the mesh
+	float lod_error;    // Largest distance between the mesh and the surface it approximates,
+	                    //   in object coordinates
 
 	CMesh(void);
 
 	void ReleaseGLResources(void);
-	// Release OpenGL resources
+	// Release OpenGL resources, including those of the coarser levels of detail
 
 	void Draw(void);
 	// Draw the mesh
 
+	int GetNumTriangles(void) const;
+	// Return the number of triangles drawn by Draw
+
+	CMesh *CreateCoarserLOD(void);
+	// Attach a new empty mesh as the next coarser level of detail and return it
+	// Returns NULL if lod_levels does not allow another level
+	// The new mesh has one level less; create it with a Create function, which sets lod_error
+
+	CMesh& GetLOD(int level);
+	// Return a level of detail, 0 for the mesh itself
+	// Levels beyond the coarsest one return the coarsest one
+
+	int SelectLOD(const mat4& model_view_matrix, float viewport_scale,
+		float max_pixel_error, int current_lod, float hysteresis=0.75f) const;
+	// Return the coarsest level of detail whose error stays within max_pixel_error on
+	//   the screen, judged from the projected size of the bounding sphere
+	// model_view_matrix: (in) Matrix from object to eye coordinates
+	// viewport_scale: (in) Pixels per unit at distance 1, viewport height/(2*tan(fovy/2))
+	// max_pixel_error: (in) Largest allowed error in pixels
+	// current_lod: (in) Level of detail drawn in the previous frame
+	// hysteresis: (in) The object only switches to a coarser level than current_lod when
+	//             its error is within hysteresis*max_pixel_error, so that objects near a
+	//             threshold do not switch levels every frame
+
 	void CreateGasket2D(
 		const point2 triangle_vertices[3],
 		int subdivision_depth);
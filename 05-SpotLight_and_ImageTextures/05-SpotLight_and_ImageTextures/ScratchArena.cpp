@@ -0,0 +1,104 @@
+#include "ScratchArena.h"
+#include <stdlib.h>
+
+CScratchArena g_scratch_arena;
+
+CScratchArena::CScratchArena(size_t block_size)
+{
+	current_block=-1;
+	offset=0;
+	this->block_size=block_size;
+	used=peak_used=reserved=0;
+	num_allocations=num_system_allocations=0;
+}
+
+CScratchArena::~CScratchArena(void)
+{
+	Release();
+}
+
+void *CScratchArena::Allocate(size_t size, size_t alignment)
+// Return memory of size bytes aligned to alignment, a power of 2 up to 16
+// The blocks are allocated with malloc, which aligns them to 16 bytes
+{
+	++num_allocations;
+	if (size==0)
+		size=1;
+
+	size_t aligned=current_block>=0 ? (offset+alignment-1)&~(alignment-1) : 0;
+	if (current_block<0 || aligned+size>blocks[current_block].size)
+	{
+		// The rest of the current block is lost until the arena is rewound, once
+		//   the next block is secured; if that fails, the current block stays usable
+		size_t lost=current_block>=0 ? blocks[current_block].size-offset : 0;
+
+		// Move on to the next block, dropping the ones that are too small
+		++current_block;
+		while (current_block<(int)blocks.size() && blocks[current_block].size<size)
+		{
+			reserved-=blocks[current_block].size;
+			free(blocks[current_block].data);
+			blocks.erase(blocks.begin()+current_block);
+		}
+		if (current_block==(int)blocks.size())
+		{
+			CBlock block;
+			block.size=size>block_size ? size : block_size;
+			block.data=(char *)malloc(block.size);
+			if (block.data==NULL)
+			{
+				--current_block;
+				return NULL;
+			}
+			blocks.insert(blocks.begin()+current_block, block);
+			reserved+=block.size;
+			++num_system_allocations;
+		}
+		used+=lost;
+		offset=0;
+		aligned=0;
+	}
+
+	used+=aligned-offset+size;
+	if (used>peak_used)
+		peak_used=used;
+	offset=aligned+size;
+	return blocks[current_block].data+aligned;
+}
+
+CScratchMarker CScratchArena::GetMarker(void) const
+{
+	CScratchMarker marker;
+	marker.block=current_block;
+	marker.offset=offset;
+	marker.used=used;
+	return marker;
+}
+
+void CScratchArena::Rewind(const CScratchMarker& marker)
+// Free everything allocated after marker
+{
+	current_block=marker.block;
+	offset=marker.offset;
+	used=marker.used;
+}
+
+void CScratchArena::Release(void)
+// Return all blocks to the system; nothing may be in use
+{
+	for (size_t i=0; i<blocks.size(); ++i)
+		free(blocks[i].data);
+	blocks.clear();
+	current_block=-1;
+	offset=0;
+	used=0;
+	reserved=0;
+}
+
+void CScratchArena::ResetStatistics(void)
+// Restart peak_used, num_allocations and num_system_allocations from now
+{
+	peak_used=used;
+	num_allocations=0;
+	num_system_allocations=0;
+}
@@ -2,11 +2,13 @@
 #include "GL/freeglut.h"
 #include "vec.h"
 #include <stdlib.h>
+#include <stdio.h>
 #include "mat.h"
 #include "GLHelper.h"
 #include "Mesh.h"
 #include "Camera.h"
 #include "ImageLib.h"
+#include "ScratchArena.h"
 
 #define CMESH_NUM 6
 class CObject3D
@@ -16,10 +18,19 @@ public:
 	color4 base_color;
 	mat4 model_matrix;
 	GLuint diffuse_texture;
+	int lod; // Level of detail drawn in the last frame
 };
 
-GLuint g_GLSL_prog;
-int g_model_matrix_loc, g_base_color_loc;
+CShaderProgram g_GLSL_prog;
+
+//ʱõ uniform ľ init_shaders вãÿֲٰ֡
+struct
+{
+	int model_matrix, view_matrix, projection_matrix, normal_matrix;
+	int diffuse_reflectivity, specular_reflectivity, shininess;
+	int base_color, enable_diffuse_texture;
+	int spot_light_position, spot_light_direction;
+} g_uniforms;
 
 float g_scene_size=10.0f;
 CObject3D g_obj[CMESH_NUM];
@@ -31,6 +42,11 @@ int g_mouse_x, g_mouse_y;
 
 GLuint g_checkerboard_texture;
 
+//ϸڲΣΧͶӰĻϵĴСѡ g_lod_pixel_error صֲ
+bool g_lod_enabled=true;
+float g_lod_pixel_error=1.0f;
+float g_lod_viewport_scale=1.0f;	//Ϊ 1 ÿλȵ reshape м
+
 GLuint CreateCheckerBoardTexture(void)
 {
 	GLubyte tex_image[64][64][3];
@@ -67,40 +83,45 @@ GLuint CreateCheckerBoardTexture(void)
 
 void init_shaders(void)
 {
-	g_GLSL_prog=InitShader(
+	g_GLSL_prog.Init(
 		"../shaders/single_light-single_texture-vs.txt",
 		"../shaders/single_light-single_texture-fs.txt");
 
-	g_model_matrix_loc=glGetUniformLocation(g_GLSL_prog, "model_matrix");
-	g_base_color_loc=glGetUniformLocation(g_GLSL_prog, "base_color");
-
-	int loc;
+	g_uniforms.model_matrix=g_GLSL_prog.GetHandle("model_matrix");
+	g_uniforms.view_matrix=g_GLSL_prog.GetHandle("view_matrix");
+	g_uniforms.projection_matrix=g_GLSL_prog.GetHandle("projection_matrix");
+	g_uniforms.normal_matrix=g_GLSL_prog.GetHandle("normal_matrix");
+	g_uniforms.diffuse_reflectivity=g_GLSL_prog.GetHandle("diffuse_reflectivity");
+	g_uniforms.specular_reflectivity=g_GLSL_prog.GetHandle("specular_reflectivity");
+	g_uniforms.shininess=g_GLSL_prog.GetHandle("shininess");
+	g_uniforms.base_color=g_GLSL_prog.GetHandle("base_color");
+	g_uniforms.enable_diffuse_texture=g_GLSL_prog.GetHandle("enable_diffuse_texture");
+	g_uniforms.spot_light_position=g_GLSL_prog.GetHandle("spot_light.position");
+	g_uniforms.spot_light_direction=g_GLSL_prog.GetHandle("spot_light.direction");
+
+	CShaderProgram& prog=g_GLSL_prog;
 	//point light
-	loc=glGetUniformLocation(g_GLSL_prog, "ambient_light_color");
-	glUniform4f(loc, 0.106f, 0.106f, 0.106f, 1.0f);
+	prog.SetUniform(prog.GetHandle("ambient_light_color"), color4(0.106f, 0.106f, 0.106f, 1.0f));
 
-	loc=glGetUniformLocation(g_GLSL_prog, "light_color");
-	glUniform4f(loc, 0.0f, 0.0f, 0.0f, 1.0f);
-	loc=glGetUniformLocation(g_GLSL_prog, "light_position");
-	glUniform4f(loc, 1.2f*g_scene_size, 1.0f*g_scene_size, 1.6f*g_scene_size, 1.0f);
+	prog.SetUniform(prog.GetHandle("light_color"), color4(0.0f, 0.0f, 0.0f, 1.0f));
+	prog.SetUniform(prog.GetHandle("light_position"), point4(1.2f*g_scene_size, 1.0f*g_scene_size, 1.6f*g_scene_size, 1.0f));
 
 	//۹
-	glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.position"), g_camera.GetCameraPosition().x, g_camera.GetCameraPosition().y, g_camera.GetCameraPosition().z, 1.0f);	//Դλãʼλ
-	glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.color"), 1.0f, 1.0f, 1.0f, 1.0f);	//̽յƹԴǿ
-	glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.direction"), 0.0f, -1.0f, 0.0f, 1.0f);	//̽յƹԴʼ򣬺ʼйأʼֵ normalize(at - eye)
-	glUniform1f(glGetUniformLocation(g_GLSL_prog, "spot_light.cut_off_angle"), 15 * DegreesToRadians);	//̽յƹԴüǶ
-	glUniform1f(glGetUniformLocation(g_GLSL_prog, "spot_light.exponent"), 1.32f);	//۹ָ
-	glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.ambient"), 0.0f, 0.0f, 0.0f, 1.0f);	//ǿ
-	glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.diffuse"), 1.0f, 1.0f, 1.0f, 1.0f);	//ǿ
-	glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.specular"), 0.4f, 0.4f, 0.4f, 1.0f);	//淴ǿ
-	glUniform1f(glGetUniformLocation(g_GLSL_prog, "spot_light.a0"), 1.0f);	//˥ϵ
-	glUniform1f(glGetUniformLocation(g_GLSL_prog, "spot_light.a1"), 0.01f);	
-	glUniform1f(glGetUniformLocation(g_GLSL_prog, "spot_light.a2"), 0.005f);
-
-
-
-	loc=glGetUniformLocation(g_GLSL_prog, "diffuse_texture");
-	glUniform1i(loc, 0);
+	prog.SetUniform(g_uniforms.spot_light_position, vec4(g_camera.GetCameraPosition(), 1.0f));	//Դλãʼλ
+	prog.SetUniform(prog.GetHandle("spot_light.color"), vec4(1.0f, 1.0f, 1.0f, 1.0f));	//̽յƹԴǿ
+	prog.SetUniform(g_uniforms.spot_light_direction, vec4(0.0f, -1.0f, 0.0f, 1.0f));	//̽յƹԴʼ򣬺ʼйأʼֵ normalize(at - eye)
+	prog.SetUniform(prog.GetHandle("spot_light.cut_off_angle"), 15 * DegreesToRadians);	//̽յƹԴüǶ
+	prog.SetUniform(prog.GetHandle("spot_light.exponent"), 1.32f);	//۹ָ
+	prog.SetUniform(prog.GetHandle("spot_light.ambient"), vec4(0.0f, 0.0f, 0.0f, 1.0f));	//ǿ
+	prog.SetUniform(prog.GetHandle("spot_light.diffuse"), vec4(1.0f, 1.0f, 1.0f, 1.0f));	//ǿ
+	prog.SetUniform(prog.GetHandle("spot_light.specular"), vec4(0.4f, 0.4f, 0.4f, 1.0f));	//淴ǿ
+	prog.SetUniform(prog.GetHandle("spot_light.a0"), 1.0f);	//˥ϵ
+	prog.SetUniform(prog.GetHandle("spot_light.a1"), 0.01f);	
+	prog.SetUniform(prog.GetHandle("spot_light.a2"), 0.005f);
+
+
+
+	prog.SetUniform(prog.GetHandle("diffuse_texture"), 0);
 }
 
 void init_scene(void)
@@ -114,7 +135,10 @@ void init_scene(void)
 		point3(0.0f, 0.0f, 0.81650f*tetra_s),
 	};
 
-	
+	//ε桢Բ׶Բÿϸڲεϸ
+	for (int i = 0; i < CMESH_NUM; i++)
+		g_obj[i].mesh.lod_levels = 5;
+
 	g_obj[0].mesh.CreateRect(g_scene_size, g_scene_size, 32, 32, 10.0f, 10.0f);
 	g_obj[1].mesh.CreateGasket3D(tetra_vertices, 4);
 	g_obj[2].mesh.CreateBlock(2.0f * s, 1.5f * s, 1.0f * s, 4.0f, 3.0f, 2.0f);
@@ -150,6 +174,14 @@ void init_scene(void)
 		"../textures/rock03.jpg");	
 	g_obj[5].diffuse_texture=LoadTexture2DFromFile(
 		"../textures/stake.jpg");
+	//ɺͼʱ鶼ȡ g_scratch_arenaسʱķֵϵͳڴĴ
+	printf("scratch arena: peak %d KB, %d KB reserved, %d allocations, %d from the system\n",
+		(int)(g_scratch_arena.peak_used / 1024), (int)(g_scratch_arena.reserved / 1024),
+		g_scratch_arena.num_allocations, g_scratch_arena.num_system_allocations);
+	// CMesh::arena Ķ㻺壬
+	printf("mesh arena: %d meshes, %d KB used of %d KB, %d repacks\n",
+		CMesh::arena.GetNumBlocks(), (int)(CMesh::arena.GetUsedBytes() / 1024),
+		(int)(CMesh::arena.GetCapacityBytes() / 1024), CMesh::arena.num_repacks);
 }
 
 void init(void)
@@ -173,43 +205,51 @@ void display(void)
 {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	glUseProgram(g_GLSL_prog);
+	glUseProgram(g_GLSL_prog.prog);
 
 	mat4 M;
 	mat3 M33;
 	g_camera.GetViewMatrix(M);
-	int loc=glGetUniformLocation(g_GLSL_prog, "view_matrix");
-	glUniformMatrix4fv(loc, 1, GL_TRUE, M);
+	g_GLSL_prog.SetUniform(g_uniforms.view_matrix, M);
 
 	//̽յƹԴλúͷ
-	glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.position"), g_camera.GetCameraPosition().x, g_camera.GetCameraPosition().y, g_camera.GetCameraPosition().z, 1.0f);
+	g_GLSL_prog.SetUniform(g_uniforms.spot_light_position, vec4(g_camera.GetCameraPosition(), 1.0f));
 
+	int num_triangles=0;
 	for (int i=0; i < CMESH_NUM; i++)
 	{
-		glUniformMatrix4fv(g_model_matrix_loc, 1, GL_TRUE, 
-			g_obj[i].model_matrix);
+		g_GLSL_prog.SetUniform(g_uniforms.model_matrix, g_obj[i].model_matrix);
 
-		loc=glGetUniformLocation(g_GLSL_prog, "normal_matrix");
 		M33=Normal(g_obj[i].model_matrix);
-		glUniformMatrix3fv(loc, 1, GL_TRUE , M33);
+		g_GLSL_prog.SetUniform(g_uniforms.normal_matrix, M33);
 
-		loc=glGetUniformLocation(g_GLSL_prog, "diffuse_reflectivity");
-		glUniform4f(loc, 1.0f, 1.0f, 1.0f, 1.0f);
-		loc=glGetUniformLocation(g_GLSL_prog, "specular_reflectivity");
-		glUniform4f(loc, 0.8f, 0.8f, 1.0f, 1.0f);
-		loc=glGetUniformLocation(g_GLSL_prog, "shininess");
-		glUniform1f(loc, 128.0f);
+		//ʶֵͬûб仯ʱ SetUniform ϴ
+		g_GLSL_prog.SetUniform(g_uniforms.diffuse_reflectivity, color4(1.0f, 1.0f, 1.0f, 1.0f));
+		g_GLSL_prog.SetUniform(g_uniforms.specular_reflectivity, color4(0.8f, 0.8f, 1.0f, 1.0f));
+		g_GLSL_prog.SetUniform(g_uniforms.shininess, 128.0f);
 
-		glUniform4fv(g_base_color_loc, 1, g_obj[i].base_color);
+		g_GLSL_prog.SetUniform(g_uniforms.base_color, g_obj[i].base_color);
 
-		loc=glGetUniformLocation(g_GLSL_prog, "enable_diffuse_texture");
-		glUniform1i(loc, g_obj[i].diffuse_texture!=0);
+		g_GLSL_prog.SetUniform(g_uniforms.enable_diffuse_texture, g_obj[i].diffuse_texture!=0);
 
 		glBindTexture(GL_TEXTURE_2D, g_obj[i].diffuse_texture);
 
-		g_obj[i].mesh.Draw();
+		//ĻϵĴСѡϸڲΣһ֡Ĳڱֵл
+		if (g_lod_enabled)
+			g_obj[i].lod = g_obj[i].mesh.SelectLOD(M * g_obj[i].model_matrix,
+				g_lod_viewport_scale, g_lod_pixel_error, g_obj[i].lod);
+		else
+			g_obj[i].lod = 0;
+		CMesh& mesh = g_obj[i].mesh.GetLOD(g_obj[i].lod);
+		mesh.Draw();
+		num_triangles += mesh.GetNumTriangles();
 	}
 
+	char title[128];
+	sprintf(title, "3D scene with textures loaded from image files - %d triangles%s",
+		num_triangles, g_lod_enabled ? "" : " (LOD off)");
+	glutSetWindowTitle(title);
+
 	glFlush();
 	glutSwapBuffers();
 }
@@ -218,12 +258,13 @@ void reshape(int w, int h)
 {
 	glViewport(0, 0, w, h);
 
-	glUseProgram(g_GLSL_prog);
-	int loc=glGetUniformLocation(g_GLSL_prog, "projection_matrix");
+	glUseProgram(g_GLSL_prog.prog);
 	mat4 M;
 	M=Perspective(60.0f, (float)w/(float)h, 
 		0.01f*g_scene_size, 4.0f*g_scene_size);
-	glUniformMatrix4fv(loc, 1, GL_TRUE, M);
+	g_GLSL_prog.SetUniform(g_uniforms.projection_matrix, M);
+
+	g_lod_viewport_scale=0.5f*h/tanf(30.0f*DegreesToRadians);
 }
 
 void mouse(int button, int state, int x, int y)
@@ -260,7 +301,7 @@ void mouse_motion(int x, int y)
 
 		//̽յƹԴ򣬺λͬ
 		vec3 new_direct = g_camera.GetNewFront();
-		glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.direction"), new_direct.x, new_direct.y, new_direct.z, 0.0f);	//̽յƹԴ 
+		g_GLSL_prog.SetUniform(g_uniforms.spot_light_direction, vec4(new_direct, 0.0f));	//̽յƹԴ 
 
 		glutPostRedisplay();
 	
@@ -301,6 +342,12 @@ void keyboard(unsigned char key, int x, int y)
 		g_camera.MoveUp(-g_camera_step);
 		glutPostRedisplay();
 		break;
+	case 'l':
+	case 'L':
+		//򿪻رϸڲΣڱʾÿ֡Ƶ
+		g_lod_enabled=!g_lod_enabled;
+		glutPostRedisplay();
+		break;
 	}
 }
 
@@ -1,3 +1,12 @@
+#ifndef _GLHELPER_H_
+#define _GLHELPER_H_
+
+#include "GL/glew.h"
+#include "vec.h"
+#include "mat.h"
+#include <string>
+#include <vector>
+
 GLuint InitShader(
 	const char *vShaderFile, 
 	const char *fShaderFile);
@@ -5,3 +14,73 @@ GLuint InitShader(
 // vShaderFile: (in) Pointer to the file containing the vertex shader source codes
 // fShaderFile: (in) Pointer to the file containing the fragment shader source codes
 // Return value: The name (index) of the shader program object
+
+// Shader program with the tables of its active uniforms and uniform blocks
+// The tables are built once after linking; a uniform is then set by its handle, an index
+//   into the table looked up at initialization, so the drawing code does no string
+//   lookups, and each setter skips the upload if the uniform already has the value
+// The cached values are only correct if the uniforms of the program are set through
+//   the setters
+class CShaderProgram
+{
+protected:
+	// Active uniform with the value it was last set to
+	struct CUniform
+	{
+		std::string name;  // Name, without the "[0]" of arrays
+		GLint location;
+		GLenum type;
+		GLint size;        // Array size
+		bool has_value;    // Whether value holds the last uploaded value
+		GLfloat value[16]; // Bit pattern of the value, ints included
+	};
+
+	// Active uniform block
+	struct CUniformBlock
+	{
+		std::string name;
+		GLuint index;
+		GLint data_size; // Size of the buffer range the block reads
+	};
+
+	std::vector<CUniform> uniforms;
+	std::vector<CUniformBlock> blocks;
+
+	bool IsUnchanged(int handle, const void *value, int size);
+	// Compare a value with the last uploaded one and remember it
+	// Returns true if the upload can be skipped, also for handle -1
+
+public:
+	GLuint prog; // OpenGL program object
+
+	CShaderProgram(void);
+
+	void Init(const char *vShaderFile, const char *fShaderFile);
+	// Initialize the program with InitShader and build the tables
+	// The program is left as the current program, like InitShader does
+
+	void Reflect(void);
+	// Build the tables of the active uniforms and uniform blocks of prog
+
+	int GetHandle(const char *name) const;
+	// Return the handle of an active uniform, or -1 if the program does not use it
+	// Like location -1 for glUniform*, handle -1 is ignored by the setters
+
+	int GetBlockSize(const char *name) const;
+	// Return the data size of an active uniform block, 0 if the program does not use it
+
+	void SetBlockBinding(const char *name, GLuint binding);
+	// Assign an active uniform block to a uniform buffer binding point
+
+	// Set a uniform of the program, which must be the current program
+	// int is used for bool and sampler uniforms too; matrices are row-major like
+	//   the ones passed to glUniformMatrix*fv with transpose set
+	void SetUniform(int handle, int value);
+	void SetUniform(int handle, float value);
+	void SetUniform(int handle, const vec3& value);
+	void SetUniform(int handle, const vec4& value);
+	void SetUniform(int handle, const mat3& value);
+	void SetUniform(int handle, const mat4& value);
+};
+
+#endif
@@ -1,8 +1,159 @@
 #include <stddef.h>
+#include <string.h>
 #include "Mesh.h"
+#include "ScratchArena.h"
+#include <stdio.h>
 #include <fstream>
 #include <iostream>
+#include <chrono>
+#include <thread>
+#include <vector>
 using namespace std;
+
+static GLushort FloatToHalf(float f)
+// Convert a float to a half float, rounding to nearest
+// Values too large for a half float are clamped, NaN becomes 0
+{
+	unsigned int bits;
+	memcpy(&bits, &f, 4);
+	GLushort sign=(GLushort)((bits>>16)&0x8000);
+	unsigned int abs_bits=bits&0x7fffffff;
+
+	if (abs_bits>0x7f800000) // NaN
+		return 0;
+	if (abs_bits>=0x477ff000) // Rounds to 65520 or more
+		return sign|0x7bff;
+	if (abs_bits<0x33000000) // Less than half of the smallest denormal
+		return sign;
+
+	int exponent=(int)(abs_bits>>23)-127;
+	unsigned int mantissa=(abs_bits&0x7fffff)|0x800000;
+	if (exponent<-14)
+	{
+		// Denormal: shift the mantissa, round to nearest even
+		int shift=-exponent-14+13;
+		unsigned int half=mantissa>>shift;
+		unsigned int rest=mantissa&((1u<<shift)-1);
+		unsigned int halfway=1u<<(shift-1);
+		if (rest>halfway || (rest==halfway && (half&1)))
+			half++;
+		return sign|(GLushort)half;
+	}
+
+	// Normal: the carry of the rounding may increase the exponent, which is fine
+	unsigned int half=((unsigned int)(exponent+15)<<10)|((mantissa>>13)&0x3ff);
+	unsigned int rest=mantissa&0x1fff;
+	if (rest>0x1000 || (rest==0x1000 && (half&1)))
+		half++;
+	return sign|(GLushort)half;
+}
+
+static GLshort FloatToSnorm16(float f)
+{
+	f=f<-1.0f ? -1.0f : (f>1.0f ? 1.0f : f);
+	return (GLshort)floorf(f*32767.0f+0.5f);
+}
+
+static GLubyte FloatToUnorm8(float f)
+{
+	f=f<0.0f ? 0.0f : (f>1.0f ? 1.0f : f);
+	return (GLubyte)(f*255.0f+0.5f);
+}
+
+static void EncodeOctahedral(const vec3& n, GLshort e[2])
+// Encode a normal by projecting it onto the octahedron |x|+|y|+|z|=1
+//   and unfolding the lower half onto the corners of the square
+// Zero length normals are encoded as (0, 0, 1)
+{
+	float s=fabsf(n.x)+fabsf(n.y)+fabsf(n.z);
+	float x=0.0f, y=0.0f;
+	if (s>0.0f)
+	{
+		x=n.x/s;
+		y=n.y/s;
+		if (n.z<0.0f)
+		{
+			float fx=(1.0f-fabsf(y))*(x>=0.0f ? 1.0f : -1.0f);
+			float fy=(1.0f-fabsf(x))*(y>=0.0f ? 1.0f : -1.0f);
+			x=fx;
+			y=fy;
+		}
+	}
+	e[0]=FloatToSnorm16(x);
+	e[1]=FloatToSnorm16(y);
+}
+
+// Constant values used for the attributes that a mesh does not store,
+//   indexed by attribute location (0=position, 1=color, 2=normal, 3=texture coordinates)
+// The normal (0, 0, 1) is also the octahedral encoding (0, 0) of itself
+static const GLfloat g_constant_attribs[4][4]={
+	{0.0f, 0.0f, 0.0f, 1.0f},
+	{1.0f, 1.0f, 1.0f, 1.0f},
+	{0.0f, 0.0f, 1.0f, 0.0f},
+	{0.0f, 0.0f, 0.0f, 0.0f},
+};
+
+static int GetAttribSize(int location, int vertex_format)
+// Return the size in bytes of the attribute at 'location' in a vertex format
+{
+	static const int float_sizes[4]={12, 16, 12, 8};
+	if (vertex_format==MESH_VERTEX_FLOAT)
+		return float_sizes[location];
+	if (location==0)
+		return vertex_format==MESH_VERTEX_QUANTIZED ? 8 : 12;
+	return 4;
+}
+
+static void SetAttribPointer(int location, int vertex_format, int stride, size_t offset)
+// Set the format of the attribute at 'location' in the current vertex buffer object
+// Normalized integer attributes are converted to floats in [0, 1] or [-1, 1]
+{
+	static const GLint float_components[4]={3, 4, 3, 2};
+	GLvoid *pointer=(GLvoid *)offset;
+	if (vertex_format==MESH_VERTEX_FLOAT)
+	{
+		glVertexAttribPointer(location, float_components[location], GL_FLOAT, GL_FALSE, 
+			stride, pointer);
+		return;
+	}
+
+	switch (location)
+	{
+	case 0: // Position
+		if (vertex_format==MESH_VERTEX_QUANTIZED)
+			glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, pointer);
+		else
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, pointer);
+		break;
+	case 1: // Color
+		glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, pointer);
+		break;
+	case 2: // Normal, decoded by the vertex shader
+		glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, stride, pointer);
+		break;
+	case 3: // Texture coordinates
+		glVertexAttribPointer(3, 2, GL_HALF_FLOAT, GL_FALSE, stride, pointer);
+		break;
+	}
+}
+
+static void SetArenaVertexFormat(int format, int vertex_size)
+// Set the interleaved attributes of an arena created by CMesh::GetArena
+// format: (in) vertex_format*(MESH_ATTRIB_ALL+1)+vertex_attribs
+{
+	int vertex_format=format/(MESH_ATTRIB_ALL+1);
+	int vertex_attribs=format%(MESH_ATTRIB_ALL+1);
+	size_t offset=0;
+	for (int i=0; i<4; ++i)
+	{
+		if ((vertex_attribs&(1<<i))==0)
+			continue;
+		glEnableVertexAttribArray(i);
+		SetAttribPointer(i, vertex_format, vertex_size, offset);
+		offset+=GetAttribSize(i, vertex_format);
+	}
+}
+
 void CMesh::DivideTriangle(
 	const point2& v0, const point2& v1, const point2& v2, 
 	CMeshVertex *vbuf, int& vcounter, int depth)
@@ -99,16 +250,33 @@ void CMesh::DivideTetra(
 CMesh::CMesh(void)
 {
 	primitive_type=GL_TRIANGLES;
+	primitive_restart=false;
+	grid_index_mode=MESH_GRID_TRIANGLES;
+	vertex_format=MESH_VERTEX_FLOAT;
+	vertex_attribs=MESH_ATTRIB_ALL;
+	separate_streams=false;
+	position_offset=vec3(0.0f, 0.0f, 0.0f);
+	position_scale=vec3(1.0f, 1.0f, 1.0f);
 	num_vertices=0;
 	num_indices=0;
 	vertex_array_obj=0;
 	vertex_buffer_obj=0;
 	index_buffer_obj=0;
+	num_triangles=0;
+	mapped_indices=NULL;
+	bound_center=vec3(0.0f);
+	bound_radius=0.0f;
+	coarser_lod=NULL;
+	lod_levels=1;
+	lod_error=0.0f;
 }
 
 void CMesh::ReleaseGLResources(void)
 // Release OpenGL resources
 {
+	if (arena_block.arena!=NULL)
+		arena_block.arena->Free(arena_block);
+
 	if (vertex_array_obj!=0)
 		glDeleteVertexArrays(1, &vertex_array_obj);
 	vertex_array_obj=0;
@@ -120,62 +288,460 @@ void CMesh::ReleaseGLResources(void)
 	if (index_buffer_obj!=0)
 		glDeleteBuffers(1, &index_buffer_obj);
 	index_buffer_obj=0;
+
+	if (coarser_lod!=NULL)
+	{
+		coarser_lod->ReleaseGLResources();
+		delete coarser_lod;
+	}
+	coarser_lod=NULL;
 }
 
 void CMesh::Draw(void)
 // Draw the mesh
 {
-	glBindVertexArray(vertex_array_obj);
-	if (index_buffer_obj==0)
-		glDrawArrays(primitive_type, 0, num_vertices);
+	// The current values of generic attributes are not part of the vertex array
+	//   object, so set the constants of the missing attributes before each draw
+	for (int i=0; i<4; ++i)
+		if ((vertex_attribs&(1<<i))==0)
+			glVertexAttrib4fv(i, g_constant_attribs[i]);
+
+	// Meshes in an arena with 16-bit indices store MESH_RESTART_INDEX as 0xFFFF
+	if (primitive_restart)
+	{
+		glEnable(GL_PRIMITIVE_RESTART);
+		glPrimitiveRestartIndex(arena_block.arena!=NULL &&
+			arena_block.index_type==GL_UNSIGNED_SHORT ? 0xFFFF : MESH_RESTART_INDEX);
+	}
+
+	if (arena_block.arena!=NULL)
+		arena_block.arena->Draw(arena_block, primitive_type);
 	else
-		glDrawElements(primitive_type, num_indices, 
-			GL_UNSIGNED_INT, (GLvoid *)0);
-	glBindVertexArray(0);
+	{
+		glBindVertexArray(vertex_array_obj);
+		if (index_buffer_obj==0)
+			glDrawArrays(primitive_type, 0, num_vertices);
+		else
+			glDrawElements(primitive_type, num_indices, 
+				GL_UNSIGNED_INT, (GLvoid *)0);
+		glBindVertexArray(0);
+	}
+
+	if (primitive_restart)
+		glDisable(GL_PRIMITIVE_RESTART);
+}
+
+CMesh *CMesh::CreateCoarserLOD(void)
+// Attach a new empty mesh as the next coarser level of detail and return it
+// Returns NULL if lod_levels does not allow another level
+{
+	if (lod_levels<=1)
+		return NULL;
+
+	if (coarser_lod!=NULL)
+	{
+		coarser_lod->ReleaseGLResources();
+		delete coarser_lod;
+	}
+	coarser_lod=new CMesh;
+	coarser_lod->lod_levels=lod_levels-1;
+	coarser_lod->grid_index_mode=grid_index_mode;
+	coarser_lod->vertex_format=vertex_format;
+	coarser_lod->separate_streams=separate_streams;
+	return coarser_lod;
+}
+
+CMesh& CMesh::GetLOD(int level)
+// Return a level of detail, 0 for the mesh itself
+{
+	CMesh *mesh=this;
+	for (; level>0 && mesh->coarser_lod!=NULL; --level)
+		mesh=mesh->coarser_lod;
+	return *mesh;
+}
+
+int CMesh::SelectLOD(const mat4& model_view_matrix, float viewport_scale,
+	float max_pixel_error, int current_lod, float hysteresis) const
+// Return the coarsest level of detail whose error stays within max_pixel_error on the screen
+// model_view_matrix: (in) Matrix from object to eye coordinates
+// viewport_scale: (in) Pixels per unit at distance 1
+// max_pixel_error: (in) Largest allowed error in pixels
+// current_lod: (in) Level of detail drawn in the previous frame
+// hysteresis: (in) Fraction of max_pixel_error for switching to a coarser level
+{
+	if (coarser_lod==NULL)
+		return 0;
+
+	// Bounding sphere in eye coordinates, scaled by the largest scale of the matrix
+	vec4 center=model_view_matrix*vec4(bound_center, 1.0f);
+	float scale=0.0f;
+	for (int j=0; j<3; ++j)
+	{
+		vec3 axis(model_view_matrix[0][j], model_view_matrix[1][j], model_view_matrix[2][j]);
+		if (length(axis)>scale)
+			scale=length(axis);
+	}
+	float distance=length(vec3(center.x, center.y, center.z));
+	float radius=scale*bound_radius;
+
+	// The finest level is drawn when the camera is inside the bounding sphere
+	if (distance<=radius)
+		return 0;
+
+	// Pixels per object unit at the nearest point of the bounding sphere; the
+	//   bounding sphere covers bound_radius*pixels_per_unit pixels on the screen
+	float pixels_per_unit=viewport_scale*scale/(distance-radius);
+
+	// max_level is the coarsest level within max_pixel_error and min_level the coarsest
+	//   one within hysteresis*max_pixel_error; the current level is kept between them
+	int level=0, min_level=0, max_level=0;
+	for (const CMesh *mesh=this; mesh!=NULL; mesh=mesh->coarser_lod, ++level)
+	{
+		float pixel_error=mesh->lod_error*pixels_per_unit;
+		if (pixel_error<=max_pixel_error)
+			max_level=level;
+		if (pixel_error<=hysteresis*max_pixel_error)
+			min_level=level;
+	}
+	if (current_lod<min_level)
+		return min_level;
+	if (current_lod>max_level)
+		return max_level;
+	return current_lod;
+}
+
+int CMesh::GetVertexSize(void) const
+// Return the size of a vertex in bytes, over all streams
+{
+	int size=0;
+	for (int i=0; i<4; ++i)
+		if (vertex_attribs&(1<<i))
+			size+=GetAttribSize(i, vertex_format);
+	return size;
+}
+
+CMeshArena *CMesh::arenas[3][MESH_ATTRIB_ALL+1];
+
+CMeshArena& CMesh::GetArena(int vertex_format, int vertex_attribs)
+// Return the arena of a vertex format and set of attributes, creating it if needed
+// The arenas are never deleted, since that would need an OpenGL context at exit
+{
+	CMeshArena *&arena=arenas[vertex_format][vertex_attribs];
+	if (arena==NULL)
+	{
+		int vertex_size=0;
+		for (int i=0; i<4; ++i)
+			if (vertex_attribs&(1<<i))
+				vertex_size+=GetAttribSize(i, vertex_format);
+		arena=new CMeshArena(vertex_size, SetArenaVertexFormat,
+			vertex_format*(MESH_ATTRIB_ALL+1)+vertex_attribs);
+	}
+	return *arena;
+}
+
+void CMesh::WriteAttrib(
+	int location, const CMeshVertex& v, unsigned char *dst) const
+// Write one attribute of a vertex in the vertex format of the mesh
+// location: (in) Attribute location (0=position, 1=color, 2=normal, 3=texture coordinates)
+// v: (in) Vertex
+// dst: (out) GetAttribSize bytes
+{
+	if (vertex_format==MESH_VERTEX_FLOAT)
+	{
+		switch (location)
+		{
+		case 0: memcpy(dst, &v.pos, 12); break;
+		case 1: memcpy(dst, &v.color, 16); break;
+		case 2: memcpy(dst, &v.normal, 12); break;
+		case 3: memcpy(dst, &v.texcoord, 8); break;
+		}
+		return;
+	}
+
+	switch (location)
+	{
+	case 0:
+		if (vertex_format==MESH_VERTEX_QUANTIZED)
+		{
+			GLushort q[4]={0, 0, 0, 0};
+			for (int i=0; i<3; ++i)
+			{
+				float t=position_scale[i]>0.0f ?
+					(v.pos[i]-position_offset[i])/position_scale[i] : 0.0f;
+				t=t<0.0f ? 0.0f : (t>1.0f ? 1.0f : t);
+				q[i]=(GLushort)(t*65535.0f+0.5f);
+			}
+			memcpy(dst, q, 8);
+		}
+		else
+			memcpy(dst, &v.pos, 12);
+		break;
+	case 1:
+		{
+			GLubyte c[4];
+			for (int i=0; i<4; ++i)
+				c[i]=FloatToUnorm8(v.color[i]);
+			memcpy(dst, c, 4);
+		}
+		break;
+	case 2:
+		{
+			GLshort n[2];
+			EncodeOctahedral(v.normal, n);
+			memcpy(dst, n, 4);
+		}
+		break;
+	case 3:
+		{
+			GLushort h[2]={FloatToHalf(v.texcoord.x), FloatToHalf(v.texcoord.y)};
+			memcpy(dst, h, 4);
+		}
+		break;
+	}
+}
+
+GLuint *CMesh::MapIndexBuffer(int num_triangles, int attribs)
+// Allocate the index range of num_vertices and num_indices in the arena, or create
+//   the index buffer object of a mesh with separate streams, and map it, so that a
+//   generator writes the indices straight into it instead of into an array
+//   that is copied
+// Pass the returned pointer to CreateGLResources, which unmaps the buffer
+// Returns NULL if the buffer cannot be mapped, or if the arena stores the indices
+//   in 16 bits; the indices then go to an array
+// num_triangles: (in) The number of triangles of the indices, which
+//                CreateGLResources cannot count from the mapped memory
+// attribs: (in) The attributes that will be passed to CreateGLResources
+{
+	if (num_indices<=0)
+		return NULL;
+
+	// The generators write 32-bit indices, which the arena narrows for meshes with
+	//   fewer than 65536 vertices when it copies them, so only larger meshes map
+	//   their index range
+	if (!separate_streams)
+	{
+		if (num_vertices<65536)
+			return NULL;
+		CMeshArena& arena=GetArena(vertex_format, attribs);
+		arena.Allocate(arena_block, num_vertices, num_indices);
+		mapped_indices=(GLuint *)arena.MapIndices(arena_block);
+		if (mapped_indices==NULL)
+		{
+			arena.Free(arena_block);
+			return NULL;
+		}
+
+		this->num_triangles=num_triangles;
+		return mapped_indices;
+	}
+
+	// The element array binding belongs to the vertex array object, which does not
+	//   exist yet, so the buffer is filled through the copy write binding
+	// Invalidating the whole buffer lets the driver hand out fresh memory without
+	//   waiting or keeping old contents, and the generator threads write it in order
+	size_t size=sizeof(GLuint)*num_indices;
+	glGenBuffers(1, &index_buffer_obj);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, index_buffer_obj);
+	glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW);
+	mapped_indices=(GLuint *)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size,
+		GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_BUFFER_BIT);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	if (mapped_indices==NULL)
+	{
+		glDeleteBuffers(1, &index_buffer_obj);
+		index_buffer_obj=0;
+		return NULL;
+	}
+
+	this->num_triangles=num_triangles;
+	return mapped_indices;
 }
 
 void CMesh::CreateGLResources(
-	CMeshVertex *vertices, GLuint *indices)
+	CMeshVertex *vertices, GLuint *indices, int attribs)
 // Create OpenGL resources
 // vertices: (in) Vertex array
-// indices: (in) Index array
+// indices: (in) Index array, or the indices returned by MapIndexBuffer
 //          NULL indicates that the mesh does not have an index array
+// attribs: (in) MESH_VERTEX_ATTRIB flags of the attributes set in the vertex array
+// The vertices are converted to the vertex format straight into the mapped
+//   vertex buffer object
 // Input member variables:
-//     num_vertices, num_indices
+//     num_vertices, num_indices, vertex_format, separate_streams
 // Output member variables:
-//     vertex_array_obj, vertex_buffer_obj, index_buffer_obj
+//     arena_block, or vertex_array_obj, vertex_buffer_obj, index_buffer_obj
+//     with separate_streams,
+//     vertex_attribs, position_offset, position_scale,
+//     bound_center, bound_radius, num_triangles
 {
+	vertex_attribs=attribs;
+
+	// Bounding sphere around the center of the bounding box
+	bound_center=vec3(0.0f, 0.0f, 0.0f);
+	bound_radius=0.0f;
+	if (num_vertices>0)
+	{
+		vec3 b_min=vertices[0].pos, b_max=vertices[0].pos;
+		for (int k=1; k<num_vertices; ++k)
+			for (int i=0; i<3; ++i)
+			{
+				if (vertices[k].pos[i]<b_min[i]) b_min[i]=vertices[k].pos[i];
+				if (vertices[k].pos[i]>b_max[i]) b_max[i]=vertices[k].pos[i];
+			}
+		bound_center=0.5f*(b_min+b_max);
+		for (int k=0; k<num_vertices; ++k)
+			if (length(vertices[k].pos-bound_center)>bound_radius)
+				bound_radius=length(vertices[k].pos-bound_center);
+	}
+
+	// Count the triangles; every strip ends with a restart index and has
+	//   2 indices more than triangles
+	// Mapped indices cannot be read back; MapIndexBuffer has set the count
+	bool indices_mapped=indices!=NULL && indices==mapped_indices;
+	if (!indices_mapped)
+	{
+		num_triangles=0;
+		if (primitive_type==GL_TRIANGLES)
+			num_triangles=(indices!=NULL ? num_indices : num_vertices)/3;
+		else if (primitive_type==GL_TRIANGLE_STRIP && indices!=NULL)
+		{
+			num_triangles=num_indices;
+			for (int k=0; k<num_indices; ++k)
+				if (indices[k]==MESH_RESTART_INDEX)
+					num_triangles-=3;
+		}
+	}
+
+	// Quantize positions to the bounding box of the mesh
+	position_offset=vec3(0.0f, 0.0f, 0.0f);
+	position_scale=vec3(1.0f, 1.0f, 1.0f);
+	if (vertex_format==MESH_VERTEX_QUANTIZED && num_vertices>0)
+	{
+		vec3 p_min=vertices[0].pos, p_max=vertices[0].pos;
+		for (int k=1; k<num_vertices; ++k)
+			for (int i=0; i<3; ++i)
+			{
+				if (vertices[k].pos[i]<p_min[i]) p_min[i]=vertices[k].pos[i];
+				if (vertices[k].pos[i]>p_max[i]) p_max[i]=vertices[k].pos[i];
+			}
+		position_offset=p_min;
+		position_scale=p_max-p_min;
+	}
+
+	// Lay out the stored attributes, either interleaved or as one array
+	//   per attribute one after another in the same buffer
+	int vertex_size=GetVertexSize();
+	size_t offsets[4]={0, 0, 0, 0};
+	int strides[4]={0, 0, 0, 0};
+	size_t offset=0;
+	int i;
+	for (i=0; i<4; ++i)
+	{
+		if ((vertex_attribs&(1<<i))==0)
+			continue;
+		int size=GetAttribSize(i, vertex_format);
+		offsets[i]=offset;
+		strides[i]=separate_streams ? size : vertex_size;
+		offset+=separate_streams ? (size_t)size*num_vertices : size;
+	}
+
+	// Each vertex is written whole, so that interleaved vertices fill the
+	//   write-combined memory of a mapped buffer in order
+	auto write_vertices=[&](unsigned char *data)
+	{
+		for (int k=0; k<num_vertices; ++k)
+			for (int location=0; location<4; ++location)
+				if (vertex_attribs&(1<<location))
+					WriteAttrib(location, vertices[k],
+						data+offsets[location]+(size_t)strides[location]*k);
+	};
+
+	// Interleaved meshes go to the ranges of the arena of their layout, which
+	//   MapIndexBuffer may have allocated already
+	size_t vertex_bytes=(size_t)vertex_size*num_vertices;
+	if (!separate_streams)
+	{
+		CMeshArena& arena=GetArena(vertex_format, vertex_attribs);
+		if (!indices_mapped)
+			arena.Allocate(arena_block, num_vertices, indices!=NULL ? num_indices : 0);
+
+		bool vertices_written=vertex_bytes==0;
+		unsigned char *data=(unsigned char *)arena.MapVertices(arena_block);
+		if (data!=NULL)
+		{
+			write_vertices(data);
+			vertices_written=arena.UnmapVertices();
+		}
+		if (!vertices_written)
+		{
+			CScratchScope scratch;
+			data=scratch.Allocate<unsigned char>(vertex_bytes);
+			write_vertices(data);
+			arena.UploadVertices(arena_block, data);
+		}
+
+		if (indices_mapped)
+		{
+			if (!arena.UnmapIndices())
+				printf("index buffer contents lost while mapped\n");
+			mapped_indices=NULL;
+		}
+		else if (indices!=NULL)
+			arena.UploadIndices(arena_block, indices);
+		return;
+	}
+
 	// Create the vertex array object
 	glGenVertexArrays(1, &vertex_array_obj);
 	glBindVertexArray(vertex_array_obj);
 
-	// Create the vertex buffer object
+	// Create the vertex buffer object and convert the vertices into its memory
 	glGenBuffers(1, &vertex_buffer_obj);
 	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_obj);
-	glBufferData(GL_ARRAY_BUFFER, 
-		sizeof(CMeshVertex)*num_vertices,
-		vertices, GL_STATIC_DRAW);
-
-	// Enable vertex attribute arrays and
-	//   set their data and formats in the vertex buffer object
-	glEnableVertexAttribArray(0); // 0=position
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 
-		sizeof(CMeshVertex), (GLvoid *)offsetof(CMeshVertex, pos));
-
-	glEnableVertexAttribArray(1); // 1=color
-	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 
-		sizeof(CMeshVertex), (GLvoid *)offsetof(CMeshVertex, color));
+	glBufferData(GL_ARRAY_BUFFER, vertex_bytes, NULL, GL_STATIC_DRAW);
+	bool vertices_written=vertex_bytes==0;
+	if (!vertices_written)
+	{
+		unsigned char *data=(unsigned char *)glMapBufferRange(GL_ARRAY_BUFFER,
+			0, vertex_bytes, GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (data!=NULL)
+		{
+			write_vertices(data);
+			vertices_written=glUnmapBuffer(GL_ARRAY_BUFFER)==GL_TRUE;
+		}
+	}
 
-	glEnableVertexAttribArray(2); // 2=normal
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 
-		sizeof(CMeshVertex), (GLvoid *)offsetof(CMeshVertex, normal));
+	// If the buffer cannot be mapped or lost its contents while it was mapped,
+	//   convert the vertices into an array and copy it
+	if (!vertices_written)
+	{
+		CScratchScope scratch;
+		unsigned char *data=scratch.Allocate<unsigned char>(vertex_bytes);
+		write_vertices(data);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, vertex_bytes, data);
+	}
 
-	glEnableVertexAttribArray(3); // 3=texture coordinates
-	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 
-		sizeof(CMeshVertex), (GLvoid *)offsetof(CMeshVertex, texcoord));
+	// Enable the vertex attribute arrays that are stored and
+	//   set their data and formats in the vertex buffer object
+	// 0=position, 1=color, 2=normal, 3=texture coordinates
+	for (i=0; i<4; ++i)
+	{
+		if ((vertex_attribs&(1<<i))==0)
+			continue;
+		glEnableVertexAttribArray(i);
+		SetAttribPointer(i, vertex_format, strides[i], offsets[i]);
+	}
 
-	// Create the index buffer object if necessary
-	if (indices!=NULL)
+	// Attach the index buffer object that MapIndexBuffer created, or create one
+	//   if necessary
+	if (indices_mapped)
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_obj);
+		if (glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER)==GL_FALSE)
+			printf("index buffer contents lost while mapped\n");
+		mapped_indices=NULL;
+	}
+	else if (indices!=NULL)
 	{
 		glGenBuffers(1, &index_buffer_obj);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_obj);
@@ -199,7 +765,8 @@ void CMesh::CreateGasket2D(
 	int i;
 	for (i=0; i<=subdivision_depth; ++i)
 		num_vertices*=3;
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
 
 	i=0;
 	DivideTriangle(
@@ -209,9 +776,8 @@ void CMesh::CreateGasket2D(
 		vertices, 
 		i, subdivision_depth);
 
-	CreateGLResources(vertices);
-
-	delete [] vertices;
+	CreateGLResources(vertices, NULL,
+		MESH_ATTRIB_POSITION|MESH_ATTRIB_COLOR);
 }
 
 void CMesh::CreateGasket3D(
@@ -221,11 +787,26 @@ void CMesh::CreateGasket3D(
 // tetra_vertices:    (in) Tetrahedron vertices
 // subdivision_depth: (in) Maximum recursive subdivision depth
 {
+	// Coarser levels of detail subdivide one level less
+	CMesh *lod=subdivision_depth>0 ? CreateCoarserLOD() : NULL;
+	if (lod!=NULL)
+		lod->CreateGasket3D(tetra_vertices, subdivision_depth-1);
+
 	num_vertices=3;
 	int i;
 	for (i=0; i<=subdivision_depth; ++i)
 		num_vertices*=4;
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
+
+	// The smallest tetrahedra are the error; each is within its circumradius
+	//   of the gasket, sqrt(6)/4 of its edge length
+	float edge=0.0f;
+	for (i=0; i<4; ++i)
+		for (int j=i+1; j<4; ++j)
+			if (length(tetra_vertices[i]-tetra_vertices[j])>edge)
+				edge=length(tetra_vertices[i]-tetra_vertices[j]);
+	lod_error=0.61237f*edge/(1<<subdivision_depth);
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
 
 	i=0;
 	DivideTetra(
@@ -236,9 +817,8 @@ void CMesh::CreateGasket3D(
 		vertices, 
 		i, subdivision_depth);
 
-	CreateGLResources(vertices);
-
-	delete [] vertices;
+	CreateGLResources(vertices, NULL,
+		MESH_ATTRIB_POSITION|MESH_ATTRIB_COLOR|MESH_ATTRIB_NORMAL);
 }
 
 void CMesh::CreateCube(float size, float ntex)
@@ -288,8 +868,9 @@ void CMesh::CreateCube(float size, float ntex)
 	num_indices=36;
 
 	// Allocate memory for vertices and indices
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
-	GLuint *indices=new GLuint [num_indices];
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint *indices=scratch.Allocate<GLuint>(num_indices);
 
 	// Loop through all 6 faces
 	int i, k;
@@ -323,11 +904,8 @@ void CMesh::CreateCube(float size, float ntex)
 	}
 
 	// Create OpenGL resources
-	CreateGLResources(vertices, indices);
-
-	// Free memory
-	delete [] vertices;
-	delete [] indices;
+	CreateGLResources(vertices, indices,
+		MESH_ATTRIB_POSITION|MESH_ATTRIB_NORMAL);
 }
 void CMesh::CreateBlock(float sx, float sy, float sz,
 	float tex_nx, float tex_ny, float tex_nz)
@@ -385,8 +963,9 @@ void CMesh::CreateBlock(float sx, float sy, float sz,
 	num_indices = 36;
 
 	// Allocate memory for vertices and indices
-	CMeshVertex* vertices = new CMeshVertex[num_vertices];
-	GLuint* indices = new GLuint[num_indices];
+	CScratchScope scratch;
+	CMeshVertex* vertices = scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint* indices = scratch.Allocate<GLuint>(num_indices);
 
 	// Loop through all 6 faces
 	int i, k;
@@ -428,152 +1007,530 @@ void CMesh::CreateBlock(float sx, float sy, float sz,
 	}
 
 	// Create OpenGL resources
-	CreateGLResources(vertices, indices);
-
-	// Free memory
-	delete[] vertices;
-	delete[] indices;
+	CreateGLResources(vertices, indices,
+		MESH_ATTRIB_POSITION|MESH_ATTRIB_NORMAL|MESH_ATTRIB_TEXCOORD);
 }
 
-void CMesh::CreateRect(
-	float sx, float sy, int nx, int ny, float tex_nx, float tex_ny)
-// Create a rectangle
-// sx, sy: (in) Rectangle sizes in x, y directions
-// nx, ny: (in) The numbers of subdivisions in x, y directions
-// tex_nx, tex_ny: (in) Texture coordinate multipliers in x, y directions
+// Attributes of the grid primitives, which have no vertex colors
+static const int g_grid_attribs=MESH_ATTRIB_POSITION|MESH_ATTRIB_NORMAL|MESH_ATTRIB_TEXCOORD;
+
+// Parametric surfaces
+// A surface is a grid of (nx+1)*(ny+1) vertices generated row by row by a
+//   surface class S that provides
+//     void BeginRow(int j): set up the values shared by the vertices of row j
+//     void Evaluate(int i, CMeshVertex& v) const: set vertex i of the current row
+// GenerateGridVertices is instantiated for each surface class, so the calls are inlined
+// Surfaces of revolution read cos and sin of theta from a ring table that is
+//   computed once and shared by all rows
+// Rows are split across threads; every vertex and index is computed exactly as in
+//   a serial loop, so the result does not depend on the number of threads
+
+template <class F>
+static void ParallelForRows(int num_rows, int row_size, int num_threads, F f)
+// Call f(j_begin, j_end) on consecutive row ranges covering rows 0..num_rows-1
+// num_rows: (in) The number of rows
+// row_size: (in) The number of items in a row, used to skip threads for small grids
+// num_threads: (in) The number of threads, 0 for the number of hardware threads
 {
-	//õ
-	ifstream read_honolulu_file("../models/honolulu.txt", ios::in);
-	if (!read_honolulu_file)
+	if (num_threads<=0)
+		num_threads=(int)std::thread::hardware_concurrency();
+	if ((double)num_rows*row_size<65536.0) // Not worth starting threads
+		num_threads=1;
+	if (num_threads>num_rows)
+		num_threads=num_rows;
+	if (num_threads<=1)
 	{
-		printf("fail to open file 'honolulu.txt'.\n");
-		exit(1);
+		f(0, num_rows);
+		return;
 	}
-	int data;
-	read_honolulu_file >> data;		//ǰλǿߣڴʱֶָ˱ûʹ
-	read_honolulu_file >> data;
 
-	float dx=sx/nx;
-	float dy=sy/ny;
-	float sx_h=0.5f*sx;
-	float sy_h=0.5f*sy;
+	// The calling thread takes the first range
+	std::vector<std::thread> threads;
+	for (int t=1; t<num_threads; ++t)
+		threads.push_back(std::thread(f,
+			(int)((long long)num_rows*t/num_threads),
+			(int)((long long)num_rows*(t+1)/num_threads)));
+	f(0, (int)((long long)num_rows/num_threads));
+	for (size_t t=0; t<threads.size(); ++t)
+		threads[t].join();
+}
 
-	// Set the number of vertices and indices
-	num_vertices=(nx+1)*(ny+1);
-	num_indices=6*nx*ny;
+template <class S>
+static void GenerateGridVertices(
+	const S& surface, int nx, int ny, CMeshVertex *vertices, int num_threads)
+// Generate the vertices of a grid
+// surface: (in) Surface
+// nx, ny: (in) The numbers of subdivisions in x (slice) and y (stack) directions
+// vertices: (out) (nx+1)*(ny+1) vertices, row by row
+// num_threads: (in) The number of threads, 0 for the number of hardware threads
+{
+	ParallelForRows(ny+1, nx+1, num_threads, [&](int j_begin, int j_end)
+	{
+		S row_surface=surface; // Each thread has its own row state
+		for (int j=j_begin; j<j_end; ++j)
+		{
+			row_surface.BeginRow(j);
+			CMeshVertex *row=vertices+j*(nx+1);
+			for (int i=0; i<=nx; ++i)
+				row_surface.Evaluate(i, row[i]);
+		}
+	});
+}
 
-	// Allocate memory for vertices and indices
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
-	GLuint *indices=new GLuint [num_indices];
+static int GetGridIndexCount(int nx, int ny, int index_mode)
+// Return the number of indices of a grid
+// nx, ny: (in) The numbers of subdivisions in x and y directions
+// index_mode: (in) MESH_GRID_INDEX_MODE
+{
+	if (index_mode==MESH_GRID_STRIPS)
+		return ny*(2*(nx+1)+1);
+	return 6*nx*ny;
+}
 
-	// Set vertices
-	int i, j, k;
-	for (j=0, k=0; j<=ny; ++j) // Loop through all rows in y direction
+static void GenerateGridIndices(
+	int nx, int ny, GLuint first_vertex, bool reverse, int index_mode,
+	GLuint *indices, int num_threads)
+// Generate the indices of a grid
+// For MESH_GRID_TRIANGLES, each sub rectangle is subdivided into two triangles
+//   in checkerboard fashion
+// For MESH_GRID_STRIPS, each row is a triangle strip that zigzags between the
+//   two rows of vertices and ends with MESH_RESTART_INDEX; all diagonals of
+//   a strip go the same way
+// nx, ny: (in) The numbers of subdivisions in x and y directions
+// first_vertex: (in) Index of the first vertex of the grid
+// reverse: (in) Reverse the orientation of the triangles
+// index_mode: (in) MESH_GRID_INDEX_MODE
+// indices: (out) GetGridIndexCount(nx, ny, index_mode) indices
+// num_threads: (in) The number of threads, 0 for the number of hardware threads
+{
+	if (index_mode==MESH_GRID_STRIPS)
 	{
-		float y=-sy_h+dy*j;
-		float texcoord_t=(float)j/(float)ny*tex_ny;
-		for (i=0; i<=nx; ++i, ++k) // Loop through all columns in x direction
+		// Starting on the upper row makes the first triangle counterclockwise
+		int first=reverse ? 0 : nx+1, second=reverse ? nx+1 : 0;
+		ParallelForRows(ny, 2*nx, num_threads, [&](int j_begin, int j_end)
 		{
-			// Set vertex position
-			float x=-sx_h+dx*i;
-			vertices[k].pos.x=x;
-			vertices[k].pos.y=y;
-
-			read_honolulu_file >> data;
-			vertices[k].pos.z = data* 3.5f;
+			int k=(2*(nx+1)+1)*j_begin;
+			for (int j=j_begin; j<j_end; ++j)
+			{
+				GLuint ibase=first_vertex+j*(nx+1);
+				for (int i=0; i<=nx; ++i)
+				{
+					indices[k++]=ibase+i+first;
+					indices[k++]=ibase+i+second;
+				}
+				indices[k++]=MESH_RESTART_INDEX;
+			}
+		});
+		return;
+	}
 
-			// Set vertex normal
-			vertices[k].normal=vec3(0.0f, 0.0f, 0.0f);
+	int a=reverse ? 2 : 1, b=reverse ? 1 : 2; // Swapped for reverse orientation
+	ParallelForRows(ny, 6*nx, num_threads, [&](int j_begin, int j_end)
+	{
+		int iv[4];
+		int k=6*nx*j_begin;
+		for (int j=j_begin; j<j_end; ++j) // Loop through all rows in y direction
+		{
+			GLuint ibase=first_vertex+j*(nx+1);
+			for (int i=0; i<nx; ++i) // Loop through all columns in x direction
+			{
+				// Calculate indices of the 4 vertices of current sub rectangle
+				iv[0]=ibase+i;
+				iv[1]=iv[0]+1;
+				iv[3]=iv[0]+nx+1;
+				iv[2]=iv[3]+1;
+
+				GLuint tri[6];
+				if (i%2==j%2)
+				{
+					tri[0]=iv[0]; tri[1]=iv[1]; tri[2]=iv[2];
+					tri[3]=iv[0]; tri[4]=iv[2]; tri[5]=iv[3];
+				}
+				else
+				{
+					tri[0]=iv[0]; tri[1]=iv[1]; tri[2]=iv[3];
+					tri[3]=iv[1]; tri[4]=iv[2]; tri[5]=iv[3];
+				}
+				indices[k++]=tri[0];
+				indices[k++]=tri[a];
+				indices[k++]=tri[b];
+				indices[k++]=tri[3];
+				indices[k++]=tri[3+a];
+				indices[k++]=tri[3+b];
+			}
+		}
+	});
+}
 
-			// Set vertex texture coordinates
-			vertices[k].texcoord.x=(float)i/(float)nx*tex_nx;
-			vertices[k].texcoord.y=texcoord_t;
+// Ring table of cos and sin of theta=dtheta*i for i=0..num_slices
+class CSinCosRing
+{
+public:
+	float *c, *s;
 
-			// Set vertex color
-			vertices[k].color=vec4(1.0f, 1.0f, 1.0f, 1.0f);
+	CSinCosRing(int num_slices)
+	{
+		c=new float [2*(num_slices+1)];
+		s=c+num_slices+1;
+		float dtheta=(M_PI+M_PI)/num_slices;
+		for (int i=0; i<=num_slices; ++i)
+		{
+			float theta=dtheta*i;
+			c[i]=cos(theta);
+			s[i]=sin(theta);
 		}
 	}
 
-	// Set indices
+	~CSinCosRing(void)
+	{
+		delete [] c;
+	}
+};
+
+// Height field over a rectangle in the xy plane
+class CRectSurface
+{
+public:
+	float sx_h, sy_h, dx, dy;
+	int nx, ny;
+	float tex_nx, tex_ny;
+	const int *heights; // (nx+1)*(ny+1) heights, NULL for a flat rectangle
+	float y, texcoord_t;
+	const int *row_heights;
+
+	void BeginRow(int j)
+	{
+		y=-sy_h+dy*j;
+		texcoord_t=(float)j/(float)ny*tex_ny;
+		row_heights=heights!=NULL ? heights+j*(nx+1) : NULL;
+	}
+
+	void Evaluate(int i, CMeshVertex& v) const
+	{
+		v.pos.x=-sx_h+dx*i;
+		v.pos.y=y;
+		v.pos.z=row_heights!=NULL ? row_heights[i]*3.5f : 0.0f;
+		v.normal=vec3(0.0f, 0.0f, 0.0f);
+		v.texcoord.x=(float)i/(float)nx*tex_nx;
+		v.texcoord.y=texcoord_t;
+		v.color=vec4(1.0f, 1.0f, 1.0f, 1.0f);
+	}
+};
+
+class CSphereSurface
+{
+public:
+	float radius, dphi;
+	int num_slices, num_stacks;
+	float tex_ntheta, tex_nphi;
+	const CSinCosRing *ring;
+	float cphi, sphi, texcoord_t;
+
+	void BeginRow(int j)
+	{
+		float phi=-0.5*M_PI+dphi*j;
+		cphi=cos(phi);
+		sphi=sin(phi);
+		texcoord_t=(float)j/(float)num_stacks*tex_nphi;
+	}
+
+	void Evaluate(int i, CMeshVertex& v) const
+	{
+		v.normal.x=cphi*ring->c[i];
+		v.normal.y=cphi*ring->s[i];
+		v.normal.z=sphi;
+		v.pos=radius*v.normal;
+		v.texcoord.x=(float)i/(float)num_slices*tex_ntheta;
+		v.texcoord.y=texcoord_t;
+		v.color=vec4(1.0f, 1.0f, 1.0f, 1.0f);
+	}
+};
+
+// Side of a cone with its base on the xy plane
+class CConeSideSurface
+{
+public:
+	float radius, h, dh;
+	int num_slices, num_stacks;
+	float tex_ntheta, tex_nh;
+	const CSinCosRing *ring;
+	float z, r, texcoord_t;
+
+	void BeginRow(int j)
+	{
+		z=j*dh;
+		r=radius*(1-z/h);
+		texcoord_t=(float)j/(float)num_stacks*tex_nh;
+	}
+
+	void Evaluate(int i, CMeshVertex& v) const
+	{
+		v.pos.x=r*ring->c[i];
+		v.pos.y=r*ring->s[i];
+		v.pos.z=z;
+		v.normal=vec3(v.pos.x, v.pos.y, 0.0f)/radius*radius;
+		v.texcoord.x=(float)i/(float)num_slices*tex_ntheta;
+		v.texcoord.y=texcoord_t;
+		v.color=vec4(1.0f, 1.0f, 1.0f, 1.0f);
+	}
+};
+
+// Side of a cylinder with its bottom on the xy plane
+// The texture coordinates address the side part of the texture atlas
+class CCylinderSideSurface
+{
+public:
+	float radius, dh;
+	int num_slices, num_stacks;
+	float tex_ntheta, tex_nh;
+	const CSinCosRing *ring;
+	float z, texcoord_t;
+
+	void BeginRow(int j)
+	{
+		z=j*dh;
+		texcoord_t=(float)(j)/num_stacks*tex_nh*(630.0f/2048);
+	}
+
+	void Evaluate(int i, CMeshVertex& v) const
+	{
+		v.pos.x=radius*ring->c[i];
+		v.pos.y=radius*ring->s[i];
+		v.pos.z=z;
+		v.normal=vec3(v.pos.x, v.pos.y, 0.0f)/radius*radius;
+		v.texcoord.x=(float)i/num_slices*tex_ntheta;
+		v.texcoord.y=texcoord_t;
+		v.color=vec4(1.0f, 1.0f, 1.0f, 1.0f);
+	}
+};
+
+// Disc in the plane z with rings from the rim (j=0) to the center (j=num_rings)
+// With atlas_texcoord the texture coordinates address the disc part of the
+//   cylinder texture atlas, otherwise they are polar
+class CDiscSurface
+{
+public:
+	float radius, z, dr;
+	vec3 normal;
+	int num_slices, num_rings;
+	float tex_ntheta, tex_nh;
+	bool atlas_texcoord;
+	const CSinCosRing *ring;
+	float r, texcoord_t;
+
+	void BeginRow(int j)
+	{
+		r=radius-dr*j;
+		texcoord_t=(float)j/(float)num_rings*tex_nh;
+	}
+
+	void Evaluate(int i, CMeshVertex& v) const
+	{
+		v.pos.x=r*ring->c[i];
+		v.pos.y=r*ring->s[i];
+		v.pos.z=z;
+		v.normal=normal;
+		if (atlas_texcoord)
+		{
+			v.texcoord.x=tex_ntheta*(334.0f/2048)+ring->s[i]*tex_ntheta*(334.0f/2048)*(r/radius);
+			v.texcoord.y=tex_nh*(1670.0f/2048)-ring->c[i]*tex_nh*(334.0f/2048)*(r/radius);
+		}
+		else
+		{
+			v.texcoord.x=(float)i/(float)num_slices*tex_ntheta;
+			v.texcoord.y=texcoord_t;
+		}
+		v.color=vec4(1.0f, 1.0f, 1.0f, 1.0f);
+	}
+};
+
+static vec3 AddRectTriangleNormals(
+	const CMeshVertex *vertices, int nx, int i, int j, int corner, vec3 N)
+// Add the normals of the triangles of sub rectangle (i, j) that contain one of its corners
+// vertices: (in) Vertices of the rectangle with positions set
+// nx: (in) The number of subdivisions in x direction
+// i, j: (in) Sub rectangle
+// corner: (in) Corner index, as iv[] in GenerateGridIndices
+// N: (in) Sum of the normals so far
+{
 	int iv[4];
-	for (j=0, k=0; j<ny; ++j) // Loop through all rows in y direction
+	iv[0]=j*(nx+1)+i;
+	iv[1]=iv[0]+1;
+	iv[3]=iv[0]+nx+1;
+	iv[2]=iv[3]+1;
+	if (i%2==j%2)
 	{
-		int ibase=j*(nx+1);
-		for (i=0; i<nx; ++i) // Loop through all columns in x direction
+		if (corner!=3)
 		{
-			// Calculate indices of the 4 vertices of current sub rectangle
-			iv[0]=ibase+i;
-			iv[1]=iv[0]+1;
-			iv[3]=iv[0]+nx+1;
-			iv[2]=iv[3]+1;
-
-			//ָͨμÿεƽ
-			int single_triangle_iv[3];
-			// Subdivide current sub rectangle into two triangles
-			//   in checkerboard fashion and set vertex indices of the two triangles
-			if (i%2==j%2)
-			{
-				indices[k++]=iv[0];
-				indices[k++]=iv[1];
-				indices[k++]=iv[2];
-				indices[k++]=iv[0];
-				indices[k++]=iv[2];
-				indices[k++]=iv[3];
-
-				//÷
-				vec3 a1 = vertices[iv[0]].pos - vertices[iv[1]].pos;
-				vec3 b1 = vertices[iv[2]].pos - vertices[iv[1]].pos;
-				vec3 n1 = cross(a1, b1);
-				vertices[iv[0]].normal = vertices[iv[0]].normal + n1;
-				vertices[iv[1]].normal = vertices[iv[1]].normal + n1;
-				vertices[iv[2]].normal = vertices[iv[2]].normal + n1;
-				vec3 a2 = vertices[iv[2]].pos - vertices[iv[0]].pos;
-				vec3 b2 = vertices[iv[3]].pos - vertices[iv[0]].pos;
-				vec3 n2 = cross(a2, b2);
-				vertices[iv[2]].normal = vertices[iv[2]].normal + n2;
-				vertices[iv[0]].normal = vertices[iv[0]].normal + n2;
-				vertices[iv[3]].normal = vertices[iv[3]].normal + n2;
-			}
-			else
+			vec3 a1 = vertices[iv[0]].pos - vertices[iv[1]].pos;
+			vec3 b1 = vertices[iv[2]].pos - vertices[iv[1]].pos;
+			N = N + cross(a1, b1);
+		}
+		if (corner!=1)
+		{
+			vec3 a2 = vertices[iv[2]].pos - vertices[iv[0]].pos;
+			vec3 b2 = vertices[iv[3]].pos - vertices[iv[0]].pos;
+			N = N + cross(a2, b2);
+		}
+	}
+	else
+	{
+		if (corner!=2)
+		{
+			vec3 a1 = vertices[iv[1]].pos - vertices[iv[0]].pos;
+			vec3 b1 = vertices[iv[3]].pos - vertices[iv[0]].pos;
+			N = N + cross(a1, b1);
+		}
+		if (corner!=0)
+		{
+			vec3 a2 = vertices[iv[1]].pos - vertices[iv[3]].pos;
+			vec3 b2 = vertices[iv[2]].pos - vertices[iv[3]].pos;
+			N = N + cross(a2, b2);
+		}
+	}
+	return N;
+}
+
+void CMesh::SetGridPrimitiveType(void)
+// Set primitive_type and primitive_restart for grid_index_mode
+{
+	primitive_type=grid_index_mode==MESH_GRID_STRIPS ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+	primitive_restart=grid_index_mode==MESH_GRID_STRIPS;
+}
+
+void CMesh::GenerateRect(
+	float sx, float sy, int nx, int ny, float tex_nx, float tex_ny,
+	const int *heights, CMeshVertex *vertices, GLuint *indices,
+	int& num_vertices, int& num_indices, int index_mode, int num_threads)
+// Generate a rectangle
+// sx, sy: (in) Rectangle sizes in x, y directions
+// nx, ny: (in) The numbers of subdivisions in x, y directions
+// tex_nx, tex_ny: (in) Texture coordinate multipliers in x, y directions
+// heights: (in) (nx+1)*(ny+1) vertex heights, NULL for a flat rectangle
+// vertices, indices: (out) Vertex and index arrays, not written if NULL
+// num_vertices, num_indices: (out) The numbers of vertices and indices
+// index_mode: (in) MESH_GRID_INDEX_MODE of the indices
+// num_threads: (in) The number of threads, 0 for the number of hardware threads
+{
+	num_vertices=(nx+1)*(ny+1);
+	num_indices=GetGridIndexCount(nx, ny, index_mode);
+	if (vertices==NULL || indices==NULL)
+		return;
+
+	CRectSurface surface;
+	surface.sx_h=0.5f*sx;
+	surface.sy_h=0.5f*sy;
+	surface.dx=sx/nx;
+	surface.dy=sy/ny;
+	surface.nx=nx;
+	surface.ny=ny;
+	surface.tex_nx=tex_nx;
+	surface.tex_ny=tex_ny;
+	surface.heights=heights;
+	GenerateGridVertices(surface, nx, ny, vertices, num_threads);
+	GenerateGridIndices(nx, ny, 0, false, index_mode, indices, num_threads);
+
+	//ָͨμÿεƽ
+	// Each vertex gathers the normals of the triangles around it in the order
+	//   of a serial loop over the sub rectangles, so rows can be done in parallel
+	ParallelForRows(ny+1, nx+1, num_threads, [&](int j_begin, int j_end)
+	{
+		for (int j=j_begin; j<j_end; ++j)
+			for (int i=0; i<=nx; ++i)
 			{
-				indices[k++]=iv[0];
-				indices[k++]=iv[1];
-				indices[k++]=iv[3];
-				indices[k++]=iv[1];
-				indices[k++]=iv[2];
-				indices[k++]=iv[3];
-
-				//÷
-				vec3 a1 = vertices[iv[1]].pos - vertices[iv[0]].pos;
-				vec3 b1 = vertices[iv[3]].pos - vertices[iv[0]].pos;
-				vec3 n1 = cross(a1, b1);
-				vertices[iv[0]].normal = vertices[iv[0]].normal + n1;
-				vertices[iv[1]].normal = vertices[iv[1]].normal + n1;
-				vertices[iv[3]].normal = vertices[iv[3]].normal + n1;
-				vec3 a2 = vertices[iv[1]].pos - vertices[iv[3]].pos;
-				vec3 b2 = vertices[iv[2]].pos - vertices[iv[3]].pos;
-				vec3 n2 = cross(a2, b2);
-				vertices[iv[1]].normal = vertices[iv[1]].normal + n2;
-				vertices[iv[2]].normal = vertices[iv[2]].normal + n2;
-				vertices[iv[3]].normal = vertices[iv[3]].normal + n2;
+				vec3 N=vec3(0.0f, 0.0f, 0.0f);
+				if (j>0 && i>0)  N=AddRectTriangleNormals(vertices, nx, i-1, j-1, 2, N);
+				if (j>0 && i<nx) N=AddRectTriangleNormals(vertices, nx, i, j-1, 3, N);
+				if (j<ny && i>0) N=AddRectTriangleNormals(vertices, nx, i-1, j, 1, N);
+				if (j<ny && i<nx) N=AddRectTriangleNormals(vertices, nx, i, j, 0, N);
+				vertices[j*(nx+1)+i].normal=N/8.0;
 			}
-		}
+	});
+}
+
+void CMesh::CreateRect(
+	float sx, float sy, int nx, int ny, float tex_nx, float tex_ny, int num_threads)
+// Create a rectangle
+// sx, sy: (in) Rectangle sizes in x, y directions
+// nx, ny: (in) The numbers of subdivisions in x, y directions
+// tex_nx, tex_ny: (in) Texture coordinate multipliers in x, y directions
+// num_threads: (in) The number of threads, 0 for the number of hardware threads
+{
+	//õ
+	ifstream read_honolulu_file("../models/honolulu.txt", ios::in);
+	if (!read_honolulu_file)
+	{
+		printf("fail to open file 'honolulu.txt'.\n");
+		exit(1);
 	}
-	for (int k = 0; k < num_vertices; k++)
+	int data;
+	read_honolulu_file >> data;		//ǰλǿߣڴʱֶָ˱ûʹ
+	read_honolulu_file >> data;
+
+	CScratchScope scratch;
+	int *heights=scratch.Allocate<int>((nx+1)*(ny+1));
+	for (int k=0; k<(nx+1)*(ny+1); ++k)
 	{
-		vertices[k].normal = vertices[k].normal / 8.0;
+		read_honolulu_file >> data;
+		heights[k]=data;
 	}
+
+	// Set the number of vertices and indices
+	GenerateRect(sx, sy, nx, ny, tex_nx, tex_ny, NULL, NULL, NULL,
+		num_vertices, num_indices, grid_index_mode);
+
+	// Allocate memory for vertices and generate the indices straight into
+	//   the index buffer object, or into an array if it cannot be mapped
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint *indices=MapIndexBuffer(2*nx*ny, g_grid_attribs);
+	if (indices==NULL)
+		indices=scratch.Allocate<GLuint>(num_indices);
+
+	GenerateRect(sx, sy, nx, ny, tex_nx, tex_ny, heights, vertices, indices,
+		num_vertices, num_indices, grid_index_mode, num_threads);
+
 	// Create OpenGL resources
-	CreateGLResources(vertices, indices);
+	SetGridPrimitiveType();
+	CreateGLResources(vertices, indices, g_grid_attribs);
+}
 
-	// Free memory
-	delete [] vertices;
-	delete [] indices;
+void CMesh::GenerateSphere(
+	float radius, int num_slices, int num_stacks,
+	float tex_ntheta, float tex_nphi,
+	CMeshVertex *vertices, GLuint *indices,
+	int& num_vertices, int& num_indices, int index_mode, int num_threads)
+// Generate a sphere
+// radius: (in) Sphere radius
+// num_slices: (in) The number of subdivisions in theta direction
+// num_stacks: (in) The number of subdivisions in phi direction
+// tex_ntheta: (in) Texture coordinate multiplier in theta direction
+// tex_nphi:   (in) Texture coordinate multiplier in phi direction
+// vertices, indices: (out) Vertex and index arrays, not written if NULL
+// num_vertices, num_indices: (out) The numbers of vertices and indices
+// index_mode: (in) MESH_GRID_INDEX_MODE of the indices
+// num_threads: (in) The number of threads, 0 for the number of hardware threads
+{
+	num_vertices=(num_slices+1)*(num_stacks+1);
+	num_indices=GetGridIndexCount(num_slices, num_stacks, index_mode);
+	if (vertices==NULL || indices==NULL)
+		return;
+
+	CSinCosRing ring(num_slices);
+	CSphereSurface surface;
+	surface.radius=radius;
+	surface.dphi=M_PI/num_stacks;
+	surface.num_slices=num_slices;
+	surface.num_stacks=num_stacks;
+	surface.tex_ntheta=tex_ntheta;
+	surface.tex_nphi=tex_nphi;
+	surface.ring=&ring;
+	GenerateGridVertices(surface, num_slices, num_stacks, vertices, num_threads);
+	GenerateGridIndices(num_slices, num_stacks, 0, false, index_mode, indices, num_threads);
 }
 
 void CMesh::CreateSphere(
 	float radius, int num_slices, int num_stacks,
-	float tex_ntheta, float tex_nphi)
+	float tex_ntheta, float tex_nphi, int num_threads)
 // Create a sphere
 // radius: (in) Sphere radius
 // num_slices: (in) The number of subdivisions in theta direction
@@ -581,90 +1538,32 @@ void CMesh::CreateSphere(
 // tex_ntheta: (in) Texture coordinate multiplier in theta direction
 // tex_nphi:   (in) Texture coordinate multiplier in phi direction
 {
-	float dtheta=(M_PI+M_PI)/num_slices;
-	float dphi=M_PI/num_stacks;
+	// Coarser levels of detail halve the subdivisions
+	CMesh *lod=num_slices>=8 && num_stacks>=4 ? CreateCoarserLOD() : NULL;
+	if (lod!=NULL)
+		lod->CreateSphere(radius, num_slices/2, num_stacks/2, tex_ntheta, tex_nphi, num_threads);
 
-	// Set the number of vertices and indices
-	num_vertices=(num_slices+1)*(num_stacks+1);
-	num_indices=6*num_slices*num_stacks;
+	// Distance from the center of a sub rectangle to the sphere
+	lod_error=radius*(1.0f-cosf(M_PI/num_slices)*cosf(0.5f*M_PI/num_stacks));
 
-	// Allocate memory for vertices and indices
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
-	GLuint *indices=new GLuint [num_indices];
-
-	// Set vertices
-	int i, j, k;
-	for (j=0, k=0; j<=num_stacks; ++j) // Loop through all rows in phi direction
-	{
-		float phi = -0.5 * M_PI + dphi * j;
-		float cphi = cos(phi);
-		float sphi = sin(phi);
-		float texcoord_t = (float)j / (float)num_stacks * tex_nphi;
-		for (i=0; i<=num_slices; ++i, ++k) // Loop through all columns in theta direction
-		{
-			float theta=dtheta*i;
-			float ctheta=cos(theta);
-			float stheta=sin(theta);
-
-			// Set vertex normal
-			vertices[k].normal.x = cphi * ctheta;
-			vertices[k].normal.y = cphi * stheta;
-			vertices[k].normal.z = sphi;
-
-			// Set vertex position
-			vertices[k].pos = radius * vertices[k].normal;
-
-			// Set vertex texture coordinates
-			vertices[k].texcoord.x = (float)i / (float)num_slices * tex_ntheta;
-			vertices[k].texcoord.y = texcoord_t;
+	// Set the number of vertices and indices
+	GenerateSphere(radius, num_slices, num_stacks, tex_ntheta, tex_nphi,
+		NULL, NULL, num_vertices, num_indices, grid_index_mode);
 
-			// Set vertex color
-			vertices[k].color = vec4(1.0f, 1.0f, 1.0f, 1.0f);
-		}
-	}
+	// Allocate memory for vertices and generate the indices straight into
+	//   the index buffer object, or into an array if it cannot be mapped
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint *indices=MapIndexBuffer(2*num_slices*num_stacks, g_grid_attribs);
+	if (indices==NULL)
+		indices=scratch.Allocate<GLuint>(num_indices);
 
-	// Set indices
-	int iv[4];
-	for (j=0, k=0; j<num_stacks; ++j) // Loop through all rows in phi direction
-	{
-		int ibase=j*(num_slices+1);
-		for (i=0; i<num_slices; ++i) // Loop through all columns in theta direction
-		{
-			// Calculate indices of the 4 vertices of current sub rectangle in parametric space
-			iv[0]=ibase+i;
-			iv[1]=iv[0]+1;
-			iv[3]=iv[0]+num_slices+1;
-			iv[2]=iv[3]+1;
-
-			// Subdivide current sub rectangle in parametric space into two triangles
-			//   in checkerboard fashion and set vertex indices of the two triangles
-			if (i%2==j%2)
-			{
-				indices[k++]=iv[0];
-				indices[k++]=iv[1];
-				indices[k++]=iv[2];
-				indices[k++]=iv[0];
-				indices[k++]=iv[2];
-				indices[k++]=iv[3];
-			}
-			else
-			{
-				indices[k++]=iv[0];
-				indices[k++]=iv[1];
-				indices[k++]=iv[3];
-				indices[k++]=iv[1];
-				indices[k++]=iv[2];
-				indices[k++]=iv[3];
-			}
-		}
-	}
+	GenerateSphere(radius, num_slices, num_stacks, tex_ntheta, tex_nphi,
+		vertices, indices, num_vertices, num_indices, grid_index_mode, num_threads);
 
 	// Create OpenGL resources
-	CreateGLResources(vertices, indices);
-
-	// Free memory
-	delete [] vertices;
-	delete [] indices;
+	SetGridPrimitiveType();
+	CreateGLResources(vertices, indices, g_grid_attribs);
 }
 
 void CMesh::CreateAxes(float sx, float sy, float sz)
@@ -694,324 +1593,242 @@ void CMesh::CreateAxes(float sx, float sy, float sz)
 	vertices[5].pos=vec3(0.0f, 0.0f, sz);
 	vertices[5].color=vcolors[2];
 
-	CreateGLResources(vertices, NULL);
+	CreateGLResources(vertices, NULL,
+		MESH_ATTRIB_POSITION|MESH_ATTRIB_COLOR);
 }
 
-void CMesh::CreateCone(float radius, float h, int num_slices, int num_stacks, int num_rings, float tex_ntheta, float tex_nh)
+void CMesh::GenerateCone(
+	float radius, float h, int num_slices, int num_stacks, int num_rings,
+	float tex_ntheta, float tex_nh,
+	CMeshVertex *vertices, GLuint *indices,
+	int& num_vertices, int& num_indices, int index_mode, int num_threads)
+// Generate a cone
+// radius, h: (in) Base radius and height
+// num_slices, num_stacks, num_rings: (in) The numbers of subdivisions around the axis,
+//     along the side and across the base
+// tex_ntheta, tex_nh: (in) Texture coordinate multipliers
+// vertices, indices: (out) Vertex and index arrays, not written if NULL
+// num_vertices, num_indices: (out) The numbers of vertices and indices
+// index_mode: (in) MESH_GRID_INDEX_MODE of the indices
+// num_threads: (in) The number of threads, 0 for the number of hardware threads
 {
-	//printf("-----------------------------------------------------------------------------------------------\n");
-	//printf("Բ׶");
-	float dtheta = (M_PI + M_PI) / num_slices;
-	float dh = h / num_stacks;
-
 	int num_curve_vertices = (num_slices + 1) * (num_stacks + 1);	//׶涥
 	int num_bottom_vertices = (num_slices + 1) * (num_rings + 1);	//涥(ΪͳһԲϵĵ㽫ظʹ2Σ⿪Сҷ)
 	num_vertices = num_curve_vertices + num_bottom_vertices;	//׶涥 + 涥
-	num_indices = 6 * num_slices * num_stacks + 6 * num_slices * num_rings;	//׶涥+ 涥
-
-	CMeshVertex* vertices = new CMeshVertex[num_vertices];
-	GLuint* indices = new GLuint[num_indices];
-
-	//׶涥ϸ--
-	int i, j, k;
-	for (j = 0, k = 0; j <= num_stacks; j++)
-	{
-		float z = j * dh;
-		for (i = 0; i <= num_slices; i++, k++)
-		{
-			float theta = dtheta * i;
-			float ctheta = cos(theta);
-			float stheta = sin(theta);
-			float texcoord_t = (float)j / (float)num_stacks * tex_nh;
-
-			vertices[k].pos.x = radius * (1 - z / h) * ctheta;
-			vertices[k].pos.y = radius * (1 - z / h) * stheta;
-			vertices[k].pos.z = z;
-
-			// ÷
-			vertices[k].normal = vec3(vertices[k].pos.x, vertices[k].pos.y, 0.0f) / radius * radius;
-
-			// 
-			vertices[k].texcoord.x = (float)i / (float)num_slices * tex_ntheta;
-			vertices[k].texcoord.y = texcoord_t;
-
-			vertices[k].color = vec4(1.0f, 1.0f, 1.0f, 1.0f);
-			//printf("%d(%f,%f,%f)\n", k,vertices[k].pos.x, vertices[k].pos.y, vertices[k].pos.z);
-		}
-	}
-	//printf("-----------------------------------------------------------------------------------------------\n");
-	//׶
-	int iv[4];
-	for (j = 0, k = 0; j < num_stacks; ++j)
-	{
-		int ibase = j * (num_slices + 1);
-		for (i = 0; i < num_slices; ++i)
-		{
-			iv[0] = ibase + i;
-			iv[1] = iv[0] + 1;
-			iv[3] = iv[0] + num_slices + 1;
-			iv[2] = iv[3] + 1;
-			//printf("%d(iv[0]:%d,iv[1]:%d,iv[2]:%d,iv[3]:%d,)\n", k / 6, iv[0], iv[1], iv[2], iv[3]);
-			if (i % 2 == j % 2)
-			{
-				indices[k++] = iv[0];
-				indices[k++] = iv[1];
-				indices[k++] = iv[2];
-				indices[k++] = iv[0];
-				indices[k++] = iv[2];
-				indices[k++] = iv[3];
-			}
-			else
-			{
-				indices[k++] = iv[0];
-				indices[k++] = iv[1];
-				indices[k++] = iv[3];
-				indices[k++] = iv[1];
-				indices[k++] = iv[2];
-				indices[k++] = iv[3];
-			}
-		}
-	}
-	//printf("-----------------------------------------------------------------------------------------------\n");
-	//涥ϸ--
-	for (j = 0, k = num_curve_vertices; j <= num_rings; j++)
-	{
-		float dr = radius / num_rings;	//뾶΢Ԫ
-		float texcoord_t = (float)j / (float)num_rings * tex_nh;
-		for (i = 0; i <= num_slices; i++, k++)
-		{
-			float theta = dtheta * i;
-			float ctheta = cos(theta);
-			float stheta = sin(theta);
+	int num_curve_indices = GetGridIndexCount(num_slices, num_stacks, index_mode);	//׶涥
+	num_indices = num_curve_indices + GetGridIndexCount(num_slices, num_rings, index_mode);	//׶涥+ 涥
+	if (vertices == NULL || indices == NULL)
+		return;
+
+	CSinCosRing ring(num_slices);
+
+	//׶
+	CConeSideSurface side;
+	side.radius = radius;
+	side.h = h;
+	side.dh = h / num_stacks;
+	side.num_slices = num_slices;
+	side.num_stacks = num_stacks;
+	side.tex_ntheta = tex_ntheta;
+	side.tex_nh = tex_nh;
+	side.ring = &ring;
+	GenerateGridVertices(side, num_slices, num_stacks, vertices, num_threads);
+	GenerateGridIndices(num_slices, num_stacks, 0, false, index_mode, indices, num_threads);
+
+	//棬עֶΪӵײǱ
+	CDiscSurface bottom;
+	bottom.radius = radius;
+	bottom.z = 0.0f;
+	bottom.dr = radius / num_rings;
+	bottom.normal = vec3(0.0f, 0.0f, -1.0f);
+	bottom.num_slices = num_slices;
+	bottom.num_rings = num_rings;
+	bottom.tex_ntheta = tex_ntheta;
+	bottom.tex_nh = tex_nh;
+	bottom.atlas_texcoord = false;
+	bottom.ring = &ring;
+	GenerateGridVertices(bottom, num_slices, num_rings, vertices + num_curve_vertices, num_threads);
+	GenerateGridIndices(num_slices, num_rings, num_curve_vertices, true, index_mode,
+		indices + num_curve_indices, num_threads);
+}
 
-			// ÷
-			vertices[k].normal = vec3(0.0f, 0.0f, -1.0f);
+void CMesh::CreateCone(float radius, float h, int num_slices, int num_stacks, int num_rings, float tex_ntheta, float tex_nh, int num_threads)
+{
+	// Coarser levels of detail halve the subdivisions
+	CMesh *lod=num_slices>=8 ? CreateCoarserLOD() : NULL;
+	if (lod!=NULL)
+		lod->CreateCone(radius, h, num_slices/2, num_stacks>1 ? num_stacks/2 : 1,
+			num_rings>1 ? num_rings/2 : 1, tex_ntheta, tex_nh, num_threads);
 
-			// 
-			vertices[k].texcoord.x = (float)i / (float)num_slices * tex_ntheta;
-			vertices[k].texcoord.y = texcoord_t;
+	// Distance from the middle of an edge of the base polygon to the circle
+	lod_error=radius*(1.0f-cosf(M_PI/num_slices));
 
-			vertices[k].pos.x = (radius - dr * j) * ctheta;
-			vertices[k].pos.y = (radius - dr * j) * stheta;
-			vertices[k].pos.z = 0;
+	GenerateCone(radius, h, num_slices, num_stacks, num_rings, tex_ntheta, tex_nh,
+		NULL, NULL, num_vertices, num_indices, grid_index_mode);
 
-			vertices[k].color = vec4(1.0f, 1.0f, 1.0f, 1.0f);
-			//printf("%d(%f,%f,%f)\n", k,vertices[k].pos.x, vertices[k].pos.y, vertices[k].pos.z);
-		}
-	}
-	//printf("-----------------------------------------------------------------------------------------------\n");
-	//㣬עֶΪӵײǱ
-	for (j = 0, k = 6 * num_slices * num_stacks; j < num_rings; ++j)
-	{
-		int ibase = j * (num_slices + 1);
-		for (i = 0; i < num_slices; ++i)
-		{
-			iv[0] = ibase + i + num_curve_vertices;
-			iv[1] = iv[0] + 1;
-			iv[3] = iv[0] + num_slices + 1;
-			iv[2] = iv[3] + 1;
-			//printf("%d(iv[0]:%d,iv[1]:%d,iv[2]:%d,iv[3]:%d,)\n", k / 6, iv[0] - num_curve_vertices, iv[1]- num_curve_vertices, iv[2]- num_curve_vertices, iv[3]- num_curve_vertices);
-			if (i % 2 == j % 2)
-			{
-				indices[k++] = iv[0];
-				indices[k++] = iv[2];
-				indices[k++] = iv[1];
-				indices[k++] = iv[0];
-				indices[k++] = iv[3];
-				indices[k++] = iv[2];
-			}
-			else
-			{
-				indices[k++] = iv[0];
-				indices[k++] = iv[3];
-				indices[k++] = iv[1];
-				indices[k++] = iv[1];
-				indices[k++] = iv[3];
-				indices[k++] = iv[2];
-			}
-		}
-	}
-	//printf("**********(k:%d,num_vertices:%d,num_indices:%d)***************\n",k, num_vertices, num_indices);
+	CScratchScope scratch;
+	CMeshVertex* vertices = scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint* indices = MapIndexBuffer(2 * num_slices * (num_stacks + num_rings), g_grid_attribs);
+	if (indices == NULL)
+		indices = scratch.Allocate<GLuint>(num_indices);
 
-	CreateGLResources(vertices, indices);
+	GenerateCone(radius, h, num_slices, num_stacks, num_rings, tex_ntheta, tex_nh,
+		vertices, indices, num_vertices, num_indices, grid_index_mode, num_threads);
 
-	delete[] vertices;
-	delete[] indices;
+	SetGridPrimitiveType();
+	CreateGLResources(vertices, indices, g_grid_attribs);
 }
-void CMesh::CreateCylinder(float radius, float h, int num_slices, int num_stacks, int num_rings, float tex_ntheta, float tex_nh)
-{
-	//printf("-----------------------------------------------------------------------------------------------\n");
-	//printf("Բ");
-	float dtheta = (M_PI + M_PI) / num_slices;
-	float dh = h / num_stacks;
 
+void CMesh::GenerateCylinder(
+	float radius, float h, int num_slices, int num_stacks, int num_rings,
+	float tex_ntheta, float tex_nh,
+	CMeshVertex *vertices, GLuint *indices,
+	int& num_vertices, int& num_indices, int index_mode, int num_threads)
+// Generate a cylinder
+// radius, h: (in) Radius and height
+// num_slices, num_stacks, num_rings: (in) The numbers of subdivisions around the axis,
+//     along the side and across the top and bottom
+// tex_ntheta, tex_nh: (in) Texture coordinate multipliers
+// vertices, indices: (out) Vertex and index arrays, not written if NULL
+// num_vertices, num_indices: (out) The numbers of vertices and indices
+// index_mode: (in) MESH_GRID_INDEX_MODE of the indices
+// num_threads: (in) The number of threads, 0 for the number of hardware threads
+{
 	int num_curve_vertices = (num_slices + 1) * (num_stacks + 1);		//׶涥
 	int num_beside_curve_vertices = 2 * (num_slices + 1) * (num_rings + 1);	//ϵµ
 	num_vertices = num_curve_vertices + num_beside_curve_vertices;	//׶涥 + 涥ȦĶǹ㣩
-	num_indices = 6 * num_slices * num_stacks + 2 * 6 * num_slices * num_rings;	//׶涥+ 涥
+	int num_curve_indices = GetGridIndexCount(num_slices, num_stacks, index_mode);	//涥
+	num_indices = num_curve_indices + 2 * GetGridIndexCount(num_slices, num_rings, index_mode);	//涥+ 涥
+	if (vertices == NULL || indices == NULL)
+		return;
+
+	CSinCosRing ring(num_slices);
+
+	//Բ
+	CCylinderSideSurface side;
+	side.radius = radius;
+	side.dh = h / num_stacks;
+	side.num_slices = num_slices;
+	side.num_stacks = num_stacks;
+	side.tex_ntheta = tex_ntheta;
+	side.tex_nh = tex_nh;
+	side.ring = &ring;
+	GenerateGridVertices(side, num_slices, num_stacks, vertices, num_threads);
+	GenerateGridIndices(num_slices, num_stacks, 0, false, index_mode, indices, num_threads);
+
+	//µ棬µ棬ϵ
+	//ϵֶµֶΪӵײǱ
+	int topside_vertices_offset = num_beside_curve_vertices / 2;
+	int topside_indices_offset = GetGridIndexCount(num_slices, num_rings, index_mode);
+	CDiscSurface cap;
+	cap.radius = radius;
+	cap.dr = radius / num_rings;
+	cap.num_slices = num_slices;
+	cap.num_rings = num_rings;
+	cap.tex_ntheta = tex_ntheta;
+	cap.tex_nh = tex_nh;
+	cap.atlas_texcoord = true;
+	cap.ring = &ring;
+
+	cap.z = 0.0f;
+	cap.normal = vec3(0.0f, 0.0f, -1.0f);	//µ淨
+	GenerateGridVertices(cap, num_slices, num_rings, vertices + num_curve_vertices, num_threads);
+	GenerateGridIndices(num_slices, num_rings, num_curve_vertices, true, index_mode,
+		indices + num_curve_indices, num_threads);
+
+	cap.z = h;
+	cap.normal = vec3(0.0f, 0.0f, 1.0f);	//ϵ淨
+	GenerateGridVertices(cap, num_slices, num_rings,
+		vertices + num_curve_vertices + topside_vertices_offset, num_threads);
+	GenerateGridIndices(num_slices, num_rings, num_curve_vertices + topside_vertices_offset, false, index_mode,
+		indices + num_curve_indices + topside_indices_offset, num_threads);
+}
 
-	CMeshVertex* vertices = new CMeshVertex[num_vertices];
-	GLuint* indices = new GLuint[num_indices];
+void CMesh::CreateCylinder(float radius, float h, int num_slices, int num_stacks, int num_rings, float tex_ntheta, float tex_nh, int num_threads)
+{
+	// Coarser levels of detail halve the subdivisions
+	CMesh *lod=num_slices>=8 ? CreateCoarserLOD() : NULL;
+	if (lod!=NULL)
+		lod->CreateCylinder(radius, h, num_slices/2, num_stacks>1 ? num_stacks/2 : 1,
+			num_rings>1 ? num_rings/2 : 1, tex_ntheta, tex_nh, num_threads);
 
-	//Բϸ--
-	int i, j, k;
-	for (j = 0, k = 0; j <= num_stacks; j++)
-	{
-		float z = j * dh;
-		float texcoord_t = (float)(j) / num_stacks * tex_nh * (630.0f / 2048);
-		for (i = 0; i <= num_slices; i++, k++)
-		{
-			float theta = dtheta * i;
-			float ctheta = cos(theta);
-			float stheta = sin(theta);
+	// Distance from the middle of an edge of the base polygon to the circle
+	lod_error=radius*(1.0f-cosf(M_PI/num_slices));
 
-			vertices[k].pos.x = radius * ctheta;
-			vertices[k].pos.y = radius * stheta;
-			vertices[k].pos.z = z;
+	GenerateCylinder(radius, h, num_slices, num_stacks, num_rings, tex_ntheta, tex_nh,
+		NULL, NULL, num_vertices, num_indices, grid_index_mode);
 
-			// ÷
-			vertices[k].normal = vec3(vertices[k].pos.x, vertices[k].pos.y, 0.0f) / radius * radius;	//
+	CScratchScope scratch;
+	CMeshVertex* vertices = scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint* indices = MapIndexBuffer(2 * num_slices * (num_stacks + 2 * num_rings), g_grid_attribs);
+	if (indices == NULL)
+		indices = scratch.Allocate<GLuint>(num_indices);
 
-			//
-			vertices[k].texcoord.x = (float)i / num_slices * tex_ntheta;
-			vertices[k].texcoord.y = texcoord_t;
+	GenerateCylinder(radius, h, num_slices, num_stacks, num_rings, tex_ntheta, tex_nh,
+		vertices, indices, num_vertices, num_indices, grid_index_mode, num_threads);
 
-			vertices[k].color = vec4(1.0f, 1.0f, 1.0f, 1.0f);
-			//printf("%d(%f,%f,%f)\n", k, vertices[k].pos.x, vertices[k].pos.y, vertices[k].pos.z);
+	SetGridPrimitiveType();
+	CreateGLResources(vertices, indices, g_grid_attribs);
+}
 
-		}
-	}
-	//printf("-----------------------------------------------------------------------------------------------\n");
-	//Բ--
-	int iv[4];
-	for (j = 0, k = 0; j < num_stacks; ++j)
-	{
-		int ibase = j * (num_slices + 1);
-		for (i = 0; i < num_slices; ++i)
-		{
-			iv[0] = ibase + i;
-			iv[1] = iv[0] + 1;
-			iv[3] = iv[0] + num_slices + 1;
-			iv[2] = iv[3] + 1;
-			//printf("%d(iv[0]:%d,iv[1]:%d,iv[2]:%d,iv[3]:%d,)\n", k / 6, iv[0], iv[1], iv[2], iv[3]);
-			if (i % 2 == j % 2)
-			{
-				indices[k++] = iv[0];
-				indices[k++] = iv[1];
-				indices[k++] = iv[2];
-				indices[k++] = iv[0];
-				indices[k++] = iv[2];
-				indices[k++] = iv[3];
-			}
-			else
-			{
-				indices[k++] = iv[0];
-				indices[k++] = iv[1];
-				indices[k++] = iv[3];
-				indices[k++] = iv[1];
-				indices[k++] = iv[2];
-				indices[k++] = iv[3];
-			}
-		}
-	}
-	//printf("-----------------------------------------------------------------------------------------------\n");
-	//µ涥ϸ--
-	//(num_curve_vertices)-(num_curve_vertices + num_bottom_vertices/2)µ棬
-	//(num_curve_vertices + num_bottom_vertices/2)-(num_curve_vertices + num_bottom_vertices)ϵ棬
-	int topside_vertices_offset = num_beside_curve_vertices / 2;
-	for (j = 0, k = num_curve_vertices; j <= num_rings; j++)
+void CMesh::BenchmarkGenerators(int grid_size, int num_threads)
+// Time the vertex and index generation of the parametric primitives and print
+//   the rate at which they are written, with one thread and with num_threads
+// grid_size: (in) The number of slices and stacks of each primitive
+// num_threads: (in) The number of threads, 0 for the number of hardware threads
+{
+	struct
 	{
-		float dr = radius / num_rings;
-		for (i = 0; i <= num_slices; i++, k++)
-		{
-			float theta = dtheta * i;
-			float ctheta = cos(theta);
-			float stheta = sin(theta);
-
-			vertices[k].pos.x = (radius - dr * j) * ctheta;			//µĶ
-			vertices[k].pos.y = (radius - dr * j) * stheta;
-			vertices[k].pos.z = 0;
-			vertices[k].color = vec4(1.0f, 1.0f, 1.0f, 1.0f);
-
-			// ÷
-			vertices[k].normal = vec3(0.0f, 0.0f, -1.0f);	//µ淨
-			vertices[k + topside_vertices_offset].normal = vec3(0.0f, 0.0f, 1.0f);	//ϵ淨
-
-			vertices[k + topside_vertices_offset].pos.x = vertices[k].pos.x;		//ϵĶ㣬ֱµĶƽ h λ
-			vertices[k + topside_vertices_offset].pos.y = vertices[k].pos.y;
-			vertices[k + topside_vertices_offset].pos.z = h;
-			vertices[k + topside_vertices_offset].color = vec4(1.0f, 1.0f, 1.0f, 1.0f);
-
-			// 
-			vertices[k].texcoord.x = tex_ntheta * (334.0f / 2048) + (float)sin(theta) * tex_ntheta * (334.0f / 2048) * ((radius - dr * j) / radius);		//ϵ
-			vertices[k].texcoord.y = tex_nh * (1670.0f / 2048) - (float)cos(theta) * tex_nh * (334.0f / 2048) * ((radius - dr * j) / radius);
-			vertices[k + topside_vertices_offset].texcoord.x = tex_ntheta * (334.0f / 2048) + (float)sin(theta) * tex_ntheta * (334.0f / 2048) * ((radius - dr * j)/radius);	//µ,ͼƬ
-			vertices[k + topside_vertices_offset].texcoord.y = tex_nh * (1670.0f / 2048) - (float)cos(theta) * tex_nh * (334.0f / 2048) * ((radius - dr * j) / radius);
-			//printf("%d(%f,%f,%f)%f\n", k + topside_vertices_offset, vertices[k].pos.x, vertices[k].pos.y, vertices[k].pos.z,dr);
-			//printf("off%d(%f,%f,%f)%f\n", k + topside_vertices_offset, vertices[k + topside_vertices_offset].pos.x, vertices[k + topside_vertices_offset].pos.y, vertices[k + topside_vertices_offset].pos.z,dr);
+		const char *name;
+		int kind;
+	} primitives[4]={
+		{"rect", 0}, {"sphere", 1}, {"cone", 2}, {"cylinder", 3}
+	};
 
-		}
-	}
-	//printf("-----------------------------------------------------------------------------------------------\n");
-	//㣬ϵֶµֶΪӵײǱ
-	int topside_indices_offset = 6 * num_slices * num_rings;
-	for (j = 0, k = 6 * num_slices * num_stacks; j < num_rings; ++j)
+	if (num_threads<=0)
+		num_threads=(int)std::thread::hardware_concurrency();
+	if (num_threads<1)
+		num_threads=1;
+
+	int n=grid_size, num_rings=grid_size/4;
+	for (int p=0; p<4; ++p)
 	{
-		int ibase = j * (num_slices + 1);
-		for (i = 0; i < num_slices; ++i)
-		{
-			iv[0] = ibase + i + num_curve_vertices;		//ibaseֵҪ涥ƫ
-			iv[1] = iv[0] + 1;
-			iv[3] = iv[0] + num_slices + 1;
-			iv[2] = iv[3] + 1;
-			//printf("%d(iv[0]:%d,iv[1]:%d,iv[2]:%d,iv[3]:%d,)\n", k / 6, iv[0] - num_curve_vertices, iv[1] - num_curve_vertices, iv[2] - num_curve_vertices, iv[3] - num_curve_vertices);
-			if (i % 2 == j % 2)
+		CScratchScope scratch;
+		int nv=0, ni=0;
+		CMeshVertex *vertices=NULL;
+		GLuint *indices=NULL;
+		double best[2]={1e30, 1e30};
+
+		// The first run only counts and the second one faults the memory in,
+		//   so take the best of the remaining runs
+		for (int run=0; run<5; ++run)
+			for (int m=0; m<2; ++m)
 			{
-				indices[k + topside_indices_offset] = iv[0] + topside_vertices_offset;		//ϵƫĵһдͬ
-				indices[k++] = iv[0];	//µֵڶͬ
-
-				indices[k + topside_indices_offset] = iv[1] + topside_vertices_offset;
-				indices[k++] = iv[2];
-
-				indices[k + topside_indices_offset] = iv[2] + topside_vertices_offset;
-				indices[k++] = iv[1];
-
-				indices[k + topside_indices_offset] = iv[0] + topside_vertices_offset;
-				indices[k++] = iv[0];
-
-				indices[k + topside_indices_offset] = iv[2] + topside_vertices_offset;
-				indices[k++] = iv[3];
-
-				indices[k + topside_indices_offset] = iv[3] + topside_vertices_offset;
-				indices[k++] = iv[2];
+				int threads=m==0 ? 1 : num_threads;
+				std::chrono::steady_clock::time_point t0=std::chrono::steady_clock::now();
+				switch (primitives[p].kind)
+				{
+				case 0: GenerateRect(100.0f, 100.0f, n, n, 1.0f, 1.0f, NULL, vertices, indices, nv, ni, MESH_GRID_TRIANGLES, threads); break;
+				case 1: GenerateSphere(1.0f, n, n, 1.0f, 1.0f, vertices, indices, nv, ni, MESH_GRID_TRIANGLES, threads); break;
+				case 2: GenerateCone(1.0f, 1.0f, n, n, num_rings, 1.0f, 1.0f, vertices, indices, nv, ni, MESH_GRID_TRIANGLES, threads); break;
+				case 3: GenerateCylinder(1.0f, 1.0f, n, n, num_rings, 1.0f, 1.0f, vertices, indices, nv, ni, MESH_GRID_TRIANGLES, threads); break;
+				}
+				double t=std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+
+				if (vertices==NULL)
+				{
+					vertices=scratch.Allocate<CMeshVertex>(nv);
+					indices=scratch.Allocate<GLuint>(ni);
+				}
+				else if (run>=2 && t<best[m])
+					best[m]=t;
 			}
-			else
-			{
-				indices[k + topside_indices_offset] = iv[0] + topside_vertices_offset;		//ϵƫĵһдͬ
-				indices[k++] = iv[0];	////µֵڶͬ
-
-				indices[k + topside_indices_offset] = iv[1] + topside_vertices_offset;
-				indices[k++] = iv[3];
-
-				indices[k + topside_indices_offset] = iv[3] + topside_vertices_offset;
-				indices[k++] = iv[1];
-
-				indices[k + topside_indices_offset] = iv[1] + topside_vertices_offset;
-				indices[k++] = iv[1];
-
-				indices[k + topside_indices_offset] = iv[2] + topside_vertices_offset;
-				indices[k++] = iv[3];
 
-				indices[k + topside_indices_offset] = iv[3] + topside_vertices_offset;
-				indices[k++] = iv[2];
-			}
-		}
+		double bytes=(double)nv*sizeof(CMeshVertex)+(double)ni*sizeof(GLuint);
+		for (int m=0; m<2; ++m)
+			printf("%-8s %2d thread(s) %9d vertices %10d indices %8.2f ms %6.2f GB/s %6.2f ns/vertex\n",
+				primitives[p].name, m==0 ? 1 : num_threads, nv, ni,
+				best[m]*1e3, bytes/best[m]*1e-9, best[m]*1e9/nv);
+		printf("%-8s speedup %.2fx\n", primitives[p].name, best[0]/best[1]);
 	}
-	//printf("**********(k:%d,num_vertices:%d,num_indices:%d)***************\n", k, num_vertices, num_indices);
-
-	CreateGLResources(vertices, indices);
-
-	delete[] vertices;
-	delete[] indices;
-
-}
\ No newline at end of file
+}
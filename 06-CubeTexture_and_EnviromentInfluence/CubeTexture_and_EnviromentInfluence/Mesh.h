@@ -4,6 +4,7 @@
 #include "GL/glew.h"
 #include "vec.h"
 #include "Camera.h"
+#include "MeshArena.h"
 // Mesh vertex
 class CMeshVertex
 {
@@ -14,6 +15,38 @@ public:
 	vec2 texcoord; // Texture coordinates
 };
 
+// Vertex formats in the vertex buffer object
+enum MESH_VERTEX_FORMAT
+{
+	MESH_VERTEX_FLOAT=0,  // CMeshVertex as is, 48 bytes
+	MESH_VERTEX_PACKED,   // Float position, RGBA8 color, octahedral 2x16-bit normal,
+	                      //   half float texture coordinates, 24 bytes
+	MESH_VERTEX_QUANTIZED // MESH_VERTEX_PACKED with 16-bit positions relative to
+	                      //   the mesh bounds, 20 bytes
+};
+
+// Vertex attributes; bit i is the attribute at location i
+// Attributes that a mesh does not store are replaced by constants when drawing
+enum MESH_VERTEX_ATTRIB
+{
+	MESH_ATTRIB_POSITION=1,
+	MESH_ATTRIB_COLOR=2,    // Constant white if missing
+	MESH_ATTRIB_NORMAL=4,   // Constant (0, 0, 1) if missing
+	MESH_ATTRIB_TEXCOORD=8, // Constant (0, 0) if missing
+	MESH_ATTRIB_ALL=15
+};
+
+// Index layouts of the grid primitives (rectangle, sphere, cone and cylinder)
+enum MESH_GRID_INDEX_MODE
+{
+	MESH_GRID_TRIANGLES=0, // Triangle list, 6 indices per sub rectangle
+	MESH_GRID_STRIPS       // One triangle strip per row ended by MESH_RESTART_INDEX,
+	                       //   2 indices per sub rectangle plus 3 per row
+};
+
+// Primitive restart index of meshes drawn with primitive_restart
+#define MESH_RESTART_INDEX 0xFFFFFFFF
+
 // Mesh
 class CMesh
 {
@@ -37,36 +70,153 @@ protected:
 	// vcounter: (in and out) Vertex counter
 	// depth: (in) Recursion depth
 
+	void WriteAttrib(
+		int location, const CMeshVertex& v, unsigned char *dst) const;
+	// Write one attribute of a vertex in the vertex format of the mesh
+	// location: (in) Attribute location (0=position, 1=color, 2=normal, 3=texture coordinates)
+	// v: (in) Vertex
+	// dst: (out) Attribute data
+
+	static void GenerateRect(
+		float sx, float sy, int nx, int ny, float tex_nx, float tex_ny,
+		const int *heights, CMeshVertex *vertices, GLuint *indices,
+		int& num_vertices, int& num_indices,
+		int index_mode=MESH_GRID_TRIANGLES, int num_threads=0);
+	static void GenerateSphere(
+		float radius, int num_slices, int num_stacks,
+		float tex_ntheta, float tex_nphi,
+		CMeshVertex *vertices, GLuint *indices,
+		int& num_vertices, int& num_indices,
+		int index_mode=MESH_GRID_TRIANGLES, int num_threads=0);
+	static void GenerateCone(
+		float radius, float h, int num_slices, int num_stacks, int num_rings,
+		float tex_ntheta, float tex_nh,
+		CMeshVertex *vertices, GLuint *indices,
+		int& num_vertices, int& num_indices,
+		int index_mode=MESH_GRID_TRIANGLES, int num_threads=0);
+	static void GenerateCylinder(
+		float radius, float h, int num_slices, int num_stacks, int num_rings,
+		float tex_ntheta, float tex_nh,
+		CMeshVertex *vertices, GLuint *indices,
+		int& num_vertices, int& num_indices,
+		int index_mode=MESH_GRID_TRIANGLES, int num_threads=0);
+	// Generate the vertices and indices of the parametric primitives
+	// The parameters are those of the corresponding Create functions, plus
+	// heights: (in) Vertex heights of the rectangle, NULL for a flat rectangle
+	// vertices, indices: (out) Vertex and index arrays, not written if NULL
+	// num_vertices, num_indices: (out) The numbers of vertices and indices
+	// index_mode: (in) MESH_GRID_INDEX_MODE of the indices
+	// num_threads: (in) The number of threads, 0 for the number of hardware threads
+	// The output does not depend on the number of threads
+
+	void SetGridPrimitiveType(void);
+	// Set primitive_type and primitive_restart for grid_index_mode
+
+	GLuint *MapIndexBuffer(int num_triangles, int attribs=MESH_ATTRIB_ALL);
+	// Allocate the index range of num_vertices and num_indices in the arena, or create
+	//   the index buffer object of a mesh with separate streams, and map it, so that a
+	//   generator writes the indices straight into it instead of into an array
+	//   that is copied
+	// Pass the returned pointer to CreateGLResources, which unmaps the buffer
+	// Returns NULL if the buffer cannot be mapped, or if the arena stores the indices
+	//   in 16 bits; the indices then go to an array
+	// num_triangles: (in) The number of triangles of the indices, which
+	//                CreateGLResources cannot count from the mapped memory
+	// attribs: (in) The attributes that will be passed to CreateGLResources
+
 	void CreateGLResources(
 		CMeshVertex *vertices,
-		GLuint *indices=NULL);	void CreateGLResources2(
+		GLuint *indices=NULL,
+		int attribs=MESH_ATTRIB_ALL);	void CreateGLResources2(
 		CMeshVertex *vertices,
 		GLuint *indices=NULL);
 	// Create OpenGL resources
 	// vertices: (in) Vertex array
-	// indices: (in) Index array
+	// indices: (in) Index array, or the indices returned by MapIndexBuffer
 	//          NULL indicates that the mesh does not have an index array
+	// attribs: (in) MESH_VERTEX_ATTRIB flags of the attributes set in the vertex array
+	// The vertices are converted to the vertex format straight into the mapped
+	//   vertex buffer object
 	// Input member variables:
-	//     num_vertices, num_indices
+	//     num_vertices, num_indices, vertex_format, separate_streams
 	// Output member variables:
-	//     vertex_array_obj, vertex_buffer_obj, index_buffer_obj
+	//     arena_block, or vertex_array_obj, vertex_buffer_obj, index_buffer_obj
+	//     with separate_streams,
+	//     vertex_attribs, position_offset, position_scale,
+	//     bound_center, bound_radius, num_triangles
+
+	int num_triangles; // The number of triangles drawn by Draw
+	GLuint *mapped_indices; // Indices mapped by MapIndexBuffer, NULL if none
 
 public:
-	GLuint vertex_array_obj;  // OpenGL vertex array object
-	GLuint vertex_buffer_obj; // OpenGL vertex buffer object
-	GLuint index_buffer_obj;  // OpenGL index buffer object
+	static CMeshArena *arenas[3][MESH_ATTRIB_ALL+1]; // Vertex and index buffers shared by
+	                          //   the interleaved meshes of each vertex format and set
+	                          //   of attributes, NULL until used
+	CMeshArenaBlock arena_block; // Ranges of the mesh in its arena
+	GLuint vertex_array_obj;  // OpenGL vertex array object, with separate_streams
+	GLuint vertex_buffer_obj; // OpenGL vertex buffer object, with separate_streams
+	GLuint index_buffer_obj;  // OpenGL index buffer object, with separate_streams
 	int num_vertices; // The number of vertices
 	int num_indices;  // The number of indices
 	GLenum primitive_type; // OpenGL primitive type
+	bool primitive_restart; // Draw with MESH_RESTART_INDEX as the primitive restart index
+	int grid_index_mode;   // MESH_GRID_INDEX_MODE of the grid primitives, set before creating
+	                       //   the mesh
+	int vertex_format;     // MESH_VERTEX_FORMAT, set before creating the mesh
+	bool separate_streams; // Store each attribute as its own array instead of
+	                       //   interleaving them, set before creating the mesh
+	int vertex_attribs;    // MESH_VERTEX_ATTRIB flags of the stored attributes
+	vec3 position_offset;  // The vertex shader computes object positions as
+	vec3 position_scale;   //   position_offset+position_scale*position
+	                       //   (0 and 1 unless positions are quantized)
+	vec3 bound_center;     // Bounding sphere of the vertices in object coordinates
+	float bound_radius;
+	CMesh *coarser_lod;    // Next coarser level of detail, NULL for the coarsest level
+	int lod_levels;        // The number of levels of detail that the gasket, sphere, cone and
+	                       //   cylinder create, including the mesh itself, set before
+	                       //   creating the mesh
+	float lod_error;       // Largest distance between the mesh and the surface it
+	                       //   approximates, in object coordinates
 
 	CMesh(void);
 
+	int GetVertexSize(void) const;
+	// Return the size of a vertex in bytes, over all streams
+
+	static CMeshArena& GetArena(int vertex_format, int vertex_attribs);
+	// Return the arena of a vertex format and set of attributes, creating it if needed
+
 	void ReleaseGLResources(void);
-	// Release OpenGL resources
+	// Release OpenGL resources, including those of the coarser levels of detail
 
 	void Draw(void);
 	// Draw the mesh
 
+	int GetNumTriangles(void) const { return num_triangles; }
+	// Return the number of triangles drawn by Draw
+
+	CMesh *CreateCoarserLOD(void);
+	// Attach a new empty mesh as the next coarser level of detail and return it
+	// Returns NULL if lod_levels does not allow another level
+	// The new mesh has one level less and the vertex format and index mode of this
+	//   mesh; create it with a Create function, which sets lod_error
+
+	CMesh& GetLOD(int level);
+	// Return a level of detail, 0 for the mesh itself
+	// Levels beyond the coarsest one return the coarsest one
+
+	int SelectLOD(const mat4& model_view_matrix, float viewport_scale,
+		float max_pixel_error, int current_lod, float hysteresis=0.75f) const;
+	// Return the coarsest level of detail whose error stays within max_pixel_error on
+	//   the screen, judged from the projected size of the bounding sphere
+	// model_view_matrix: (in) Matrix from object to eye coordinates
+	// viewport_scale: (in) Pixels per unit at distance 1, viewport height/(2*tan(fovy/2))
+	// max_pixel_error: (in) Largest allowed error in pixels
+	// current_lod: (in) Level of detail drawn in the previous frame
+	// hysteresis: (in) The object only switches to a coarser level than current_lod when
+	//             its error is within hysteresis*max_pixel_error, so that objects near a
+	//             threshold do not switch levels every frame
+
 	void CreateGasket2D(
 		const point2 triangle_vertices[3],
 		int subdivision_depth);
@@ -93,26 +243,34 @@ public:
 	// tex_nx, tex_ny, tex_nz: (in) Texture coordinate multipliers in x, y, z directions
 
 	void CreateRect(float sx, float sy, int nx, int ny,
-		float tex_nx, float tex_ny);
+		float tex_nx, float tex_ny, int num_threads=0);
 	// Create a rectangle
 	// sx, sy: (in) Rectangle sizes in x, y directions
 	// nx, ny: (in) The numbers of subdivisions in x, y directions
 	// tex_nx, tex_ny: (in) Texture coordinate multipliers in x, y directions
+	// num_threads: (in) The number of threads, 0 for the number of hardware threads
 
 	void CreateSphere(float radius, int num_slices, int num_stacks,
-		float tex_ntheta, float tex_nphi);
+		float tex_ntheta, float tex_nphi, int num_threads=0);
 	// Create a sphere
 	// radius: (in) Sphere radius
 	// num_slices: (in) The number of subdivisions in theta direction
 	// num_stacks: (in) The number of subdivisions in phi direction
 	// tex_ntheta: (in) Texture coordinate multiplier in theta direction
 	// tex_nphi:   (in) Texture coordinate multiplier in phi direction
+	// num_threads: (in) The number of threads, 0 for the number of hardware threads
 
 	void CreateAxes(float sx, float sy, float sz);
 
-	void CreateCone(float radius, float h, int num_slices, int num_stacks, int rings, float tex_ntheta, float tex_nh);
+	void CreateCone(float radius, float h, int num_slices, int num_stacks, int rings, float tex_ntheta, float tex_nh, int num_threads=0);
+
+	void CreateCylinder(float radius, float h, int num_slices, int num_stacks, int rings, float tex_nx, float tex_ny, int num_threads=0);
 
-	void CreateCylinder(float radius, float h, int num_slices, int num_stacks, int rings, float tex_nx, float tex_ny);
+	static void BenchmarkGenerators(int grid_size, int num_threads=0);
+	// Time the vertex and index generation of the parametric primitives and print
+	//   the rate at which they are written, with one thread and with num_threads
+	// grid_size: (in) The number of slices and stacks of each primitive
+	// num_threads: (in) The number of threads, 0 for the number of hardware threads
 
 };
 
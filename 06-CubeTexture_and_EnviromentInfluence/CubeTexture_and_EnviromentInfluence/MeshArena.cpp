@@ -0,0 +1,418 @@
+#include "MeshArena.h"
+#include "ScratchArena.h"
+#include <algorithm>
+
+// Initial sizes of the buffers, in vertices and bytes
+#define MESH_ARENA_INITIAL_VERTICES (1<<16)
+#define MESH_ARENA_INITIAL_INDEX_BYTES (1<<20)
+
+static size_t GetIndexBytes(const CMeshArenaBlock& block)
+// Return the size of the index range of a block, rounded up to 4 bytes
+{
+	size_t size=(size_t)block.num_indices*(block.index_type==GL_UNSIGNED_SHORT ? 2 : 4);
+	return (size+3)&~(size_t)3;
+}
+
+CMeshArenaBlock::CMeshArenaBlock(void)
+{
+	arena=NULL;
+	base_vertex=0;
+	num_vertices=0;
+	index_offset=0;
+	num_indices=0;
+	index_type=GL_UNSIGNED_INT;
+}
+
+bool CMeshArena::CRangeList::Allocate(size_t size, size_t& offset)
+// Take the first free range that is large enough, or the end of the buffer
+{
+	offset=0;
+	if (size==0)
+		return true;
+
+	for (size_t i=0; i<free_ranges.size(); ++i)
+		if (free_ranges[i].size>=size)
+		{
+			offset=free_ranges[i].offset;
+			free_ranges[i].offset+=size;
+			free_ranges[i].size-=size;
+			if (free_ranges[i].size==0)
+				free_ranges.erase(free_ranges.begin()+i);
+			used+=size;
+			return true;
+		}
+
+	if (top+size>capacity)
+		return false;
+	offset=top;
+	top+=size;
+	used+=size;
+	return true;
+}
+
+void CMeshArena::CRangeList::Free(size_t offset, size_t size)
+// Return a range, merging it with the free ranges next to it
+{
+	if (size==0)
+		return;
+	used-=size;
+
+	// A range at the end lowers top, together with the holes right below it
+	if (offset+size==top)
+	{
+		top=offset;
+		while (!free_ranges.empty() &&
+			free_ranges.back().offset+free_ranges.back().size==top)
+		{
+			top=free_ranges.back().offset;
+			free_ranges.pop_back();
+		}
+		return;
+	}
+
+	size_t i=0;
+	while (i<free_ranges.size() && free_ranges[i].offset<offset)
+		++i;
+	CRange range={offset, size};
+	free_ranges.insert(free_ranges.begin()+i, range);
+	if (i+1<free_ranges.size() &&
+		free_ranges[i].offset+free_ranges[i].size==free_ranges[i+1].offset)
+	{
+		free_ranges[i].size+=free_ranges[i+1].size;
+		free_ranges.erase(free_ranges.begin()+i+1);
+	}
+	if (i>0 && free_ranges[i-1].offset+free_ranges[i-1].size==free_ranges[i].offset)
+	{
+		free_ranges[i-1].size+=free_ranges[i].size;
+		free_ranges.erase(free_ranges.begin()+i);
+	}
+}
+
+void CMeshArena::CRangeList::Reset(size_t capacity)
+{
+	free_ranges.clear();
+	top=0;
+	used=0;
+	this->capacity=capacity;
+}
+
+CMeshArena::CMeshArena(int vertex_size, CMeshArenaVertexFormat set_vertex_format, int format)
+{
+	this->vertex_size=vertex_size;
+	this->set_vertex_format=set_vertex_format;
+	this->format=format;
+	vertex_ranges.Reset(0);
+	index_ranges.Reset(0);
+	vertex_array_obj=0;
+	vertex_buffer_obj=0;
+	index_buffer_obj=0;
+	num_repacks=0;
+}
+
+bool CMeshArena::AllocateRanges(CMeshArenaBlock& block)
+// Take the ranges of a block from the free lists or the end of the buffers
+{
+	size_t vertex_offset, index_offset;
+	if (!vertex_ranges.Allocate(block.num_vertices, vertex_offset))
+		return false;
+	if (!index_ranges.Allocate(GetIndexBytes(block), index_offset))
+	{
+		vertex_ranges.Free(vertex_offset, block.num_vertices);
+		return false;
+	}
+	block.base_vertex=(GLint)vertex_offset;
+	block.index_offset=index_offset;
+	return true;
+}
+
+void CMeshArena::Allocate(CMeshArenaBlock& block, int num_vertices, int num_indices)
+// Allocate the ranges of a mesh, freeing the ones block had before
+// block: (out) Ranges of the mesh
+// num_vertices: (in) The number of vertices
+// num_indices: (in) The number of indices, 0 for a mesh without indices
+{
+	if (block.arena!=NULL)
+		block.arena->Free(block);
+
+	// Indices below 65535 fit in 16 bits, and 0xFFFF stays free for primitive restart
+	block.num_vertices=num_vertices;
+	block.num_indices=num_indices;
+	block.index_type=num_vertices<65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+	if (vertex_array_obj==0 || !AllocateRanges(block))
+	{
+		// Pack the meshes together, growing the buffers if the free space is too small
+		size_t vertex_capacity=std::max(vertex_ranges.capacity, (size_t)MESH_ARENA_INITIAL_VERTICES);
+		size_t index_capacity=std::max(index_ranges.capacity, (size_t)MESH_ARENA_INITIAL_INDEX_BYTES);
+		while (vertex_capacity<vertex_ranges.used+num_vertices)
+			vertex_capacity*=2;
+		while (index_capacity<index_ranges.used+GetIndexBytes(block))
+			index_capacity*=2;
+		Repack(vertex_capacity, index_capacity);
+		AllocateRanges(block);
+	}
+
+	block.arena=this;
+	blocks.push_back(&block);
+}
+
+void CMeshArena::Free(CMeshArenaBlock& block)
+// Return the ranges of a mesh to the free lists
+{
+	if (block.arena!=this)
+		return;
+
+	vertex_ranges.Free(block.base_vertex, block.num_vertices);
+	index_ranges.Free(block.index_offset, GetIndexBytes(block));
+	std::vector<CMeshArenaBlock *>::iterator it=std::find(blocks.begin(), blocks.end(), &block);
+	if (it!=blocks.end())
+	{
+		*it=blocks.back();
+		blocks.pop_back();
+	}
+	block.arena=NULL;
+}
+
+static bool CompareBaseVertex(const CMeshArenaBlock *a, const CMeshArenaBlock *b)
+{
+	return a->base_vertex<b->base_vertex;
+}
+
+static bool CompareIndexOffset(const CMeshArenaBlock *a, const CMeshArenaBlock *b)
+{
+	return a->index_offset<b->index_offset;
+}
+
+void CMeshArena::Repack(size_t vertex_capacity, size_t index_capacity)
+// Copy the allocated ranges one after another into new buffers and delete the old ones
+// Buffer copies cannot overlap within one buffer, so the ranges always move to new
+//   buffers, in the order of their offsets
+// vertex_capacity: (in) Size of the new vertex buffer in vertices
+// index_capacity: (in) Size of the new index buffer in bytes
+{
+	GLuint new_vertex_buffer_obj, new_index_buffer_obj;
+	std::vector<CMeshArenaBlock *> order(blocks);
+	size_t top;
+
+	glGenBuffers(1, &new_vertex_buffer_obj);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, new_vertex_buffer_obj);
+	glBufferData(GL_COPY_WRITE_BUFFER, vertex_capacity*vertex_size, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_READ_BUFFER, vertex_buffer_obj);
+	std::sort(order.begin(), order.end(), CompareBaseVertex);
+	top=0;
+	for (size_t i=0; i<order.size(); ++i)
+	{
+		CMeshArenaBlock *block=order[i];
+		if (block->num_vertices>0)
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+				(GLintptr)block->base_vertex*vertex_size, (GLintptr)top*vertex_size,
+				(GLsizeiptr)block->num_vertices*vertex_size);
+		block->base_vertex=(GLint)top;
+		top+=block->num_vertices;
+	}
+	vertex_ranges.Reset(vertex_capacity);
+	vertex_ranges.top=vertex_ranges.used=top;
+
+	glGenBuffers(1, &new_index_buffer_obj);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, new_index_buffer_obj);
+	glBufferData(GL_COPY_WRITE_BUFFER, index_capacity, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_READ_BUFFER, index_buffer_obj);
+	std::sort(order.begin(), order.end(), CompareIndexOffset);
+	top=0;
+	for (size_t i=0; i<order.size(); ++i)
+	{
+		CMeshArenaBlock *block=order[i];
+		size_t size=GetIndexBytes(*block);
+		if (size>0)
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+				block->index_offset, top, size);
+		block->index_offset=top;
+		top+=size;
+	}
+	index_ranges.Reset(index_capacity);
+	index_ranges.top=index_ranges.used=top;
+
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	if (vertex_buffer_obj!=0)
+	{
+		glDeleteBuffers(1, &vertex_buffer_obj);
+		glDeleteBuffers(1, &index_buffer_obj);
+		++num_repacks;
+	}
+	vertex_buffer_obj=new_vertex_buffer_obj;
+	index_buffer_obj=new_index_buffer_obj;
+
+	// Point the vertex array object at the new buffers
+	if (vertex_array_obj==0)
+		glGenVertexArrays(1, &vertex_array_obj);
+	glBindVertexArray(vertex_array_obj);
+	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_obj);
+	set_vertex_format(format, vertex_size);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_obj);
+	glBindVertexArray(0);
+}
+
+void CMeshArena::Compact(void)
+// Pack the allocated ranges together, so that the free space is in one piece
+{
+	if (vertex_array_obj!=0)
+		Repack(vertex_ranges.capacity, index_ranges.capacity);
+}
+
+void CMeshArena::Release(void)
+// Delete the buffers; all blocks must have been freed
+{
+	for (size_t i=0; i<blocks.size(); ++i)
+		blocks[i]->arena=NULL;
+	blocks.clear();
+
+	if (vertex_array_obj!=0)
+	{
+		glDeleteVertexArrays(1, &vertex_array_obj);
+		glDeleteBuffers(1, &vertex_buffer_obj);
+		glDeleteBuffers(1, &index_buffer_obj);
+	}
+	vertex_array_obj=0;
+	vertex_buffer_obj=0;
+	index_buffer_obj=0;
+	vertex_ranges.Reset(0);
+	index_ranges.Reset(0);
+}
+
+void CMeshArena::UploadVertices(const CMeshArenaBlock& block, const void *vertices)
+// Copy the vertices of a mesh into its range
+{
+	if (block.num_vertices==0)
+		return;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, vertex_buffer_obj);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)block.base_vertex*vertex_size,
+		(GLsizeiptr)block.num_vertices*vertex_size, vertices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void CMeshArena::UploadIndices(const CMeshArenaBlock& block, const GLuint *indices)
+// Copy the indices of a mesh into its range, narrowing them to 16 bits if the
+//   block has 16-bit indices
+// Truncating turns the primitive restart index 0xFFFFFFFF into 0xFFFF
+{
+	if (block.num_indices==0)
+		return;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, index_buffer_obj);
+	if (block.index_type==GL_UNSIGNED_INT)
+		glBufferSubData(GL_COPY_WRITE_BUFFER, block.index_offset,
+			sizeof(GLuint)*block.num_indices, indices);
+	else
+	{
+		CScratchScope scratch;
+		GLushort *narrow_indices=scratch.Allocate<GLushort>(block.num_indices);
+		for (int k=0; k<block.num_indices; ++k)
+			narrow_indices[k]=(GLushort)indices[k];
+		glBufferSubData(GL_COPY_WRITE_BUFFER, block.index_offset,
+			sizeof(GLushort)*block.num_indices, narrow_indices);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void *CMeshArena::MapVertices(const CMeshArenaBlock& block)
+// Map the vertex range of a mesh for writing, or return NULL if it cannot be mapped
+{
+	if (block.num_vertices==0)
+		return NULL;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, vertex_buffer_obj);
+	void *vertices=glMapBufferRange(GL_COPY_WRITE_BUFFER,
+		(GLintptr)block.base_vertex*vertex_size, (GLsizeiptr)block.num_vertices*vertex_size,
+		GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_RANGE_BIT);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	return vertices;
+}
+
+void *CMeshArena::MapIndices(const CMeshArenaBlock& block)
+// Map the index range of a mesh for writing, or return NULL if it cannot be mapped
+{
+	if (block.num_indices==0)
+		return NULL;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, index_buffer_obj);
+	void *indices=glMapBufferRange(GL_COPY_WRITE_BUFFER,
+		block.index_offset, GetIndexBytes(block),
+		GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_RANGE_BIT);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	return indices;
+}
+
+bool CMeshArena::UnmapVertices(void)
+// Unmap the range mapped by MapVertices
+// Returns false if the contents of the buffer were lost while it was mapped
+{
+	glBindBuffer(GL_COPY_WRITE_BUFFER, vertex_buffer_obj);
+	bool result=glUnmapBuffer(GL_COPY_WRITE_BUFFER)==GL_TRUE;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	return result;
+}
+
+bool CMeshArena::UnmapIndices(void)
+// Unmap the range mapped by MapIndices
+// Returns false if the contents of the buffer were lost while it was mapped
+{
+	glBindBuffer(GL_COPY_WRITE_BUFFER, index_buffer_obj);
+	bool result=glUnmapBuffer(GL_COPY_WRITE_BUFFER)==GL_TRUE;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	return result;
+}
+
+void CMeshArena::ReadVertices(const CMeshArenaBlock& block, void *vertices) const
+// Copy the vertices of a mesh out of its range
+{
+	if (block.num_vertices==0)
+		return;
+	glBindBuffer(GL_COPY_READ_BUFFER, vertex_buffer_obj);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, (GLintptr)block.base_vertex*vertex_size,
+		(GLsizeiptr)block.num_vertices*vertex_size, vertices);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+void CMeshArena::ReadIndices(const CMeshArenaBlock& block, GLuint *indices) const
+// Copy the indices of a mesh out of its range, widening 16-bit indices
+// A 16-bit mesh has at most 65535 vertices, so 0xFFFF can only be a restart index
+{
+	if (block.num_indices==0)
+		return;
+	glBindBuffer(GL_COPY_READ_BUFFER, index_buffer_obj);
+	if (block.index_type==GL_UNSIGNED_INT)
+		glGetBufferSubData(GL_COPY_READ_BUFFER, block.index_offset,
+			sizeof(GLuint)*block.num_indices, indices);
+	else
+	{
+		CScratchScope scratch;
+		GLushort *narrow_indices=scratch.Allocate<GLushort>(block.num_indices);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, block.index_offset,
+			sizeof(GLushort)*block.num_indices, narrow_indices);
+		for (int k=0; k<block.num_indices; ++k)
+			indices[k]=narrow_indices[k]==0xFFFF ? 0xFFFFFFFF : narrow_indices[k];
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+void CMeshArena::Draw(const CMeshArenaBlock& block, GLenum primitive_type) const
+// Draw a mesh with the vertex array object of the arena, which stays bound
+// Binding the vertex array object that is already bound costs next to nothing
+{
+	glBindVertexArray(vertex_array_obj);
+	if (block.num_indices==0)
+		glDrawArrays(primitive_type, block.base_vertex, block.num_vertices);
+	else
+		glDrawElementsBaseVertex(primitive_type, block.num_indices, block.index_type,
+			(GLvoid *)block.index_offset, block.base_vertex);
+}
+
+size_t CMeshArena::GetUsedBytes(void) const
+// Return the bytes in use in both buffers
+{
+	return vertex_ranges.used*vertex_size+index_ranges.used;
+}
+
+size_t CMeshArena::GetCapacityBytes(void) const
+// Return the bytes allocated in both buffers
+{
+	return vertex_ranges.capacity*vertex_size+index_ranges.capacity;
+}
@@ -0,0 +1,58 @@
+#ifndef _UNIFORM_RING_H_
+#define _UNIFORM_RING_H_
+
+#include "GL/glew.h"
+
+// Ring buffer for the std140 uniform blocks that change every frame
+// The buffer holds NUM_SECTIONS sections, one per frame in flight; a frame writes its
+//   blocks into the next section and binds each of them with glBindBufferRange, so a
+//   block that changes per object costs one call instead of a glUniform* call per
+//   member, and the driver never has to wait for or copy a buffer the GPU still reads
+// Usage per frame: Begin, Allocate and fill all blocks, Unmap, draw with Bind, End
+class CUniformRing
+{
+protected:
+	enum { NUM_SECTIONS=3 }; // Frames in flight
+
+	GLsizeiptr section_size;  // Bytes per section, a multiple of offset_alignment
+	GLint offset_alignment;   // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+	GLsync section_fences[NUM_SECTIONS]; // Signalled when the GPU is done with a section
+	int current_section;
+	unsigned char *persistent_ptr; // Persistent mapping of the whole buffer, NULL if unsupported
+	unsigned char *section_ptr;    // Mapped memory of the current section, NULL when unmapped
+	GLsizeiptr section_used;       // Bytes allocated in the current section
+
+public:
+	GLuint buffer_obj; // OpenGL uniform buffer object
+
+	CUniformRing(void);
+
+	void Init(GLsizeiptr size);
+	// Create the buffer
+	// size: (in) Bytes per frame, rounded up to the offset alignment
+
+	void Release(void);
+	// Delete the buffer and the fences
+
+	void Begin(void);
+	// Wait until the GPU has finished reading the next section and map it
+
+	void *Allocate(GLsizeiptr size, GLintptr& offset);
+	// Allocate a block in the current section
+	// Returns the memory to write the block to, or NULL if the section is full
+	// size: (in) Size of the block in bytes
+	// offset: (out) Offset of the block in the buffer, passed to Bind
+
+	void Unmap(void);
+	// Finish writing the blocks of this frame; must be called before drawing
+
+	void Bind(GLuint binding, GLintptr offset, GLsizeiptr size);
+	// Bind a block to a uniform buffer binding point
+	// binding: (in) Binding point, see glUniformBlockBinding
+	// offset, size: (in) The block returned by Allocate
+
+	void End(void);
+	// Fence the section after the draws of this frame and move to the next one
+};
+
+#endif
@@ -2,11 +2,15 @@
 #include "GL/freeglut.h"
 #include "vec.h"
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include "mat.h"
 #include "GLHelper.h"
 #include "Mesh.h"
 #include "Camera.h"
 #include "ImageLib.h"
+#include "ScratchArena.h"
+#include "UniformRing.h"
 
 using namespace std;
 #define CMESH_NUM 7
@@ -18,10 +22,70 @@ public:
 	mat4 model_matrix;
 	GLuint diffuse_texture;
 	GLboolean isEnvirmomentObj;
+	int lod; // Level of detail drawn in the last frame
 };
 
-GLuint g_GLSL_prog;
+CShaderProgram g_GLSL_prog;
 //GLuint g_cube_GLSL_prog;
+
+//ɫе std140 uniform 飬Ա˳ɫеһ
+//ÿ֡ݺÿд뻷λ壬ÿǰֻһ glBindBufferRange
+//ͬĲֻڳʼʱϴһ
+enum {
+	UNIFORM_BINDING_FRAME=0,
+	UNIFORM_BINDING_OBJECT,
+	UNIFORM_BINDING_MATERIAL
+};
+
+struct CSpotLightBlock
+{
+	vec4 position;
+	vec4 color;
+	vec4 direction;
+	float cut_off_angle;
+	float exponent;
+	float a0, a1, a2;
+	float padding[3];
+	vec4 ambient;
+	vec4 diffuse;
+	vec4 specular;
+};
+
+struct CFrameBlock
+{
+	mat4 view_matrix;
+	mat4 projection_matrix;
+	color4 ambient_light_color;
+	point4 light_position;
+	color4 light_color;
+	CSpotLightBlock spot_light;
+};
+
+struct CObjectBlock
+{
+	mat4 model_matrix;
+	mat4 normal_matrix;	//Ͻ 3x3 Ƿ
+	color4 base_color;
+	vec3 position_offset;	//Ķʽ display д
+	int octahedral_normal;
+	vec3 position_scale;
+	int enable_diffuse_texture;
+	int is_envirmoment_obj;
+	int is_block_obj;
+	int padding[2];
+};
+
+struct CMaterialBlock
+{
+	color4 diffuse_reflectivity;
+	color4 specular_reflectivity;
+	float shininess;
+	float padding[3];
+};
+
+CFrameBlock g_frame;	//ÿ֡ʼʱƵλ
+CUniformRing g_uniform_ring;
+GLuint g_material_buffer;
  
 float g_scene_size=100.0f;
 CObject3D g_obj[CMESH_NUM];
@@ -31,46 +95,72 @@ float g_camera_step=0.6f*g_scene_size;
 int g_mouse_rotation_mode=0;
 int g_mouse_x, g_mouse_y;
 
+//ϸڲΣΧͶӰĻϵĴСѡ g_lod_pixel_error صֲ
+bool g_lod_enabled=true;
+float g_lod_pixel_error=1.0f;
+float g_lod_viewport_scale=1.0f;	//Ϊ 1 ÿλȵ reshape м
+
 void init_shaders(void)
 {
 	//InitShader Ĭ  glUseProgram(<ǰ>);
 
-	g_GLSL_prog=InitShader(
+	g_GLSL_prog.Init(
 		"../shaders/single_light-single_texture-vs.txt",
 		"../shaders/single_light-single_texture-fs.txt");
 
-	glUseProgram(g_GLSL_prog);
-	
-	int loc;
-	//point light
-	loc=glGetUniformLocation(g_GLSL_prog, "ambient_light_color");
-	glUniform4f(loc, 1.0f, 1.0f, 1.0f, 1.0f);
+	glUseProgram(g_GLSL_prog.prog);
+
+	g_GLSL_prog.SetBlockBinding("FrameBlock", UNIFORM_BINDING_FRAME);
+	g_GLSL_prog.SetBlockBinding("ObjectBlock", UNIFORM_BINDING_OBJECT);
+	g_GLSL_prog.SetBlockBinding("MaterialBlock", UNIFORM_BINDING_MATERIAL);
+
+	//C++ еĽṹɫе std140 Сһ
+	if (g_GLSL_prog.GetBlockSize("FrameBlock") != (int)sizeof(CFrameBlock) ||
+		g_GLSL_prog.GetBlockSize("ObjectBlock") != (int)sizeof(CObjectBlock) ||
+		g_GLSL_prog.GetBlockSize("MaterialBlock") != (int)sizeof(CMaterialBlock))
+		printf("uniform block sizes do not match the shaders\n");
 
-	loc=glGetUniformLocation(g_GLSL_prog, "light_color");
-	glUniform4f(loc, 1.0f, 1.0f, 1.0f, 1.0f);
-	loc=glGetUniformLocation(g_GLSL_prog, "light_position");
-	glUniform4f(loc, 45.0f * g_scene_size, -45.0f * g_scene_size, 45.0f*g_scene_size, 1.0f);
+	//point light
+	g_frame.ambient_light_color=color4(1.0f, 1.0f, 1.0f, 1.0f);
+	g_frame.light_color=color4(1.0f, 1.0f, 1.0f, 1.0f);
+	g_frame.light_position=point4(45.0f * g_scene_size, -45.0f * g_scene_size, 45.0f*g_scene_size, 1.0f);
 
 	vec3 init_camera_pos = g_camera.GetCameraPosition();
 	vec3 init_LookAt_pos = g_camera.GetLookAtPoint();
 	vec3 init_direct = init_LookAt_pos - init_camera_pos;
 	//۹
-	glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.position"), init_camera_pos.x, init_camera_pos.y, init_camera_pos.z, 1.0f);	//Դλãʼλ
-	glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.color"), 1.0f, 0.0f, 0.0f, 1.0f);	//̽յƹԴǿ
-	glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.direction"), init_direct.x, init_direct.y, init_direct.z, 1.0f);	//̽յƹԴʼ򣬺ʼйأʼֵ normalize(at - eye)
-	glUniform1f(glGetUniformLocation(g_GLSL_prog, "spot_light.cut_off_angle"), 10 * DegreesToRadians);	//̽յƹԴüǶ
-	glUniform1f(glGetUniformLocation(g_GLSL_prog, "spot_light.exponent"), 0.005f);	//۹ָ
-	glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.ambient"), 1.0f, 1.0f, 1.0f, 1.0f);	//ǿ
-	glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.diffuse"), 1.0f, 1.0f, 1.0f, 1.0f);	//ǿ
-	glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.specular"), 1.0f, 1.0f, 1.0f, 1.0f);	//淴ǿ
-	glUniform1f(glGetUniformLocation(g_GLSL_prog, "spot_light.a0"), 1.0f);	//˥ϵ
-	glUniform1f(glGetUniformLocation(g_GLSL_prog, "spot_light.a1"), 0.0000002f);	
-	glUniform1f(glGetUniformLocation(g_GLSL_prog, "spot_light.a2"), 0.00000001f);
-
-	glUniform1i(glGetUniformLocation(g_GLSL_prog, "diffuse_texture"), 0);
-	glUniform1i(glGetUniformLocation(g_GLSL_prog, "skybox"), 1);
-
-	glUniformMatrix4fv(glGetUniformLocation(g_GLSL_prog, "rotateX_90"), 1, GL_FALSE, RotateX(90.0f));
+	CSpotLightBlock& spot_light = g_frame.spot_light;
+	spot_light.position = vec4(init_camera_pos.x, init_camera_pos.y, init_camera_pos.z, 1.0f);	//Դλãʼλ
+	spot_light.color = vec4(1.0f, 0.0f, 0.0f, 1.0f);	//̽յƹԴǿ
+	spot_light.direction = vec4(init_direct.x, init_direct.y, init_direct.z, 1.0f);	//̽յƹԴʼ򣬺ʼйأʼֵ normalize(at - eye)
+	spot_light.cut_off_angle = 10 * DegreesToRadians;	//̽յƹԴüǶ
+	spot_light.exponent = 0.005f;	//۹ָ
+	spot_light.ambient = vec4(1.0f, 1.0f, 1.0f, 1.0f);	//ǿ
+	spot_light.diffuse = vec4(1.0f, 1.0f, 1.0f, 1.0f);	//ǿ
+	spot_light.specular = vec4(1.0f, 1.0f, 1.0f, 1.0f);	//淴ǿ
+	spot_light.a0 = 1.0f;	//˥ϵ
+	spot_light.a1 = 0.0000002f;
+	spot_light.a2 = 0.00000001f;
+
+	//Ĳֻͬϴһ
+	CMaterialBlock material={};
+	material.diffuse_reflectivity = color4(1.0f, 1.0f, 1.0f, 1.0f);
+	material.specular_reflectivity = color4(0.8f, 0.8f, 1.0f, 1.0f);
+	material.shininess = 128.0f;
+	glGenBuffers(1, &g_material_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, g_material_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(material), &material, GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_MATERIAL, g_material_buffer);
+
+	//ÿ֡֡飨պеͼ󲻺ƽƣÿһ飬64KB 㹻
+	g_uniform_ring.Init(65536);
+
+	g_GLSL_prog.SetUniform(g_GLSL_prog.GetHandle("diffuse_texture"), 0);
+	g_GLSL_prog.SetUniform(g_GLSL_prog.GetHandle("skybox"), 1);
+
+	//ɫʹõ RotateX(90) תϴľ󣬶 SetUniform תãתһ
+	g_GLSL_prog.SetUniform(g_GLSL_prog.GetHandle("rotateX_90"), transpose(RotateX(90.0f)));
 }
 
 void init_scene(void)
@@ -83,6 +173,18 @@ void init_scene(void)
 		point3(0.0f, 0.57735f*tetra_s, 0.0f),
 		point3(0.0f, 0.0f, 0.81650f*tetra_s),
 	};
+
+	//嶼ʹѹĶʽֻ洢õԣĶ48ֽڼٵ16ֽ
+	for (int i = 0; i < CMESH_NUM; i++)
+		g_obj[i].mesh.vertex_format = MESH_VERTEX_QUANTIZED;
+
+	//桢Բ׶ԲÿһδͼԪӣԼΪб1/3
+	for (int i = 0; i < CMESH_NUM; i++)
+		g_obj[i].mesh.grid_index_mode = MESH_GRID_STRIPS;
+
+	//ε桢Բ׶Բÿϸڲεϸ룻ڵΣϸڲ
+	for (int i = 1; i < CMESH_NUM; i++)
+		g_obj[i].mesh.lod_levels = 5;
 	
 	g_obj[0].mesh.CreateRect(108.0f * g_scene_size, 465.0f / 436.0f * 108.0f * g_scene_size, 436, 465, 1.0f, 1.0f);
 	g_obj[1].mesh.CreateGasket3D(tetra_vertices, 6);
@@ -92,6 +194,17 @@ void init_scene(void)
 	g_obj[5].mesh.CreateCylinder(60.0f * s, 90.0f * s, 64, 64, 16, 1.0f, 1.0f);
 	g_obj[6].mesh.CreateCube(50.0f * g_scene_size, 1.0f);
 
+	int vertex_bytes = 0, float_vertex_bytes = 0, index_bytes = 0;
+	for (int i = 0; i < CMESH_NUM; i++)
+	{
+		vertex_bytes += g_obj[i].mesh.num_vertices * g_obj[i].mesh.GetVertexSize();
+		float_vertex_bytes += g_obj[i].mesh.num_vertices * (int)sizeof(CMeshVertex);
+		index_bytes += g_obj[i].mesh.num_indices * (int)sizeof(GLuint);
+	}
+	printf("vertex buffers: %d KB (%d KB with float vertices)\n",
+		vertex_bytes / 1024, float_vertex_bytes / 1024);
+	printf("index buffers: %d KB\n", index_bytes / 1024);
+
 	g_obj[0].base_color = color4(1.0f);
 	g_obj[1].base_color = color4(1.0f);
 	g_obj[2].base_color = color4(1.0f);
@@ -129,6 +242,17 @@ void init_scene(void)
 		"../textures/Skybox01_back.jpg"
 	};
 	g_obj[6].diffuse_texture = LoadTextureCubeMapFromFile(cube_texture);
+	//ɺͼʱ鶼ȡ g_scratch_arenaسʱķֵϵͳڴĴ
+	printf("scratch arena: peak %d KB, %d KB reserved, %d allocations, %d from the system\n",
+		(int)(g_scratch_arena.peak_used / 1024), (int)(g_scratch_arena.reserved / 1024),
+		g_scratch_arena.num_allocations, g_scratch_arena.num_system_allocations);
+	//洢񰴶ʽϹ CMesh::arenas еĶ㻺
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j <= MESH_ATTRIB_ALL; ++j)
+			if (CMesh::arenas[i][j] != NULL)
+				printf("mesh arena (format %d, attributes %d): %d meshes, %d KB used of %d KB, %d repacks\n",
+					i, j, CMesh::arenas[i][j]->GetNumBlocks(), (int)(CMesh::arenas[i][j]->GetUsedBytes() / 1024),
+					(int)(CMesh::arenas[i][j]->GetCapacityBytes() / 1024), CMesh::arenas[i][j]->num_repacks);
 }
 
 void init(void)
@@ -152,59 +276,106 @@ void display(void)
 {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	glUseProgram(g_GLSL_prog);
+	glUseProgram(g_GLSL_prog.prog);
 
 	mat4 M;
 	mat3 M33;
 	g_camera.GetViewMatrix(M);
 
 	//̽յƹԴλ
-	glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.position"), g_camera.GetCameraPosition().x, g_camera.GetCameraPosition().y, g_camera.GetCameraPosition().z, 1.0f);
+	vec3 camera_pos = g_camera.GetCameraPosition();
+	g_frame.spot_light.position = vec4(camera_pos.x, camera_pos.y, camera_pos.z, 1.0f);
+	g_frame.view_matrix = M;
+
+	//Ȱѱ֡е uniform д뻷λ壬ʱÿֻԼĿ
+	g_uniform_ring.Begin();
+
+	GLintptr frame_offset = 0, skybox_frame_offset = 0;
+	CFrameBlock *frame = (CFrameBlock *)g_uniform_ring.Allocate(sizeof(CFrameBlock), frame_offset);
+	if (frame != NULL)
+		*frame = g_frame;
+	frame = (CFrameBlock *)g_uniform_ring.Allocate(sizeof(CFrameBlock), skybox_frame_offset);
+	if (frame != NULL)
+	{
+		*frame = g_frame;
+		frame->view_matrix = removeTranslateFromMatrix2(M);
+	}
 
+	CMesh *meshes[CMESH_NUM];
+	GLintptr object_offsets[CMESH_NUM];
+	int num_triangles=0;
 	for (int i=0; i < CMESH_NUM; i++)	//ѭûа
 	{
-		glUniformMatrix4fv(glGetUniformLocation(g_GLSL_prog, "model_matrix"), 1, GL_TRUE, g_obj[i].model_matrix);
-		glUniformMatrix4fv(glGetUniformLocation(g_GLSL_prog, "view_matrix"), 1, GL_TRUE, M);
+		//ĻϵĴСѡϸڲΣһ֡Ĳڱֵл
+		if (g_lod_enabled)
+			g_obj[i].lod = g_obj[i].mesh.SelectLOD(M * g_obj[i].model_matrix,
+				g_lod_viewport_scale, g_lod_pixel_error, g_obj[i].lod);
+		else
+			g_obj[i].lod = 0;
+		CMesh& mesh = g_obj[i].mesh.GetLOD(g_obj[i].lod);
+		meshes[i] = &mesh;
+		num_triangles += mesh.GetNumTriangles();
+
+		CObjectBlock *object = (CObjectBlock *)g_uniform_ring.Allocate(sizeof(CObjectBlock), object_offsets[i]);
+		if (object == NULL)
+		{
+			meshes[i] = NULL;
+			continue;
+		}
 
+		object->model_matrix = g_obj[i].model_matrix;
 		M33 = Normal(g_obj[i].model_matrix);
-		glUniformMatrix4fv(glGetUniformLocation(g_GLSL_prog, "normal_matrix"), 1, GL_TRUE, M33);
+		object->normal_matrix = mat4(vec4(M33[0], 0.0f), vec4(M33[1], 0.0f), vec4(M33[2], 0.0f),
+			vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		object->base_color = g_obj[i].base_color;
 
-		glUniform4f(glGetUniformLocation(g_GLSL_prog, "diffuse_reflectivity"), 1.0f, 1.0f, 1.0f, 1.0f);
-		glUniform4f(glGetUniformLocation(g_GLSL_prog, "specular_reflectivity"), 0.8f, 0.8f, 1.0f, 1.0f);
-		glUniform1f(glGetUniformLocation(g_GLSL_prog, "shininess"), 128.0f);
-		
-		glUniform4fv(glGetUniformLocation(g_GLSL_prog, "base_color"), 1, g_obj[i].base_color);
+		object->position_offset = mesh.position_offset;
+		object->position_scale = mesh.position_scale;
+		object->octahedral_normal = mesh.vertex_format != MESH_VERTEX_FLOAT;
 
-		glUniform1i(glGetUniformLocation(g_GLSL_prog, "enable_diffuse_texture"), g_obj[i].diffuse_texture != 0);
+		object->enable_diffuse_texture = g_obj[i].diffuse_texture != 0;
+		object->is_envirmoment_obj = i == CMESH_NUM - 1;
+		object->is_block_obj = i == 2;
+	}
 
-		if(i != CMESH_NUM - 1)
-			glUniform1i(glGetUniformLocation(g_GLSL_prog, "isEnvirmomentObj"), false);
-		else
-			glUniform1i(glGetUniformLocation(g_GLSL_prog, "isEnvirmomentObj"), true);
+	g_uniform_ring.Unmap();
+	g_uniform_ring.Bind(UNIFORM_BINDING_FRAME, frame_offset, sizeof(CFrameBlock));
 
-		if( i != 2)	glUniform1i(glGetUniformLocation(g_GLSL_prog, "isBlockObj"), false);
-		else glUniform1i(glGetUniformLocation(g_GLSL_prog, "isBlockObj"), true);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, g_obj[CMESH_NUM - 1].diffuse_texture);
+	glActiveTexture(GL_TEXTURE0);
+
+	for (int i=0; i < CMESH_NUM; i++)
+	{
+		if (meshes[i] == NULL)
+			continue;
+
+		g_uniform_ring.Bind(UNIFORM_BINDING_OBJECT, object_offsets[i], sizeof(CObjectBlock));
 
 		if (i != CMESH_NUM - 1)
 		{
-			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, g_obj[i].diffuse_texture);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, g_obj[CMESH_NUM - 1].diffuse_texture);
-			g_obj[i].mesh.Draw();
+			meshes[i]->Draw();
 		}
 		else
 		{
 			glDepthFunc(GL_LEQUAL);
 
-			glUniformMatrix4fv(glGetUniformLocation(g_GLSL_prog, "view_matrix"), 1, GL_TRUE, removeTranslateFromMatrix2(M));
+			g_uniform_ring.Bind(UNIFORM_BINDING_FRAME, skybox_frame_offset, sizeof(CFrameBlock));
 
-			g_obj[i].mesh.Draw();
+			meshes[i]->Draw();
 
 			glDepthFunc(GL_LESS);
 		}
 	}
 
+	g_uniform_ring.End();
+
+	char title[128];
+	sprintf(title, "3D scene with cube texture and enviroment influence - %d triangles%s",
+		num_triangles, g_lod_enabled ? "" : " (LOD off)");
+	glutSetWindowTitle(title);
+
 	glFlush();
 	glutSwapBuffers();
 }
@@ -213,12 +384,10 @@ void reshape(int w, int h)
 {
 	glViewport(0, 0, w, h);
 
-	glUseProgram(g_GLSL_prog);
-	int loc=glGetUniformLocation(g_GLSL_prog, "projection_matrix");
-	mat4 M;
-	M=Perspective(60.0f, (float)w/(float)h, 
+	g_frame.projection_matrix=Perspective(60.0f, (float)w/(float)h, 
 		0.01f*g_scene_size, 200.0f*g_scene_size);
-	glUniformMatrix4fv(loc, 1, GL_TRUE, M);
+
+	g_lod_viewport_scale=0.5f*h/tanf(30.0f*DegreesToRadians);
 }
 
 void mouse(int button, int state, int x, int y)
@@ -251,7 +420,8 @@ void mouse_motion(int x, int y)
 		g_camera.LookUp(dy);
 
 		//̽յƹԴ򣬺λͬ
-		glUniform4f(glGetUniformLocation(g_GLSL_prog, "spot_light.direction"), g_camera.GetNewFront().x, g_camera.GetNewFront().y, g_camera.GetNewFront().z, 0.0f);	//̽յƹԴ 
+		vec3 front = g_camera.GetNewFront();
+		g_frame.spot_light.direction = vec4(front.x, front.y, front.z, 0.0f);	//̽յƹԴ 
 
 		glutPostRedisplay();
 	
@@ -292,12 +462,27 @@ void keyboard(unsigned char key, int x, int y)
 		g_camera.MoveUp(-g_camera_step);
 		glutPostRedisplay();
 		break;
+	case 'l':
+	case 'L':
+		//򿪻رϸڲΣڱʾÿ֡Ƶ
+		g_lod_enabled=!g_lod_enabled;
+		glutPostRedisplay();
+		break;
 	}
 }
 
 int main(int argc, char **argv)
 {
 	glutInit(&argc, argv);
+
+	//-benchmark [n] [threads]ԸɶٶȣnǷֶ
+	//threads߳ĬΪӲ߳ͬʱ̵߳ĽԱ
+	if (argc >= 2 && strcmp(argv[1], "-benchmark") == 0)
+	{
+		CMesh::BenchmarkGenerators(argc >= 3 ? atoi(argv[2]) : 2048,
+			argc >= 4 ? atoi(argv[3]) : 0);
+		return 0;
+	}
 	glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH);
 
 	glutInitContextVersion(3, 3);
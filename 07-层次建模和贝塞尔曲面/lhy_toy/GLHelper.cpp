@@ -1,6 +1,8 @@
 #include "GL/glew.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "GLHelper.h"
 
 static char * ReadShaderSource(const char *file_name)
 // Read shader source codes from a file
@@ -291,4 +293,143 @@ GLuint InitShader(
 
 	// Return the program name (index)
 	return prog;
-}
\ No newline at end of file
+}
+
+CShaderProgram::CShaderProgram(void)
+{
+	prog=0;
+}
+
+void CShaderProgram::Init(const char *vShaderFile, const char *fShaderFile)
+// Initialize the program with InitShader and build the tables
+// The program is left as the current program, like InitShader does
+{
+	prog=InitShader(vShaderFile, fShaderFile);
+	Reflect();
+}
+
+void CShaderProgram::Reflect(void)
+// Build the tables of the active uniforms and uniform blocks of prog
+{
+	uniforms.clear();
+	blocks.clear();
+
+	GLint num_uniforms=0, max_name_len=0;
+	glGetProgramiv(prog, GL_ACTIVE_UNIFORMS, &num_uniforms);
+	glGetProgramiv(prog, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_name_len);
+	std::vector<char> name(max_name_len+1);
+	for (GLint i=0; i<num_uniforms; i++)
+	{
+		CUniform u;
+		GLsizei len=0;
+		glGetActiveUniform(prog, i, (GLsizei)name.size(), &len, &u.size, &u.type, &name[0]);
+		name[len]=0;
+
+		// Members of uniform blocks have no location; they are set through the buffer
+		u.location=glGetUniformLocation(prog, &name[0]);
+		if (u.location<0)
+			continue;
+
+		if (len>3 && strcmp(&name[len-3], "[0]")==0)
+			len-=3;
+		u.name.assign(&name[0], len);
+		u.has_value=false;
+		uniforms.push_back(u);
+	}
+
+	GLint num_blocks=0;
+	glGetProgramiv(prog, GL_ACTIVE_UNIFORM_BLOCKS, &num_blocks);
+	if (num_blocks>0)
+	{
+		glGetProgramiv(prog, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_name_len);
+		name.resize(max_name_len+1);
+	}
+	for (GLint i=0; i<num_blocks; i++)
+	{
+		CUniformBlock b;
+		GLsizei len=0;
+		glGetActiveUniformBlockName(prog, i, (GLsizei)name.size(), &len, &name[0]);
+		b.name.assign(&name[0], len);
+		b.index=i;
+		glGetActiveUniformBlockiv(prog, i, GL_UNIFORM_BLOCK_DATA_SIZE, &b.data_size);
+		blocks.push_back(b);
+	}
+}
+
+int CShaderProgram::GetHandle(const char *name) const
+// Return the handle of an active uniform, or -1 if the program does not use it
+// Like location -1 for glUniform*, handle -1 is ignored by the setters
+{
+	for (size_t i=0; i<uniforms.size(); i++)
+		if (uniforms[i].name==name)
+			return (int)i;
+	return -1;
+}
+
+int CShaderProgram::GetBlockSize(const char *name) const
+// Return the data size of an active uniform block, 0 if the program does not use it
+{
+	for (size_t i=0; i<blocks.size(); i++)
+		if (blocks[i].name==name)
+			return blocks[i].data_size;
+	return 0;
+}
+
+void CShaderProgram::SetBlockBinding(const char *name, GLuint binding)
+// Assign an active uniform block to a uniform buffer binding point
+{
+	for (size_t i=0; i<blocks.size(); i++)
+		if (blocks[i].name==name)
+			glUniformBlockBinding(prog, blocks[i].index, binding);
+}
+
+bool CShaderProgram::IsUnchanged(int handle, const void *value, int size)
+// Compare a value with the last uploaded one and remember it
+// Returns true if the upload can be skipped, also for handle -1
+{
+	if (handle<0)
+		return true;
+
+	CUniform& u=uniforms[handle];
+	if (u.has_value && memcmp(u.value, value, size)==0)
+		return true;
+	memcpy(u.value, value, size);
+	u.has_value=true;
+	return false;
+}
+
+void CShaderProgram::SetUniform(int handle, int value)
+{
+	if (!IsUnchanged(handle, &value, sizeof(value)))
+		glUniform1i(uniforms[handle].location, value);
+}
+
+void CShaderProgram::SetUniform(int handle, float value)
+{
+	if (!IsUnchanged(handle, &value, sizeof(value)))
+		glUniform1f(uniforms[handle].location, value);
+}
+
+void CShaderProgram::SetUniform(int handle, const vec3& value)
+{
+	if (!IsUnchanged(handle, &value, sizeof(value)))
+		glUniform3fv(uniforms[handle].location, 1, value);
+}
+
+void CShaderProgram::SetUniform(int handle, const vec4& value)
+{
+	if (!IsUnchanged(handle, &value, sizeof(value)))
+		glUniform4fv(uniforms[handle].location, 1, value);
+}
+
+void CShaderProgram::SetUniform(int handle, const mat3& value)
+{
+	if (!IsUnchanged(handle, &value, sizeof(value)))
+		glUniformMatrix3fv(uniforms[handle].location, 1, GL_TRUE, value);
+}
+
+void CShaderProgram::SetUniform(int handle, const mat4& value)
+{
+	if (!IsUnchanged(handle, &value, sizeof(value)))
+		glUniformMatrix4fv(uniforms[handle].location, 1, GL_TRUE, value);
+}
@@ -0,0 +1,273 @@
+#include "GasketSDF.h"
+#include <math.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+// Vertices of the canonical tetrahedron; vertex i is mapped to tetra_vertices[i]
+static const vec3 g_corners[4]={
+	vec3(1.0f, 1.0f, 1.0f),
+	vec3(-1.0f, -1.0f, 1.0f),
+	vec3(1.0f, -1.0f, -1.0f),
+	vec3(-1.0f, 1.0f, -1.0f),
+};
+
+// Face colors used by CMesh::DivideTetra; face i is opposite vertex i
+static const color4 g_base_colors[4]={
+	color4(1.0f, 0.0f, 0.0f, 1.0f),
+	color4(0.0f, 1.0f, 0.0f, 1.0f),
+	color4(0.0f, 0.0f, 1.0f, 1.0f),
+	color4(0.3f, 0.3f, 0.3f, 1.0f),
+};
+
+static mat4 AffineInverse(const mat4& M)
+// Return the inverse of an affine transformation matrix
+{
+	mat3 R=transpose(Normal(M));
+	vec3 t=R*vec3(M[0][3], M[1][3], M[2][3]);
+	return mat4(
+		vec4(R[0], -t.x),
+		vec4(R[1], -t.y),
+		vec4(R[2], -t.z),
+		vec4(0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+static mat3 LinearPart(const mat4& M)
+// Return the upper-left 3x3 block of M
+{
+	return mat3(
+		vec3(M[0][0], M[0][1], M[0][2]),
+		vec3(M[1][0], M[1][1], M[1][2]),
+		vec3(M[2][0], M[2][1], M[2][2]));
+}
+
+static mat4 AffineFromTetra(const vec3 v[4])
+// Return the affine transformation that takes the standard simplex
+//   (0,0,0), (1,0,0), (0,1,0), (0,0,1) to the tetrahedron v[0..3]
+{
+	vec3 e1=v[1]-v[0], e2=v[2]-v[0], e3=v[3]-v[0];
+	return mat4(
+		vec4(e1.x, e2.x, e3.x, v[0].x),
+		vec4(e1.y, e2.y, e3.y, v[0].y),
+		vec4(e1.z, e2.z, e3.z, v[0].z),
+		vec4(0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+CGasketSDF::CGasketSDF(void)
+{
+	subdivision_depth=0;
+	max_steps=128;
+}
+
+void CGasketSDF::Init(
+	const point3 tetra_vertices[4],
+	int subdivision_depth)
+// Set up the gasket
+// tetra_vertices:    (in) Tetrahedron vertices, as passed to CMesh::CreateGasket3D
+// subdivision_depth: (in) Maximum recursive subdivision depth
+{
+	this->subdivision_depth=subdivision_depth;
+
+	// Go through the standard simplex to map the tetrahedron onto the canonical one
+	canonical_from_object=
+		AffineFromTetra(g_corners)*
+		AffineInverse(AffineFromTetra(tetra_vertices));
+}
+
+float CGasketSDF::Distance(const vec3& p_in, int& face, const vec3& dir) const
+// Return a lower bound of the distance from p to the gasket
+// p: (in) Point in canonical coordinates
+// face: (out) Index of the nearest face
+// dir: (in) Ray direction; only faces facing the ray are considered, all if zero
+{
+	// label[k] is the original vertex currently folded onto corner k
+	int label[4]={0, 1, 2, 3};
+	int tmp;
+	float t;
+	vec3 p=p_in;
+	float s=1.0f;
+	for (int i=0; i<subdivision_depth; ++i)
+	{
+		// Fold the other three corner tetrahedra onto the one at corner 0
+		if (p.x+p.y<0.0f)
+		{
+			t=-p.x; p.x=-p.y; p.y=t;
+			tmp=label[0]; label[0]=label[1]; label[1]=tmp;
+		}
+		if (p.x+p.z<0.0f)
+		{
+			t=-p.x; p.x=-p.z; p.z=t;
+			tmp=label[0]; label[0]=label[3]; label[3]=tmp;
+		}
+		if (p.y+p.z<0.0f)
+		{
+			t=-p.y; p.y=-p.z; p.z=t;
+			tmp=label[0]; label[0]=label[2]; label[2]=tmp;
+		}
+
+		// Scale the corner tetrahedron back to full size
+		p=2.0f*p-vec3(1.0f, 1.0f, 1.0f);
+		s*=0.5f;
+	}
+
+	// Signed distance to the faces of the tetrahedron reached at the finest level
+	float d=-1e30f;
+	int k=0;
+	for (int i=0; i<4; ++i)
+	{
+		float di=-1.0f-dot(g_corners[i], p);
+		if (di>d && dot(g_corners[label[i]], dir)>=0.0f) { d=di; k=i; }
+	}
+	face=label[k];
+	return d*s*0.57735027f;
+}
+
+mat4 CGasketSDF::GetCanonicalFromEye(const mat4& model_view_matrix) const
+// Return the matrix that transforms eye coordinates to canonical coordinates
+// model_view_matrix: (in) Object to eye transformation
+{
+	return canonical_from_object*AffineInverse(model_view_matrix);
+}
+
+float CGasketSDF::GetStepScale(const mat4& canonical_from_eye)
+// Return the factor that converts canonical distances to eye distances
+// canonical_from_eye: (in) Matrix returned by GetCanonicalFromEye
+{
+	// A canonical distance d corresponds to an eye distance of at least d/|L|,
+	//   where |L| is the largest singular value of the linear part L
+	// Estimate it by power iteration on L^T*L
+	mat3 L=LinearPart(canonical_from_eye);
+	mat3 LTL=transpose(L)*L;
+	vec3 v(0.577f, 0.578f, 0.576f);
+	for (int i=0; i<32; ++i)
+		v=normalize(LTL*v);
+	float sigma=length(L*v);
+
+	// Power iteration approaches sigma from below, so keep a small margin
+	return 0.95f/sigma;
+}
+
+vec3 CGasketSDF::GetFaceNormal(int face)
+// Return the outward normal of face 'face' in canonical coordinates
+{
+	return -g_corners[face];
+}
+
+void CGasketSDF::RenderReference(
+	const mat4& model_matrix, const mat4& view_matrix,
+	float fovy, int width, int height,
+	const CGasketLighting& lighting,
+	unsigned char *rgb, int num_threads) const
+// Ray-march the gasket on the CPU, following gasket_raymarch-fs.txt
+// model_matrix, view_matrix: (in) Model and view matrices
+// fovy: (in) Vertical field of view in degrees, as passed to Perspective
+// width, height: (in) Image size
+// lighting: (in) Lighting and material parameters
+// rgb: (out) RGB image of width*height*3 bytes, top row first
+// num_threads: (in) The number of worker threads
+{
+	const int tile_size=16;
+
+	mat4 canonical_from_eye=GetCanonicalFromEye(view_matrix*model_matrix);
+	float step_scale=GetStepScale(canonical_from_eye);
+	vec3 origin(
+		canonical_from_eye[0][3], canonical_from_eye[1][3], canonical_from_eye[2][3]);
+	mat3 L_matrix=LinearPart(canonical_from_eye);
+	mat3 N_matrix=transpose(L_matrix); // Inverse transpose of the canonical to eye matrix
+	vec4 P_light_eye=view_matrix*lighting.light_position;
+
+	float tan_half=tanf(0.5f*fovy*DegreesToRadians);
+	float aspect=(float)width/(float)height;
+	float pixel_angle=2.0f*tan_half/(float)height;
+
+	int tiles_x=(width+tile_size-1)/tile_size;
+	int tiles_y=(height+tile_size-1)/tile_size;
+	std::atomic<int> next_tile(0);
+
+	auto worker=[&](void)
+	{
+		int tile;
+		while ((tile=next_tile++)<tiles_x*tiles_y)
+		{
+			int x0=(tile%tiles_x)*tile_size, y0=(tile/tiles_x)*tile_size;
+			for (int y=y0; y<y0+tile_size && y<height; ++y)
+				for (int x=x0; x<x0+tile_size && x<width; ++x)
+				{
+					unsigned char *pixel=rgb+3*(y*width+x);
+					pixel[0]=pixel[1]=pixel[2]=0;
+
+					// Eye ray through the pixel center
+					vec3 dir_eye=normalize(vec3(
+						(2.0f*(x+0.5f)/width-1.0f)*tan_half*aspect,
+						(1.0f-2.0f*(y+0.5f)/height)*tan_half,
+						-1.0f));
+					vec3 dir=L_matrix*dir_eye;
+
+					// Clip the ray against the bounding tetrahedron
+					float t=0.0f, t_exit=1e30f;
+					for (int i=0; i<4; ++i)
+					{
+						float a=dot(g_corners[i], dir);
+						float b=(-1.0f-dot(g_corners[i], origin))/a;
+						if (a>0.0f)
+						{
+							if (b>t) t=b;
+						}
+						else if (a<0.0f)
+						{
+							if (b<t_exit) t_exit=b;
+						}
+					}
+
+					// March until the distance drops below the pixel footprint
+					int face=0;
+					bool hit=false;
+					for (int i=0; i<max_steps && t<t_exit; ++i)
+					{
+						float d=step_scale*Distance(origin+t*dir, face);
+						if (d<pixel_angle*t)
+						{
+							hit=true;
+							break;
+						}
+						t+=d;
+					}
+					if (!hit) continue;
+
+					// Pick the hit face among the faces that face the ray
+					Distance(origin+t*dir, face, dir);
+
+					// Phong lighting, as in final-fs.txt
+					vec3 P_eye=t*dir_eye;
+					vec3 N=normalize(N_matrix*GetFaceNormal(face));
+					vec3 L=normalize(vec3(P_light_eye.x, P_light_eye.y, P_light_eye.z)-P_eye);
+					vec3 V=-dir_eye;
+					vec3 R=2.0f*dot(N, L)*N-L;
+
+					float diffuse_factor=fmaxf(dot(L, N), 0.0f);
+					float specular_factor=powf(fmaxf(dot(V, R), 0.0f), lighting.shininess);
+
+					color4 color_t=
+						lighting.diffuse_reflectivity*lighting.ambient_light_color
+						+lighting.diffuse_reflectivity*lighting.light_color*diffuse_factor
+						+lighting.specular_reflectivity*lighting.light_color*specular_factor;
+					color4 color=g_base_colors[face]*lighting.base_color*color_t;
+
+					for (int i=0; i<3; ++i)
+						pixel[i]=(unsigned char)(255.0f*fminf(fmaxf(color[i], 0.0f), 1.0f)+0.5f);
+				}
+		}
+	};
+
+	if (num_threads<=0)
+		num_threads=(int)std::thread::hardware_concurrency();
+	if (num_threads<=0)
+		num_threads=1;
+
+	std::vector<std::thread> threads;
+	for (int i=1; i<num_threads; ++i)
+		threads.push_back(std::thread(worker));
+	worker();
+	for (size_t i=0; i<threads.size(); ++i)
+		threads[i].join();
+}
@@ -0,0 +1,75 @@
+#ifndef _GASKET_SDF_H_
+#define _GASKET_SDF_H_
+
+#include "vec.h"
+#include "mat.h"
+
+// Phong lighting parameters, same meaning as the uniforms in final-fs.txt
+class CGasketLighting
+{
+public:
+	color4 ambient_light_color;   // Ambient light intensity
+	point4 light_position;        // Light position in world coordinates
+	color4 light_color;           // Light intensity
+	color4 base_color;            // Base color
+	color4 diffuse_reflectivity;  // kd (ka)
+	color4 specular_reflectivity; // ks
+	float shininess;              // Specular exponent
+};
+
+// 3D gasket represented by the tetrahedral-fold distance estimator
+// The gasket is ray-marched instead of being tessellated, so its cost no longer
+//   grows as 4^depth like CMesh::CreateGasket3D
+class CGasketSDF
+{
+public:
+	mat4 canonical_from_object; // Object coordinates to canonical tetrahedron coordinates
+	int subdivision_depth;      // Maximum recursive subdivision depth
+	int max_steps;              // Maximum number of ray marching steps
+
+	CGasketSDF(void);
+
+	void Init(
+		const point3 tetra_vertices[4],
+		int subdivision_depth);
+	// Set up the gasket
+	// tetra_vertices:    (in) Tetrahedron vertices, as passed to CMesh::CreateGasket3D
+	// subdivision_depth: (in) Maximum recursive subdivision depth
+
+	float Distance(const vec3& p, int& face,
+		const vec3& dir=vec3(0.0f, 0.0f, 0.0f)) const;
+	// Return a lower bound of the distance from p to the gasket
+	// p: (in) Point in canonical coordinates
+	// face: (out) Index of the nearest face, which has the same color as
+	//             face 'face' of the tetrahedra generated by CMesh::DivideTetra
+	// dir: (in) Ray direction; only faces facing the ray are considered
+	//           Zero considers all faces
+
+	mat4 GetCanonicalFromEye(const mat4& model_view_matrix) const;
+	// Return the matrix that transforms eye coordinates to canonical coordinates
+	// model_view_matrix: (in) Object to eye transformation
+
+	static float GetStepScale(const mat4& canonical_from_eye);
+	// Return the factor that converts canonical distances to eye distances
+	// canonical_from_eye: (in) Matrix returned by GetCanonicalFromEye
+
+	static vec3 GetFaceNormal(int face);
+	// Return the outward normal of face 'face' in canonical coordinates
+
+	void RenderReference(
+		const mat4& model_matrix, const mat4& view_matrix,
+		float fovy, int width, int height,
+		const CGasketLighting& lighting,
+		unsigned char *rgb, int num_threads=0) const;
+	// Ray-march the gasket on the CPU, following gasket_raymarch-fs.txt
+	// The image is split into tiles that are shared by the worker threads
+	// model_matrix, view_matrix: (in) Model and view matrices
+	// fovy: (in) Vertical field of view in degrees, as passed to Perspective
+	// width, height: (in) Image size
+	// lighting: (in) Lighting and material parameters
+	// rgb: (out) RGB image of width*height*3 bytes, top row first
+	// num_threads: (in) The number of worker threads
+	//              0 indicates that the number of hardware threads is used
+};
+
+#endif
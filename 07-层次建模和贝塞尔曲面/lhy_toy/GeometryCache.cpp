@@ -0,0 +1,189 @@
+#include "GeometryCache.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+CGeometryKey::CGeometryKey(const char *generator)
+// Start a key
+// generator: (in) Name of the generator
+{
+	hash=14695981039346656037ULL; // FNV-1a offset basis
+	unsigned int version=GEOMETRY_CACHE_VERSION;
+	Add(&version, sizeof(version));
+	Add(generator, strlen(generator)+1);
+}
+
+void CGeometryKey::Add(const void *data, size_t size)
+{
+	const unsigned char *p=(const unsigned char *)data;
+	for (size_t i=0; i<size; ++i)
+	{
+		hash^=p[i];
+		hash*=1099511628211ULL; // FNV-1a prime
+	}
+}
+
+void CGeometryKey::Add(int value)
+{
+	Add(&value, sizeof(value));
+}
+
+void CGeometryKey::Add(float value)
+{
+	Add(&value, sizeof(value));
+}
+
+bool CGeometryKey::AddFile(const char *filename)
+// Add the contents of a file; returns false if it cannot be read
+{
+	FILE *fp=fopen(filename, "rb");
+	if (fp==NULL)
+		return false;
+	unsigned char buffer[65536];
+	size_t n;
+	while ((n=fread(buffer, 1, sizeof(buffer), fp))>0)
+		Add(buffer, n);
+	fclose(fp);
+	return true;
+}
+
+static std::string GetCacheFileName(const char *directory, unsigned long long key, const char *extension)
+{
+	char name[32];
+	sprintf(name, "/%016llx.%s", key, extension);
+	return std::string(directory)+name;
+}
+
+CGeometryCacheFile::CGeometryCacheFile(void)
+{
+	data=NULL;
+	size=0;
+	file_handle=mapping_handle=NULL;
+}
+
+CGeometryCacheFile::~CGeometryCacheFile(void)
+{
+	Close();
+}
+
+bool CGeometryCacheFile::Open(const char *directory, unsigned long long key)
+// Map the file of a key and check its header and size
+{
+	Close();
+	std::string filename=GetCacheFileName(directory, key, "geo");
+
+#ifdef _WIN32
+	HANDLE file=CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file==INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file, &file_size);
+	HANDLE mapping=CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping==NULL)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	file_handle=file;
+	mapping_handle=mapping;
+	size=(size_t)file_size.QuadPart;
+	data=MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	int fd=open(filename.c_str(), O_RDONLY);
+	if (fd<0)
+		return false;
+	struct stat st;
+	fstat(fd, &st);
+	size=(size_t)st.st_size;
+	data=size>0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (data==MAP_FAILED)
+		data=NULL;
+#endif
+
+	// Reject files of other versions or keys and files whose size does not match
+	const CGeometryCacheHeader *header=(const CGeometryCacheHeader *)data;
+	if (data==NULL || size<sizeof(CGeometryCacheHeader) ||
+		memcmp(header->magic, "GEOC", 4)!=0 || header->version!=GEOMETRY_CACHE_VERSION ||
+		header->key!=key || header->num_vertices<0 || header->num_indices<0 ||
+		size!=sizeof(CGeometryCacheHeader)+
+			(size_t)header->num_vertices*header->vertex_size+
+			(size_t)header->num_indices*sizeof(GLuint))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void CGeometryCacheFile::Close(void)
+{
+#ifdef _WIN32
+	if (data!=NULL)
+		UnmapViewOfFile(data);
+	if (mapping_handle!=NULL)
+		CloseHandle((HANDLE)mapping_handle);
+	if (file_handle!=NULL)
+		CloseHandle((HANDLE)file_handle);
+#else
+	if (data!=NULL)
+		munmap(data, size);
+#endif
+	data=NULL;
+	size=0;
+	file_handle=mapping_handle=NULL;
+}
+
+bool WriteGeometryCacheFile(
+	const char *directory, const CGeometryCacheHeader& header,
+	const void *vertices, const GLuint *indices)
+// Write a cache file, creating the directory if necessary
+// The file is written under a temporary name and then renamed, so that a
+//   partly written file is never found
+// directory: (in) Cache directory
+// header: (in) Header; key, counts and vertex_size describe the arrays
+// vertices, indices: (in) Vertex and index arrays; indices may be NULL if
+//                    header.num_indices is 0
+{
+#ifdef _WIN32
+	_mkdir(directory);
+#else
+	mkdir(directory, 0755);
+#endif
+
+	std::string temp_name=GetCacheFileName(directory, header.key, "tmp");
+	std::string filename=GetCacheFileName(directory, header.key, "geo");
+	FILE *fp=fopen(temp_name.c_str(), "wb");
+	if (fp==NULL)
+		return false;
+
+	size_t vertex_bytes=(size_t)header.num_vertices*header.vertex_size;
+	size_t index_bytes=(size_t)header.num_indices*sizeof(GLuint);
+	bool ok=fwrite(&header, sizeof(header), 1, fp)==1;
+	if (ok && vertex_bytes>0)
+		ok=fwrite(vertices, vertex_bytes, 1, fp)==1;
+	if (ok && index_bytes>0)
+		ok=fwrite(indices, index_bytes, 1, fp)==1;
+	if (fclose(fp)!=0)
+		ok=false;
+
+	// rename does not replace an existing file on Windows
+	remove(filename.c_str());
+	if (!ok || rename(temp_name.c_str(), filename.c_str())!=0)
+	{
+		remove(temp_name.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,89 @@
+#ifndef _GEOMETRY_CACHE_H_
+#define _GEOMETRY_CACHE_H_
+
+#include "GL/glew.h"
+#include "MeshOptimizer.h"
+#include <stddef.h>
+
+// Generated meshes are stored in a directory, one binary file per mesh named after
+//   the 64-bit key of the generator call: a CGeometryCacheHeader followed by the
+//   vertex array and the index array
+// Bump GEOMETRY_CACHE_VERSION whenever a generator or CMeshVertex changes, so that
+//   old files are no longer found
+#define GEOMETRY_CACHE_VERSION 3
+
+// Hash of a generator call: its name, parameters and input files (FNV-1a)
+class CGeometryKey
+{
+public:
+	unsigned long long hash;
+
+	CGeometryKey(const char *generator);
+	// Start a key
+	// generator: (in) Name of the generator
+
+	void Add(const void *data, size_t size);
+	void Add(int value);
+	void Add(float value);
+	// Add a parameter
+
+	bool AddFile(const char *filename);
+	// Add the contents of a file; returns false if it cannot be read
+};
+
+struct CGeometryCacheHeader
+{
+	char magic[4];          // "GEOC"
+	unsigned int version;   // GEOMETRY_CACHE_VERSION
+	unsigned long long key; // CGeometryKey::hash
+	unsigned int vertex_size; // sizeof(CMeshVertex)
+	unsigned int primitive_type;
+	int num_vertices, num_indices;
+	int original_num_vertices, original_num_indices; // CMesh statistics
+	CVertexCacheStats cache_stats[2];
+	float lod_error;        // CMesh::lod_error
+	int num_simplified_lods; // The number of simplified coarser levels of detail, stored
+	                         //   under the key of the call followed by their level
+};
+
+// Read-only view of a cache file mapped into memory
+class CGeometryCacheFile
+{
+protected:
+	void *data;        // Start of the mapping
+	size_t size;       // Size of the mapping in bytes
+	void *file_handle, *mapping_handle; // Platform handles of the mapping
+
+public:
+	CGeometryCacheFile(void);
+	~CGeometryCacheFile(void);
+
+	bool Open(const char *directory, unsigned long long key);
+	// Map the file of a key and check its header and size
+
+	void Close(void);
+
+	const CGeometryCacheHeader& GetHeader(void) const
+	{ return *(const CGeometryCacheHeader *)data; }
+
+	const void *GetVertices(void) const
+	{ return (const char *)data+sizeof(CGeometryCacheHeader); }
+
+	const GLuint *GetIndices(void) const
+	{ return (const GLuint *)((const char *)GetVertices()+
+		(size_t)GetHeader().num_vertices*GetHeader().vertex_size); }
+	// Arrays in the mapping; the index array is empty for meshes without indices
+};
+
+bool WriteGeometryCacheFile(
+	const char *directory, const CGeometryCacheHeader& header,
+	const void *vertices, const GLuint *indices);
+// Write a cache file, creating the directory if necessary
+// The file is written under a temporary name and then renamed, so that a
+//   partly written file is never found
+// directory: (in) Cache directory
+// header: (in) Header; key, counts and vertex_size describe the arrays
+// vertices, indices: (in) Vertex and index arrays; indices may be NULL if
+//                    header.num_indices is 0
+
+#endif
@@ -1,6 +1,7 @@
 #include "ImageLib.h"
 #include "FreeImage.h"
 #include "GL/glew.h"
+#include "ScratchArena.h"
 
 unsigned int LoadTexture2DFromFile(const char *file_name)
 // Create a 2D texture object and load its image from an image file
@@ -165,7 +166,8 @@ unsigned int LoadBumpMap2DFromHeightMapFile(const char *file_name)
 	BYTE *height_image=FreeImage_GetBits(img);
 
 	// Create a bump map image
-	float *bump_image=new float [image_width*image_height*3];
+	CScratchScope scratch;
+	float *bump_image=scratch.Allocate<float>(image_width*image_height*3);
 
 	// Set pixel values of the bump map image using
 	//   finite differences of pixel values of the height map image
@@ -221,8 +223,64 @@ unsigned int LoadBumpMap2DFromHeightMapFile(const char *file_name)
 	// Delete the height map image
 	FreeImage_Unload(img);
 
-	// Delete the bump map image
-	delete [] bump_image;
+	// Return the texture object name (index)
+	return itex;
+}
+
+unsigned int CreateTexture2DArrayFromTextures(
+	const unsigned int *textures, int num_textures, int size)
+// Create a 2D array texture object whose layers are 2D textures scaled to size x size
+// Each texture is scaled from its smallest mipmap level that is at least size x size,
+//   so that the linear filter of the blit does not skip texels
+// textures: (in) Names of the 2D texture objects, one per layer
+// num_textures: (in) The number of textures
+// size: (in) Width and height of the layers
+// Return value: Name (index) of the texture object
+{
+	// Create a texture object
+	unsigned int itex;
+	glGenTextures(1, &itex);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, itex);
+
+	// Set texture filtering parameters
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+	// Set texture wrapping modes
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8,
+		size, size, num_textures, 0,
+		GL_RGB, GL_UNSIGNED_BYTE, NULL);
+
+	// Blit each texture into its layer through two framebuffer objects
+	GLuint framebuffers[2];
+	glGenFramebuffers(2, framebuffers);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+	for (int i=0; i<num_textures; ++i)
+	{
+		GLint width, height, level=0;
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+		while ((width>>(level+1))>=size && (height>>(level+1))>=size)
+			++level;
+
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, textures[i], level);
+		glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			itex, 0, i);
+		glBlitFramebuffer(0, 0, width>>level, height>>level, 0, 0, size, size,
+			GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(2, framebuffers);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// Generate mipmaps
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
 
 	// Return the texture object name (index)
 	return itex;
@@ -18,4 +18,12 @@ unsigned int LoadBumpMap2DFromHeightMapFile(const char *file_name);
 // file_name: (in) Height map image file name string
 // Return value: Name (index) of the texture object
 
+unsigned int CreateTexture2DArrayFromTextures(
+	const unsigned int *textures, int num_textures, int size);
+// Create a 2D array texture object whose layers are 2D textures scaled to size x size
+// textures: (in) Names of the 2D texture objects, one per layer
+// num_textures: (in) The number of textures
+// size: (in) Width and height of the layers
+// Return value: Name (index) of the texture object
+
 #endif
@@ -0,0 +1,138 @@
+#include "IndirectDraw.h"
+
+CIndirectDrawList::CIndirectDrawList(void)
+{
+	command_buffer_obj=0;
+	draw_buffer_obj=0;
+	num_draws=0;
+	num_calls=0;
+}
+
+bool CIndirectDrawList::IsIndirectDrawSupported(void)
+// Return true if the current context has what Submit and the shaders need
+// Multi-draw indirect and shader storage buffers are core in OpenGL 4.3, and
+//   gl_DrawID comes from GL_ARB_shader_draw_parameters (core in 4.6)
+{
+	return GLEW_VERSION_4_3 && GLEW_ARB_shader_draw_parameters;
+}
+
+void CIndirectDrawList::Clear(void)
+// Remove all draws, keeping the memory for the next frame
+{
+	for (size_t i=0; i<groups.size(); ++i)
+	{
+		groups[i].commands.clear();
+		groups[i].draws.clear();
+	}
+}
+
+void CIndirectDrawList::Add(const CMesh& mesh, const CDrawData& data)
+// Add a draw of a mesh in CMesh::arena with its per-draw data
+{
+	const CMeshArenaBlock& block=mesh.arena_block;
+	if (block.arena!=&CMesh::arena)
+		return;
+
+	GLenum index_type=block.num_indices!=0 ? block.index_type : 0;
+	size_t i;
+	for (i=0; i<groups.size(); ++i)
+		if (groups[i].primitive_type==mesh.primitive_type && groups[i].index_type==index_type)
+			break;
+	if (i==groups.size())
+	{
+		groups.push_back(CGroup());
+		groups[i].primitive_type=mesh.primitive_type;
+		groups[i].index_type=index_type;
+	}
+
+	// The offsets of index ranges are multiples of 4 bytes, so they are whole indices
+	CCommand command;
+	if (index_type==0)
+	{
+		command.count=block.num_vertices;
+		command.instance_count=1;
+		command.first_index=block.base_vertex;
+		command.base_vertex=0;
+	}
+	else
+	{
+		command.count=block.num_indices;
+		command.instance_count=1;
+		command.first_index=(GLuint)(block.index_offset/(index_type==GL_UNSIGNED_SHORT ? 2 : 4));
+		command.base_vertex=block.base_vertex;
+	}
+	command.base_instance=0;
+	groups[i].commands.push_back(command);
+	groups[i].draws.push_back(data);
+}
+
+void CIndirectDrawList::Submit(GLint draw_offset_location)
+// Upload the draws and submit them, one multi-draw call per group
+// draw_offset_location: (in) Location of the uniform int that the shaders add
+//                       to gl_DrawID, which restarts at 0 in every call
+{
+	size_t i;
+	num_draws=0;
+	num_calls=0;
+	for (i=0; i<groups.size(); ++i)
+		num_draws+=(int)groups[i].commands.size();
+	if (num_draws==0)
+		return;
+
+	if (command_buffer_obj==0)
+	{
+		glGenBuffers(1, &command_buffer_obj);
+		glGenBuffers(1, &draw_buffer_obj);
+	}
+
+	// Both buffers are respecified every frame, so the driver can hand out new
+	//   memory instead of waiting for the draws of the previous frame
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer_obj);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(CCommand)*num_draws, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, draw_buffer_obj);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(CDrawData)*num_draws, NULL, GL_STREAM_DRAW);
+	int first=0;
+	for (i=0; i<groups.size(); ++i)
+	{
+		int n=(int)groups[i].commands.size();
+		if (n==0)
+			continue;
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, sizeof(CCommand)*first,
+			sizeof(CCommand)*n, &groups[i].commands[0]);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(CDrawData)*first,
+			sizeof(CDrawData)*n, &groups[i].draws[0]);
+		first+=n;
+	}
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, draw_buffer_obj);
+
+	glBindVertexArray(CMesh::arena.vertex_array_obj);
+	first=0;
+	for (i=0; i<groups.size(); ++i)
+	{
+		int n=(int)groups[i].commands.size();
+		if (n==0)
+			continue;
+		glUniform1i(draw_offset_location, first);
+		const GLvoid *commands=(const GLvoid *)(sizeof(CCommand)*first);
+		if (groups[i].index_type==0)
+			glMultiDrawArraysIndirect(groups[i].primitive_type, commands, n, sizeof(CCommand));
+		else
+			glMultiDrawElementsIndirect(groups[i].primitive_type, groups[i].index_type,
+				commands, n, sizeof(CCommand));
+		first+=n;
+		++num_calls;
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void CIndirectDrawList::ReleaseGLResources(void)
+// Delete the buffers
+{
+	if (command_buffer_obj!=0)
+	{
+		glDeleteBuffers(1, &command_buffer_obj);
+		glDeleteBuffers(1, &draw_buffer_obj);
+	}
+	command_buffer_obj=0;
+	draw_buffer_obj=0;
+}
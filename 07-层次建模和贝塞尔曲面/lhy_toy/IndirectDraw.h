@@ -0,0 +1,87 @@
+#ifndef _INDIRECT_DRAW_H_
+#define _INDIRECT_DRAW_H_
+
+#include "GL/glew.h"
+#include "vec.h"
+#include "mat.h"
+#include "Mesh.h"
+#include <vector>
+
+// Submission of a whole scene with a few glMultiDraw*Indirect calls
+// Every object adds a draw command for the ranges of its mesh in CMesh::arena and the
+//   data that the shaders used to read from uniforms; Submit uploads the data to a
+//   shader storage buffer and the commands to an indirect buffer, and the shaders
+//   fetch the data of a draw with draw_offset+gl_DrawID
+// A multi-draw call has one primitive type and one index type, so the commands are
+//   grouped by them: meshes without indices, with 16-bit and with 32-bit indices are
+//   drawn by up to three calls, however many objects there are
+// Needs OpenGL 4.3 and GL_ARB_shader_draw_parameters; see IsIndirectDrawSupported
+
+// Per-draw data in the std430 layout of the shaders, with row-major matrices like the
+//   ones passed to glUniformMatrix4fv with transpose set
+struct CDrawData
+{
+	mat4 model_matrix;
+	mat4 normal_matrix;  // Normal matrix in the upper-left 3x3 part
+	color4 base_color;
+	color4 diffuse_reflectivity;
+	color4 specular_reflectivity;
+	float shininess;
+	int texture_layer;   // Layer of the diffuse texture array, -1 for no texture
+	int padding[2];
+};
+
+class CIndirectDrawList
+{
+protected:
+	// Command of glMultiDrawElementsIndirect; meshes without indices use the first
+	//   four members as the command of glMultiDrawArraysIndirect
+	//   (count, instance count, first vertex, base instance)
+	struct CCommand
+	{
+		GLuint count;
+		GLuint instance_count;
+		GLuint first_index;
+		GLint base_vertex;
+		GLuint base_instance;
+	};
+
+	// Draws that one multi-draw call submits
+	struct CGroup
+	{
+		GLenum primitive_type;
+		GLenum index_type; // 0 for meshes without indices
+		std::vector<CCommand> commands;
+		std::vector<CDrawData> draws;
+	};
+
+	std::vector<CGroup> groups; // Kept from frame to frame with their memory
+	GLuint command_buffer_obj;  // OpenGL indirect buffer object
+	GLuint draw_buffer_obj;     // OpenGL shader storage buffer object
+
+public:
+	int num_draws; // The numbers of draws and of multi-draw calls of the last Submit
+	int num_calls;
+
+	CIndirectDrawList(void);
+
+	static bool IsIndirectDrawSupported(void);
+	// Return true if the current context has what Submit and the shaders need
+
+	void Clear(void);
+	// Remove all draws, keeping the memory for the next frame
+
+	void Add(const CMesh& mesh, const CDrawData& data);
+	// Add a draw of a mesh in CMesh::arena with its per-draw data
+
+	void Submit(GLint draw_offset_location);
+	// Upload the draws and submit them, one multi-draw call per group
+	// The draw data buffer is bound to shader storage binding 0
+	// draw_offset_location: (in) Location of the uniform int that the shaders add
+	//                       to gl_DrawID, which restarts at 0 in every call
+
+	void ReleaseGLResources(void);
+	// Delete the buffers
+};
+
+#endif
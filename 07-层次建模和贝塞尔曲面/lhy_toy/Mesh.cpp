@@ -1,5 +1,10 @@
 #include <stddef.h>
 #include "Mesh.h"
+#include "ScratchArena.h"
+#include <string.h>
+#include <float.h>
+#include <vector>
+#include <algorithm>
 
 #include <fstream>
 #include <iostream>
@@ -101,63 +106,236 @@ void CMesh::DivideTetra(
 CMesh::CMesh(void)
 {
 	primitive_type=GL_TRIANGLES;
+	optimize_flags=0;
+	weld_tolerance.position=1e-5f;
+	weld_tolerance.color=1.0f/512.0f;
+	weld_tolerance.normal=1e-3f;
+	weld_tolerance.texcoord=1e-5f;
+	cache_stats[0].acmr=cache_stats[0].atvr=0.0f;
+	cache_stats[1]=cache_stats[0];
+	original_num_vertices=0;
+	original_num_indices=0;
 	num_vertices=0;
 	num_indices=0;
-	vertex_array_obj=0;
-	vertex_buffer_obj=0;
-	index_buffer_obj=0;
+	bound_center=vec3(0.0f);
+	bound_radius=0.0f;
+	coarser_lod=NULL;
+	lod_levels=1;
+	lod_error=0.0f;
+	lod_simplify=false;
 }
 
 void CMesh::ReleaseGLResources(void)
 // Release OpenGL resources
 {
-	if (vertex_array_obj!=0)
-		glDeleteVertexArrays(1, &vertex_array_obj);
-	vertex_array_obj=0;
+	arena.Free(arena_block);
 
-	if (vertex_buffer_obj!=0)
-		glDeleteBuffers(1, &vertex_buffer_obj);
-	vertex_buffer_obj=0;
-
-	if (index_buffer_obj!=0)
-		glDeleteBuffers(1, &index_buffer_obj);
-	index_buffer_obj=0;
+	if (coarser_lod!=NULL)
+	{
+		coarser_lod->ReleaseGLResources();
+		delete coarser_lod;
+	}
+	coarser_lod=NULL;
 }
 
 void CMesh::Draw(void)
 // Draw the mesh
 {
-	glBindVertexArray(vertex_array_obj);
-	if (index_buffer_obj==0)
-		glDrawArrays(primitive_type, 0, num_vertices);
-	else
-		glDrawElements(primitive_type, num_indices, 
-			GL_UNSIGNED_INT, (GLvoid *)0);
-	glBindVertexArray(0);
+	if (arena_block.arena!=NULL)
+		arena.Draw(arena_block, primitive_type);
+}
+
+int CMesh::GetNumTriangles(void) const
+// Return the number of triangles drawn by Draw
+{
+	if (primitive_type!=GL_TRIANGLES)
+		return 0;
+	return (arena_block.num_indices!=0 ? num_indices : num_vertices)/3;
+}
+
+CMesh *CMesh::CreateCoarserLOD(void)
+// Attach a new empty mesh as the next coarser level of detail and return it
+// Returns NULL if lod_levels does not allow another level
+{
+	if (lod_levels<=1)
+		return NULL;
+
+	if (coarser_lod!=NULL)
+	{
+		coarser_lod->ReleaseGLResources();
+		delete coarser_lod;
+	}
+	coarser_lod=new CMesh;
+	coarser_lod->lod_levels=lod_levels-1;
+	coarser_lod->optimize_flags=optimize_flags;
+	coarser_lod->weld_tolerance=weld_tolerance;
+	return coarser_lod;
+}
+
+CMesh& CMesh::GetLOD(int level)
+// Return a level of detail, 0 for the mesh itself
+{
+	CMesh *mesh=this;
+	for (; level>0 && mesh->coarser_lod!=NULL; --level)
+		mesh=mesh->coarser_lod;
+	return *mesh;
+}
+
+int CMesh::SelectLOD(const mat4& model_view_matrix, float viewport_scale,
+	float max_pixel_error, int current_lod, float hysteresis) const
+// Return the coarsest level of detail whose error stays within max_pixel_error on the screen
+// model_view_matrix: (in) Matrix from object to eye coordinates
+// viewport_scale: (in) Pixels per unit at distance 1
+// max_pixel_error: (in) Largest allowed error in pixels
+// current_lod: (in) Level of detail drawn in the previous frame
+// hysteresis: (in) Fraction of max_pixel_error for switching to a coarser level
+{
+	if (coarser_lod==NULL)
+		return 0;
+
+	// Bounding sphere in eye coordinates, scaled by the largest scale of the matrix
+	vec4 center=model_view_matrix*vec4(bound_center, 1.0f);
+	float scale=0.0f;
+	for (int j=0; j<3; ++j)
+	{
+		vec3 axis(model_view_matrix[0][j], model_view_matrix[1][j], model_view_matrix[2][j]);
+		if (length(axis)>scale)
+			scale=length(axis);
+	}
+	float distance=length(vec3(center.x, center.y, center.z));
+	float radius=scale*bound_radius;
+
+	// The finest level is drawn when the camera is inside the bounding sphere
+	if (distance<=radius)
+		return 0;
+
+	// Pixels per object unit at the nearest point of the bounding sphere; the
+	//   bounding sphere covers bound_radius*pixels_per_unit pixels on the screen
+	float pixels_per_unit=viewport_scale*scale/(distance-radius);
+
+	// max_level is the coarsest level within max_pixel_error and min_level the coarsest
+	//   one within hysteresis*max_pixel_error; the current level is kept between them
+	int level=0, min_level=0, max_level=0;
+	for (const CMesh *mesh=this; mesh!=NULL; mesh=mesh->coarser_lod, ++level)
+	{
+		float pixel_error=mesh->lod_error*pixels_per_unit;
+		if (pixel_error<=max_pixel_error)
+			max_level=level;
+		if (pixel_error<=hysteresis*max_pixel_error)
+			min_level=level;
+	}
+	if (current_lod<min_level)
+		return min_level;
+	if (current_lod>max_level)
+		return max_level;
+	return current_lod;
+}
+
+void CMesh::Optimize(CMeshVertex *vertices, GLuint *indices)
+// Clean up and reorder the triangles and vertices of an indexed triangle mesh
+// vertices: (in and out) Vertex array
+// indices: (in and out) Index array
+// Input member variables:
+//     num_vertices, num_indices, optimize_flags, weld_tolerance
+// Output member variables:
+//     num_vertices, num_indices, cache_stats,
+//     original_num_vertices, original_num_indices
+{
+	cache_stats[0]=AnalyzeVertexCache(indices, num_indices, num_vertices);
+	original_num_vertices=num_vertices;
+	original_num_indices=num_indices;
+
+	// The arrays only shrink, so they are compacted in place
+	if (optimize_flags&MESH_OPTIMIZE_WELD)
+		num_vertices=WeldVertices(vertices, indices, num_indices, num_vertices, weld_tolerance);
+	if (optimize_flags&MESH_OPTIMIZE_REMOVE_DEGENERATE)
+		num_indices=RemoveDegenerateTriangles(vertices, indices, num_indices);
+
+	if (optimize_flags&(MESH_OPTIMIZE_VERTEX_CACHE|MESH_OPTIMIZE_OVERDRAW))
+	{
+		std::vector<GLuint> original(indices, indices+num_indices);
+		float max_acmr=AnalyzeVertexCache(indices, num_indices, num_vertices).acmr;
+		if (optimize_flags&MESH_OPTIMIZE_VERTEX_CACHE)
+			OptimizeVertexCache(indices, num_indices, num_vertices);
+		if (optimize_flags&MESH_OPTIMIZE_OVERDRAW)
+		{
+			OptimizeOverdraw(vertices, indices, num_indices, num_vertices, 1.05f);
+			max_acmr*=1.05f;
+		}
+
+		// Small grids whose rows fit in the cache are already in a good order
+		if (AnalyzeVertexCache(indices, num_indices, num_vertices).acmr>max_acmr)
+			std::copy(original.begin(), original.end(), indices);
+	}
+	if (optimize_flags&MESH_OPTIMIZE_VERTEX_FETCH)
+		num_vertices=OptimizeVertexFetch(vertices, indices, num_indices, num_vertices);
+
+	cache_stats[1]=AnalyzeVertexCache(indices, num_indices, num_vertices);
 }
 
 void CMesh::CreateGLResources(
 	CMeshVertex *vertices, GLuint *indices)
 // Create OpenGL resources
+// Indexed triangle meshes are optimized first according to optimize_flags
 // vertices: (in) Vertex array
 // indices: (in) Index array
 //          NULL indicates that the mesh does not have an index array
 // Input member variables:
+//     num_vertices, num_indices, optimize_flags
+// Output member variables:
+//     arena_block, cache_stats,
+//     coarser_lod if lod_simplify is set
+{
+	// Only indexed triangles can be reordered; the gaskets have no shared vertices
+	if (indices!=NULL && primitive_type==GL_TRIANGLES)
+		Optimize(vertices, indices);
+
+	UploadGLResources(vertices, indices);
+
+	if (lod_simplify)
+		CreateSimplifiedLODs(vertices, indices);
+}
+
+void CMesh::UploadGLResources(
+	const void *vertices, const GLuint *indices)
+// Create OpenGL resources from arrays that are ready to use
+// vertices: (in) Vertex array of CMeshVertex
+// indices: (in) Index array
+//          NULL indicates that the mesh does not have an index array
+// Input member variables:
 //     num_vertices, num_indices
 // Output member variables:
-//     vertex_array_obj, vertex_buffer_obj, index_buffer_obj
+//     arena_block, bound_center, bound_radius
 {
-	// Create the vertex array object
-	glGenVertexArrays(1, &vertex_array_obj);
-	glBindVertexArray(vertex_array_obj);
+	// Bounding sphere around the center of the bounding box
+	const CMeshVertex *v=(const CMeshVertex *)vertices;
+	bound_center=vec3(0.0f);
+	bound_radius=0.0f;
+	if (num_vertices>0)
+	{
+		vec3 pmin=v[0].pos, pmax=v[0].pos;
+		int i;
+		for (i=1; i<num_vertices; ++i)
+		{
+			const point3& p=v[i].pos;
+			pmin=vec3(fminf(pmin.x, p.x), fminf(pmin.y, p.y), fminf(pmin.z, p.z));
+			pmax=vec3(fmaxf(pmax.x, p.x), fmaxf(pmax.y, p.y), fmaxf(pmax.z, p.z));
+		}
+		bound_center=0.5f*(pmin+pmax);
+		for (i=0; i<num_vertices; ++i)
+			bound_radius=fmaxf(bound_radius, length(v[i].pos-bound_center));
+	}
 
-	// Create the vertex buffer object
-	glGenBuffers(1, &vertex_buffer_obj);
-	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_obj);
-	glBufferData(GL_ARRAY_BUFFER, 
-		sizeof(CMeshVertex)*num_vertices,
-		vertices, GL_STATIC_DRAW);
+	// Copy the arrays into ranges of the shared buffers
+	arena.Allocate(arena_block, num_vertices, indices!=NULL ? num_indices : 0);
+	arena.UploadVertices(arena_block, vertices);
+	if (indices!=NULL)
+		arena.UploadIndices(arena_block, indices);
+}
 
+void CMesh::SetVertexFormat(int /*format*/, int /*vertex_size*/)
+// Set the vertex attributes of CMeshVertex for the arena
+{
 	// Enable vertex attribute arrays and
 	//   set their data and formats in the vertex buffer object
 	glEnableVertexAttribArray(0); // 0=position
@@ -175,21 +353,209 @@ void CMesh::CreateGLResources(
 	glEnableVertexAttribArray(3); // 3=texture coordinates
 	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 
 		sizeof(CMeshVertex), (GLvoid *)offsetof(CMeshVertex, texcoord));
+}
 
-	// Create the index buffer object if necessary
+void CMesh::CreateSimplifiedLODs(
+	const CMeshVertex *vertices, const GLuint *indices)
+// Create the coarser levels of detail by simplifying the mesh, each level with
+//   about a quarter of the triangles of the previous one
+// Meshes without an index array are welded first
+{
+	simplify_curve.clear();
+	if (lod_levels<=1 || primitive_type!=GL_TRIANGLES || num_vertices==0)
+		return;
+
+	// The gaskets repeat the corners of each triangle, so they are welded into an
+	//   indexed mesh first
+	std::vector<CMeshVertex> lod_vertices(vertices, vertices+num_vertices);
+	std::vector<GLuint> lod_indices;
+	int lod_num_vertices=num_vertices;
 	if (indices!=NULL)
+		lod_indices.assign(indices, indices+num_indices);
+	else
 	{
-		glGenBuffers(1, &index_buffer_obj);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_obj);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, 
-			sizeof(GLuint)*num_indices,
-			indices, GL_STATIC_DRAW);
+		lod_indices.resize(num_vertices);
+		for (int i=0; i<num_vertices; ++i)
+			lod_indices[i]=i;
+		lod_num_vertices=WeldVertices(&lod_vertices[0], &lod_indices[0],
+			num_vertices, num_vertices, weld_tolerance);
 	}
+	int lod_num_indices=(int)lod_indices.size();
 
-	// Restore the current vertex array object to the default one
-	glBindVertexArray(0);
+	// Each level simplifies the previous one, so its error is the error of the mesh
+	//   plus the simplification errors of all levels up to it
+	float error=lod_error;
+	CMesh *mesh=this, *lod;
+	while ((lod=mesh->CreateCoarserLOD())!=NULL)
+	{
+		float simplify_error;
+		size_t curve_start=simplify_curve.size();
+		int n=SimplifyMesh(&lod_vertices[0], lod_num_vertices, &lod_indices[0], lod_num_indices,
+			lod_num_indices/12*3, FLT_MAX, simplify_options, &simplify_error, &simplify_curve);
+		for (size_t i=curve_start; i<simplify_curve.size(); ++i)
+			simplify_curve[i].error+=error;
+
+		// Stop when borders and seams keep the mesh from getting much simpler
+		if (n==0 || n>lod_num_indices*3/4)
+		{
+			delete lod;
+			mesh->coarser_lod=NULL;
+			break;
+		}
+		lod_num_indices=n;
+		error+=simplify_error;
+
+		// Each level keeps only the vertices that it uses
+		std::vector<CMeshVertex> level_vertices(lod_vertices.begin(), lod_vertices.begin()+lod_num_vertices);
+		std::vector<GLuint> level_indices(lod_indices.begin(), lod_indices.begin()+lod_num_indices);
+		lod->num_vertices=OptimizeVertexFetch(&level_vertices[0], &level_indices[0],
+			lod_num_indices, lod_num_vertices);
+		lod->num_indices=lod_num_indices;
+		lod->lod_error=error;
+		lod->CreateGLResources(&level_vertices[0], &level_indices[0]);
+		mesh=lod;
+	}
+}
+
+const char *CMesh::cache_directory=NULL;
+CMeshArena CMesh::arena(sizeof(CMeshVertex), CMesh::SetVertexFormat);
+
+CGeometryKey CMesh::GetCacheKey(const CGeometryKey& generator_key) const
+// Return the key of a generator call, including the settings that change its output
+{
+	CGeometryKey key=generator_key;
+	key.Add((int)sizeof(CMeshVertex));
+	key.Add((int)primitive_type);
+	key.Add(optimize_flags);
+	key.Add(&weld_tolerance, sizeof(weld_tolerance));
+
+	// Simplified levels of detail are stored with the mesh
+	if (lod_simplify)
+	{
+		key.Add(lod_levels);
+		key.Add(simplify_options.normal_weight);
+		key.Add(simplify_options.texcoord_weight);
+		key.Add(simplify_options.color_weight);
+		key.Add(simplify_options.border_weight);
+		key.Add(simplify_options.position_tolerance);
+	}
+	return key;
+}
 
+bool CMesh::LoadFromCache(const CGeometryKey& generator_key)
+// Create the mesh from the geometry cache
+// Returns false if the cache is disabled or does not have the mesh
+// generator_key: (in) Key of the generator call
+{
+	if (cache_directory==NULL)
+		return false;
+
+	int num_simplified_lods;
+	if (!ReadCacheFile(GetCacheKey(generator_key).hash, &num_simplified_lods))
+		return false;
 
+	// The simplified levels of detail are stored under the key followed by their level
+	simplify_curve.clear();
+	CMesh *mesh=this;
+	for (int level=1; level<=num_simplified_lods; ++level)
+	{
+		CGeometryKey level_key=generator_key;
+		level_key.Add(level);
+		int n;
+		mesh=mesh->CreateCoarserLOD();
+		if (mesh==NULL || !mesh->ReadCacheFile(GetCacheKey(level_key).hash, &n))
+		{
+			ReleaseGLResources();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CMesh::ReadCacheFile(unsigned long long key, int *num_simplified_lods)
+// Create the mesh from one file of the geometry cache
+// Returns false if the file is missing or does not match
+// key: (in) Key of the file
+// num_simplified_lods: (out) The number of simplified levels stored after the mesh
+{
+	CGeometryCacheFile file;
+	if (!file.Open(cache_directory, key))
+		return false;
+	const CGeometryCacheHeader& header=file.GetHeader();
+	if (header.vertex_size!=sizeof(CMeshVertex))
+		return false;
+
+	// The arrays are uploaded straight from the mapping
+	primitive_type=header.primitive_type;
+	num_vertices=header.num_vertices;
+	num_indices=header.num_indices;
+	original_num_vertices=header.original_num_vertices;
+	original_num_indices=header.original_num_indices;
+	cache_stats[0]=header.cache_stats[0];
+	cache_stats[1]=header.cache_stats[1];
+	lod_error=header.lod_error;
+	*num_simplified_lods=header.num_simplified_lods;
+	UploadGLResources(file.GetVertices(), num_indices>0 ? file.GetIndices() : NULL);
+	return true;
+}
+
+void CMesh::SaveToCache(
+	const CGeometryKey& generator_key,
+	const CMeshVertex *vertices, const GLuint *indices) const
+// Store the arrays passed to CreateGLResources in the geometry cache, followed by
+//   the simplified levels of detail, which are read back from their buffers
+// generator_key: (in) Key of the generator call
+// vertices, indices: (in) Arrays after CreateGLResources
+{
+	if (cache_directory==NULL)
+		return;
+
+	int num_simplified_lods=0;
+	const CMesh *mesh;
+	if (lod_simplify)
+		for (mesh=coarser_lod; mesh!=NULL; mesh=mesh->coarser_lod)
+			++num_simplified_lods;
+	WriteCacheFile(GetCacheKey(generator_key).hash, vertices, indices, num_simplified_lods);
+
+	mesh=this;
+	for (int level=1; level<=num_simplified_lods; ++level)
+	{
+		mesh=mesh->coarser_lod;
+		std::vector<CMeshVertex> lod_vertices(mesh->num_vertices);
+		std::vector<GLuint> lod_indices(mesh->num_indices);
+		arena.ReadVertices(mesh->arena_block, &lod_vertices[0]);
+		arena.ReadIndices(mesh->arena_block, &lod_indices[0]);
+
+		CGeometryKey level_key=generator_key;
+		level_key.Add(level);
+		mesh->WriteCacheFile(GetCacheKey(level_key).hash, &lod_vertices[0], &lod_indices[0], 0);
+	}
+}
+
+void CMesh::WriteCacheFile(
+	unsigned long long key,
+	const void *vertices, const GLuint *indices,
+	int num_simplified_lods) const
+// Store the arrays of the mesh in one file of the geometry cache
+// key: (in) Key of the file
+// vertices, indices: (in) Arrays of the mesh; indices may be NULL
+// num_simplified_lods: (in) The number of simplified levels stored after the mesh
+{
+	CGeometryCacheHeader header;
+	memcpy(header.magic, "GEOC", 4);
+	header.version=GEOMETRY_CACHE_VERSION;
+	header.key=key;
+	header.vertex_size=sizeof(CMeshVertex);
+	header.primitive_type=primitive_type;
+	header.num_vertices=num_vertices;
+	header.num_indices=indices!=NULL ? num_indices : 0;
+	header.original_num_vertices=original_num_vertices;
+	header.original_num_indices=original_num_indices;
+	header.cache_stats[0]=cache_stats[0];
+	header.cache_stats[1]=cache_stats[1];
+	header.lod_error=lod_error;
+	header.num_simplified_lods=num_simplified_lods;
+	WriteGeometryCacheFile(cache_directory, header, vertices, indices);
 }
 
 void CMesh::CreateGasket2D(
@@ -199,11 +565,18 @@ void CMesh::CreateGasket2D(
 // triangle_vertices: (in) Triangle vertices
 // subdivision_depth: (in) Maximum recursive subdivision depth
 {
+	CGeometryKey key("CreateGasket2D");
+	key.Add(triangle_vertices, sizeof(point2)*3);
+	key.Add(subdivision_depth);
+	if (LoadFromCache(key))
+		return;
+
 	num_vertices=1;
 	int i;
 	for (i=0; i<=subdivision_depth; ++i)
 		num_vertices*=3;
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
 
 	i=0;
 	DivideTriangle(
@@ -214,8 +587,7 @@ void CMesh::CreateGasket2D(
 		i, subdivision_depth);
 
 	CreateGLResources(vertices);
-
-	delete [] vertices;
+	SaveToCache(key, vertices, NULL);
 }
 
 void CMesh::CreateGasket3D(
@@ -225,11 +597,31 @@ void CMesh::CreateGasket3D(
 // tetra_vertices:    (in) Tetrahedron vertices
 // subdivision_depth: (in) Maximum recursive subdivision depth
 {
+	// Coarser levels of detail subdivide one level less
+	CMesh *lod=!lod_simplify && subdivision_depth>0 ? CreateCoarserLOD() : NULL;
+	if (lod!=NULL)
+		lod->CreateGasket3D(tetra_vertices, subdivision_depth-1);
+
+	CGeometryKey key("CreateGasket3D");
+	key.Add(tetra_vertices, sizeof(point3)*4);
+	key.Add(subdivision_depth);
+	if (LoadFromCache(key))
+		return;
+
 	num_vertices=3;
 	int i;
 	for (i=0; i<=subdivision_depth; ++i)
 		num_vertices*=4;
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
+
+	// The smallest tetrahedra are the error; each is within its circumradius
+	//   of the gasket, sqrt(6)/4 of its edge length
+	float edge=0.0f;
+	for (i=0; i<4; ++i)
+		for (int j=i+1; j<4; ++j)
+			edge=fmaxf(edge, length(tetra_vertices[i]-tetra_vertices[j]));
+	lod_error=0.61237f*edge/(1<<subdivision_depth);
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
 
 	i=0;
 	DivideTetra(
@@ -241,8 +633,7 @@ void CMesh::CreateGasket3D(
 		i, subdivision_depth);
 
 	CreateGLResources(vertices);
-
-	delete [] vertices;
+	SaveToCache(key, vertices, NULL);
 }
 
 void CMesh::CreateCube(float size, float ntex)
@@ -292,8 +683,9 @@ void CMesh::CreateCube(float size, float ntex)
 	num_indices=36;
 
 	// Allocate memory for vertices and indices
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
-	GLuint *indices=new GLuint [num_indices];
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint *indices=scratch.Allocate<GLuint>(num_indices);
 
 	// Loop through all 6 faces
 	int i, k;
@@ -332,10 +724,6 @@ void CMesh::CreateCube(float size, float ntex)
 
 	// Create OpenGL resources
 	CreateGLResources(vertices, indices);
-
-	// Free memory
-	delete [] vertices;
-	delete [] indices;
 }
 
 void CMesh::CreateBlock(float sx, float sy, float sz,
@@ -394,8 +782,9 @@ void CMesh::CreateBlock(float sx, float sy, float sz,
 	num_indices=36;
 
 	// Allocate memory for vertices and indices
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
-	GLuint *indices=new GLuint [num_indices];
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint *indices=scratch.Allocate<GLuint>(num_indices);
 
 	// Loop through all 6 faces
 	int i, k;
@@ -438,10 +827,6 @@ void CMesh::CreateBlock(float sx, float sy, float sz,
 
 	// Create OpenGL resources
 	CreateGLResources(vertices, indices);
-
-	// Free memory
-	delete [] vertices;
-	delete [] indices;
 }
 
 void CMesh::CreateRect(
@@ -451,6 +836,12 @@ void CMesh::CreateRect(
 // nx, ny: (in) The numbers of subdivisions in x, y directions
 // tex_nx, tex_ny: (in) Texture coordinate multipliers in x, y directions
 {
+	CGeometryKey key("CreateRect");
+	key.Add(sx); key.Add(sy); key.Add(nx); key.Add(ny);
+	key.Add(tex_nx); key.Add(tex_ny);
+	if (LoadFromCache(key))
+		return;
+
 	float dx=sx/nx;
 	float dy=sy/ny;
 	float sx_h=0.5f*sx;
@@ -461,8 +852,9 @@ void CMesh::CreateRect(
 	num_indices=6*nx*ny;
 
 	// Allocate memory for vertices and indices
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
-	GLuint *indices=new GLuint [num_indices];
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint *indices=scratch.Allocate<GLuint>(num_indices);
 
 	// Set vertices
 	int i, j, k;
@@ -528,10 +920,7 @@ void CMesh::CreateRect(
 
 	// Create OpenGL resources
 	CreateGLResources(vertices, indices);
-
-	// Free memory
-	delete [] vertices;
-	delete [] indices;
+	SaveToCache(key, vertices, indices);
 }
 
 void CMesh::CreateSphere(
@@ -544,16 +933,31 @@ void CMesh::CreateSphere(
 // tex_ntheta: (in) Texture coordinate multiplier in theta direction
 // tex_nphi:   (in) Texture coordinate multiplier in phi direction
 {
+	// Coarser levels of detail halve the subdivisions
+	CMesh *lod=!lod_simplify && num_slices>=8 && num_stacks>=4 ? CreateCoarserLOD() : NULL;
+	if (lod!=NULL)
+		lod->CreateSphere(radius, num_slices/2, num_stacks/2, tex_ntheta, tex_nphi);
+
+	CGeometryKey key("CreateSphere");
+	key.Add(radius); key.Add(num_slices); key.Add(num_stacks);
+	key.Add(tex_ntheta); key.Add(tex_nphi);
+	if (LoadFromCache(key))
+		return;
+
 	float dtheta=(M_PI+M_PI)/num_slices;
 	float dphi=M_PI/num_stacks;
 
+	// Distance from the center of a sub rectangle to the sphere
+	lod_error=radius*(1.0f-cosf(0.5f*dtheta)*cosf(0.5f*dphi));
+
 	// Set the number of vertices and indices
 	num_vertices=(num_slices+1)*(num_stacks+1);
 	num_indices=6*num_slices*num_stacks;
 
 	// Allocate memory for vertices and indices
-	CMeshVertex *vertices=new CMeshVertex [num_vertices];
-	GLuint *indices=new GLuint [num_indices];
+	CScratchScope scratch;
+	CMeshVertex *vertices=scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint *indices=scratch.Allocate<GLuint>(num_indices);
 
 	// Set vertices
 	int i, j, k;
@@ -624,21 +1028,59 @@ void CMesh::CreateSphere(
 
 	// Create OpenGL resources
 	CreateGLResources(vertices, indices);
-
-	// Free memory
-	delete [] vertices;
-	delete [] indices;
+	SaveToCache(key, vertices, indices);
 }
 
 float Bernstein(int i, float u) {
 	const vec4 bc = vec4(1, 3, 3, 1);
 	return bc[i] * pow(u, i) * pow(1.0 - u, 3 - i);
 }
+
+static point3 EvaluateBezierPatch(const point3* cp_vertices, const int cp_indices[16], float u, float v)
+// Return the point p(u, v) of a bicubic Bezier patch
+{
+	float bu[4], bv[4];
+	int i, j;
+	for (i = 0; i < 4; i++)
+	{
+		bu[i] = Bernstein(i, u);
+		bv[i] = Bernstein(i, v);
+	}
+	point3 p(0.0f, 0.0f, 0.0f);
+	for (i = 0; i < 4; i++)
+		for (j = 0; j < 4; j++)
+			p += bu[i] * bv[j] * cp_vertices[cp_indices[i * 4 + j]];
+	return p;
+}
+
+static float BezierPatchError(const point3* cp_vertices, const int cp_indices[16], int num_segments)
+// Estimate the largest distance between a patch and its tessellation with num_segments
+//   sub rectangles in u and v directions: the distance between the surface and the
+//   straight edge or the center of a sub rectangle, measured at their midpoints
+{
+	float d = 1.0f / num_segments;
+	float error = 0.0f;
+	for (int i = 0; i < num_segments; i++)
+	{
+		for (int j = 0; j < num_segments; j++)
+		{
+			float u = i * d, v = j * d;
+			point3 p00 = EvaluateBezierPatch(cp_vertices, cp_indices, u, v);
+			point3 p10 = EvaluateBezierPatch(cp_vertices, cp_indices, u + d, v);
+			point3 p01 = EvaluateBezierPatch(cp_vertices, cp_indices, u, v + d);
+			point3 p11 = EvaluateBezierPatch(cp_vertices, cp_indices, u + d, v + d);
+			error = fmaxf(error, length(EvaluateBezierPatch(cp_vertices, cp_indices, u + 0.5f * d, v) - 0.5f * (p00 + p10)));
+			error = fmaxf(error, length(EvaluateBezierPatch(cp_vertices, cp_indices, u, v + 0.5f * d) - 0.5f * (p00 + p01)));
+			error = fmaxf(error, length(EvaluateBezierPatch(cp_vertices, cp_indices, u + 0.5f * d, v + 0.5f * d) - 0.25f * (p00 + p10 + p01 + p11)));
+		}
+	}
+	return error;
+}
 void CMesh::DivideBezierPatch(int& counter, int& iv_counter, int patch_index, CMeshVertex* vbuf, GLuint* indices, point3* cp_vertices, int cp_indices[16], float increment, float tex_u, float tex_v)
 {
 	int i, j;
 	int u_cnt = 0, v_cnt = 0;							//u,vϸֵļ
-	int u_num = (1 / increment) + 1, v_num = u_num;		//u,vϸֺĶ
+	int u_num = (int)(1 / increment + 0.5f) + 1, v_num = u_num;		//u,vϸֺĶ룬1/13 С
 	float u = 0.0, v = 0.0;								//Bernstein е u,v
 	vec4 curve_p = vec4(0.0);							//ϵĵ㣨м
 
@@ -730,7 +1172,20 @@ void CMesh::CreateBezierObject(const char* filename, float increment, float tex_
 
 	if (increment <= 1e-6 || increment - 1.0 >= 1e-6) { cout << " increment Ϸ,Ӧ (0, 1)Χڵĸ" << endl; exit(1); };
 
-	int u_num = (int)(1 / increment) + 1, v_num = u_num;		//u,vϸֺĶ
+	//ϴֵϸڲΰѷֶ루ȡȻ 1ѷ
+	int num_segments = (int)(1 / increment + 0.5f);
+	CMesh *lod = !lod_simplify && num_segments >= 4 ? CreateCoarserLOD() : NULL;
+	if (lod != NULL)
+		lod->CreateBezierObject(filename, 1.0f / ((num_segments + 1) / 2), tex_u, tex_v);
+
+	//ֵģļݣļ޸ĺϸ
+	CGeometryKey key("CreateBezierObject");
+	bool cacheable = key.AddFile(filename);
+	key.Add(increment); key.Add(tex_u); key.Add(tex_v);
+	if (cacheable && LoadFromCache(key))
+		return;
+
+	int u_num = (int)(1 / increment + 0.5f) + 1, v_num = u_num;		//u,vϸֺĶ
 	//printf("%s : u_num:%d,v_num:%d\n", filename, u_num, v_num);
 	
 	//ȡļϢ
@@ -739,7 +1194,8 @@ void CMesh::CreateBezierObject(const char* filename, float increment, float tex_
 	
 	//пƵݣⲿֽļn+1жȡ
 	int control_point_num;	iofile >> control_point_num;//Ƶ
-	point3* cp_vertices = new point3[control_point_num];
+	CScratchScope scratch;
+	point3* cp_vertices = scratch.Allocate<point3>(control_point_num);
 	char sep; int i, j;	//ָ  \n   ѭi,j
 	for (i = 0; i < control_point_num; i++)
 	{
@@ -755,14 +1211,15 @@ void CMesh::CreateBezierObject(const char* filename, float increment, float tex_
 	int patch_num;	iofile >> patch_num;//Ƭ(n+2)
 	//жVAO
 	num_vertices = patch_num * u_num * v_num;	//patch_numƬ, u, vÿ򶼻ϸֳ (1 / increment)+1
-	CMeshVertex* vertices = new CMeshVertex[num_vertices];
+	CMeshVertex* vertices = scratch.Allocate<CMeshVertex>(num_vertices);
 
 	int cp_iv[16];		//Ƭ
+	lod_error = 0.0f;
 	int counter = 0;
 	int iv_counter = 0;
 	int cnt_patch;
 	num_indices = patch_num * 6 * (u_num) * (v_num);//
-	GLuint* indices = new GLuint[num_indices];
+	GLuint* indices = scratch.Allocate<GLuint>(num_indices);
 	for (cnt_patch = 0; cnt_patch < patch_num; cnt_patch++)  //ѭϸpatch_numƬ
 	{
 		for (j = 0; j < 16; j++)	//ÿƬ16Ƶ
@@ -775,13 +1232,17 @@ void CMesh::CreateBezierObject(const char* filename, float increment, float tex_
 			}
 		}
 		DivideBezierPatch(counter, iv_counter, cnt_patch, vertices, indices, cp_vertices, cp_iv, increment, tex_u, tex_v);
+		lod_error = fmaxf(lod_error, BezierPatchError(cp_vertices, cp_iv, u_num - 1));
 	}
 	iofile.close();
 
-	CreateGLResources(vertices, indices);
-
-	delete[] vertices;
+	//ÿƬʵֻ (u_num-1)*(v_num-1) СΣʵд
+	//δʼҲᱻ
+	num_indices = iv_counter;
 
+	CreateGLResources(vertices, indices);
+	if (cacheable)
+		SaveToCache(key, vertices, indices);
 }
 void CMesh::CreateAxes(float sx, float sy, float sz)
 {
@@ -814,18 +1275,34 @@ void CMesh::CreateAxes(float sx, float sy, float sz)
 }
 void CMesh::CreateCylinder(float radius, float h, int num_slices, int num_stacks, int num_rings, int tex_nx, int tex_ny)
 {
+	// Coarser levels of detail halve the subdivisions
+	CMesh *lod=!lod_simplify && num_slices>=8 ? CreateCoarserLOD() : NULL;
+	if (lod!=NULL)
+		lod->CreateCylinder(radius, h, num_slices/2, num_stacks>1 ? num_stacks/2 : 1,
+			num_rings>1 ? num_rings/2 : 1, tex_nx, tex_ny);
+
+	CGeometryKey key("CreateCylinder");
+	key.Add(radius); key.Add(h); key.Add(num_slices); key.Add(num_stacks); key.Add(num_rings);
+	key.Add(tex_nx); key.Add(tex_ny);
+	if (LoadFromCache(key))
+		return;
+
 	//printf("-----------------------------------------------------------------------------------------------\n");
 	//printf("Բ");
 	float dtheta = (M_PI + M_PI) / num_slices;
 	float dh = h / num_stacks;
 
+	// Distance from the middle of an edge of the base polygon to the circle
+	lod_error = radius * (1.0f - cosf(0.5f * dtheta));
+
 	int num_curve_vertices = (num_slices + 1) * (num_stacks + 1);		//׶涥
 	int num_beside_curve_vertices = 2 * (num_slices + 1) * (num_rings + 1);	//ϵµ
 	num_vertices = num_curve_vertices + num_beside_curve_vertices;	//׶涥 + 涥ȦĶǹ㣩
 	num_indices = 6 * num_slices * num_stacks + 2 * 6 * num_slices * num_rings;	//׶涥+ 涥
 
-	CMeshVertex* vertices = new CMeshVertex[num_vertices];
-	GLuint* indices = new GLuint[num_indices];
+	CScratchScope scratch;
+	CMeshVertex* vertices = scratch.Allocate<CMeshVertex>(num_vertices);
+	GLuint* indices = scratch.Allocate<GLuint>(num_indices);
 
 	//Բϸ--
 	int i, j, k;
@@ -968,8 +1445,5 @@ void CMesh::CreateCylinder(float radius, float h, int num_slices, int num_stacks
 	}
 
 	CreateGLResources(vertices, indices);
-
-	delete[] vertices;
-	delete[] indices;
-
+	SaveToCache(key, vertices, indices);
 }
\ No newline at end of file
@@ -3,6 +3,11 @@
 
 #include "GL/glew.h"
 #include "vec.h"
+#include "mat.h"
+#include "MeshOptimizer.h"
+#include "GeometryCache.h"
+#include "MeshSimplifier.h"
+#include "MeshArena.h"
 
 // Mesh vertex
 class CMeshVertex
@@ -14,6 +19,19 @@ public:
 	vec2 texcoord; // Texture coordinates
 };
 
+// Passes applied to indexed triangle meshes when they are created, in this order
+// See MeshOptimizer.h
+enum MESH_OPTIMIZE
+{
+	MESH_OPTIMIZE_VERTEX_CACHE=1,  // Reorder triangles for the post-transform vertex cache
+	MESH_OPTIMIZE_OVERDRAW=2,      // Reorder triangle clusters to reduce overdraw
+	MESH_OPTIMIZE_VERTEX_FETCH=4,  // Reorder vertices in the order the triangles use them
+	                               //   and drop the unused ones
+	MESH_OPTIMIZE_WELD=8,          // Merge duplicate vertices (runs first)
+	MESH_OPTIMIZE_REMOVE_DEGENERATE=16, // Remove zero-area triangles (runs second)
+	MESH_OPTIMIZE_ALL=31
+};
+
 // Mesh
 class CMesh
 {
@@ -37,34 +55,150 @@ protected:
 	// vcounter: (in and out) Vertex counter
 	// depth: (in) Recursion depth
 
+	void Optimize(CMeshVertex *vertices, GLuint *indices);
+	// Clean up and reorder the triangles and vertices of an indexed triangle mesh
+	// vertices: (in and out) Vertex array
+	// indices: (in and out) Index array
+	// Input member variables:
+	//     num_vertices, num_indices, optimize_flags, weld_tolerance
+	// Output member variables:
+	//     num_vertices, num_indices, cache_stats,
+	//     original_num_vertices, original_num_indices
+
 	void CreateGLResources(
 		CMeshVertex *vertices,
 		GLuint *indices=NULL);
 	// Create OpenGL resources
+	// Indexed triangle meshes are optimized first according to optimize_flags
 	// vertices: (in) Vertex array
 	// indices: (in) Index array
 	//          NULL indicates that the mesh does not have an index array
 	// Input member variables:
+	//     num_vertices, num_indices, optimize_flags
+	// Output member variables:
+	//     arena_block, cache_stats
+
+	void UploadGLResources(
+		const void *vertices,
+		const GLuint *indices);
+	// Create OpenGL resources from arrays that are ready to use
+	// vertices: (in) Vertex array of CMeshVertex
+	// indices: (in) Index array
+	//          NULL indicates that the mesh does not have an index array
+	// Input member variables:
 	//     num_vertices, num_indices
 	// Output member variables:
-	//     vertex_array_obj, vertex_buffer_obj, index_buffer_obj
+	//     arena_block, bound_center, bound_radius
+
+	void CreateSimplifiedLODs(
+		const CMeshVertex *vertices,
+		const GLuint *indices);
+	// Create the coarser levels of detail by simplifying the mesh, each level with
+	//   about a quarter of the triangles of the previous one
+	// Meshes without an index array are welded first
+	// vertices: (in) Vertex array after CreateGLResources
+	// indices: (in) Index array after CreateGLResources, or NULL
+	// Input member variables:
+	//     num_vertices, num_indices, lod_levels, lod_error, simplify_options
+	// Output member variables:
+	//     coarser_lod, simplify_curve
+
+	CGeometryKey GetCacheKey(const CGeometryKey& generator_key) const;
+	// Return the key of a generator call, including the settings that change its output
+
+	bool LoadFromCache(const CGeometryKey& generator_key);
+	// Create the mesh from the geometry cache
+	// Returns false if the cache is disabled or does not have the mesh
+	// generator_key: (in) Key of the generator call
+
+	bool ReadCacheFile(unsigned long long key, int *num_simplified_lods);
+	// Create the mesh from one file of the geometry cache
+	// Returns false if the file is missing or does not match
+	// key: (in) Key of the file
+	// num_simplified_lods: (out) The number of simplified levels stored after the mesh
+
+	void WriteCacheFile(
+		unsigned long long key,
+		const void *vertices, const GLuint *indices,
+		int num_simplified_lods) const;
+	// Store the arrays of the mesh in one file of the geometry cache
+	// key: (in) Key of the file
+	// vertices, indices: (in) Arrays of the mesh; indices may be NULL
+	// num_simplified_lods: (in) The number of simplified levels stored after the mesh
+
+	void SaveToCache(
+		const CGeometryKey& generator_key,
+		const CMeshVertex *vertices, const GLuint *indices) const;
+	// Store the arrays passed to CreateGLResources in the geometry cache, followed by
+	//   the simplified levels of detail, which are read back from their buffers
+	// generator_key: (in) Key of the generator call
+	// vertices, indices: (in) Arrays after CreateGLResources
+
+	static void SetVertexFormat(int format, int vertex_size);
+	// Set the vertex attributes of CMeshVertex for the arena
 
 public:
-	GLuint vertex_array_obj;  // OpenGL vertex array object
-	GLuint vertex_buffer_obj; // OpenGL vertex buffer object
-	GLuint index_buffer_obj;  // OpenGL index buffer object
+	static CMeshArena arena;  // Vertex and index buffers shared by all meshes
+	CMeshArenaBlock arena_block; // Ranges of the mesh in arena
 	int num_vertices; // The number of vertices
 	int num_indices;  // The number of indices
 	GLenum primitive_type; // OpenGL primitive type
+	int optimize_flags;    // MESH_OPTIMIZE flags, set before creating the mesh
+	CWeldTolerance weld_tolerance; // Used by MESH_OPTIMIZE_WELD
+	CVertexCacheStats cache_stats[2]; // Vertex cache statistics before and after
+	                                  //   optimizing, for indexed triangle meshes
+	int original_num_vertices; // The numbers of vertices and indices before
+	int original_num_indices;  //   welding and removing degenerate triangles
+
+	static const char *cache_directory; // Directory of the geometry cache
+	                                    //   NULL disables the cache
+	vec3 bound_center;  // Bounding sphere of the vertices in object coordinates
+	float bound_radius;
+	CMesh *coarser_lod; // Next coarser level of detail, NULL for the coarsest level
+	int lod_levels;     // The number of levels of detail that the gasket, sphere, Bezier
+	                    //   objects and cylinder create, including the mesh itself, set
+	                    //   before creating the mesh
+	float lod_error;    // Largest distance between the mesh and the surface it approximates,
+	                    //   in object coordinates
+	bool lod_simplify;  // Create the coarser levels of detail by simplifying the mesh
+	                    //   instead of generating them again, set before creating the mesh
+	CSimplifyOptions simplify_options; // Used by lod_simplify
+	std::vector<CSimplifyStep> simplify_curve; // Triangles and error of the coarser levels
+	                    //   after each simplification pass, empty if loaded from the cache
 
 	CMesh(void);
 
 	void ReleaseGLResources(void);
-	// Release OpenGL resources
+	// Release OpenGL resources, including those of the coarser levels of detail
 
 	void Draw(void);
 	// Draw the mesh
 
+	int GetNumTriangles(void) const;
+	// Return the number of triangles drawn by Draw
+
+	CMesh *CreateCoarserLOD(void);
+	// Attach a new empty mesh as the next coarser level of detail and return it
+	// Returns NULL if lod_levels does not allow another level
+	// The new mesh has one level less and the optimization settings of this mesh;
+	//   create it with a Create function, which sets lod_error
+
+	CMesh& GetLOD(int level);
+	// Return a level of detail, 0 for the mesh itself
+	// Levels beyond the coarsest one return the coarsest one
+
+	int SelectLOD(const mat4& model_view_matrix, float viewport_scale,
+		float max_pixel_error, int current_lod, float hysteresis=0.75f) const;
+	// Return the coarsest level of detail whose error stays within max_pixel_error on
+	//   the screen, judged from the projected size of the bounding sphere
+	// model_view_matrix: (in) Matrix from object to eye coordinates
+	// viewport_scale: (in) Pixels per unit at distance 1, viewport height/(2*tan(fovy/2))
+	// max_pixel_error: (in) Largest allowed error in pixels
+	// current_lod: (in) Level of detail drawn in the previous frame
+	// hysteresis: (in) The object only switches to a coarser level than current_lod when
+	//             its error is within hysteresis*max_pixel_error, so that objects near a
+	//             threshold do not switch levels every frame
+
 	void CreateGasket2D(
 		const point2 triangle_vertices[3],
 		int subdivision_depth);
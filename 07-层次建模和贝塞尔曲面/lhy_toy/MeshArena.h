@@ -0,0 +1,144 @@
+#ifndef _MESH_ARENA_H_
+#define _MESH_ARENA_H_
+
+#include "GL/glew.h"
+#include <stddef.h>
+#include <vector>
+
+// Vertex and index buffers shared by many meshes
+// Each mesh gets a range of vertices and a range of indices in two large buffer objects
+//   read by one vertex array object, and is drawn with glDrawElementsBaseVertex, so a
+//   scene is drawn without switching vertex arrays
+// All meshes of an arena have the same vertex size and attribute layout
+// Meshes with fewer than 65536 vertices store 16-bit indices
+// Freed ranges go to free lists; an allocation that fits in neither a free range nor
+//   the end of the buffers first packs the remaining meshes together, and grows the
+//   buffers if that still leaves too little room
+
+class CMeshArena;
+
+// Ranges of a mesh in a CMeshArena
+// The arena moves the ranges when it packs its meshes, so a block must stay at the
+//   same address while it is allocated
+class CMeshArenaBlock
+{
+public:
+	CMeshArena *arena;   // Arena of the ranges, NULL if none are allocated
+	GLint base_vertex;   // Index of the first vertex in the vertex buffer
+	int num_vertices;    // The number of vertices
+	size_t index_offset; // Offset of the first index in bytes in the index buffer
+	int num_indices;     // The number of indices, 0 for a mesh without indices
+	GLenum index_type;   // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+
+	CMeshArenaBlock(void);
+};
+
+// Sets and enables the vertex attributes of a vertex array object for the vertex
+//   buffer bound to GL_ARRAY_BUFFER
+// format: (in) Layout identifier given to the arena
+// vertex_size: (in) Size of a vertex in bytes
+typedef void (*CMeshArenaVertexFormat)(int format, int vertex_size);
+
+class CMeshArena
+{
+protected:
+	// Free range of a buffer, in vertices or bytes
+	struct CRange
+	{
+		size_t offset;
+		size_t size;
+	};
+
+	// Allocator of the ranges of one buffer
+	struct CRangeList
+	{
+		std::vector<CRange> free_ranges; // Holes below top, sorted by offset
+		size_t top;      // Start of the free space at the end of the buffer
+		size_t capacity; // Size of the buffer
+		size_t used;     // Size of the allocated ranges
+
+		bool Allocate(size_t size, size_t& offset);
+		void Free(size_t offset, size_t size);
+		void Reset(size_t capacity);
+	};
+
+	int vertex_size;
+	CMeshArenaVertexFormat set_vertex_format;
+	int format;
+	CRangeList vertex_ranges; // In vertices
+	CRangeList index_ranges;  // In bytes, multiples of 4
+	std::vector<CMeshArenaBlock *> blocks; // Allocated blocks
+
+	bool AllocateRanges(CMeshArenaBlock& block);
+	// Take the ranges of a block from the free lists or the end of the buffers
+
+	void Repack(size_t vertex_capacity, size_t index_capacity);
+	// Copy the allocated ranges one after another into new buffers and delete the
+	//   old ones
+	// vertex_capacity: (in) Size of the new vertex buffer in vertices
+	// index_capacity: (in) Size of the new index buffer in bytes
+
+public:
+	GLuint vertex_array_obj;  // OpenGL vertex array object of all meshes
+	GLuint vertex_buffer_obj; // OpenGL vertex buffer object
+	GLuint index_buffer_obj;  // OpenGL index buffer object
+	int num_repacks;          // The number of times the buffers were packed or grown
+
+	CMeshArena(int vertex_size, CMeshArenaVertexFormat set_vertex_format, int format=0);
+	// The buffers are created by the first allocation, so an arena can be constructed
+	//   before there is an OpenGL context
+	// vertex_size: (in) Size of a vertex in bytes
+	// set_vertex_format: (in) Function that sets the vertex attributes
+	// format: (in) Value passed to set_vertex_format
+
+	void Allocate(CMeshArenaBlock& block, int num_vertices, int num_indices);
+	// Allocate the ranges of a mesh, freeing the ones block had before
+	// block: (out) Ranges of the mesh
+	// num_vertices: (in) The number of vertices
+	// num_indices: (in) The number of indices, 0 for a mesh without indices
+
+	void Free(CMeshArenaBlock& block);
+	// Return the ranges of a mesh to the free lists
+
+	void Compact(void);
+	// Pack the allocated ranges together, so that the free space is in one piece
+
+	void Release(void);
+	// Delete the buffers; all blocks must have been freed
+
+	void UploadVertices(const CMeshArenaBlock& block, const void *vertices);
+	// Copy the vertices of a mesh into its range
+
+	void UploadIndices(const CMeshArenaBlock& block, const GLuint *indices);
+	// Copy the indices of a mesh into its range, narrowing them to 16 bits if the
+	//   block has 16-bit indices
+	// The primitive restart index 0xFFFFFFFF becomes 0xFFFF
+
+	void *MapVertices(const CMeshArenaBlock& block);
+	void *MapIndices(const CMeshArenaBlock& block);
+	// Map the range of a mesh for writing, or return NULL if it cannot be mapped
+	// The old contents of the range are discarded, and nothing may be allocated until
+	//   the range is unmapped
+
+	bool UnmapVertices(void);
+	bool UnmapIndices(void);
+	// Unmap the range mapped by MapVertices or MapIndices
+	// Returns false if the contents of the buffer were lost while it was mapped
+
+	void ReadVertices(const CMeshArenaBlock& block, void *vertices) const;
+	// Copy the vertices of a mesh out of its range
+
+	void ReadIndices(const CMeshArenaBlock& block, GLuint *indices) const;
+	// Copy the indices of a mesh out of its range, widening 16-bit indices
+	// The primitive restart index 0xFFFF becomes 0xFFFFFFFF
+
+	void Draw(const CMeshArenaBlock& block, GLenum primitive_type) const;
+	// Draw a mesh with the vertex array object of the arena, which stays bound
+
+	int GetNumBlocks(void) const { return (int)blocks.size(); }
+	size_t GetUsedBytes(void) const;
+	size_t GetCapacityBytes(void) const;
+	// Return the number of meshes, and the bytes in use and allocated in both buffers
+};
+
+#endif
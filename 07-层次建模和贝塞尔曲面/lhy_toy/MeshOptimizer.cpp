@@ -0,0 +1,474 @@
+#include "MeshOptimizer.h"
+#include "Mesh.h"
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+// Size of the LRU cache modeled by OptimizeVertexCache
+#define FORSYTH_CACHE_SIZE 32
+// Valences above this are scored with the last table entry
+#define FORSYTH_MAX_VALENCE 32
+
+static bool WithinTolerance(const float *a, const float *b, int n, float tolerance)
+// Return whether all components of two attributes differ by at most tolerance
+{
+	if (tolerance<0.0f)
+		return true;
+	for (int k=0; k<n; ++k)
+		if (fabsf(a[k]-b[k])>tolerance)
+			return false;
+	return true;
+}
+
+static unsigned long long WeldCellKey(int x, int y, int z)
+// Return the hash key of a cell of the welding grid, 21 bits per coordinate
+{
+	return ((unsigned long long)(x&0x1fffff)<<42)|
+		((unsigned long long)(y&0x1fffff)<<21)|
+		(unsigned long long)(z&0x1fffff);
+}
+
+int WeldVertices(
+	CMeshVertex *vertices, GLuint *indices, int num_indices, int num_vertices,
+	const CWeldTolerance& tolerance)
+// Merge vertices whose attributes are all within tolerance and return the number
+//   of vertices left; each merged vertex keeps the attributes of its first copy
+// Vertices are looked up in a hash grid of cells of the position tolerance
+// vertices: (in and out) Vertex array, compacted in place
+// indices: (in and out) Index array
+// num_indices, num_vertices: (in) The numbers of indices and vertices
+// tolerance: (in) Attribute tolerances
+{
+	// Vertices closer than the cell size are in the same or adjacent cells
+	float cell_size=tolerance.position>0.0f ? tolerance.position : 1e-6f;
+
+	// Kept vertices in each cell, linked through next_in_cell
+	std::unordered_map<unsigned long long, int> cell_heads;
+	cell_heads.reserve(num_vertices);
+	std::vector<int> next_in_cell, remap(num_vertices);
+	next_in_cell.reserve(num_vertices);
+
+	int num_kept=0;
+	for (int v=0; v<num_vertices; ++v)
+	{
+		const CMeshVertex& p=vertices[v];
+		int cx=(int)floorf(p.pos.x/cell_size);
+		int cy=(int)floorf(p.pos.y/cell_size);
+		int cz=(int)floorf(p.pos.z/cell_size);
+
+		int match=-1;
+		for (int d=0; d<27 && match<0; ++d)
+		{
+			std::unordered_map<unsigned long long, int>::const_iterator it=
+				cell_heads.find(WeldCellKey(cx+d%3-1, cy+d/3%3-1, cz+d/9-1));
+			if (it==cell_heads.end())
+				continue;
+			for (int w=it->second; w>=0; w=next_in_cell[w])
+			{
+				const CMeshVertex& q=vertices[w];
+				if (length(p.pos-q.pos)<=tolerance.position &&
+					WithinTolerance(&p.color.x, &q.color.x, 4, tolerance.color) &&
+					WithinTolerance(&p.normal.x, &q.normal.x, 3, tolerance.normal) &&
+					WithinTolerance(&p.texcoord.x, &q.texcoord.x, 2, tolerance.texcoord))
+				{
+					match=w;
+					break;
+				}
+			}
+		}
+
+		if (match<0)
+		{
+			// Kept vertices are moved down; the kept index never exceeds v
+			match=num_kept++;
+			vertices[match]=p;
+			unsigned long long key=WeldCellKey(cx, cy, cz);
+			std::unordered_map<unsigned long long, int>::iterator it=cell_heads.find(key);
+			next_in_cell.push_back(it==cell_heads.end() ? -1 : it->second);
+			cell_heads[key]=match;
+		}
+		remap[v]=match;
+	}
+
+	for (int i=0; i<num_indices; ++i)
+		indices[i]=remap[indices[i]];
+	return num_kept;
+}
+
+int RemoveDegenerateTriangles(
+	const CMeshVertex *vertices, GLuint *indices, int num_indices)
+// Remove the triangles that use a vertex twice or whose area is negligible
+//   compared with their longest edge, and return the number of indices left
+// Such triangles do not cover any pixel
+// vertices: (in) Vertex array
+// indices: (in and out) Triangle list, compacted in place
+// num_indices: (in) The number of indices
+{
+	int k=0;
+	for (int i=0; i+2<num_indices; i+=3)
+	{
+		GLuint a=indices[i], b=indices[i+1], c=indices[i+2];
+		if (a==b || b==c || c==a)
+			continue;
+
+		// |e0 x e1| is twice the area; compare it with the squared longest edge
+		vec3 e0=vertices[b].pos-vertices[a].pos;
+		vec3 e1=vertices[c].pos-vertices[a].pos;
+		vec3 e2=vertices[c].pos-vertices[b].pos;
+		float max_edge2=std::max(dot(e0, e0), std::max(dot(e1, e1), dot(e2, e2)));
+		if (length(cross(e0, e1))<=1e-6f*max_edge2)
+			continue;
+
+		indices[k++]=a;
+		indices[k++]=b;
+		indices[k++]=c;
+	}
+	return k;
+}
+
+static unsigned int CacheMisses(
+	std::vector<unsigned int>& cache_time, unsigned int& timestamp,
+	const GLuint *triangle, int cache_size)
+// Add a triangle to a FIFO cache and return the number of its vertices that missed
+// cache_time: (in and out) Time at which each vertex entered the cache, 0 if never
+// timestamp: (in and out) The number of cache misses so far plus cache_size
+// triangle: (in) The 3 vertex indices of the triangle
+// cache_size: (in) The number of vertices in the cache
+{
+	unsigned int misses=0;
+	for (int k=0; k<3; ++k)
+	{
+		GLuint v=triangle[k];
+		if (timestamp-cache_time[v]>=(unsigned int)cache_size)
+		{
+			cache_time[v]=++timestamp;
+			misses++;
+		}
+	}
+	return misses;
+}
+
+CVertexCacheStats AnalyzeVertexCache(
+	const GLuint *indices, int num_indices, int num_vertices, int cache_size)
+// Simulate a FIFO post-transform vertex cache and return its statistics
+// indices: (in) Triangle list
+// num_indices, num_vertices: (in) The numbers of indices and vertices
+// cache_size: (in) The number of vertices in the cache
+{
+	// Starting the clock at cache_size makes every vertex miss on its first use
+	std::vector<unsigned int> cache_time(num_vertices, 0);
+	unsigned int timestamp=cache_size;
+	unsigned int misses=0;
+	for (int i=0; i+2<num_indices; i+=3)
+		misses+=CacheMisses(cache_time, timestamp, indices+i, cache_size);
+
+	int num_used=0;
+	for (int v=0; v<num_vertices; ++v)
+		if (cache_time[v]!=0)
+			num_used++;
+
+	CVertexCacheStats stats;
+	stats.acmr=num_indices>=3 ? (float)misses/(num_indices/3) : 0.0f;
+	stats.atvr=num_used>0 ? (float)misses/num_used : 0.0f;
+	return stats;
+}
+
+class CForsythScores
+// Score tables of Forsyth's algorithm
+{
+public:
+	float cache[FORSYTH_CACHE_SIZE];
+	float valence[FORSYTH_MAX_VALENCE+1];
+
+	CForsythScores(void)
+	{
+		// The last triangle's vertices score a bit lower so that the strip
+		//   does not turn back on itself
+		for (int i=0; i<FORSYTH_CACHE_SIZE; ++i)
+			cache[i]=i<3 ? 0.75f :
+				powf(1.0f-(float)(i-3)/(FORSYTH_CACHE_SIZE-3), 1.5f);
+
+		// Vertices with few triangles left are finished first
+		valence[0]=0.0f;
+		for (int i=1; i<=FORSYTH_MAX_VALENCE; ++i)
+			valence[i]=2.0f/sqrtf((float)i);
+	}
+
+	float VertexScore(int cache_position, int num_active_triangles) const
+	{
+		if (num_active_triangles==0)
+			return -1.0f; // No triangles to add
+		float score=cache_position>=0 ? cache[cache_position] : 0.0f;
+		return score+valence[std::min(num_active_triangles, FORSYTH_MAX_VALENCE)];
+	}
+};
+
+void OptimizeVertexCache(GLuint *indices, int num_indices, int num_vertices)
+// Reorder the triangles so that the vertices they share are still in the cache
+//   (Forsyth's linear-speed vertex cache optimization)
+// indices: (in and out) Triangle list
+// num_indices, num_vertices: (in) The numbers of indices and vertices
+{
+	static const CForsythScores scores;
+	int num_triangles=num_indices/3;
+	if (num_triangles==0)
+		return;
+
+	// Triangles of each vertex; the first num_active[v] of them are not added yet
+	std::vector<int> num_active(num_vertices, 0), first_triangle(num_vertices+1, 0);
+	for (int i=0; i<3*num_triangles; ++i)
+		num_active[indices[i]]++;
+	for (int v=0; v<num_vertices; ++v)
+		first_triangle[v+1]=first_triangle[v]+num_active[v];
+	std::vector<int> vertex_triangles(3*num_triangles);
+	std::vector<int> fill(first_triangle.begin(), first_triangle.end()-1);
+	for (int i=0; i<3*num_triangles; ++i)
+		vertex_triangles[fill[indices[i]]++]=i/3;
+
+	std::vector<int> cache_position(num_vertices, -1);
+	std::vector<float> vertex_score(num_vertices);
+	for (int v=0; v<num_vertices; ++v)
+		vertex_score[v]=scores.VertexScore(-1, num_active[v]);
+
+	std::vector<float> triangle_score(num_triangles);
+	std::vector<bool> added(num_triangles, false);
+	int best_triangle=0;
+	for (int t=0; t<num_triangles; ++t)
+	{
+		const GLuint *tri=indices+3*t;
+		triangle_score[t]=vertex_score[tri[0]]+vertex_score[tri[1]]+vertex_score[tri[2]];
+		if (triangle_score[t]>triangle_score[best_triangle])
+			best_triangle=t;
+	}
+
+	// LRU cache; the 3 extra entries hold the vertices pushed out by a triangle
+	int cache[FORSYTH_CACHE_SIZE+3], new_cache[FORSYTH_CACHE_SIZE+3];
+	int cache_count=0;
+
+	std::vector<GLuint> output(3*num_triangles);
+	int next_input=0; // Triangles before it in the input order have been added
+	for (int k=0; k<num_triangles; ++k)
+	{
+		// No cached vertex has triangles left, so continue in the input order
+		if (best_triangle<0)
+		{
+			while (added[next_input])
+				next_input++;
+			best_triangle=next_input;
+		}
+
+		const GLuint *tri=indices+3*best_triangle;
+		output[3*k]=tri[0];
+		output[3*k+1]=tri[1];
+		output[3*k+2]=tri[2];
+		added[best_triangle]=true;
+
+		// Remove the triangle from the active triangles of its vertices
+		for (int j=0; j<3; ++j)
+		{
+			int v=tri[j];
+			int *list=&vertex_triangles[first_triangle[v]];
+			int n=num_active[v];
+			for (int m=0; m<n; ++m)
+				if (list[m]==best_triangle)
+				{
+					std::swap(list[m], list[n-1]);
+					break;
+				}
+			num_active[v]=n-1;
+		}
+
+		// Move the vertices of the triangle to the front of the cache
+		int new_count=0;
+		for (int j=0; j<3; ++j)
+			new_cache[new_count++]=tri[j];
+		for (int m=0; m<cache_count; ++m)
+		{
+			int v=cache[m];
+			if (v!=(int)tri[0] && v!=(int)tri[1] && v!=(int)tri[2])
+				new_cache[new_count++]=v;
+		}
+
+		// Update the scores of the vertices whose cache position changed and
+		//   of their triangles
+		for (int m=0; m<new_count; ++m)
+		{
+			int v=new_cache[m];
+			cache_position[v]=m<FORSYTH_CACHE_SIZE ? m : -1;
+			float score=scores.VertexScore(cache_position[v], num_active[v]);
+			float delta=score-vertex_score[v];
+			vertex_score[v]=score;
+			const int *list=&vertex_triangles[first_triangle[v]];
+			for (int a=0; a<num_active[v]; ++a)
+				triangle_score[list[a]]+=delta;
+		}
+		cache_count=std::min(new_count, FORSYTH_CACHE_SIZE);
+		std::copy(new_cache, new_cache+cache_count, cache);
+
+		// The next triangle is the best one that uses a cached vertex
+		best_triangle=-1;
+		float best_score=-1.0f;
+		for (int m=0; m<cache_count; ++m)
+		{
+			int v=cache[m];
+			const int *list=&vertex_triangles[first_triangle[v]];
+			for (int a=0; a<num_active[v]; ++a)
+				if (triangle_score[list[a]]>best_score)
+				{
+					best_score=triangle_score[list[a]];
+					best_triangle=list[a];
+				}
+		}
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+class COverdrawCluster
+// Run of consecutive triangles that is moved as a whole by OptimizeOverdraw
+{
+public:
+	int first_triangle, num_triangles;
+	float sort_key;
+
+	bool operator<(const COverdrawCluster& c) const
+	{ return sort_key>c.sort_key; } // Outward facing clusters first
+};
+
+void OptimizeOverdraw(
+	const CMeshVertex *vertices, GLuint *indices, int num_indices, int num_vertices,
+	float threshold)
+// Reorder clusters of triangles so that outward facing parts of the mesh are drawn
+//   first, independent of the view direction (Sander et al., Fast triangle reordering
+//   for vertex locality and reduced overdraw)
+// Run after OptimizeVertexCache; the triangles within a cluster keep their order
+// vertices: (in) Vertex array
+// indices: (in and out) Triangle list
+// num_indices, num_vertices: (in) The numbers of indices and vertices
+// threshold: (in) Allowed increase of the ACMR; larger values make more clusters
+{
+	const int cache_size=16;
+	int num_triangles=num_indices/3;
+	if (num_triangles==0)
+		return;
+
+	// Hard boundaries: triangles whose 3 vertices all miss start a new region
+	//   of the cache optimized order, so moving them costs nothing
+	std::vector<int> hard_boundaries;
+	{
+		std::vector<unsigned int> cache_time(num_vertices, 0);
+		unsigned int timestamp=cache_size;
+		for (int t=0; t<num_triangles; ++t)
+			if (CacheMisses(cache_time, timestamp, indices+3*t, cache_size)==3)
+				hard_boundaries.push_back(t);
+	}
+	if (hard_boundaries.empty() || hard_boundaries[0]!=0)
+		hard_boundaries.insert(hard_boundaries.begin(), 0);
+	hard_boundaries.push_back(num_triangles);
+
+	// Soft boundaries: split a region where the ACMR of the part before the split,
+	//   starting with a cold cache, is within threshold of that of the whole region
+	std::vector<COverdrawCluster> clusters;
+	for (size_t h=0; h+1<hard_boundaries.size(); ++h)
+	{
+		int start=hard_boundaries[h], end=hard_boundaries[h+1];
+
+		std::vector<unsigned int> cache_time(num_vertices, 0);
+		unsigned int timestamp=cache_size;
+		unsigned int region_misses=0;
+		for (int t=start; t<end; ++t)
+			region_misses+=CacheMisses(cache_time, timestamp, indices+3*t, cache_size);
+		float max_acmr=threshold*region_misses/(end-start);
+
+		std::fill(cache_time.begin(), cache_time.end(), 0);
+		timestamp=cache_size;
+		unsigned int misses=0;
+		int first=start;
+		for (int t=start; t<end; ++t)
+		{
+			misses+=CacheMisses(cache_time, timestamp, indices+3*t, cache_size);
+			if (t+1==end || (float)misses/(t+1-first)<=max_acmr)
+			{
+				COverdrawCluster c;
+				c.first_triangle=first;
+				c.num_triangles=t+1-first;
+				clusters.push_back(c);
+
+				first=t+1;
+				misses=0;
+				std::fill(cache_time.begin(), cache_time.end(), 0);
+				timestamp=cache_size;
+			}
+		}
+	}
+
+	// Area weighted centroids and normals of the clusters and of the mesh
+	std::vector<vec3> centroids(clusters.size()), normals(clusters.size());
+	vec3 mesh_centroid(0.0f, 0.0f, 0.0f);
+	float mesh_area=0.0f;
+	for (size_t c=0; c<clusters.size(); ++c)
+	{
+		vec3 centroid(0.0f, 0.0f, 0.0f), normal(0.0f, 0.0f, 0.0f);
+		float area=0.0f;
+		for (int t=0; t<clusters[c].num_triangles; ++t)
+		{
+			const GLuint *tri=indices+3*(clusters[c].first_triangle+t);
+			const point3& p0=vertices[tri[0]].pos;
+			const point3& p1=vertices[tri[1]].pos;
+			const point3& p2=vertices[tri[2]].pos;
+			vec3 n=cross(p1-p0, p2-p0);
+			float a=length(n);
+			centroid+=(a/3.0f)*(p0+p1+p2);
+			normal+=n;
+			area+=a;
+		}
+		mesh_centroid+=centroid;
+		mesh_area+=area;
+		centroids[c]=area>0.0f ? centroid/area : centroid;
+		normals[c]=length(normal)>0.0f ? normalize(normal) : normal;
+	}
+	if (mesh_area>0.0f)
+		mesh_centroid/=mesh_area;
+
+	// Clusters that face away from the center are more likely to hide others
+	for (size_t c=0; c<clusters.size(); ++c)
+		clusters[c].sort_key=dot(centroids[c]-mesh_centroid, normals[c]);
+	std::stable_sort(clusters.begin(), clusters.end());
+
+	std::vector<GLuint> output;
+	output.reserve(3*num_triangles);
+	for (size_t c=0; c<clusters.size(); ++c)
+		output.insert(output.end(),
+			indices+3*clusters[c].first_triangle,
+			indices+3*(clusters[c].first_triangle+clusters[c].num_triangles));
+	std::copy(output.begin(), output.end(), indices);
+}
+
+int OptimizeVertexFetch(CMeshVertex *vertices, GLuint *indices, int num_indices, int num_vertices)
+// Reorder the vertices in the order in which the indices first use them and
+//   return the number of vertices used
+// Vertices that are not used are moved to the end
+// vertices: (in and out) Vertex array
+// indices: (in and out) Index array
+// num_indices, num_vertices: (in) The numbers of indices and vertices
+{
+	std::vector<int> remap(num_vertices, -1);
+	int next=0;
+	for (int i=0; i<num_indices; ++i)
+	{
+		if (remap[indices[i]]<0)
+			remap[indices[i]]=next++;
+		indices[i]=remap[indices[i]];
+	}
+	int num_used=next;
+	for (int v=0; v<num_vertices; ++v)
+		if (remap[v]<0)
+			remap[v]=next++;
+
+	std::vector<CMeshVertex> reordered(num_vertices);
+	for (int v=0; v<num_vertices; ++v)
+		reordered[remap[v]]=vertices[v];
+	std::copy(reordered.begin(), reordered.end(), vertices);
+	return num_used;
+}
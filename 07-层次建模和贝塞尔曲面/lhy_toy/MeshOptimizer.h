@@ -0,0 +1,88 @@
+#ifndef _MESH_OPTIMIZER_H_
+#define _MESH_OPTIMIZER_H_
+
+#include "GL/glew.h"
+
+class CMeshVertex;
+
+// Clean-up and reordering of indexed triangle lists for the GPU
+// None of the passes changes how the mesh looks
+// Typical use: WeldVertices, RemoveDegenerateTriangles, OptimizeVertexCache,
+//   OptimizeOverdraw, then OptimizeVertexFetch
+
+// Largest differences of the attributes of two vertices that are merged by WeldVertices
+// A negative tolerance for color, normal or texcoord ignores that attribute; the
+//   position tolerance must be 0 or more, 0 merging only identical positions, since
+//   vertices are only compared with the ones near them
+class CWeldTolerance
+{
+public:
+	float position; // Distance, 0 or more
+	float color;    // Per component
+	float normal;   // Per component
+	float texcoord; // Per component
+};
+
+// Vertex cache statistics of an index array
+class CVertexCacheStats
+{
+public:
+	float acmr; // Average cache miss ratio: vertex shader runs per triangle (0.5 to 3)
+	float atvr; // Average transformed vertex ratio: vertex shader runs per
+	            //   referenced vertex (1 is optimal)
+};
+
+int WeldVertices(
+	CMeshVertex *vertices, GLuint *indices, int num_indices, int num_vertices,
+	const CWeldTolerance& tolerance);
+// Merge vertices whose attributes are all within tolerance and return the number
+//   of vertices left; each merged vertex keeps the attributes of its first copy
+// Vertices are looked up in a hash grid of cells of the position tolerance
+// vertices: (in and out) Vertex array, compacted in place
+// indices: (in and out) Index array
+// num_indices, num_vertices: (in) The numbers of indices and vertices
+// tolerance: (in) Attribute tolerances
+
+int RemoveDegenerateTriangles(
+	const CMeshVertex *vertices, GLuint *indices, int num_indices);
+// Remove the triangles that use a vertex twice or whose area is negligible
+//   compared with their longest edge, and return the number of indices left
+// Such triangles do not cover any pixel
+// vertices: (in) Vertex array
+// indices: (in and out) Triangle list, compacted in place
+// num_indices: (in) The number of indices
+
+CVertexCacheStats AnalyzeVertexCache(
+	const GLuint *indices, int num_indices, int num_vertices, int cache_size=16);
+// Simulate a FIFO post-transform vertex cache and return its statistics
+// indices: (in) Triangle list
+// num_indices, num_vertices: (in) The numbers of indices and vertices
+// cache_size: (in) The number of vertices in the cache
+
+void OptimizeVertexCache(GLuint *indices, int num_indices, int num_vertices);
+// Reorder the triangles so that the vertices they share are still in the cache
+//   (Forsyth's linear-speed vertex cache optimization)
+// indices: (in and out) Triangle list
+// num_indices, num_vertices: (in) The numbers of indices and vertices
+
+void OptimizeOverdraw(
+	const CMeshVertex *vertices, GLuint *indices, int num_indices, int num_vertices,
+	float threshold=1.05f);
+// Reorder clusters of triangles so that outward facing parts of the mesh are drawn
+//   first, independent of the view direction (Sander et al., Fast triangle reordering
+//   for vertex locality and reduced overdraw)
+// Run after OptimizeVertexCache; the triangles within a cluster keep their order
+// vertices: (in) Vertex array
+// indices: (in and out) Triangle list
+// num_indices, num_vertices: (in) The numbers of indices and vertices
+// threshold: (in) Allowed increase of the ACMR; larger values make more clusters
+
+int OptimizeVertexFetch(CMeshVertex *vertices, GLuint *indices, int num_indices, int num_vertices);
+// Reorder the vertices in the order in which the indices first use them and
+//   return the number of vertices used
+// Vertices that are not used are moved to the end
+// vertices: (in and out) Vertex array
+// indices: (in and out) Index array
+// num_indices, num_vertices: (in) The numbers of indices and vertices
+
+#endif
@@ -0,0 +1,680 @@
+#include "MeshSimplifier.h"
+#include "Mesh.h"
+#include <math.h>
+#include <float.h>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <thread>
+
+// Loops over fewer items than this run on the calling thread only
+#define SIMPLIFY_MIN_PARALLEL_ITEMS 16384
+
+// How a vertex may move, found once from the input mesh
+enum SIMPLIFY_VERTEX_KIND
+{
+	SIMPLIFY_MANIFOLD, // Interior vertex, moves along any edge
+	SIMPLIFY_BORDER,   // Vertex of one open boundary, moves along the boundary
+	SIMPLIFY_SEAM,     // One of the two copies of a seam vertex, moves along the seam
+	                   //   together with the other copy
+	SIMPLIFY_LOCKED    // Corner of boundaries or seams, or non-manifold; never moves
+};
+
+CSimplifyOptions::CSimplifyOptions(void)
+{
+	normal_weight=0.003f;
+	texcoord_weight=0.003f;
+	color_weight=0.003f;
+	border_weight=10.0f;
+	position_tolerance=1e-5f;
+	num_threads=0;
+}
+
+// Sum of weighted squared distances to planes, p'Ap+2b'p+c, and the sum of the weights
+class CQuadric
+{
+public:
+	double a00, a11, a22, a01, a02, a12, b0, b1, b2, c;
+	double weight;
+
+	void Clear(void)
+	{
+		a00=a11=a22=a01=a02=a12=b0=b1=b2=c=weight=0.0;
+	}
+
+	void AddPlane(const vec3& n, double d, double w)
+	// Add the plane dot(n, p)+d=0 with weight w; n is of unit length
+	{
+		a00+=w*n.x*n.x; a11+=w*n.y*n.y; a22+=w*n.z*n.z;
+		a01+=w*n.x*n.y; a02+=w*n.x*n.z; a12+=w*n.y*n.z;
+		b0+=w*n.x*d; b1+=w*n.y*d; b2+=w*n.z*d;
+		c+=w*d*d;
+		weight+=w;
+	}
+
+	void Add(const CQuadric& q)
+	{
+		a00+=q.a00; a11+=q.a11; a22+=q.a22;
+		a01+=q.a01; a02+=q.a02; a12+=q.a12;
+		b0+=q.b0; b1+=q.b1; b2+=q.b2;
+		c+=q.c;
+		weight+=q.weight;
+	}
+
+	double Evaluate(const vec3& p) const
+	// Return the weighted mean of the squared distances of p to the planes
+	{
+		if (weight<=0.0)
+			return 0.0;
+		double x=p.x, y=p.y, z=p.z;
+		double e=a00*x*x+a11*y*y+a22*z*z+2.0*(a01*x*y+a02*x*z+a12*y*z)
+			+2.0*(b0*x+b1*y+b2*z)+c;
+		return e>0.0 ? e/weight : 0.0;
+	}
+};
+
+// Collapse of a vertex onto a neighbor
+class CCollapse
+{
+public:
+	float cost;        // Squared error relative to the size of the mesh
+	int from, to;      // The vertex that moves and its target; to is -1 if from cannot move
+	int num_removed;   // The number of triangles that the collapse removes
+
+	bool operator<(const CCollapse& other) const
+	{ return cost<other.cost || (cost==other.cost && from<other.from); }
+};
+
+template<class Function>
+static void ParallelFor(int count, int num_threads, const Function& function)
+// Split 0 to count into one range per thread and call function(begin, end) on each
+{
+	if (num_threads<=0)
+		num_threads=(int)std::thread::hardware_concurrency();
+	if (num_threads<=0 || count<SIMPLIFY_MIN_PARALLEL_ITEMS)
+		num_threads=1;
+
+	std::vector<std::thread> threads;
+	for (int i=1; i<num_threads; ++i)
+		threads.push_back(std::thread(function,
+			(int)((long long)count*i/num_threads), (int)((long long)count*(i+1)/num_threads)));
+	function(0, (int)((long long)count/num_threads));
+	for (size_t i=0; i<threads.size(); ++i)
+		threads[i].join();
+}
+
+static unsigned long long CellKey(int x, int y, int z)
+// Return the hash key of a cell of the position grid, 21 bits per coordinate
+{
+	return ((unsigned long long)(x&0x1fffff)<<42)|
+		((unsigned long long)(y&0x1fffff)<<21)|
+		(unsigned long long)(z&0x1fffff);
+}
+
+static unsigned long long EdgeKey(int a, int b)
+{
+	return ((unsigned long long)(unsigned int)a<<32)|(unsigned int)b;
+}
+
+// State of one SimplifyMesh call
+class CSimplifier
+{
+public:
+	const CMeshVertex *vertices;
+	int num_vertices;
+	GLuint *indices;
+	int num_indices;
+	const CSimplifyOptions& options;
+
+	std::vector<vec3> positions;       // Positions scaled into a unit box, the same for
+	                                   //   all vertices at one position
+	std::vector<int> group;            // First vertex at the same position
+	std::vector<int> next_wedge;       // Ring of the vertices at the same position
+	std::vector<unsigned char> kind;   // SIMPLIFY_VERTEX_KIND
+	std::vector<CQuadric> quadrics;    // Quadric of each position, at its first vertex
+	std::vector<int> offsets;          // Triangles around each vertex in
+	std::vector<int> adjacent;         //   adjacent[offsets[v]] to adjacent[offsets[v+1]-1]
+
+	CSimplifier(const CMeshVertex *vertices, int num_vertices, GLuint *indices,
+		int num_indices, const CSimplifyOptions& options)
+		: vertices(vertices), num_vertices(num_vertices), indices(indices),
+		num_indices(num_indices), options(options) {}
+
+	void GroupPositions(void);
+	void ScalePositions(const vec3& pmin, float extent);
+	void RemoveDegenerateTriangles(void);
+	void BuildAdjacency(void);
+	void ClassifyVertices(void);
+	void ComputeQuadrics(void);
+
+	int CountTrianglesWith(int v, int g) const;
+	int FindCornerIn(int v, int g, int end=-1) const;
+	int GetTwin(int v) const;
+	void GetNeighborGroups(int v, std::vector<int>& neighbors) const;
+	bool Flips(int v, int g, const vec3& p) const;
+	float AttributeError(int a, int b) const;
+	CCollapse EvaluateVertex(int u, std::vector<int>& scratch_u, std::vector<int>& scratch_v) const;
+};
+
+void CSimplifier::GroupPositions(void)
+// Link the vertices whose positions are within options.position_tolerance into rings;
+//   a vertex joins the first earlier vertex in range, so that copies of a vertex
+//   computed by different patches match
+// The first vertices are kept in a hash grid of cells of twice the tolerance; vertices
+//   in range are in the same cell or in the adjacent ones on the nearer side, which
+//   takes 8 lookups per vertex instead of 27
+{
+	float tolerance=options.position_tolerance;
+	float cell_size=tolerance>0.0f ? 2.0f*tolerance : 1e-6f;
+	std::unordered_map<unsigned long long, int> cell_heads;
+	cell_heads.reserve(num_vertices);
+	std::vector<int> next_in_cell;
+	next_in_cell.reserve(num_vertices);
+
+	group.resize(num_vertices);
+	next_wedge.resize(num_vertices);
+	for (int v=0; v<num_vertices; ++v)
+	{
+		const point3& p=vertices[v].pos;
+		float fx=p.x/cell_size, fy=p.y/cell_size, fz=p.z/cell_size;
+		int cx=(int)floorf(fx), cy=(int)floorf(fy), cz=(int)floorf(fz);
+		int sx=fx-cx<0.5f ? -1 : 1, sy=fy-cy<0.5f ? -1 : 1, sz=fz-cz<0.5f ? -1 : 1;
+
+		int match=-1;
+		for (int dz=0; dz<2 && match<0; ++dz)
+			for (int dy=0; dy<2 && match<0; ++dy)
+				for (int dx=0; dx<2 && match<0; ++dx)
+				{
+					std::unordered_map<unsigned long long, int>::const_iterator it=
+						cell_heads.find(CellKey(cx+dx*sx, cy+dy*sy, cz+dz*sz));
+					for (int k=it!=cell_heads.end() ? it->second : -1; k>=0; k=next_in_cell[k])
+					{
+						const point3& q=vertices[group[k]].pos;
+						if (fabsf(p.x-q.x)<=tolerance && fabsf(p.y-q.y)<=tolerance &&
+							fabsf(p.z-q.z)<=tolerance)
+						{
+							match=group[k];
+							break;
+						}
+					}
+				}
+
+		if (match>=0)
+		{
+			group[v]=match;
+			next_wedge[v]=next_wedge[match];
+			next_wedge[match]=v;
+			next_in_cell.push_back(-1);
+		}
+		else
+		{
+			// The cell lists hold the first vertex of each position
+			group[v]=v;
+			next_wedge[v]=v;
+			unsigned long long key=CellKey(cx, cy, cz);
+			std::unordered_map<unsigned long long, int>::iterator it=cell_heads.find(key);
+			next_in_cell.push_back(it!=cell_heads.end() ? it->second : -1);
+			cell_heads[key]=v;
+		}
+	}
+}
+
+void CSimplifier::ScalePositions(const vec3& pmin, float extent)
+// Scale the positions into a unit box; all vertices at one position take the position
+//   of the first one
+{
+	positions.resize(num_vertices);
+	for (int v=0; v<num_vertices; ++v)
+		positions[v]=(vertices[group[v]].pos-pmin)/extent;
+}
+
+void CSimplifier::RemoveDegenerateTriangles(void)
+// Drop the triangles with two corners at the same position
+{
+	int n=0;
+	for (int i=0; i<num_indices; i+=3)
+	{
+		int g0=group[indices[i]], g1=group[indices[i+1]], g2=group[indices[i+2]];
+		if (g0==g1 || g1==g2 || g2==g0)
+			continue;
+		indices[n]=indices[i];
+		indices[n+1]=indices[i+1];
+		indices[n+2]=indices[i+2];
+		n+=3;
+	}
+	num_indices=n;
+}
+
+void CSimplifier::BuildAdjacency(void)
+{
+	offsets.assign(num_vertices+1, 0);
+	for (int i=0; i<num_indices; ++i)
+		++offsets[indices[i]+1];
+	for (int v=0; v<num_vertices; ++v)
+		offsets[v+1]+=offsets[v];
+
+	adjacent.resize(num_indices);
+	std::vector<int> fill(offsets.begin(), offsets.end()-1);
+	for (int i=0; i<num_indices; ++i)
+		adjacent[fill[indices[i]]++]=i/3;
+}
+
+void CSimplifier::ClassifyVertices(void)
+// Find the open edges, which have no opposite edge between the same positions, and
+//   the seam edges, which have one between other copies of the same positions
+{
+	std::vector<unsigned long long> vertex_edges(num_indices), group_edges(num_indices);
+	for (int i=0; i<num_indices; ++i)
+	{
+		int a=indices[i], b=indices[i%3==2 ? i-2 : i+1];
+		vertex_edges[i]=EdgeKey(a, b);
+		group_edges[i]=EdgeKey(group[a], group[b]);
+	}
+	std::sort(vertex_edges.begin(), vertex_edges.end());
+	std::sort(group_edges.begin(), group_edges.end());
+
+	std::vector<int> open_in(num_vertices, 0), open_out(num_vertices, 0);
+	std::vector<int> seam_in(num_vertices, 0), seam_out(num_vertices, 0);
+	std::vector<int> num_wedges(num_vertices, 0);
+	for (int i=0; i<num_indices; ++i)
+	{
+		int a=indices[i], b=indices[i%3==2 ? i-2 : i+1];
+		if (!std::binary_search(group_edges.begin(), group_edges.end(), EdgeKey(group[b], group[a])))
+		{
+			++open_out[group[a]];
+			++open_in[group[b]];
+		}
+		else if (!std::binary_search(vertex_edges.begin(), vertex_edges.end(), EdgeKey(b, a)))
+		{
+			++seam_out[a];
+			++seam_in[b];
+		}
+	}
+	for (int v=0; v<num_vertices; ++v)
+		if (offsets[v+1]>offsets[v])
+			++num_wedges[group[v]];
+
+	kind.resize(num_vertices);
+	for (int v=0; v<num_vertices; ++v)
+	{
+		int g=group[v];
+		bool no_seam=seam_in[v]==0 && seam_out[v]==0;
+		if (open_in[g]==0 && open_out[g]==0)
+		{
+			if (num_wedges[g]==1 && no_seam)
+				kind[v]=SIMPLIFY_MANIFOLD;
+			else if (num_wedges[g]==2 && seam_in[v]==1 && seam_out[v]==1)
+				kind[v]=SIMPLIFY_SEAM;
+			else
+				kind[v]=SIMPLIFY_LOCKED;
+		}
+		else if (open_in[g]==1 && open_out[g]==1 && num_wedges[g]==1 && no_seam)
+			kind[v]=SIMPLIFY_BORDER;
+		else
+			kind[v]=SIMPLIFY_LOCKED;
+	}
+}
+
+void CSimplifier::ComputeQuadrics(void)
+// Sum the planes of the triangles around each position, weighted by their areas, and
+//   add planes through the open edges that keep the boundaries in place
+{
+	int num_triangles=num_indices/3;
+	std::vector<CQuadric> triangle_quadrics(num_triangles);
+	ParallelFor(num_triangles, options.num_threads, [&](int begin, int end)
+	{
+		for (int t=begin; t<end; ++t)
+		{
+			const vec3& p0=positions[indices[3*t]];
+			vec3 n=cross(positions[indices[3*t+1]]-p0, positions[indices[3*t+2]]-p0);
+			float area2=length(n);
+			triangle_quadrics[t].Clear();
+			if (area2>0.0f)
+				triangle_quadrics[t].AddPlane(n/area2, -dot(n/area2, p0), 0.5*area2);
+		}
+	});
+
+	quadrics.resize(num_vertices);
+	ParallelFor(num_vertices, options.num_threads, [&](int begin, int end)
+	{
+		for (int v=begin; v<end; ++v)
+		{
+			quadrics[v].Clear();
+			if (group[v]!=v)
+				continue;
+			int w=v;
+			do
+			{
+				for (int k=offsets[w]; k<offsets[w+1]; ++k)
+					quadrics[v].Add(triangle_quadrics[adjacent[k]]);
+				w=next_wedge[w];
+			} while (w!=v);
+		}
+	});
+
+	// An open edge has a single triangle around the position of its first vertex
+	//   that has a corner at the position of the second vertex
+	for (int i=0; i<num_indices; ++i)
+	{
+		int a=indices[i], b=indices[i%3==2 ? i-2 : i+1];
+		int count=0;
+		int w=a;
+		do
+		{
+			count+=CountTrianglesWith(w, group[b]);
+			w=next_wedge[w];
+		} while (w!=a);
+		if (count!=1)
+			continue;
+
+		const vec3& p0=positions[indices[i/3*3]];
+		vec3 face_normal=cross(positions[indices[i/3*3+1]]-p0, positions[indices[i/3*3+2]]-p0);
+		vec3 edge=positions[b]-positions[a];
+		vec3 n=cross(edge, face_normal);
+		float len=length(n);
+		if (len<=0.0f)
+			continue;
+		n/=len;
+		double w2=options.border_weight*dot(edge, edge);
+		quadrics[group[a]].AddPlane(n, -dot(n, positions[a]), w2);
+		quadrics[group[b]].AddPlane(n, -dot(n, positions[a]), w2);
+	}
+}
+
+int CSimplifier::CountTrianglesWith(int v, int g) const
+// Return the number of triangles around v with a corner at position group g
+{
+	int count=0;
+	for (int k=offsets[v]; k<offsets[v+1]; ++k)
+	{
+		const GLuint *t=&indices[3*adjacent[k]];
+		if (group[t[0]]==g || group[t[1]]==g || group[t[2]]==g)
+			++count;
+	}
+	return count;
+}
+
+int CSimplifier::FindCornerIn(int v, int g, int end) const
+// Return a corner at position group g of the triangles around v, or -1
+// end: (in) Offset in adjacent after the last triangle to search, -1 for all of them
+{
+	if (end<0)
+		end=offsets[v+1];
+	for (int k=offsets[v]; k<end; ++k)
+	{
+		const GLuint *t=&indices[3*adjacent[k]];
+		for (int c=0; c<3; ++c)
+			if (group[t[c]]==g)
+				return t[c];
+	}
+	return -1;
+}
+
+int CSimplifier::GetTwin(int v) const
+// Return the other copy of a seam vertex that is still used, or -1
+{
+	for (int w=next_wedge[v]; w!=v; w=next_wedge[w])
+		if (offsets[w+1]>offsets[w])
+			return w;
+	return -1;
+}
+
+void CSimplifier::GetNeighborGroups(int v, std::vector<int>& neighbors) const
+// Collect the positions connected by an edge to the position of v
+{
+	neighbors.clear();
+	int w=v;
+	do
+	{
+		for (int k=offsets[w]; k<offsets[w+1]; ++k)
+		{
+			const GLuint *t=&indices[3*adjacent[k]];
+			for (int c=0; c<3; ++c)
+			{
+				int g=group[t[c]];
+				if (g!=group[v] && std::find(neighbors.begin(), neighbors.end(), g)==neighbors.end())
+					neighbors.push_back(g);
+			}
+		}
+		w=next_wedge[w];
+	} while (w!=v);
+}
+
+bool CSimplifier::Flips(int v, int g, const vec3& p) const
+// Return whether moving v to p turns over one of the triangles around v that do not
+//   have a corner at position group g and so are kept
+{
+	for (int k=offsets[v]; k<offsets[v+1]; ++k)
+	{
+		const GLuint *t=&indices[3*adjacent[k]];
+		if (group[t[0]]==g || group[t[1]]==g || group[t[2]]==g)
+			continue;
+		vec3 p0=positions[t[0]], p1=positions[t[1]], p2=positions[t[2]];
+		vec3 before=cross(p1-p0, p2-p0);
+		if ((int)t[0]==v) p0=p;
+		if ((int)t[1]==v) p1=p;
+		if ((int)t[2]==v) p2=p;
+		vec3 after=cross(p1-p0, p2-p0);
+		if (dot(before, after)<=0.0f)
+			return true;
+	}
+	return false;
+}
+
+float CSimplifier::AttributeError(int a, int b) const
+// Return the weighted squared difference of the attributes of two vertices
+{
+	vec3 dn=vertices[a].normal-vertices[b].normal;
+	vec2 dt=vertices[a].texcoord-vertices[b].texcoord;
+	color4 dc=vertices[a].color-vertices[b].color;
+	return options.normal_weight*options.normal_weight*dot(dn, dn)+
+		options.texcoord_weight*options.texcoord_weight*dot(dt, dt)+
+		options.color_weight*options.color_weight*dot(dc, dc);
+}
+
+CCollapse CSimplifier::EvaluateVertex(int u, std::vector<int>& neighbors_u, std::vector<int>& neighbors_v) const
+// Return the cheapest valid collapse of u onto one of its neighbors
+// A collapse is valid if it follows the boundaries and seams, keeps the surface
+//   manifold (the two positions share only the neighbors of the removed triangles)
+//   and turns over no triangle
+// neighbors_u, neighbors_v: (in) Scratch arrays
+{
+	CCollapse best;
+	best.cost=FLT_MAX;
+	best.from=u;
+	best.to=-1;
+	best.num_removed=0;
+	if (kind[u]==SIMPLIFY_LOCKED || offsets[u+1]==offsets[u])
+		return best;
+
+	int twin=-1;
+	if (kind[u]==SIMPLIFY_SEAM && (twin=GetTwin(u))<0)
+		return best;
+	const CQuadric& q=quadrics[group[u]];
+	neighbors_u.clear();
+	GetNeighborGroups(u, neighbors_u);
+
+	// Each target is rated once, though it is a corner of two triangles around u
+	for (int k=offsets[u]; k<offsets[u+1]; ++k)
+	{
+		const GLuint *t=&indices[3*adjacent[k]];
+		for (int c=0; c<3; ++c)
+		{
+			int v=t[c], g=group[v];
+			if (g==group[u] || FindCornerIn(u, g, k)>=0)
+				continue;
+
+			// Interior edges have two triangles, open edges one and seam edges one on
+			//   each side
+			int count=CountTrianglesWith(u, g);
+			float cost=AttributeError(u, v);
+			if (kind[u]==SIMPLIFY_MANIFOLD && count!=2)
+				continue;
+			if (kind[u]==SIMPLIFY_BORDER && count!=1)
+				continue;
+			if (kind[u]==SIMPLIFY_SEAM)
+			{
+				int twin_to=FindCornerIn(twin, g);
+				if (count!=1 || twin_to<0 || twin_to==v || CountTrianglesWith(twin, g)!=1)
+					continue;
+				cost=std::max(cost, AttributeError(twin, twin_to));
+				count=2;
+			}
+			// Vertices with invalid attributes (NaN) neither move nor take others
+			cost+=(float)q.Evaluate(positions[v]);
+			if (!(cost<best.cost))
+				continue;
+
+			GetNeighborGroups(v, neighbors_v);
+			int common=0;
+			for (size_t i=0; i<neighbors_v.size(); ++i)
+				if (std::find(neighbors_u.begin(), neighbors_u.end(), neighbors_v[i])!=neighbors_u.end())
+					++common;
+			if (common!=count)
+				continue;
+
+			if (Flips(u, g, positions[v]) || (twin>=0 && Flips(twin, g, positions[v])))
+				continue;
+
+			best.cost=cost;
+			best.to=v;
+			best.num_removed=count;
+		}
+	}
+	return best;
+}
+
+int SimplifyMesh(
+	const CMeshVertex *vertices, int num_vertices, GLuint *indices, int num_indices,
+	int target_num_indices, float target_error, const CSimplifyOptions& options,
+	float *result_error, std::vector<CSimplifyStep> *curve)
+// Collapse edges until at most target_num_indices indices are left or no collapse
+//   stays within target_error, and return the number of indices left
+// Each pass rates a collapse for every vertex in parallel and then applies the cheapest
+//   ones whose neighborhoods do not overlap
+// vertices: (in) Vertex array
+// num_vertices: (in) The number of vertices
+// indices: (in and out) Triangle list, compacted in place
+// num_indices: (in) The number of indices
+// target_num_indices: (in) The number of indices to reach
+// target_error: (in) Largest error allowed, in object coordinates
+// options: (in) Attribute weights and the number of threads
+// result_error: (out) Largest error of the collapses in object coordinates, if not NULL
+// curve: (out) The numbers of triangles and errors after each pass are appended,
+//        if not NULL
+{
+	if (result_error!=NULL)
+		*result_error=0.0f;
+	if (num_vertices==0 || num_indices<3)
+		return num_indices;
+
+	// Errors are measured in a box of unit size, so that the attribute weights do not
+	//   depend on the size of the mesh
+	vec3 pmin=vertices[0].pos, pmax=vertices[0].pos;
+	for (int v=1; v<num_vertices; ++v)
+		for (int k=0; k<3; ++k)
+		{
+			pmin[k]=fminf(pmin[k], vertices[v].pos[k]);
+			pmax[k]=fmaxf(pmax[k], vertices[v].pos[k]);
+		}
+	float extent=fmaxf(fmaxf(pmax.x-pmin.x, pmax.y-pmin.y), pmax.z-pmin.z);
+	if (extent<=0.0f)
+		return num_indices;
+
+	CSimplifier s(vertices, num_vertices, indices, num_indices-num_indices%3, options);
+	s.GroupPositions();
+	s.ScalePositions(pmin, extent);
+	s.RemoveDegenerateTriangles();
+	s.BuildAdjacency();
+	s.ClassifyVertices();
+	s.ComputeQuadrics();
+
+	double error_limit=(double)target_error/extent;
+	error_limit*=error_limit;
+	float max_cost=0.0f;
+	std::vector<int> remap(num_vertices);
+	for (int v=0; v<num_vertices; ++v)
+		remap[v]=v;
+	std::vector<unsigned char> locked(num_vertices);
+	std::vector<CCollapse> candidates(num_vertices);
+
+	while (s.num_indices>target_num_indices)
+	{
+		ParallelFor(num_vertices, options.num_threads, [&](int begin, int end)
+		{
+			std::vector<int> neighbors_u, neighbors_v;
+			for (int v=begin; v<end; ++v)
+				candidates[v]=s.EvaluateVertex(v, neighbors_u, neighbors_v);
+		});
+		std::vector<CCollapse> sorted;
+		for (int v=0; v<num_vertices; ++v)
+			if (candidates[v].to>=0)
+				sorted.push_back(candidates[v]);
+		std::sort(sorted.begin(), sorted.end());
+
+		// Apply the cheapest collapses; each locks the vertices of the triangles that it
+		//   changes, so that the ratings of the later ones stay valid
+		std::fill(locked.begin(), locked.end(), 0);
+		int num_removable=(s.num_indices-target_num_indices)/3;
+		int num_removed=0;
+		std::vector<int> collapsed;
+		for (size_t i=0; i<sorted.size() && num_removed<num_removable; ++i)
+		{
+			const CCollapse& c=sorted[i];
+			if (c.cost>error_limit)
+				break;
+			if (locked[c.from] || locked[c.to])
+				continue;
+
+			int twin=s.kind[c.from]==SIMPLIFY_SEAM ? s.GetTwin(c.from) : -1;
+			remap[c.from]=c.to;
+			collapsed.push_back(c.from);
+			if (twin>=0)
+			{
+				remap[twin]=s.FindCornerIn(twin, s.group[c.to]);
+				collapsed.push_back(twin);
+			}
+			s.quadrics[s.group[c.to]].Add(s.quadrics[s.group[c.from]]);
+
+			int moved[2]={c.from, twin};
+			for (int m=0; m<2 && moved[m]>=0; ++m)
+				for (int k=s.offsets[moved[m]]; k<s.offsets[moved[m]+1]; ++k)
+					for (int corner=0; corner<3; ++corner)
+					{
+						int x=indices[3*s.adjacent[k]+corner], y=x;
+						do
+						{
+							locked[y]=1;
+							y=s.next_wedge[y];
+						} while (y!=x);
+					}
+
+			num_removed+=c.num_removed;
+			max_cost=std::max(max_cost, c.cost);
+		}
+		if (collapsed.empty())
+			break;
+
+		ParallelFor(s.num_indices, options.num_threads, [&](int begin, int end)
+		{
+			for (int i=begin; i<end; ++i)
+				indices[i]=remap[indices[i]];
+		});
+		for (size_t i=0; i<collapsed.size(); ++i)
+			remap[collapsed[i]]=collapsed[i];
+		s.RemoveDegenerateTriangles();
+		s.BuildAdjacency();
+
+		if (curve!=NULL)
+		{
+			CSimplifyStep step;
+			step.num_triangles=s.num_indices/3;
+			step.error=sqrtf(max_cost)*extent;
+			curve->push_back(step);
+		}
+	}
+
+	if (result_error!=NULL)
+		*result_error=sqrtf(max_cost)*extent;
+	return s.num_indices;
+}
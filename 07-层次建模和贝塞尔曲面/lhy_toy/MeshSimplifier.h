@@ -0,0 +1,58 @@
+#ifndef _MESH_SIMPLIFIER_H_
+#define _MESH_SIMPLIFIER_H_
+
+#include "GL/glew.h"
+#include <vector>
+
+class CMeshVertex;
+
+// Edge collapse simplification of indexed triangle lists with quadric error metrics
+//   (Garland and Heckbert, Surface simplification using quadric error metrics)
+// A collapse moves a vertex onto one of its neighbors, so the simplified triangles
+//   index a subset of the original vertices
+// Vertices at the same position with different attributes form a seam; seams and
+//   open boundaries only collapse along themselves and non-manifold vertices never move
+
+// Settings of SimplifyMesh
+class CSimplifyOptions
+{
+public:
+	float normal_weight;   // Error, relative to the size of the mesh, of a unit difference
+	float texcoord_weight; //   of the normals, texture coordinates and colors of the two
+	float color_weight;    //   vertices of a collapse
+	float border_weight;   // Weight of the planes that keep open boundaries in place
+	float position_tolerance; // Vertices closer than this in each coordinate are at the
+	                          //   same position, in object coordinates
+	int num_threads;       // The number of threads, 0 for the number of hardware threads
+
+	CSimplifyOptions(void);
+};
+
+// Point of the error curve of SimplifyMesh
+class CSimplifyStep
+{
+public:
+	int num_triangles; // The number of triangles after a pass of collapses
+	float error;       // Largest error so far, in object coordinates
+};
+
+int SimplifyMesh(
+	const CMeshVertex *vertices, int num_vertices, GLuint *indices, int num_indices,
+	int target_num_indices, float target_error, const CSimplifyOptions& options,
+	float *result_error=NULL, std::vector<CSimplifyStep> *curve=NULL);
+// Collapse edges until at most target_num_indices indices are left or no collapse
+//   stays within target_error, and return the number of indices left
+// Each pass rates a collapse for every vertex in parallel and then applies the cheapest
+//   ones whose neighborhoods do not overlap
+// vertices: (in) Vertex array
+// num_vertices: (in) The number of vertices
+// indices: (in and out) Triangle list, compacted in place
+// num_indices: (in) The number of indices
+// target_num_indices: (in) The number of indices to reach
+// target_error: (in) Largest error allowed, in object coordinates
+// options: (in) Attribute weights and the number of threads
+// result_error: (out) Largest error of the collapses in object coordinates, if not NULL
+// curve: (out) The numbers of triangles and errors after each pass are appended,
+//        if not NULL
+
+#endif
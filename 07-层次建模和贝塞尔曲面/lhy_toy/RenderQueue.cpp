@@ -0,0 +1,292 @@
+#include <stddef.h>
+#include <string.h>
+#include "RenderQueue.h"
+
+// Widths of the fields of the sort key in bits
+#define KEY_PASS_BITS 4
+#define KEY_PROGRAM_BITS 8
+#define KEY_MATERIAL_BITS 8
+#define KEY_TEXTURE_BITS 10
+#define KEY_MESH_BITS 10
+#define KEY_DEPTH_BITS 24
+
+CRenderQueue::CRenderQueue(void)
+{
+	instance_buffer_obj=0;
+	num_draws=0;
+	num_instances=0;
+	num_program_changes=0;
+	num_material_changes=0;
+	num_texture_changes=0;
+	num_vertex_array_changes=0;
+	num_pass_changes=0;
+}
+
+unsigned long long CRenderQueue::GetId(std::vector<GLuint>& table, GLuint name, int bits)
+// Return the id of an OpenGL object, giving it the next one if it has none
+{
+	size_t i=0;
+	while (i<table.size() && table[i]!=name)
+		i++;
+	if (i==table.size())
+		table.push_back(name);
+	return (unsigned long long)i & ((1ULL<<bits)-1);
+}
+
+unsigned long long CRenderQueue::GetId(std::vector<const CMesh *>& table, const CMesh *mesh, int bits)
+// Return the id of a mesh, giving it the next one if it has none
+{
+	size_t i=0;
+	while (i<table.size() && table[i]!=mesh)
+		i++;
+	if (i==table.size())
+		table.push_back(mesh);
+	return (unsigned long long)i & ((1ULL<<bits)-1);
+}
+
+unsigned long long CRenderQueue::MakeKey(const CRenderItem& item)
+// Return the sort key of a draw
+{
+	// The bits of a positive float increase with its value, so the upper bits of the
+	//   depth compare like the depth itself
+	float depth=item.depth>0.0f ? item.depth : 0.0f;
+	unsigned int depth_bits;
+	memcpy(&depth_bits, &depth, sizeof(depth_bits));
+	unsigned long long d=depth_bits>>(31-KEY_DEPTH_BITS);
+
+	// program | material | texture | mesh
+	unsigned long long state=GetId(programs, item.program, KEY_PROGRAM_BITS);
+	state=(state<<KEY_MATERIAL_BITS) | GetId(materials, item.material_buffer, KEY_MATERIAL_BITS);
+	state=(state<<KEY_TEXTURE_BITS) | GetId(textures, item.texture, KEY_TEXTURE_BITS);
+	state=(state<<KEY_MESH_BITS) | GetId(meshes, item.mesh, KEY_MESH_BITS);
+
+	unsigned long long key=(unsigned long long)(item.pass & ((1<<KEY_PASS_BITS)-1))<<(64-KEY_PASS_BITS);
+	if (item.pass==RENDER_PASS_TRANSPARENT)
+	{
+		// Back to front: a larger depth gives a smaller key
+		d=((1ULL<<KEY_DEPTH_BITS)-1)-d;
+		key|=(d<<(64-KEY_PASS_BITS-KEY_DEPTH_BITS)) | state;
+	}
+	else
+	{
+		key|=(state<<KEY_DEPTH_BITS) | d;
+	}
+	return key;
+}
+
+void CRenderQueue::Sort(void)
+// Sort entries by key with a least significant digit radix sort, one byte per pass
+{
+	int n=(int)entries.size();
+	if (n<2)
+		return;
+	sort_buffer.resize(n);
+
+	// The histograms of all eight bytes are counted in one pass over the keys
+	int counts[8][256];
+	memset(counts, 0, sizeof(counts));
+	int i, b;
+	for (i=0; i<n; i++)
+	{
+		unsigned long long key=entries[i].key;
+		for (b=0; b<8; b++)
+			counts[b][(key>>(8*b)) & 0xFF]++;
+	}
+
+	CSortEntry *src=&entries[0], *dst=&sort_buffer[0];
+	for (b=0; b<8; b++)
+	{
+		// A byte that is the same in all keys leaves the order unchanged
+		int first_byte=(int)((src[0].key>>(8*b)) & 0xFF);
+		if (counts[b][first_byte]==n)
+			continue;
+
+		int offsets[256];
+		int sum=0;
+		for (i=0; i<256; i++)
+		{
+			offsets[i]=sum;
+			sum+=counts[b][i];
+		}
+		for (i=0; i<n; i++)
+			dst[offsets[(src[i].key>>(8*b)) & 0xFF]++]=src[i];
+
+		CSortEntry *t=src;
+		src=dst;
+		dst=t;
+	}
+	if (src!=&entries[0])
+		entries.swap(sort_buffer);
+}
+
+bool CRenderQueue::IsSameState(const CRenderItem& a, const CRenderItem& b)
+// Return true if two draws can be drawn by the same instanced draw
+{
+	return a.pass==b.pass && a.program==b.program && a.material_buffer==b.material_buffer &&
+		a.texture==b.texture && a.mesh==b.mesh;
+}
+
+void CRenderQueue::SetInstanceFormat(void)
+// Set the instanced vertex attributes of the bound vertex array object to read
+//   instance_buffer_obj
+{
+	GLsizei stride=sizeof(CInstanceData);
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_obj);
+	int i;
+	for (i=0; i<4; i++)
+	{
+		GLuint index=INSTANCE_ATTRIB_MODEL_MATRIX+i;
+		glEnableVertexAttribArray(index);
+		glVertexAttribPointer(index, 4, GL_FLOAT, GL_FALSE, stride,
+			(GLvoid *)(offsetof(CInstanceData, model_matrix)+i*sizeof(vec4)));
+		glVertexAttribDivisor(index, 1);
+	}
+	for (i=0; i<3; i++)
+	{
+		GLuint index=INSTANCE_ATTRIB_NORMAL_MATRIX+i;
+		glEnableVertexAttribArray(index);
+		glVertexAttribPointer(index, 3, GL_FLOAT, GL_FALSE, stride,
+			(GLvoid *)(offsetof(CInstanceData, normal_matrix)+i*sizeof(vec4)));
+		glVertexAttribDivisor(index, 1);
+	}
+	glEnableVertexAttribArray(INSTANCE_ATTRIB_BASE_COLOR);
+	glVertexAttribPointer(INSTANCE_ATTRIB_BASE_COLOR, 4, GL_FLOAT, GL_FALSE, stride,
+		(GLvoid *)offsetof(CInstanceData, base_color));
+	glVertexAttribDivisor(INSTANCE_ATTRIB_BASE_COLOR, 1);
+	glEnableVertexAttribArray(INSTANCE_ATTRIB_ENABLE_DIFFUSE_TEXTURE);
+	glVertexAttribIPointer(INSTANCE_ATTRIB_ENABLE_DIFFUSE_TEXTURE, 1, GL_INT, stride,
+		(GLvoid *)offsetof(CInstanceData, enable_diffuse_texture));
+	glVertexAttribDivisor(INSTANCE_ATTRIB_ENABLE_DIFFUSE_TEXTURE, 1);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void CRenderQueue::Clear(void)
+// Remove all draws, keeping the memory for the next frame
+{
+	items.clear();
+	entries.clear();
+}
+
+void CRenderQueue::Add(const CRenderItem& item)
+// Add a draw
+{
+	if (item.mesh==NULL || item.mesh->arena_block.arena==NULL)
+		return;
+
+	CSortEntry entry;
+	entry.key=MakeKey(item);
+	entry.item=(int)items.size();
+	items.push_back(item);
+	entries.push_back(entry);
+}
+
+void CRenderQueue::Submit(GLuint material_binding)
+// Sort the draws, upload their per-object data and draw each run of equal draws
+//   with one instanced draw, changing only the states that differ from the
+//   previous run, and count the draws and state changes
+{
+	num_draws=0;
+	num_instances=0;
+	num_program_changes=0;
+	num_material_changes=0;
+	num_texture_changes=0;
+	num_vertex_array_changes=0;
+	num_pass_changes=0;
+	if (entries.empty())
+		return;
+
+	Sort();
+
+	// Equal draws are next to each other after sorting, so each run is a range of
+	//   the instance buffer, and the base instance of its draw selects the range
+	int n=(int)entries.size();
+	instances.resize(n);
+	for (int i=0; i<n; i++)
+		instances[i]=items[entries[i].item].instance;
+	if (instance_buffer_obj==0)
+		glGenBuffers(1, &instance_buffer_obj);
+	// Respecified every frame, so the driver can hand out new memory instead of
+	//   waiting for the draws of the previous frame
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_obj);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(CInstanceData)*n, &instances[0], GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// The state before the first draw is unknown, so the first draw sets all of it
+	const CRenderItem *prev=NULL;
+	GLuint vertex_array=0;
+	for (int first=0, last; first<n; first=last)
+	{
+		const CRenderItem& item=items[entries[first].item];
+		const CMeshArenaBlock& block=item.mesh->arena_block;
+		last=first+1;
+		while (last<n && IsSameState(item, items[entries[last].item]))
+			last++;
+
+		if (prev==NULL || item.pass!=prev->pass)
+		{
+			if (item.pass==RENDER_PASS_TRANSPARENT)
+			{
+				glEnable(GL_BLEND);
+				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+				glDepthMask(GL_FALSE);
+			}
+			++num_pass_changes;
+		}
+		if (prev==NULL || item.program!=prev->program)
+		{
+			glUseProgram(item.program);
+			++num_program_changes;
+		}
+		if (item.material_buffer!=0 && (prev==NULL || item.material_buffer!=prev->material_buffer))
+		{
+			glBindBufferBase(GL_UNIFORM_BUFFER, material_binding, item.material_buffer);
+			++num_material_changes;
+		}
+		if (prev==NULL || item.texture!=prev->texture)
+		{
+			glBindTexture(GL_TEXTURE_2D, item.texture);
+			++num_texture_changes;
+		}
+		if (block.arena->vertex_array_obj!=vertex_array)
+		{
+			vertex_array=block.arena->vertex_array_obj;
+			glBindVertexArray(vertex_array);
+			SetInstanceFormat();
+			++num_vertex_array_changes;
+		}
+
+		// Same ranges as CMeshArena::Draw, drawn once per object of the run
+		GLsizei count=last-first;
+		if (block.num_indices==0)
+			glDrawArraysInstancedBaseInstance(item.mesh->primitive_type,
+				block.base_vertex, block.num_vertices, count, first);
+		else
+			glDrawElementsInstancedBaseVertexBaseInstance(item.mesh->primitive_type,
+				block.num_indices, block.index_type, (GLvoid *)block.index_offset,
+				count, block.base_vertex, first);
+		++num_draws;
+		num_instances+=count;
+		prev=&item;
+	}
+
+	if (prev->pass==RENDER_PASS_TRANSPARENT)
+	{
+		glDepthMask(GL_TRUE);
+		glDisable(GL_BLEND);
+	}
+}
+
+void CRenderQueue::ReleaseGLResources(void)
+// Delete the instance buffer
+{
+	if (instance_buffer_obj!=0)
+		glDeleteBuffers(1, &instance_buffer_obj);
+	instance_buffer_obj=0;
+}
+
+int CRenderQueue::GetNumStateChanges(void) const
+// Return the number of program, material, texture and vertex array changes of the
+//   last Submit
+{
+	return num_program_changes+num_material_changes+num_texture_changes+num_vertex_array_changes;
+}
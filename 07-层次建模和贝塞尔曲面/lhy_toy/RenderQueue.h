@@ -0,0 +1,145 @@
+#ifndef _RENDER_QUEUE_H_
+#define _RENDER_QUEUE_H_
+
+#include "GL/glew.h"
+#include "vec.h"
+#include "mat.h"
+#include "Mesh.h"
+#include <vector>
+
+// Queue of the draws of a frame, submitted in the order of a 64-bit sort key
+// The key packs the pass, program, material, texture and mesh of a draw, and its depth
+//   in eye coordinates, so that after sorting the draws with the same state follow one
+//   another and Submit only changes a state when it differs from the previous draw:
+//   objects sharing a texture bind it once, and so do objects sharing a mesh
+// Neighbouring draws with the same pass, program, material, texture and mesh are drawn
+//   as one instanced draw: the per-object data of all draws goes into one instance
+//   buffer in sorted order, read by instanced vertex attributes, and each run of equal
+//   draws is one glDraw*InstancedBaseInstance call starting at its first element, so a
+//   scene costs one draw per distinct state however many objects repeat it
+// Layout of the key, from the most significant bit:
+//   opaque pass:      pass (4) | program (8) | material (8) | texture (10) | mesh (10) | depth (24)
+//   transparent pass: pass (4) | inverted depth (24) | program (8) | material (8) | texture (10) | mesh (10)
+// Opaque draws are drawn front to back within the same state, which lets the depth
+//   test reject hidden fragments early; transparent draws must be blended back to front
+//   whatever their state, so their depth comes first
+// Programs, materials, textures and meshes get small ids in the order the queue first
+//   sees them; the ids are kept from frame to frame, and ids beyond the width of their
+//   field wrap around, which only makes the grouping less tight
+
+enum RENDER_PASS
+{
+	RENDER_PASS_OPAQUE=0,
+	RENDER_PASS_TRANSPARENT=1 // Blended with the alpha of the fragments, without depth writes
+};
+
+// Vertex attribute locations of CInstanceData in the shaders
+enum INSTANCE_ATTRIB
+{
+	INSTANCE_ATTRIB_MODEL_MATRIX=4,  // mat4, locations 4-7
+	INSTANCE_ATTRIB_NORMAL_MATRIX=8, // mat3, locations 8-10
+	INSTANCE_ATTRIB_BASE_COLOR=11,   // vec4
+	INSTANCE_ATTRIB_ENABLE_DIFFUSE_TEXTURE=12 // int
+};
+
+// Per-object data, one element of the instance buffer
+// The matrices are row-major like the ones passed to glUniformMatrix4fv with transpose
+//   set; each attribute location reads one row
+struct CInstanceData
+{
+	mat4 model_matrix;
+	mat4 normal_matrix; // Normal matrix in the upper-left 3x3 part
+	color4 base_color;
+	int enable_diffuse_texture;
+};
+
+// Draw added to the queue
+struct CRenderItem
+{
+	int pass;               // RENDER_PASS
+	GLuint program;         // OpenGL program object
+	GLuint material_buffer; // Uniform buffer of the material block, 0 if none
+	GLuint texture;         // 2D texture bound to texture unit 0, 0 if none
+	CMesh *mesh;            // Mesh in an arena, see CMeshArena
+	float depth;            // Distance from the eye, e.g. to the center of the bounding sphere
+	CInstanceData instance; // Per-object data
+};
+
+class CRenderQueue
+{
+protected:
+	// Key of a draw and its index in items
+	struct CSortEntry
+	{
+		unsigned long long key;
+		int item;
+	};
+
+	std::vector<CRenderItem> items;
+	std::vector<CSortEntry> entries;
+	std::vector<CSortEntry> sort_buffer; // Second array of the radix sort
+	std::vector<CInstanceData> instances; // Per-object data in sorted order
+	GLuint instance_buffer_obj; // OpenGL vertex buffer object of the instances
+
+	// Objects that have an id, in the order of their ids
+	std::vector<GLuint> programs;
+	std::vector<GLuint> materials;
+	std::vector<GLuint> textures;
+	std::vector<const CMesh *> meshes;
+
+	static unsigned long long GetId(std::vector<GLuint>& table, GLuint name, int bits);
+	static unsigned long long GetId(std::vector<const CMesh *>& table, const CMesh *mesh, int bits);
+	// Return the id of an object, giving it the next one if it has none
+
+	unsigned long long MakeKey(const CRenderItem& item);
+	// Return the sort key of a draw
+
+	void Sort(void);
+	// Sort entries by key with a least significant digit radix sort, one byte per pass
+	// Passes in which all keys have the same byte are skipped
+
+	static bool IsSameState(const CRenderItem& a, const CRenderItem& b);
+	// Return true if two draws can be drawn by the same instanced draw
+
+	void SetInstanceFormat(void);
+	// Set the instanced vertex attributes of the bound vertex array object to read
+	//   instance_buffer_obj
+
+public:
+	// Counters of the last Submit
+	int num_draws;     // Instanced draw calls
+	int num_instances; // Objects drawn by them
+	int num_program_changes;
+	int num_material_changes;
+	int num_texture_changes;
+	int num_vertex_array_changes;
+	int num_pass_changes;
+
+	CRenderQueue(void);
+
+	void Clear(void);
+	// Remove all draws, keeping the memory for the next frame
+
+	void Add(const CRenderItem& item);
+	// Add a draw
+	// Meshes that are not in an arena are ignored
+
+	void Submit(GLuint material_binding);
+	// Sort the draws, upload their per-object data and draw each run of equal draws
+	//   with one instanced draw, changing only the states that differ from the
+	//   previous run, and count the draws and state changes
+	// The depth test and the blending state are restored after the transparent pass;
+	//   the instanced attributes stay enabled in the vertex array objects, which
+	//   shaders that do not declare them ignore
+	// Needs OpenGL 4.2 for the base instance of the draws
+	// material_binding: (in) Uniform buffer binding point of the material block
+
+	void ReleaseGLResources(void);
+	// Delete the instance buffer
+
+	int GetNumStateChanges(void) const;
+	// Return the number of program, material, texture and vertex array changes of the
+	//   last Submit
+};
+
+#endif
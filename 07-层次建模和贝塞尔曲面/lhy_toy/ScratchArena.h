@@ -0,0 +1,98 @@
+#ifndef _SCRATCH_ARENA_H_
+#define _SCRATCH_ARENA_H_
+
+#include <stddef.h>
+#include <new>
+#include <vector>
+
+// Monotonic allocator for the temporary arrays of mesh generation and image processing
+// Allocating bumps an offset in large blocks; nothing is freed one by one, instead a
+//   CScratchScope rewinds the arena to where it was when the scope was opened
+// The blocks are kept for the next allocations, so loading a scene allocates from the
+//   system only until the arena has grown to the peak usage
+// The arena is not thread-safe; allocate on the loading thread only
+
+// Position in an arena to rewind to
+struct CScratchMarker
+{
+	int block;     // Index of the current block
+	size_t offset; // Offset in the current block
+	size_t used;   // Bytes in use
+};
+
+class CScratchArena
+{
+protected:
+	struct CBlock
+	{
+		char *data;
+		size_t size;
+	};
+	std::vector<CBlock> blocks; // Blocks in the order they are used
+	int current_block;          // Block that allocations come from, -1 if none
+	size_t offset;              // Offset of the free space in the current block
+	size_t block_size;          // Size of new blocks, unless an allocation needs more
+
+public:
+	size_t used;           // Bytes in use, including alignment and the ends of blocks
+	size_t peak_used;      // Largest value of used
+	size_t reserved;       // Bytes in blocks
+	int num_allocations;   // The number of calls to Allocate
+	int num_system_allocations; // The number of blocks allocated from the system
+
+	CScratchArena(size_t block_size=1<<20);
+	~CScratchArena(void);
+
+	void *Allocate(size_t size, size_t alignment=16);
+	// Return memory of size bytes aligned to alignment, a power of 2 up to 16
+	// Returns NULL if the system is out of memory
+
+	template<class T>
+	T *Allocate(size_t count)
+	{
+		// Fail like new T [count] would, before constructing anything
+		if (count>(size_t)-1/sizeof(T))
+			throw std::bad_alloc();
+		T *p=(T *)Allocate(sizeof(T)*count);
+		if (p==NULL)
+			throw std::bad_alloc();
+		for (size_t i=0; i<count; ++i)
+			new (&p[i]) T;
+		return p;
+	}
+	// Return an array of count default-initialized elements, like new T [count]
+	// Throws std::bad_alloc if the memory cannot be allocated
+	// T must not need its destructor called
+
+	CScratchMarker GetMarker(void) const;
+	void Rewind(const CScratchMarker& marker);
+	// Free everything allocated after marker
+
+	void Release(void);
+	// Return all blocks to the system; nothing may be in use
+
+	void ResetStatistics(void);
+	// Restart peak_used, num_allocations and num_system_allocations from now
+};
+
+// Arena shared by the Create functions of CMesh and the image loaders
+extern CScratchArena g_scratch_arena;
+
+// Frees everything allocated from an arena during its lifetime
+class CScratchScope
+{
+protected:
+	CScratchArena& arena;
+	CScratchMarker marker;
+
+public:
+	CScratchScope(CScratchArena& arena=g_scratch_arena)
+		: arena(arena), marker(arena.GetMarker()) {}
+	~CScratchScope(void) { arena.Rewind(marker); }
+
+	template<class T>
+	T *Allocate(size_t count) { return arena.Allocate<T>(count); }
+	// Return an array of count default-initialized elements, like new T [count]
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include <stddef.h>
+#include "UniformRing.h"
+
+CUniformRing::CUniformRing(void)
+{
+	section_size=0;
+	offset_alignment=256;
+	for (int i=0; i<NUM_SECTIONS; i++)
+		section_fences[i]=0;
+	current_section=0;
+	persistent_ptr=NULL;
+	section_ptr=NULL;
+	section_used=0;
+	buffer_obj=0;
+}
+
+void CUniformRing::Init(GLsizeiptr size)
+// Create the buffer
+// size: (in) Bytes per frame, rounded up to the offset alignment
+{
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offset_alignment);
+	if (offset_alignment<=0)
+		offset_alignment=256;
+	section_size=(size+offset_alignment-1)/offset_alignment*offset_alignment;
+
+	GLsizeiptr buffer_size=NUM_SECTIONS*section_size;
+	glGenBuffers(1, &buffer_obj);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer_obj);
+	if (GLEW_ARB_buffer_storage)
+	{
+		// Map once and keep writing through the same pointer
+		GLbitfield flags=GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_UNIFORM_BUFFER, buffer_size, NULL, flags);
+		persistent_ptr=(unsigned char *)glMapBufferRange(GL_UNIFORM_BUFFER, 0, buffer_size, flags);
+	}
+	else
+	{
+		glBufferData(GL_UNIFORM_BUFFER, buffer_size, NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	current_section=0;
+}
+
+void CUniformRing::Release(void)
+// Delete the buffer and the fences
+{
+	for (int i=0; i<NUM_SECTIONS; i++)
+	{
+		if (section_fences[i]!=0)
+			glDeleteSync(section_fences[i]);
+		section_fences[i]=0;
+	}
+
+	if (buffer_obj!=0)
+	{
+		if (persistent_ptr!=NULL || section_ptr!=NULL)
+		{
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer_obj);
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &buffer_obj);
+	}
+	buffer_obj=0;
+	persistent_ptr=NULL;
+	section_ptr=NULL;
+	section_used=0;
+}
+
+void CUniformRing::Begin(void)
+// Wait until the GPU has finished reading the next section and map it
+{
+	if (buffer_obj==0)
+		return;
+
+	// Wait until the GPU has finished reading this section three frames ago
+	int section=current_section;
+	if (section_fences[section]!=0)
+	{
+		glClientWaitSync(section_fences[section], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(section_fences[section]);
+		section_fences[section]=0;
+	}
+
+	GLintptr offset=section*section_size;
+	if (persistent_ptr!=NULL)
+		section_ptr=persistent_ptr+offset;
+	else
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer_obj);
+		section_ptr=(unsigned char *)glMapBufferRange(GL_UNIFORM_BUFFER, offset, section_size,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	section_used=0;
+}
+
+void *CUniformRing::Allocate(GLsizeiptr size, GLintptr& offset)
+// Allocate a block in the current section
+// Returns the memory to write the block to, or NULL if the section is full
+// size: (in) Size of the block in bytes
+// offset: (out) Offset of the block in the buffer, passed to Bind
+{
+	// Every block starts at a multiple of the alignment that glBindBufferRange requires
+	GLsizeiptr aligned_size=(size+offset_alignment-1)/offset_alignment*offset_alignment;
+	if (section_ptr==NULL || section_used+aligned_size>section_size)
+		return NULL;
+
+	void *p=section_ptr+section_used;
+	offset=current_section*section_size+section_used;
+	section_used+=aligned_size;
+	return p;
+}
+
+void CUniformRing::Unmap(void)
+// Finish writing the blocks of this frame; must be called before drawing
+{
+	if (section_ptr==NULL)
+		return;
+
+	// The persistent mapping is coherent, so the writes are visible without a flush
+	if (persistent_ptr==NULL)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer_obj);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	section_ptr=NULL;
+}
+
+void CUniformRing::Bind(GLuint binding, GLintptr offset, GLsizeiptr size)
+// Bind a block to a uniform buffer binding point
+// binding: (in) Binding point, see glUniformBlockBinding
+// offset, size: (in) The block returned by Allocate
+{
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer_obj, offset, size);
+}
+
+void CUniformRing::End(void)
+// Fence the section after the draws of this frame and move to the next one
+{
+	if (buffer_obj==0)
+		return;
+
+	Unmap();
+
+	// The section may be rewritten once the GPU has passed this point
+	section_fences[current_section]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	current_section=(current_section+1)%NUM_SECTIONS;
+}
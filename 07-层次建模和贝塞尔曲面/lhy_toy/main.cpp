@@ -7,7 +7,13 @@
 #include "Mesh.h"
 #include "Camera.h"
 #include "ImageLib.h"
+#include "ScratchArena.h"
+#include "GasketSDF.h"
+#include "IndirectDraw.h"
+#include "UniformRing.h"
+#include "RenderQueue.h"
 #include <stack>
+#include <stdio.h>
 
 
 #define MENU_ITEM_POLYGON_MODE_LINE 10
@@ -41,10 +47,20 @@ public:
 	mat4 M_instance;    // Instance matrix
 	CObject3D *p_child;   // Pointer to the first child
 	CObject3D *p_sibling; // Pointer to the next sibling
+	int lod; // Level of detail drawn in the last frame
+	int texture_layer; // Layer of diffuse_texture in g_diffuse_texture_array, -1 if none
 };
 
-GLuint g_GLSL_prog;
-int g_model_matrix_loc, g_base_color_loc;
+CShaderProgram g_GLSL_prog;
+CShaderProgram g_gasket_prog; // ߲ά Sierpinski εɫ
+
+//εɫÿ֡õ uniform ľ init_shaders вãʱֲٰ
+struct
+{
+	int view_matrix, model_matrix, projection_matrix, canonical_from_eye;
+	int step_scale, pixel_angle, subdivision_depth, max_steps;
+	int diffuse_reflectivity, specular_reflectivity, shininess, base_color;
+} g_gasket_uniforms;
 
 float g_scene_size=10.0f;
 
@@ -59,6 +75,7 @@ enum {
 	OBJECT_TEAPOT,
 	OBJECT_TEACUP,
 	OBJECT_TEASPOON,
+	OBJECT_GASKET,
 	NUM_OBJECTS
 };
 
@@ -71,6 +88,8 @@ enum {
 	MESH_TEAPOT,
 	MESH_TEACUP,
 	MESH_TEASPOON,
+	MESH_GASKET,
+	MESH_GASKET_PROXY,
 	NUM_MESHES
 };
 
@@ -92,6 +111,63 @@ float g_slice_radius=0.4f, g_slice_height=0.2f, g_slice_width= 0.05f, g_slice_le
 float g_wheel_radius = 0.6f, g_wheel_width = 0.5f, g_wheel_height = 1.0f;
 float g_fans_separation_dist_half=0.1f;
 
+// άε棺ƣҲþ볡߲
+CGasketSDF g_gasket_sdf;
+CGasketLighting g_gasket_lighting;
+int g_gasket_depth=6;
+bool g_gasket_raymarch=true;
+int g_window_width=1, g_window_height=1;
+float g_fovy=60.0f;
+
+//ϸڲΣΧͶӰĻϵĴСѡ g_lod_pixel_error صֲ
+//ҶƬһ񣬵Լ¼ԼĲ
+bool g_lod_enabled=true;
+float g_lod_pixel_error=1.0f;
+float g_lod_viewport_scale=1.0f;	//Ϊ 1 ÿλȵ reshape м
+
+//ؼӻƣľͲʷɫ洢Уɫ gl_DrawID ȡ
+//ֻһ glMultiDraw*IndirectCPU ϲ uniform
+bool g_indirect_supported=false;
+bool g_indirect_draw=false;
+CShaderProgram g_indirect_prog;
+int g_draw_offset_loc;
+CIndirectDrawList g_draw_list;
+GLuint g_diffuse_texture_array;	//ŵͬһСΪĸ
+
+//ɫе std140 uniform 飬Ա˳ɫеһ
+//ÿ֡д뻷λ壬ͬĲֻڳʼʱϴһΣֻƷʽ֡飻
+//ʱÿ CRenderQueue ϴʵԣ CInstanceData
+enum {
+	UNIFORM_BINDING_FRAME=0,
+	UNIFORM_BINDING_MATERIAL
+};
+
+struct CFrameBlock
+{
+	mat4 view_matrix;
+	mat4 projection_matrix;
+	color4 ambient_light_color;
+	point4 light_position;
+	color4 light_color;
+};
+
+struct CMaterialBlock
+{
+	color4 diffuse_reflectivity;
+	color4 specular_reflectivity;
+	float shininess;
+	float padding[3];
+};
+
+CFrameBlock g_frame;	//ÿ֡ʼʱƵλ
+CUniformRing g_uniform_ring;
+GLuint g_material_buffer;
+
+//ʱ尴򡢲ʡɵļٻƣ
+//ͬĸ blackwood.jpgҶƬֻһΣ
+//ڵġͬ壨ҶƬϲΪһʵ
+CRenderQueue g_render_queue;
+
 CCamera g_camera;
 float g_camera_step=0.01f*g_scene_size;
 int g_mouse_rotation_mode=0;
@@ -155,29 +231,105 @@ void AnimateRobotArm(void)
 
 void init_shaders(void)
 {
-	g_GLSL_prog=InitShader(
+	g_GLSL_prog.Init(
 		"../shaders/final-vs.txt",
 		"../shaders/final-fs.txt");
 
-	g_model_matrix_loc=glGetUniformLocation(g_GLSL_prog, "model_matrix");
-	g_base_color_loc=glGetUniformLocation(g_GLSL_prog, "base_color");
-
-	int loc;
-	loc=glGetUniformLocation(g_GLSL_prog, "ambient_light_color");
-	glUniform4f(loc, 0.4f, 0.4f, 0.4f, 1.0f);
-	loc=glGetUniformLocation(g_GLSL_prog, "light_color");
-	glUniform4f(loc, 1.0f, 1.0f, 1.0f, 1.0f);
-	loc=glGetUniformLocation(g_GLSL_prog, "light_position");
-	glUniform4f(loc, 1.2f*g_scene_size, 1.0f*g_scene_size, 1.6f*g_scene_size, 1.0f);
-
-	loc=glGetUniformLocation(g_GLSL_prog, "diffuse_texture");
-	glUniform1i(loc, 0);
-
-	glUniform1i(glGetUniformLocation(g_GLSL_prog, "cube_texture"), 1);
+	g_GLSL_prog.SetBlockBinding("FrameBlock", UNIFORM_BINDING_FRAME);
+	g_GLSL_prog.SetBlockBinding("MaterialBlock", UNIFORM_BINDING_MATERIAL);
+
+	//C++ еĽṹɫе std140 Сһ
+	if (g_GLSL_prog.GetBlockSize("FrameBlock")!=(int)sizeof(CFrameBlock) ||
+		g_GLSL_prog.GetBlockSize("MaterialBlock")!=(int)sizeof(CMaterialBlock))
+		printf("uniform block sizes do not match the shaders\n");
+
+	g_frame.ambient_light_color=color4(0.4f, 0.4f, 0.4f, 1.0f);
+	g_frame.light_color=color4(1.0f, 1.0f, 1.0f, 1.0f);
+	g_frame.light_position=point4(1.2f*g_scene_size, 1.0f*g_scene_size, 1.6f*g_scene_size, 1.0f);
+
+	//Ĳֻͬϴһ
+	CMaterialBlock material={};
+	material.diffuse_reflectivity=color4(1.0f, 1.0f, 1.0f, 1.0f);
+	material.specular_reflectivity=color4(0.5f, 0.5f, 1.0f, 1.0f);
+	material.shininess=512.0f;
+	glGenBuffers(1, &g_material_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, g_material_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(material), &material, GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_MATERIAL, g_material_buffer);
+
+	//ÿֻ֡һ֡
+	g_uniform_ring.Init(sizeof(CFrameBlock));
+
+	g_GLSL_prog.SetUniform(g_GLSL_prog.GetHandle("diffuse_texture"), 0);
+
+	g_GLSL_prog.SetUniform(g_GLSL_prog.GetHandle("cube_texture"), 1);
+
+	// ߲εʹ final-fs.txt ͬĹղ
+	g_gasket_lighting.ambient_light_color=color4(0.4f, 0.4f, 0.4f, 1.0f);
+	g_gasket_lighting.light_color=color4(1.0f, 1.0f, 1.0f, 1.0f);
+	g_gasket_lighting.light_position=point4(1.2f*g_scene_size, 1.0f*g_scene_size, 1.6f*g_scene_size, 1.0f);
+	g_gasket_lighting.base_color=color4(1.0f, 1.0f, 1.0f, 1.0f);
+	g_gasket_lighting.diffuse_reflectivity=color4(1.0f, 1.0f, 1.0f, 1.0f);
+	g_gasket_lighting.specular_reflectivity=color4(0.5f, 0.5f, 1.0f, 1.0f);
+	g_gasket_lighting.shininess=512.0f;
+
+	g_gasket_prog.Init(
+		"../shaders/gasket_raymarch-vs.txt",
+		"../shaders/gasket_raymarch-fs.txt");
+
+	g_gasket_prog.SetUniform(g_gasket_prog.GetHandle("ambient_light_color"), g_gasket_lighting.ambient_light_color);
+	g_gasket_prog.SetUniform(g_gasket_prog.GetHandle("light_color"), g_gasket_lighting.light_color);
+	g_gasket_prog.SetUniform(g_gasket_prog.GetHandle("light_position"), g_gasket_lighting.light_position);
+
+	g_gasket_uniforms.view_matrix=g_gasket_prog.GetHandle("view_matrix");
+	g_gasket_uniforms.model_matrix=g_gasket_prog.GetHandle("model_matrix");
+	g_gasket_uniforms.projection_matrix=g_gasket_prog.GetHandle("projection_matrix");
+	g_gasket_uniforms.canonical_from_eye=g_gasket_prog.GetHandle("canonical_from_eye");
+	g_gasket_uniforms.step_scale=g_gasket_prog.GetHandle("step_scale");
+	g_gasket_uniforms.pixel_angle=g_gasket_prog.GetHandle("pixel_angle");
+	g_gasket_uniforms.subdivision_depth=g_gasket_prog.GetHandle("subdivision_depth");
+	g_gasket_uniforms.max_steps=g_gasket_prog.GetHandle("max_steps");
+	g_gasket_uniforms.diffuse_reflectivity=g_gasket_prog.GetHandle("diffuse_reflectivity");
+	g_gasket_uniforms.specular_reflectivity=g_gasket_prog.GetHandle("specular_reflectivity");
+	g_gasket_uniforms.shininess=g_gasket_prog.GetHandle("shininess");
+	g_gasket_uniforms.base_color=g_gasket_prog.GetHandle("base_color");
+
+	// ӻƵɫҪ OpenGL 4.3  GL_ARB_shader_draw_parameters֧ʱֻ
+	g_indirect_supported=CIndirectDrawList::IsIndirectDrawSupported();
+	g_indirect_draw=g_indirect_supported;
+	if (g_indirect_supported)
+	{
+		g_indirect_prog.Init(
+			"../shaders/final_indirect-vs.txt",
+			"../shaders/final_indirect-fs.txt");
+
+		g_indirect_prog.SetBlockBinding("FrameBlock", UNIFORM_BINDING_FRAME);
+		//draw_offset  CIndirectDrawList::Submit ֱӰλ
+		g_draw_offset_loc=glGetUniformLocation(g_indirect_prog.prog, "draw_offset");
+		g_indirect_prog.SetUniform(g_indirect_prog.GetHandle("diffuse_texture_array"), 2);
+	}
+	printf("draw submission: %s\n", g_indirect_draw ? "multi-draw indirect" : "one draw per object");
 }
 
 void init_scene(void)
 {
+	//ڴʱ㻺桢ڵͶȡ˳κͶ
+	for (int i = 0; i < NUM_MESHES; i++)
+		g_obj_mesh[i].optimize_flags = MESH_OPTIMIZE_ALL;
+
+	//ε桢Բͱÿϸڲεϸ
+	for (int i = 0; i < NUM_MESHES; i++)
+		g_obj_mesh[i].lod_levels = 5;
+
+	//ϸĲΪöı۵򻯣ÿԼΪһķ֮һƽ̹ɾȥθࣻ
+	//εĶ㶼Сӵķζ㣬۵ɾΣ԰Сĵݹ
+	g_obj_mesh[MESH_TEAPOT].lod_simplify = true;
+
+	//ϸֺŻĽ cache Ŀ¼УٴʱֱӳļϴɾĿ¼
+	CMesh::cache_directory = "../cache";
+	int start_time = glutGet(GLUT_ELAPSED_TIME);
+
 	g_obj_mesh[MESH_GROUND].CreateRect(
 		g_scene_size, g_scene_size, 32, 32, 10.0f, 10.0f);
 	g_obj_mesh[MESH_TOY_PLATFORM].CreateBlock(
@@ -190,6 +342,53 @@ void init_scene(void)
 	g_obj_mesh[MESH_TEACUP].CreateBezierObject("../models/teacup.txt", 0.1, 1.0f, 1.0f);		//0.01ȱȽϸߣķʱȽ϶ࡣ
 	g_obj_mesh[MESH_TEASPOON].CreateBezierObject("../models/teaspoon.txt", 0.2, 1.0f, 1.0f);	//ʹϸɫʵϸ֡
 
+	float tetra_s=1.0f;
+	point3 tetra_vertices[4]={
+		point3(-0.5f*tetra_s, -0.28868f*tetra_s, 0.0f),
+		point3( 0.5f*tetra_s, -0.28868f*tetra_s, 0.0f),
+		point3(0.0f, 0.57735f*tetra_s, 0.0f),
+		point3(0.0f, 0.0f, 0.81650f*tetra_s),
+	};
+	g_obj_mesh[MESH_GASKET].CreateGasket3D(tetra_vertices, g_gasket_depth);
+	g_obj_mesh[MESH_GASKET_PROXY].CreateGasket3D(tetra_vertices, 0);	//ֻ߲Ҫ
+	printf("meshes created in %d ms\n", glutGet(GLUT_ELAPSED_TIME) - start_time);
+	g_gasket_sdf.Init(tetra_vertices, g_gasket_depth);
+
+	//ŻǰĶԼƽʧЧ ACMRÿδĶ ATVRÿ㱻Ĵ
+	const static char *mesh_names[NUM_MESHES] = {
+		"ground", "platform", "body", "axle", "slice",
+		"teapot", "teacup", "teaspoon", "gasket", "gasket proxy"
+	};
+	printf("%-12s %15s %15s %13s %13s\n", "mesh", "vertices", "triangles", "ACMR", "ATVR");
+	for (int i = 0; i < NUM_MESHES; i++)
+	{
+		const CMesh& mesh = g_obj_mesh[i];
+		if (mesh.num_indices == 0)
+			continue;	//εûŻ
+		printf("%-12s %7d->%-7d %7d->%-7d %5.3f->%5.3f %5.3f->%5.3f\n", mesh_names[i],
+			mesh.original_num_vertices, mesh.num_vertices,
+			mesh.original_num_indices / 3, mesh.num_indices / 3,
+			mesh.cache_stats[0].acmr, mesh.cache_stats[1].acmr,
+			mesh.cache_stats[0].atvr, mesh.cache_stats[1].atvr);
+	}
+
+	//ϸڲε򻯵õÿֱ۵ߣӻȡʱûУ
+	printf("%-12s %s\n", "mesh", "levels of detail: triangles (error)");
+	for (int i = 0; i < NUM_MESHES; i++)
+	{
+		const CMesh& mesh = g_obj_mesh[i];
+		if (mesh.coarser_lod == NULL)
+			continue;
+		printf("%-12s", mesh_names[i]);
+		for (const CMesh *lod = &mesh; lod != NULL; lod = lod->coarser_lod)
+			printf(" %d (%.4f)", lod->GetNumTriangles(), lod->lod_error);
+		printf("\n");
+		for (size_t j = 0; j < mesh.simplify_curve.size(); j++)
+			printf("%s%d:%.4f%s", j % 8 == 0 ? "             " : " ",
+				mesh.simplify_curve[j].num_triangles, mesh.simplify_curve[j].error,
+				j % 8 == 7 || j + 1 == mesh.simplify_curve.size() ? "\n" : "");
+	}
+
 	g_obj[OBJECT_GROUND].pmesh=&g_obj_mesh[MESH_GROUND];
 	g_obj[OBJECT_TOY_PLATFORM].pmesh=&g_obj_mesh[MESH_TOY_PLATFORM];
 	g_obj[OBJECT_TOY_BODY].pmesh=&g_obj_mesh[MESH_TOY_BODY];
@@ -200,6 +399,7 @@ void init_scene(void)
 	g_obj[OBJECT_TEAPOT].pmesh=&g_obj_mesh[MESH_TEAPOT];
 	g_obj[OBJECT_TEACUP].pmesh=&g_obj_mesh[MESH_TEACUP];
 	g_obj[OBJECT_TEASPOON].pmesh=&g_obj_mesh[MESH_TEASPOON];
+	g_obj[OBJECT_GASKET].pmesh=&g_obj_mesh[MESH_GASKET];
 
 	for (int i = 0; i < NUM_OBJECTS; i++)
 	{
@@ -225,6 +425,35 @@ void init_scene(void)
 	g_obj[OBJECT_TEASPOON].diffuse_texture= LoadTexture2DFromFile(
 		"../textures/redwood.jpg");
 
+	//ӻһεòлõų 1024x1024 Žά飬ÿ¼ԼĲ
+	if (g_indirect_supported)
+	{
+		GLuint layer_textures[NUM_OBJECTS];
+		int num_layers = 0;
+		for (int i = 0; i < NUM_OBJECTS; i++)
+		{
+			g_obj[i].texture_layer = -1;
+			if (g_obj[i].diffuse_texture == 0)
+				continue;
+			int j = 0;
+			while (j < num_layers && layer_textures[j] != g_obj[i].diffuse_texture)
+				j++;
+			if (j == num_layers)
+				layer_textures[num_layers++] = g_obj[i].diffuse_texture;
+			g_obj[i].texture_layer = j;
+		}
+		g_diffuse_texture_array = CreateTexture2DArrayFromTextures(layer_textures, num_layers, 1024);
+	}
+
+	//ɺͼʱ鶼ȡ g_scratch_arenaسʱķֵϵͳڴĴ
+	printf("scratch arena: peak %d KB, %d KB reserved, %d allocations, %d from the system\n",
+		(int)(g_scratch_arena.peak_used / 1024), (int)(g_scratch_arena.reserved / 1024),
+		g_scratch_arena.num_allocations, g_scratch_arena.num_system_allocations);
+	// CMesh::arena Ķ㻺壬
+	printf("mesh arena: %d meshes, %d KB used of %d KB, %d repacks\n",
+		CMesh::arena.GetNumBlocks(), (int)(CMesh::arena.GetUsedBytes() / 1024),
+		(int)(CMesh::arena.GetCapacityBytes() / 1024), CMesh::arena.num_repacks);
+
 
 	g_obj[OBJECT_TOY_PLATFORM].M_instance=Translate(0.0f, 0.0f, 1.6f*g_platform_height);
 	g_obj[OBJECT_TOY_BODY].M_instance=Translate(0.0f, 0.0f, 1.0f * g_platform_height);
@@ -235,6 +464,7 @@ void init_scene(void)
 	g_obj[OBJECT_TEAPOT].model_matrix = Translate(1.6f, 1.1f, 0.6f) * Scale(0.35f, 0.35f, 0.35f);
 	g_obj[OBJECT_TEACUP].model_matrix = Translate(1.6f, -0.6f, 1.2f) * Scale(0.6f, 0.6f, 0.6f)*RotateX(90.0f);
 	g_obj[OBJECT_TEASPOON].model_matrix = Translate(1.6f, -0.6f, 1.6f) * Scale(0.6f, 0.6f, 0.6f) * RotateX(30.0f) * Rotate(-90.0f, 1.0f , 0.0f, 0.0f);
+	g_obj[OBJECT_GASKET].model_matrix = Translate(-1.6f, 1.1f, 0.16f) * RotateZ(30.0f);
 
 	g_obj[OBJECT_TOY_PLATFORM].p_sibling=NULL;
 	g_obj[OBJECT_TOY_PLATFORM].p_child=&g_obj[OBJECT_TOY_BODY];
@@ -284,45 +514,182 @@ void init(void)
 	glutAttachMenu(GLUT_RIGHT_BUTTON);
 
 }
-void display(void)
+void draw_gasket_raymarch(const mat4& view_matrix)
 {
+	// ı津ƬԪƬԪɫй߲
+	glUseProgram(g_gasket_prog.prog);
+
+	const mat4& model_matrix=g_obj[OBJECT_GASKET].model_matrix;
+	mat4 canonical_from_eye=g_gasket_sdf.GetCanonicalFromEye(view_matrix*model_matrix);
+
+	// ûб仯ֵʡʱľ󣩲ϴ
+	CShaderProgram& prog=g_gasket_prog;
+	prog.SetUniform(g_gasket_uniforms.view_matrix, view_matrix);
+	prog.SetUniform(g_gasket_uniforms.model_matrix, model_matrix);
+	prog.SetUniform(g_gasket_uniforms.canonical_from_eye, canonical_from_eye);
+	prog.SetUniform(g_gasket_uniforms.step_scale, CGasketSDF::GetStepScale(canonical_from_eye));
+	prog.SetUniform(g_gasket_uniforms.subdivision_depth, g_gasket_sdf.subdivision_depth);
+	prog.SetUniform(g_gasket_uniforms.max_steps, g_gasket_sdf.max_steps);
+
+	prog.SetUniform(g_gasket_uniforms.diffuse_reflectivity, g_gasket_lighting.diffuse_reflectivity);
+	prog.SetUniform(g_gasket_uniforms.specular_reflectivity, g_gasket_lighting.specular_reflectivity);
+	prog.SetUniform(g_gasket_uniforms.shininess, g_gasket_lighting.shininess);
+	prog.SetUniform(g_gasket_uniforms.base_color, g_obj[OBJECT_GASKET].base_color);
+
+	glCullFace(GL_FRONT);
+	g_obj_mesh[MESH_GASKET_PROXY].Draw();
+	glCullFace(GL_BACK);
+}
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+void save_gasket_reference(void)
+{
+	//  CPU ̹߲߳ɲοͼں GPU Ա
+	int w=g_window_width, h=g_window_height;
+	unsigned char *rgb=new unsigned char [w*h*3];
+
+	mat4 view_matrix;
+	g_camera.GetViewMatrix(view_matrix);
+	g_gasket_lighting.base_color=g_obj[OBJECT_GASKET].base_color;
+
+	int start_time=glutGet(GLUT_ELAPSED_TIME);
+	g_gasket_sdf.RenderReference(
+		g_obj[OBJECT_GASKET].model_matrix, view_matrix,
+		g_fovy, w, h, g_gasket_lighting, rgb);
+	int end_time=glutGet(GLUT_ELAPSED_TIME);
+
+	FILE *fp=fopen("gasket_reference.ppm", "wb");
+	if (fp!=NULL)
+	{
+		fprintf(fp, "P6\n%d %d\n255\n", w, h);
+		fwrite(rgb, 1, w*h*3, fp);
+		fclose(fp);
+	}
+	printf("gasket_reference.ppm: %dx%d, %d ms\n", w, h, end_time-start_time);
 
-	glUseProgram(g_GLSL_prog);
+	delete [] rgb;
+}
 
-	mat4 M;
-	mat3 M33;
-	g_camera.GetViewMatrix(M);
-	int loc=glGetUniformLocation(g_GLSL_prog, "view_matrix");
-	glUniformMatrix4fv(loc, 1, GL_TRUE, M);
+CMesh& select_lod(CObject3D& obj, const mat4& view_matrix)
+{
+	//ĻϵĴСѡϸڲΣһ֡Ĳڱֵл
+	if (g_lod_enabled)
+		obj.lod = obj.pmesh->SelectLOD(view_matrix * obj.model_matrix,
+			g_lod_viewport_scale, g_lod_pixel_error, obj.lod);
+	else
+		obj.lod = 0;
+	return obj.pmesh->GetLOD(obj.lod);
+}
+
+int draw_scene_indirect(const mat4& view_matrix)
+{
+	// ÿֻ CPU дһһ CDrawDataػƵ
+	g_uniform_ring.Unmap();
+	glUseProgram(g_indirect_prog.prog);
+
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, g_diffuse_texture_array);
+	glActiveTexture(GL_TEXTURE0);
 
-	for (int i= 0; i<NUM_OBJECTS; i++)
+	int num_triangles=0;
+	g_draw_list.Clear();
+	for (int i=0; i<NUM_OBJECTS; i++)
 	{
-		glUniformMatrix4fv(g_model_matrix_loc, 1, GL_TRUE, 
-			g_obj[i].model_matrix);
+		if (i==OBJECT_GASKET && g_gasket_raymarch)
+			continue;
+
+		CDrawData data;
+		data.model_matrix=g_obj[i].model_matrix;
+		mat3 N=Normal(g_obj[i].model_matrix);
+		data.normal_matrix=mat4(vec4(N[0], 0.0f), vec4(N[1], 0.0f), vec4(N[2], 0.0f),
+			vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		data.base_color=g_obj[i].base_color;
+		data.diffuse_reflectivity=color4(1.0f, 1.0f, 1.0f, 1.0f);
+		data.specular_reflectivity=color4(0.5f, 0.5f, 1.0f, 1.0f);
+		data.shininess=512.0f;
+		data.texture_layer=g_obj[i].texture_layer;
+
+		CMesh& mesh=select_lod(g_obj[i], view_matrix);
+		g_draw_list.Add(mesh, data);
+		num_triangles+=mesh.GetNumTriangles();
+	}
+	g_draw_list.Submit(g_draw_offset_loc);
+	return num_triangles;
+}
 
-		loc=glGetUniformLocation(g_GLSL_prog, "normal_matrix");
-		M33=Normal(g_obj[i].model_matrix);
-		glUniformMatrix3fv(loc, 1, GL_TRUE , M33);
+int draw_scene(const mat4& view_matrix)
+{
+	// ͬʵݼƶУƣػƵ
+	g_uniform_ring.Unmap();
 
-		loc=glGetUniformLocation(g_GLSL_prog, "diffuse_reflectivity");
-		glUniform4f(loc, 1.0f, 1.0f, 1.0f, 1.0f);
-		loc=glGetUniformLocation(g_GLSL_prog, "specular_reflectivity");
-		glUniform4f(loc, 0.5f, 0.5f, 1.0f, 1.0f);
-		loc=glGetUniformLocation(g_GLSL_prog, "shininess");
-		glUniform1f(loc, 512.0f);
+	int num_triangles=0;
+	g_render_queue.Clear();
+	for (int i=0; i<NUM_OBJECTS; i++)
+	{
+		if (i==OBJECT_GASKET && g_gasket_raymarch)
+			continue;
+
+		CRenderItem item;
+		item.instance.model_matrix=g_obj[i].model_matrix;
+		mat3 N=Normal(g_obj[i].model_matrix);
+		item.instance.normal_matrix=mat4(vec4(N[0], 0.0f), vec4(N[1], 0.0f), vec4(N[2], 0.0f),
+			vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		item.instance.base_color=g_obj[i].base_color;
+		item.instance.enable_diffuse_texture=g_obj[i].diffuse_texture!=0;
+
+		CMesh& mesh=select_lod(g_obj[i], view_matrix);
+		num_triangles+=mesh.GetNumTriangles();
+
+		//͸ڲ͸֮ӺǰƣȡΧӵϵеľ
+		vec4 center=view_matrix*(g_obj[i].model_matrix*vec4(mesh.bound_center, 1.0f));
+		item.pass=g_obj[i].base_color.w<1.0f ? RENDER_PASS_TRANSPARENT : RENDER_PASS_OPAQUE;
+		item.program=g_GLSL_prog.prog;
+		item.material_buffer=g_material_buffer;
+		item.texture=g_obj[i].diffuse_texture;
+		item.mesh=&mesh;
+		item.depth=-center.z;
+		g_render_queue.Add(item);
+	}
 
-		glUniform4fv(g_base_color_loc, 1, g_obj[i].base_color);
+	g_render_queue.Submit(UNIFORM_BINDING_MATERIAL);
+	return num_triangles;
+}
 
-		loc=glGetUniformLocation(g_GLSL_prog, "enable_diffuse_texture");
-		glUniform1i(loc, g_obj[i].diffuse_texture!=0);
+void display(void)
+{
 
-		glBindTexture(GL_TEXTURE_2D, g_obj[i].diffuse_texture);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		g_obj[i].pmesh->Draw();
+	mat4 M;
+	g_camera.GetViewMatrix(M);
 
-	}
+	//ֻƷʽӻλжȡ֡֡
+	g_frame.view_matrix=M;
+	g_uniform_ring.Begin();
+	GLintptr frame_offset=0;
+	CFrameBlock *frame=(CFrameBlock *)g_uniform_ring.Allocate(sizeof(CFrameBlock), frame_offset);
+	if (frame!=NULL)
+		*frame=g_frame;
+	g_uniform_ring.Bind(UNIFORM_BINDING_FRAME, frame_offset, sizeof(CFrameBlock));
+
+	int num_triangles=0;
+	if (g_indirect_draw)
+		num_triangles=draw_scene_indirect(M);
+	else
+		num_triangles=draw_scene(M);
+	g_uniform_ring.End();
+
+	//ʱлʾƴƵ״̬л
+	char stats[80]="";
+	if (!g_indirect_draw)
+		sprintf(stats, ", %d draws of %d objects, %d state changes", g_render_queue.num_draws,
+			g_render_queue.num_instances, g_render_queue.GetNumStateChanges());
+	char title[160];
+	sprintf(title, "Toy - %d triangles%s%s%s", num_triangles, stats, g_lod_enabled ? "" : " (LOD off)",
+		g_indirect_draw ? " (indirect)" : "");
+	glutSetWindowTitle(title);
+
+	if (g_gasket_raymarch)
+		draw_gasket_raymarch(M);
 
 	glFlush();
 	glutSwapBuffers();
@@ -331,13 +698,19 @@ void display(void)
 void reshape(int w, int h)
 {
 	glViewport(0, 0, w, h);
+	g_window_width=w;
+	g_window_height=h>0 ? h : 1;
 
-	glUseProgram(g_GLSL_prog);
-	int loc=glGetUniformLocation(g_GLSL_prog, "projection_matrix");
 	mat4 M;
-	M=Perspective(60.0f, (float)w/(float)h, 
+	M=Perspective(g_fovy, (float)w/(float)g_window_height, 
 		0.01f*g_scene_size, 4.0f*g_scene_size);
-	glUniformMatrix4fv(loc, 1, GL_TRUE, M);
+	g_frame.projection_matrix=M;
+
+	glUseProgram(g_gasket_prog.prog);
+	g_gasket_prog.SetUniform(g_gasket_uniforms.projection_matrix, M);
+	g_gasket_prog.SetUniform(g_gasket_uniforms.pixel_angle, 2.0f*tanf(0.5f*g_fovy*DegreesToRadians)/g_window_height);
+
+	g_lod_viewport_scale=0.5f*g_window_height/tanf(0.5f*g_fovy*DegreesToRadians);
 }
 
 void mouse(int button, int state, int x, int y)
@@ -405,6 +778,30 @@ void keyboard(unsigned char key, int x, int y)
 		g_camera.MoveUp(-g_camera_step);
 		glutPostRedisplay();
 		break;
+	case 'g':
+	case 'G':
+		// лεĻƷʽ߲ / 
+		g_gasket_raymarch=!g_gasket_raymarch;
+		printf("gasket: %s\n", g_gasket_raymarch ? "ray marching" : "mesh");
+		glutPostRedisplay();
+		break;
+	case 'p':
+	case 'P':
+		save_gasket_reference();
+		break;
+	case 'l':
+	case 'L':
+		//򿪻رϸڲΣڱʾÿ֡Ƶ
+		g_lod_enabled=!g_lod_enabled;
+		glutPostRedisplay();
+		break;
+	case 'i':
+	case 'I':
+		//лؼӻƺƣּ֧ӻʱ
+		g_indirect_draw=!g_indirect_draw && g_indirect_supported;
+		printf("draw submission: %s\n", g_indirect_draw ? "multi-draw indirect" : "one draw per object");
+		glutPostRedisplay();
+		break;
 	}
 
 	if (key>='0' && key<='4')